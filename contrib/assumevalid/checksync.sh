@@ -0,0 +1,46 @@
+#!/bin/sh
+#
+# Check that a fresh sync from genesis skips the checks -assumevalid covers
+# while the trusted checkpoint is still ahead:
+#
+#   ./checksync.sh <novacoind> <peer[:port]> [height=20000]
+#
+# Starts a node on an empty data directory connected only to <peer>, waits
+# until it has <height> blocks (below the last hardened checkpoint), and
+# fails unless getassumevalidinfo reports skipped script and block
+# signature checks.
+
+NOVACOIND=${1:?usage: checksync.sh <novacoind> <peer[:port]> [height]}
+PEER=${2:?usage: checksync.sh <novacoind> <peer[:port]> [height]}
+HEIGHT=${3:-20000}
+
+DATADIR=$(mktemp -d)
+RPC="$NOVACOIND -datadir=$DATADIR -rpcuser=check -rpcpassword=check -rpcport=18344"
+trap '$RPC stop >/dev/null 2>&1; sleep 2; rm -rf "$DATADIR"' EXIT
+
+$NOVACOIND -datadir=$DATADIR -rpcuser=check -rpcpassword=check -rpcport=18344 \
+    -connect=$PEER -listen=0 -dnsseed=0 -irc=0 -daemon || exit 1
+
+while :; do
+    COUNT=$($RPC getblockcount 2>/dev/null)
+    [ -n "$COUNT" ] && [ "$COUNT" -ge "$HEIGHT" ] && break
+    sleep 10
+done
+
+INFO=$($RPC getassumevalidinfo)
+echo "$INFO"
+
+skipped() {
+    echo "$INFO" | tr -d ' \n' | sed -n "s/.*\"$1\":{\"skipped\":\([0-9]*\).*/\1/p"
+}
+
+STATUS=0
+for CHECK in scripts blocksignature; do
+    if [ "$(skipped $CHECK)" -gt 0 ] 2>/dev/null; then
+        echo "ok: $CHECK skipped below the checkpoint"
+    else
+        echo "FAIL: no $CHECK checks skipped" >&2
+        STATUS=1
+    fi
+done
+exit $STATUS
@@ -0,0 +1,58 @@
+#!/usr/bin/env python
+#
+# Minimal DNS server answering A queries with fixed addresses, to check
+# DNS seeding without a real seed:
+#
+#   ./fakedns.py 5353 10.1.2.3 10.4.5.6
+#   novacoind -testnet -dnsseedhost=seed.test@127.0.0.1:5353 -dnsseedttl=0 -debug
+#
+# The node should log "2 addresses found from DNS seeds". Passing -delay=<s>
+# before the port makes the server answer late, to check -dnsseedtimeout.
+
+import socket
+import struct
+import sys
+import time
+
+def question_end(data):
+    pos = 12
+    while ord(data[pos:pos+1]) != 0:
+        pos += 1 + ord(data[pos:pos+1])
+    return pos + 5
+
+def answer(data, addrs):
+    ident, flags, qdcount = struct.unpack(">HHH", data[:6])
+    end = question_end(data)
+    qtype = struct.unpack(">H", data[end-4:end-2])[0]
+    records = addrs if qtype == 1 else []
+    reply = struct.pack(">HHHHHH", ident, 0x8180, 1, len(records), 0, 0)
+    reply += data[12:end]
+    for addr in records:
+        # name is a pointer to the question, class IN, TTL 60
+        reply += struct.pack(">HHHIH", 0xc00c, 1, 1, 60, 4) + socket.inet_aton(addr)
+    return reply
+
+def main():
+    args = sys.argv[1:]
+    delay = 0
+    if args and args[0].startswith("-delay="):
+        delay = float(args.pop(0)[7:])
+    if len(args) < 1:
+        sys.stderr.write("usage: fakedns.py [-delay=<s>] <port> [ipv4 ...]\n")
+        sys.exit(1)
+    port = int(args[0])
+    addrs = args[1:]
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind(("127.0.0.1", port))
+    while True:
+        data, peer = sock.recvfrom(512)
+        if len(data) < 17:
+            continue
+        time.sleep(delay)
+        sock.sendto(answer(data, addrs), peer)
+        sys.stdout.write("answered %s\n" % (peer,))
+        sys.stdout.flush()
+
+if __name__ == "__main__":
+    main()
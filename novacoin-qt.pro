@@ -206,10 +206,14 @@ HEADERS += src/qt/bitcoingui.h \
     src/coincontrol.h \
     src/sync.h \
     src/util.h \
+    src/logging.h \
     src/timestamps.h \
     src/hash.h \
     src/uint256.h \
     src/kernel.h \
+    src/stakeforecast.h \
+    src/stratum.h \
+    src/snapshot.h \
     src/scrypt.h \
     src/serialize.h \
     src/main.h \
@@ -217,6 +221,8 @@ HEADERS += src/qt/bitcoingui.h \
     src/net.h \
     src/ministun.h \
     src/key.h \
+    src/secp256k1.h \
+    src/txview.h \
     src/db.h \
     src/txdb.h \
     src/walletdb.h \
@@ -292,8 +298,11 @@ SOURCES += src/qt/bitcoin.cpp src/qt/bitcoingui.cpp \
     src/version.cpp \
     src/sync.cpp \
     src/util.cpp \
+    src/logging.cpp \
     src/netbase.cpp \
     src/key.cpp \
+    src/secp256k1.cpp \
+    src/txview.cpp \
     src/script.cpp \
     src/main.cpp \
     src/miner.cpp \
@@ -340,6 +349,9 @@ SOURCES += src/qt/bitcoin.cpp src/qt/bitcoingui.cpp \
     src/qt/rpcconsole.cpp \
     src/noui.cpp \
     src/kernel.cpp \
+    src/stakeforecast.cpp \
+    src/stratum.cpp \
+    src/snapshot.cpp \
     src/qt/multisigaddressentry.cpp \
     src/qt/multisiginputentry.cpp \
     src/qt/multisigdialog.cpp
@@ -7,31 +7,17 @@
 
 using namespace std;
 
-int CAddrInfo::GetTriedBucket(const std::vector<unsigned char> &nKey) const
+int CAddrInfo::GetTriedBucket(uint64_t k0, uint64_t k1) const
 {
-    CDataStream ss1(SER_GETHASH, 0);
-    std::vector<unsigned char> vchKey = GetKey();
-    ss1 << nKey << vchKey;
-    uint64_t hash1 = Hash(ss1.begin(), ss1.end()).Get64();
-
-    CDataStream ss2(SER_GETHASH, 0);
-    std::vector<unsigned char> vchGroupKey = GetGroup();
-    ss2 << nKey << vchGroupKey << (hash1 % ADDRMAN_TRIED_BUCKETS_PER_GROUP);
-    uint64_t hash2 = Hash(ss2.begin(), ss2.end()).Get64();
+    uint64_t hash1 = nAddrHash % ADDRMAN_TRIED_BUCKETS_PER_GROUP;
+    uint64_t hash2 = CSipHasher(k0, k1).Write(nGroupHash).Write(hash1).Finalize();
     return hash2 % ADDRMAN_TRIED_BUCKET_COUNT;
 }
 
-int CAddrInfo::GetNewBucket(const std::vector<unsigned char> &nKey, const CNetAddr& src) const
+int CAddrInfo::GetNewBucket(uint64_t k0, uint64_t k1, uint64_t nSourceGroupHashIn) const
 {
-    CDataStream ss1(SER_GETHASH, 0);
-    std::vector<unsigned char> vchGroupKey = GetGroup();
-    std::vector<unsigned char> vchSourceGroupKey = src.GetGroup();
-    ss1 << nKey << vchGroupKey << vchSourceGroupKey;
-    uint64_t hash1 = Hash(ss1.begin(), ss1.end()).Get64();
-
-    CDataStream ss2(SER_GETHASH, 0);
-    ss2 << nKey << vchSourceGroupKey << (hash1 % ADDRMAN_NEW_BUCKETS_PER_SOURCE_GROUP);
-    uint64_t hash2 = Hash(ss2.begin(), ss2.end()).Get64();
+    uint64_t hash1 = CSipHasher(k0, k1).Write(nGroupHash).Write(nSourceGroupHashIn).Finalize();
+    uint64_t hash2 = CSipHasher(k0, k1).Write(nSourceGroupHashIn).Write(hash1 % ADDRMAN_NEW_BUCKETS_PER_SOURCE_GROUP).Finalize();
     return hash2 % ADDRMAN_NEW_BUCKET_COUNT;
 }
 
@@ -78,29 +64,67 @@ double CAddrInfo::GetChance(int64_t nNow) const
     return fChance;
 }
 
+void CAddrMan::SetKey_()
+{
+    memcpy(&nKey0, &nKey[0], sizeof(nKey0));
+    memcpy(&nKey1, &nKey[sizeof(nKey0)], sizeof(nKey1));
+}
+
+void CAddrMan::Clear_()
+{
+    vInfo.clear();
+    vFreeIds.clear();
+    mapAddr.clear();
+    vRandom.clear();
+    nTried = 0;
+    nNew = 0;
+    memset(vTriedSize, 0, sizeof(vTriedSize));
+    memset(vNewSize, 0, sizeof(vNewSize));
+}
+
 CAddrInfo* CAddrMan::Find(const CNetAddr& addr, int *pnId)
 {
-    std::map<CNetAddr, int>::iterator it = mapAddr.find(addr);
+    MapAddr::iterator it = mapAddr.find(addr);
     if (it == mapAddr.end())
         return NULL;
     if (pnId)
         *pnId = (*it).second;
-    std::map<int, CAddrInfo>::iterator it2 = mapInfo.find((*it).second);
-    if (it2 != mapInfo.end())
-        return &(*it2).second;
-    return NULL;
+    return &vInfo[(*it).second];
 }
 
-CAddrInfo* CAddrMan::Create(const CAddress &addr, const CNetAddr &addrSource, int *pnId)
+CAddrInfo* CAddrMan::Create(const CAddress &addr, const CNetAddr &addrSource, uint64_t nSourceGroupHash, int *pnId)
 {
-    int nId = nIdCount++;
-    mapInfo[nId] = CAddrInfo(addr, addrSource);
+    int nId;
+    if (!vFreeIds.empty())
+    {
+        nId = vFreeIds.back();
+        vFreeIds.pop_back();
+    } else {
+        nId = vInfo.size();
+        vInfo.push_back(CAddrInfo());
+    }
+    CAddrInfo &info = vInfo[nId];
+    info = CAddrInfo(addr, addrSource);
+    info.SetHashes(nKey0, nKey1, nSourceGroupHash);
     mapAddr[addr] = nId;
-    mapInfo[nId].nRandomPos = vRandom.size();
+    info.nRandomPos = vRandom.size();
     vRandom.push_back(nId);
     if (pnId)
         *pnId = nId;
-    return &mapInfo[nId];
+    return &info;
+}
+
+void CAddrMan::Delete(int nId)
+{
+    CAddrInfo &info = vInfo[nId];
+    assert(!info.fInTried && info.nRefCount == 0);
+
+    SwapRandom(info.nRandomPos, vRandom.size()-1);
+    vRandom.pop_back();
+    mapAddr.erase(info);
+    info = CAddrInfo();
+    vFreeIds.push_back(nId);
+    nNew--;
 }
 
 void CAddrMan::SwapRandom(unsigned int nRndPos1, unsigned int nRndPos2)
@@ -113,34 +137,66 @@ void CAddrMan::SwapRandom(unsigned int nRndPos1, unsigned int nRndPos2)
     int nId1 = vRandom[nRndPos1];
     int nId2 = vRandom[nRndPos2];
 
-    assert(mapInfo.count(nId1) == 1);
-    assert(mapInfo.count(nId2) == 1);
-
-    mapInfo[nId1].nRandomPos = nRndPos2;
-    mapInfo[nId2].nRandomPos = nRndPos1;
+    vInfo[nId1].nRandomPos = nRndPos2;
+    vInfo[nId2].nRandomPos = nRndPos1;
 
     vRandom[nRndPos1] = nId2;
     vRandom[nRndPos2] = nId1;
 }
 
+void CAddrMan::InsertNew(int nUBucket, int nId)
+{
+    CAddrInfo &info = vInfo[nId];
+    assert(vNewSize[nUBucket] < ADDRMAN_NEW_BUCKET_SIZE);
+    assert(info.nRefCount < ADDRMAN_NEW_BUCKETS_PER_ADDRESS);
+
+    vvNew[nUBucket][vNewSize[nUBucket]++] = nId;
+    info.vNewBucket[info.nRefCount++] = nUBucket;
+}
+
+void CAddrMan::RemoveNew(int nUBucket, int nPos)
+{
+    assert(nPos >= 0 && nPos < vNewSize[nUBucket]);
+    int nId = vvNew[nUBucket][nPos];
+    vvNew[nUBucket][nPos] = vvNew[nUBucket][--vNewSize[nUBucket]];
+
+    CAddrInfo &info = vInfo[nId];
+    for (int i = 0; i < info.nRefCount; i++)
+    {
+        if (info.vNewBucket[i] == nUBucket)
+        {
+            info.vNewBucket[i] = info.vNewBucket[--info.nRefCount];
+            break;
+        }
+    }
+}
+
+int CAddrMan::FindNew(int nUBucket, int nId) const
+{
+    for (int n = 0; n < vNewSize[nUBucket]; n++)
+        if (vvNew[nUBucket][n] == nId)
+            return n;
+    return -1;
+}
+
 int CAddrMan::SelectTried(int nKBucket)
 {
-    std::vector<int> &vTried = vvTried[nKBucket];
+    int *vTried = vvTried[nKBucket];
+    int nSize = vTriedSize[nKBucket];
 
     // random shuffle the first few elements (using the entire list)
     // find the least recently tried among them
-    int64_t nOldest = -1;
+    int nOldest = -1;
     int nOldestPos = -1;
-    for (unsigned int i = 0; i < ADDRMAN_TRIED_ENTRIES_INSPECT_ON_EVICT && i < vTried.size(); i++)
+    for (int i = 0; i < ADDRMAN_TRIED_ENTRIES_INSPECT_ON_EVICT && i < nSize; i++)
     {
-        int nPos = GetRandInt(vTried.size() - i) + i;
+        int nPos = GetRandInt(nSize - i) + i;
         int nTemp = vTried[nPos];
         vTried[nPos] = vTried[i];
         vTried[i] = nTemp;
-        assert(nOldest == -1 || mapInfo.count(nTemp) == 1);
-        if (nOldest == -1 || mapInfo[nTemp].nLastSuccess < mapInfo[nOldest].nLastSuccess) {
+        if (nOldest == -1 || vInfo[nTemp].nLastSuccess < vInfo[nOldest].nLastSuccess) {
            nOldest = nTemp;
-           nOldestPos = nPos;
+           nOldestPos = i;
         }
     }
 
@@ -149,80 +205,59 @@ int CAddrMan::SelectTried(int nKBucket)
 
 int CAddrMan::ShrinkNew(int nUBucket)
 {
-    assert(nUBucket >= 0 && (unsigned int)nUBucket < vvNew.size());
-    std::set<int> &vNew = vvNew[nUBucket];
+    assert(nUBucket >= 0 && nUBucket < ADDRMAN_NEW_BUCKET_COUNT);
+    int *vNew = vvNew[nUBucket];
+    int nSize = vNewSize[nUBucket];
+    int64_t nNow = GetAdjustedTime();
 
     // first look for deletable items
-    for (std::set<int>::iterator it = vNew.begin(); it != vNew.end(); it++)
+    for (int n = 0; n < nSize; n++)
     {
-        assert(mapInfo.count(*it));
-        CAddrInfo &info = mapInfo[*it];
-        if (info.IsTerrible())
+        int nId = vNew[n];
+        if (vInfo[nId].IsTerrible(nNow))
         {
-            if (--info.nRefCount == 0)
-            {
-                SwapRandom(info.nRandomPos, vRandom.size()-1);
-                vRandom.pop_back();
-                mapAddr.erase(info);
-                mapInfo.erase(*it);
-                nNew--;
-            }
-            vNew.erase(it);
+            RemoveNew(nUBucket, n);
+            if (vInfo[nId].nRefCount == 0)
+                Delete(nId);
             return 0;
         }
     }
 
     // otherwise, select four randomly, and pick the oldest of those to replace
-    int n[4] = {GetRandInt(vNew.size()), GetRandInt(vNew.size()), GetRandInt(vNew.size()), GetRandInt(vNew.size())};
-    int nI = 0;
-    int nOldest = -1;
-    for (std::set<int>::iterator it = vNew.begin(); it != vNew.end(); it++)
-    {
-        if (nI == n[0] || nI == n[1] || nI == n[2] || nI == n[3])
-        {
-            assert(nOldest == -1 || mapInfo.count(*it) == 1);
-            if (nOldest == -1 || mapInfo[*it].nTime < mapInfo[nOldest].nTime)
-                nOldest = *it;
-        }
-        nI++;
-    }
-    assert(mapInfo.count(nOldest) == 1);
-    CAddrInfo &info = mapInfo[nOldest];
-    if (--info.nRefCount == 0)
+    int nOldestPos = -1;
+    for (int i = 0; i < 4; i++)
     {
-        SwapRandom(info.nRandomPos, vRandom.size()-1);
-        vRandom.pop_back();
-        mapAddr.erase(info);
-        mapInfo.erase(nOldest);
-        nNew--;
+        int nPos = GetRandInt(nSize);
+        if (nOldestPos == -1 || vInfo[vNew[nPos]].nTime < vInfo[vNew[nOldestPos]].nTime)
+            nOldestPos = nPos;
     }
-    vNew.erase(nOldest);
+    int nOldest = vNew[nOldestPos];
+    RemoveNew(nUBucket, nOldestPos);
+    if (vInfo[nOldest].nRefCount == 0)
+        Delete(nOldest);
 
     return 1;
 }
 
 void CAddrMan::MakeTried(CAddrInfo& info, int nId, int nOrigin)
 {
-    assert(vvNew[nOrigin].count(nId) == 1);
+    assert(info.IsInNewBucket(nOrigin));
 
     // remove the entry from all new buckets
-    for (std::vector<std::set<int> >::iterator it = vvNew.begin(); it != vvNew.end(); it++)
+    while (info.nRefCount > 0)
     {
-        if ((*it).erase(nId))
-            info.nRefCount--;
+        int nUBucket = info.vNewBucket[0];
+        RemoveNew(nUBucket, FindNew(nUBucket, nId));
     }
     nNew--;
 
-    assert(info.nRefCount == 0);
-
     // what tried bucket to move the entry to
-    int nKBucket = info.GetTriedBucket(nKey);
-    std::vector<int> &vTried = vvTried[nKBucket];
+    int nKBucket = info.GetTriedBucket(nKey0, nKey1);
 
     // first check whether there is place to just add it
-    if (vTried.size() < ADDRMAN_TRIED_BUCKET_SIZE)
+    if (vTriedSize[nKBucket] < ADDRMAN_TRIED_BUCKET_SIZE)
     {
-        vTried.push_back(nId);
+        vvTried[nKBucket][vTriedSize[nKBucket]++] = nId;
         nTried++;
         info.fInTried = true;
         return;
@@ -230,31 +265,29 @@ void CAddrMan::MakeTried(CAddrInfo& info, int nId, int nOrigin)
 
     // otherwise, find an item to evict
     int nPos = SelectTried(nKBucket);
+    int nIdOld = vvTried[nKBucket][nPos];
 
     // find which new bucket it belongs to
-    assert(mapInfo.count(vTried[nPos]) == 1);
-    int nUBucket = mapInfo[vTried[nPos]].GetNewBucket(nKey);
-    std::set<int> &vNew = vvNew[nUBucket];
+    CAddrInfo& infoOld = vInfo[nIdOld];
+    int nUBucket = infoOld.GetNewBucket(nKey0, nKey1);
 
     // remove the to-be-replaced tried entry from the tried set
-    CAddrInfo& infoOld = mapInfo[vTried[nPos]];
     infoOld.fInTried = false;
-    infoOld.nRefCount = 1;
     // do not update nTried, as we are going to move something else there immediately
 
     // check whether there is place in that one,
-    if (vNew.size() < ADDRMAN_NEW_BUCKET_SIZE)
+    if (vNewSize[nUBucket] < ADDRMAN_NEW_BUCKET_SIZE)
     {
         // if so, move it back there
-        vNew.insert(vTried[nPos]);
+        InsertNew(nUBucket, nIdOld);
     } else {
         // otherwise, move it to the new bucket nId came from (there is certainly place there)
-        vvNew[nOrigin].insert(vTried[nPos]);
+        InsertNew(nOrigin, nIdOld);
     }
     nNew++;
 
-    vTried[nPos] = nId;
-    // we just overwrote an entry in vTried; no need to update nTried
+    vvTried[nKBucket][nPos] = nId;
+    // we just overwrote an entry in vvTried; no need to update nTried
     info.fInTried = true;
     return;
 }
@@ -287,18 +320,9 @@ void CAddrMan::Good_(const CService &addr, int64_t nTime)
         return;
 
     // find a bucket it is in now
-    int nRnd = GetRandInt(vvNew.size());
     int nUBucket = -1;
-    for (unsigned int n = 0; n < vvNew.size(); n++)
-    {
-        int nB = (n+nRnd) % vvNew.size();
-        std::set<int> &vNew = vvNew[nB];
-        if (vNew.count(nId))
-        {
-            nUBucket = nB;
-            break;
-        }
-    }
+    if (info.nRefCount > 0)
+        nUBucket = info.vNewBucket[GetRandInt(info.nRefCount)];
 
     // if no bucket is found, something bad happened;
     // TODO: maybe re-add the node, but for now, just bail out
@@ -310,7 +334,7 @@ void CAddrMan::Good_(const CService &addr, int64_t nTime)
     MakeTried(info, nId, nUBucket);
 }
 
-bool CAddrMan::Add_(const CAddress &addr, const CNetAddr& source, int64_t nTimePenalty)
+bool CAddrMan::Add_(const CAddress &addr, const CNetAddr& source, uint64_t nSourceGroupHash, int64_t nTimePenalty)
 {
     if (!addr.IsRoutable())
         return false;
@@ -349,21 +373,19 @@ bool CAddrMan::Add_(const CAddress &addr, const CNetAddr& source, int64_t nTimeP
         if (nFactor > 1 && (GetRandInt(nFactor) != 0))
             return false;
     } else {
-        pinfo = Create(addr, source, &nId);
+        pinfo = Create(addr, source, nSourceGroupHash, &nId);
         pinfo->nTime = max((int64_t)0, (int64_t)pinfo->nTime - nTimePenalty);
 //        printf("Added %s [nTime=%fhr]\n", pinfo->ToString().c_str(), (GetAdjustedTime() - pinfo->nTime) / 3600.0);
         nNew++;
         fNew = true;
     }
 
-    int nUBucket = pinfo->GetNewBucket(nKey, source);
-    std::set<int> &vNew = vvNew[nUBucket];
-    if (!vNew.count(nId))
+    int nUBucket = pinfo->GetNewBucket(nKey0, nKey1, nSourceGroupHash);
+    if (!pinfo->IsInNewBucket(nUBucket))
     {
-        pinfo->nRefCount++;
-        if (vNew.size() == ADDRMAN_NEW_BUCKET_SIZE)
+        if (vNewSize[nUBucket] == ADDRMAN_NEW_BUCKET_SIZE)
             ShrinkNew(nUBucket);
-        vvNew[nUBucket].insert(nId);
+        InsertNew(nUBucket, nId);
     }
     return fNew;
 }
@@ -400,12 +422,10 @@ CAddress CAddrMan::Select_(int nUnkBias)
         double fChanceFactor = 1.0;
         while(1)
         {
-            int nKBucket = GetRandInt(vvTried.size());
-            std::vector<int> &vTried = vvTried[nKBucket];
-            if (vTried.size() == 0) continue;
-            int nPos = GetRandInt(vTried.size());
-            assert(mapInfo.count(vTried[nPos]) == 1);
-            CAddrInfo &info = mapInfo[vTried[nPos]];
+            int nKBucket = GetRandInt(ADDRMAN_TRIED_BUCKET_COUNT);
+            if (vTriedSize[nKBucket] == 0) continue;
+            int nPos = GetRandInt(vTriedSize[nKBucket]);
+            CAddrInfo &info = vInfo[vvTried[nKBucket][nPos]];
             if (GetRandInt(1<<30) < fChanceFactor*info.GetChance()*(1<<30))
                 return info;
             fChanceFactor *= 1.2;
@@ -415,15 +435,10 @@ CAddress CAddrMan::Select_(int nUnkBias)
         double fChanceFactor = 1.0;
         while(1)
         {
-            int nUBucket = GetRandInt(vvNew.size());
-            std::set<int> &vNew = vvNew[nUBucket];
-            if (vNew.size() == 0) continue;
-            int nPos = GetRandInt(vNew.size());
-            std::set<int>::iterator it = vNew.begin();
-            while (nPos--)
-                it++;
-            assert(mapInfo.count(*it) == 1);
-            CAddrInfo &info = mapInfo[*it];
+            int nUBucket = GetRandInt(ADDRMAN_NEW_BUCKET_COUNT);
+            if (vNewSize[nUBucket] == 0) continue;
+            int nPos = GetRandInt(vNewSize[nUBucket]);
+            CAddrInfo &info = vInfo[vvNew[nUBucket][nPos]];
             if (GetRandInt(1<<30) < fChanceFactor*info.GetChance()*(1<<30))
                 return info;
             fChanceFactor *= 1.2;
@@ -439,10 +454,11 @@ int CAddrMan::Check_()
 
     if (vRandom.size() != nTried + nNew) return -7;
 
-    for (std::map<int, CAddrInfo>::iterator it = mapInfo.begin(); it != mapInfo.end(); it++)
+    for (unsigned int n = 0; n < vInfo.size(); n++)
     {
-        int n = (*it).first;
-        CAddrInfo &info = (*it).second;
+        CAddrInfo &info = vInfo[n];
+        if (info.nRandomPos == -1)
+            continue;
         if (info.fInTried)
         {
 
@@ -454,7 +470,7 @@ int CAddrMan::Check_()
             if (!info.nRefCount) return -4;
             mapNew[n] = info.nRefCount;
         }
-        if (mapAddr[info] != n) return -5;
+        if (mapAddr[info] != (int)n) return -5;
         if (info.nRandomPos<0 || info.nRandomPos>=vRandom.size() || vRandom[info.nRandomPos] != n) return -14;
         if (info.nLastTry < 0) return -6;
         if (info.nLastSuccess < 0) return -8;
@@ -463,24 +479,24 @@ int CAddrMan::Check_()
     if (setTried.size() != nTried) return -9;
     if (mapNew.size() != nNew) return -10;
 
-    for (int n=0; n<vvTried.size(); n++)
+    for (int n=0; n<ADDRMAN_TRIED_BUCKET_COUNT; n++)
     {
-        std::vector<int> &vTried = vvTried[n];
-        for (std::vector<int>::iterator it = vTried.begin(); it != vTried.end(); it++)
+        for (int i=0; i<vTriedSize[n]; i++)
         {
-            if (!setTried.count(*it)) return -11;
-            setTried.erase(*it);
+            if (!setTried.count(vvTried[n][i])) return -11;
+            setTried.erase(vvTried[n][i]);
         }
     }
 
-    for (int n=0; n<vvNew.size(); n++)
+    for (int n=0; n<ADDRMAN_NEW_BUCKET_COUNT; n++)
     {
-        std::set<int> &vNew = vvNew[n];
-        for (std::set<int>::iterator it = vNew.begin(); it != vNew.end(); it++)
+        for (int i=0; i<vNewSize[n]; i++)
         {
-            if (!mapNew.count(*it)) return -12;
-            if (--mapNew[*it] == 0)
-                mapNew.erase(*it);
+            int nId = vvNew[n][i];
+            if (!mapNew.count(nId)) return -12;
+            if (!vInfo[nId].IsInNewBucket(n)) return -16;
+            if (--mapNew[nId] == 0)
+                mapNew.erase(nId);
         }
     }
 
@@ -502,16 +518,15 @@ void CAddrMan::GetAddr_(std::vector<CAddress> &vAddr)
     {
         int nRndPos = GetRandInt(vRandom.size() - n) + n;
         SwapRandom(n, nRndPos);
-        assert(mapInfo.count(vRandom[n]) == 1);
-        vAddr.push_back(mapInfo[vRandom[n]]);
+        vAddr.push_back(vInfo[vRandom[n]]);
     }
 }
 
 void CAddrMan::GetOnlineAddr_(std::vector<CAddrInfo> &vAddr)
 {
-    for (std::map<int, CAddrInfo>::const_iterator it = mapInfo.begin(); it != mapInfo.end(); it++)
+    for (std::vector<int>::const_iterator it = vRandom.begin(); it != vRandom.end(); it++)
     {
-        CAddrInfo addr = it->second;
+        const CAddrInfo &addr = vInfo[*it];
         bool fCurrentlyOnline = (GetAdjustedTime() - addr.nTime < 24 * 60 * 60);
         if (fCurrentlyOnline)
             vAddr.push_back(addr);
@@ -8,14 +8,88 @@
 #include "protocol.h"
 #include "util.h"
 #include "sync.h"
+#include "hash.h"
 
 
 #include <map>
+#include <set>
 #include <vector>
 
+#include <boost/unordered_map.hpp>
+
 #include <openssl/rand.h>
 
 
+// Stochastic address manager
+//
+// Design goals:
+//  * Only keep a limited number of addresses around, so that addr.dat and memory requirements do not grow without bound.
+//  * Keep the address tables in-memory, and asynchronously dump the entire to able in addr.dat.
+//  * Make sure no (localized) attacker can fill the entire table with his nodes/addresses.
+//
+// To that end:
+//  * Addresses are organized into buckets.
+//    * Address that have not yet been tried go into 256 "new" buckets.
+//      * Based on the address range (/16 for IPv4) of source of the information, 32 buckets are selected at random
+//      * The actual bucket is chosen from one of these, based on the range the address itself is located.
+//      * One single address can occur in up to 4 different buckets, to increase selection chances for addresses that
+//        are seen frequently. The chance for increasing this multiplicity decreases exponentially.
+//      * When adding a new address to a full bucket, a randomly chosen entry (with a bias favoring less recently seen
+//        ones) is removed from it first.
+//    * Addresses of nodes that are known to be accessible go into 64 "tried" buckets.
+//      * Each address range selects at random 4 of these buckets.
+//      * The actual bucket is chosen from one of these, based on the full address.
+//      * When adding a new good address to a full bucket, a randomly chosen entry (with a bias favoring less recently
+//        tried ones) is evicted from it, back to the "new" buckets.
+//    * Bucket selection is based on keyed hashing (SipHash), using a randomly-generated 256-bit key, which should not
+//      be observable by adversaries. The hashes of an address, its group and the group of its source are computed
+//      once per entry.
+//    * Entries are kept in a flat table indexed by nId, buckets are fixed-size arrays of nIds. Several indexes are kept
+//      for high performance. Defining DEBUG_ADDRMAN will introduce frequent (and expensive)
+//      consistency checks for the entire data structure.
+
+// total number of buckets for tried addresses
+#define ADDRMAN_TRIED_BUCKET_COUNT 64
+
+// maximum allowed number of entries in buckets for tried addresses
+#define ADDRMAN_TRIED_BUCKET_SIZE 64
+
+// total number of buckets for new addresses
+#define ADDRMAN_NEW_BUCKET_COUNT 256
+
+// maximum allowed number of entries in buckets for new addresses
+#define ADDRMAN_NEW_BUCKET_SIZE 64
+
+// over how many buckets entries with tried addresses from a single group (/16 for IPv4) are spread
+#define ADDRMAN_TRIED_BUCKETS_PER_GROUP 4
+
+// over how many buckets entries with new addresses originating from a single group are spread
+#define ADDRMAN_NEW_BUCKETS_PER_SOURCE_GROUP 32
+
+// in how many buckets for entries with new addresses a single address may occur
+#define ADDRMAN_NEW_BUCKETS_PER_ADDRESS 4
+
+// how many entries in a bucket with tried addresses are inspected, when selecting one to replace
+#define ADDRMAN_TRIED_ENTRIES_INSPECT_ON_EVICT 4
+
+// how old addresses can maximally be
+#define ADDRMAN_HORIZON_DAYS 30
+
+// after how many failed attempts we give up on a new node
+#define ADDRMAN_RETRIES 3
+
+// how many successive failures are allowed ...
+#define ADDRMAN_MAX_FAILURES 10
+
+// ... in at least this many days
+#define ADDRMAN_MIN_FAIL_DAYS 7
+
+// the maximum percentage of nodes to return in a getaddr call
+#define ADDRMAN_GETADDR_MAX_PCT 23
+
+// the maximum number of nodes to return in a getaddr call
+#define ADDRMAN_GETADDR_MAX 2500
+
 /** Extended statistics about a CAddress */
 class CAddrInfo : public CAddress
 {
@@ -35,12 +109,20 @@ private:
     // reference count in new sets (memory only)
     int nRefCount;
 
+    // the new buckets this entry is in, nRefCount are used (memory only)
+    int vNewBucket[ADDRMAN_NEW_BUCKETS_PER_ADDRESS];
+
     // in tried set? (memory only)
     bool fInTried;
 
     // position in vRandom
     int nRandomPos;
 
+    // keyed hashes of the address, its group and the group of the source (memory only)
+    uint64_t nAddrHash;
+    uint64_t nGroupHash;
+    uint64_t nSourceGroupHash;
+
     friend class CAddrMan;
 
 public:
@@ -61,6 +143,9 @@ public:
         nRefCount = 0;
         fInTried = false;
         nRandomPos = -1;
+        nAddrHash = 0;
+        nGroupHash = 0;
+        nSourceGroupHash = 0;
     }
 
     CAddrInfo(const CAddress &addrIn, const CNetAddr &addrSource) : CAddress(addrIn), source(addrSource)
@@ -73,16 +158,46 @@ public:
         Init();
     }
 
+    // Keyed hash of the group of an address
+    static uint64_t GetGroupHash(uint64_t k0, uint64_t k1, const CNetAddr& addr)
+    {
+        std::vector<unsigned char> vchGroup = addr.GetGroup();
+        return CSipHasher(k0, k1).Write(&vchGroup[0], vchGroup.size()).Finalize();
+    }
+
+    // Compute the hashes used for bucket selection
+    void SetHashes(uint64_t k0, uint64_t k1, uint64_t nSourceGroupHashIn)
+    {
+        std::vector<unsigned char> vchKey = GetKey();
+        nAddrHash = CSipHasher(k0, k1).Write(&vchKey[0], vchKey.size()).Finalize();
+        nGroupHash = GetGroupHash(k0, k1, *this);
+        nSourceGroupHash = nSourceGroupHashIn;
+    }
+
+    void SetHashes(uint64_t k0, uint64_t k1)
+    {
+        SetHashes(k0, k1, GetGroupHash(k0, k1, source));
+    }
+
     // Calculate in which "tried" bucket this entry belongs
-    int GetTriedBucket(const std::vector<unsigned char> &nKey) const;
+    int GetTriedBucket(uint64_t k0, uint64_t k1) const;
 
-    // Calculate in which "new" bucket this entry belongs, given a certain source
-    int GetNewBucket(const std::vector<unsigned char> &nKey, const CNetAddr& src) const;
+    // Calculate in which "new" bucket this entry belongs, given the group hash of a source
+    int GetNewBucket(uint64_t k0, uint64_t k1, uint64_t nSourceGroupHashIn) const;
 
     // Calculate in which "new" bucket this entry belongs, using its default source
-    int GetNewBucket(const std::vector<unsigned char> &nKey) const
+    int GetNewBucket(uint64_t k0, uint64_t k1) const
     {
-        return GetNewBucket(nKey, source);
+        return GetNewBucket(k0, k1, nSourceGroupHash);
+    }
+
+    // Whether this entry is in the given "new" bucket
+    bool IsInNewBucket(int nUBucket) const
+    {
+        for (int i = 0; i < nRefCount; i++)
+            if (vNewBucket[i] == nUBucket)
+                return true;
+        return false;
     }
 
     // Determine whether the statistics about this entry are bad enough so that it can just be deleted
@@ -93,92 +208,49 @@ public:
 
 };
 
-// Stochastic address manager
-//
-// Design goals:
-//  * Only keep a limited number of addresses around, so that addr.dat and memory requirements do not grow without bound.
-//  * Keep the address tables in-memory, and asynchronously dump the entire to able in addr.dat.
-//  * Make sure no (localized) attacker can fill the entire table with his nodes/addresses.
-//
-// To that end:
-//  * Addresses are organized into buckets.
-//    * Address that have not yet been tried go into 256 "new" buckets.
-//      * Based on the address range (/16 for IPv4) of source of the information, 32 buckets are selected at random
-//      * The actual bucket is chosen from one of these, based on the range the address itself is located.
-//      * One single address can occur in up to 4 different buckets, to increase selection chances for addresses that
-//        are seen frequently. The chance for increasing this multiplicity decreases exponentially.
-//      * When adding a new address to a full bucket, a randomly chosen entry (with a bias favoring less recently seen
-//        ones) is removed from it first.
-//    * Addresses of nodes that are known to be accessible go into 64 "tried" buckets.
-//      * Each address range selects at random 4 of these buckets.
-//      * The actual bucket is chosen from one of these, based on the full address.
-//      * When adding a new good address to a full bucket, a randomly chosen entry (with a bias favoring less recently
-//        tried ones) is evicted from it, back to the "new" buckets.
-//    * Bucket selection is based on cryptographic hashing, using a randomly-generated 256-bit key, which should not
-//      be observable by adversaries.
-//    * Several indexes are kept for high performance. Defining DEBUG_ADDRMAN will introduce frequent (and expensive)
-//      consistency checks for the entire data structure.
-
-// total number of buckets for tried addresses
-#define ADDRMAN_TRIED_BUCKET_COUNT 64
-
-// maximum allowed number of entries in buckets for tried addresses
-#define ADDRMAN_TRIED_BUCKET_SIZE 64
-
-// total number of buckets for new addresses
-#define ADDRMAN_NEW_BUCKET_COUNT 256
-
-// maximum allowed number of entries in buckets for new addresses
-#define ADDRMAN_NEW_BUCKET_SIZE 64
-
-// over how many buckets entries with tried addresses from a single group (/16 for IPv4) are spread
-#define ADDRMAN_TRIED_BUCKETS_PER_GROUP 4
-
-// over how many buckets entries with new addresses originating from a single group are spread
-#define ADDRMAN_NEW_BUCKETS_PER_SOURCE_GROUP 32
-
-// in how many buckets for entries with new addresses a single address may occur
-#define ADDRMAN_NEW_BUCKETS_PER_ADDRESS 4
-
-// how many entries in a bucket with tried addresses are inspected, when selecting one to replace
-#define ADDRMAN_TRIED_ENTRIES_INSPECT_ON_EVICT 4
-
-// how old addresses can maximally be
-#define ADDRMAN_HORIZON_DAYS 30
-
-// after how many failed attempts we give up on a new node
-#define ADDRMAN_RETRIES 3
-
-// how many successive failures are allowed ...
-#define ADDRMAN_MAX_FAILURES 10
-
-// ... in at least this many days
-#define ADDRMAN_MIN_FAIL_DAYS 7
+/** Keyed hash of a network address for the address index */
+class CNetAddrHasher
+{
+private:
+    uint64_t k0, k1;
 
-// the maximum percentage of nodes to return in a getaddr call
-#define ADDRMAN_GETADDR_MAX_PCT 23
+public:
+    CNetAddrHasher()
+    {
+        RAND_bytes((unsigned char*)&k0, sizeof(k0));
+        RAND_bytes((unsigned char*)&k1, sizeof(k1));
+    }
 
-// the maximum number of nodes to return in a getaddr call
-#define ADDRMAN_GETADDR_MAX 2500
+    size_t operator()(const CNetAddr& addr) const
+    {
+        return (size_t)addr.GetSipHash(k0, k1);
+    }
+};
 
 /** Stochastical (IP) address manager */
 class CAddrMan
 {
 private:
+    typedef boost::unordered_map<CNetAddr, int, CNetAddrHasher> MapAddr;
+
     // critical section to protect the inner data structures
     mutable CCriticalSection cs;
 
     // secret key to randomize bucket select with
     std::vector<unsigned char> nKey;
 
-    // last used nId
-    int nIdCount;
+    // SipHash key derived from nKey
+    uint64_t nKey0;
+    uint64_t nKey1;
+
+    // table with information about all nIds, unused ones have nRandomPos == -1
+    std::vector<CAddrInfo> vInfo;
 
-    // table with information about all nIds
-    std::map<int, CAddrInfo> mapInfo;
+    // unused nIds in vInfo
+    std::vector<int> vFreeIds;
 
     // find an nId based on its network address
-    std::map<CNetAddr, int> mapAddr;
+    MapAddr mapAddr;
 
     // randomly-ordered vector of all nIds
     std::vector<int> vRandom;
@@ -186,27 +258,47 @@ private:
     // number of "tried" entries
     int nTried;
 
-    // list of "tried" buckets
-    std::vector<std::vector<int> > vvTried;
+    // "tried" buckets, the first vTriedSize[n] entries of vvTried[n] are used
+    int vvTried[ADDRMAN_TRIED_BUCKET_COUNT][ADDRMAN_TRIED_BUCKET_SIZE];
+    int vTriedSize[ADDRMAN_TRIED_BUCKET_COUNT];
 
     // number of (unique) "new" entries
     int nNew;
 
-    // list of "new" buckets
-    std::vector<std::set<int> > vvNew;
+    // "new" buckets, the first vNewSize[n] entries of vvNew[n] are used
+    int vvNew[ADDRMAN_NEW_BUCKET_COUNT][ADDRMAN_NEW_BUCKET_SIZE];
+    int vNewSize[ADDRMAN_NEW_BUCKET_COUNT];
 
 protected:
 
+    // Derive the SipHash key from nKey.
+    void SetKey_();
+
+    // Remove all entries.
+    void Clear_();
+
     // Find an entry.
     CAddrInfo* Find(const CNetAddr& addr, int *pnId = NULL);
 
     // find an entry, creating it if necessary.
     // nTime and nServices of found node is updated, if necessary.
-    CAddrInfo* Create(const CAddress &addr, const CNetAddr &addrSource, int *pnId = NULL);
+    CAddrInfo* Create(const CAddress &addr, const CNetAddr &addrSource, uint64_t nSourceGroupHash, int *pnId = NULL);
+
+    // Delete an entry which is in no bucket.
+    void Delete(int nId);
 
     // Swap two elements in vRandom.
     void SwapRandom(unsigned int nRandomPos1, unsigned int nRandomPos2);
 
+    // Add an entry to a "new" bucket which has room for it.
+    void InsertNew(int nUBucket, int nId);
+
+    // Remove the entry at a position of a "new" bucket, without deleting it.
+    void RemoveNew(int nUBucket, int nPos);
+
+    // Return the position of an entry in a "new" bucket, or -1.
+    int FindNew(int nUBucket, int nId) const;
+
     // Return position in given bucket to replace.
     int SelectTried(int nKBucket);
 
@@ -216,14 +308,14 @@ protected:
     int ShrinkNew(int nUBucket);
 
     // Move an entry from the "new" table(s) to the "tried" table
-    // @pre vvUnkown[nOrigin].count(nId) != 0
+    // @pre vvNew[nOrigin] contains nId
     void MakeTried(CAddrInfo& info, int nId, int nOrigin);
 
     // Mark an entry "good", possibly moving it from "new" to "tried".
     void Good_(const CService &addr, int64_t nTime);
 
     // Add an entry to the "new" table.
-    bool Add_(const CAddress &addr, const CNetAddr& source, int64_t nTimePenalty);
+    bool Add_(const CAddress &addr, const CNetAddr& source, uint64_t nSourceGroupHash, int64_t nTimePenalty);
 
     // Mark an entry as attempted to connect.
     void Attempt_(const CService &addr, int64_t nTime);
@@ -246,325 +338,161 @@ protected:
 
 public:
 
-#ifndef _MSC_VER 
-    IMPLEMENT_SERIALIZE
-    (({
-        // serialized format:
-        // * version byte (currently 0)
-        // * nKey
-        // * nNew
-        // * nTried
-        // * number of "new" buckets
-        // * all nNew addrinfos in vvNew
-        // * all nTried addrinfos in vvTried
-        // * for each bucket:
-        //   * number of elements
-        //   * for each element: index
-        //
-        // Notice that vvTried, mapAddr and vVector are never encoded explicitly;
-        // they are instead reconstructed from the other information.
-        //
-        // vvNew is serialized, but only used if ADDRMAN_UNKOWN_BUCKET_COUNT didn't change,
-        // otherwise it is reconstructed as well.
-        //
-        // This format is more complex, but significantly smaller (at most 1.5 MiB), and supports
-        // changes to the ADDRMAN_ parameters without breaking the on-disk structure.
+    // serialized format:
+    // * version byte (currently 1)
+    // * nKey
+    // * nNew
+    // * nTried
+    // * number of "new" buckets
+    // * all nNew addrinfos in vvNew
+    // * all nTried addrinfos in vvTried
+    // * for each bucket:
+    //   * number of elements
+    //   * for each element: index
+    //
+    // Notice that vvTried, mapAddr and vVector are never encoded explicitly;
+    // they are instead reconstructed from the other information.
+    //
+    // vvNew is serialized, but only used if ADDRMAN_NEW_BUCKET_COUNT and the version didn't change
+    // (version 0 used a different bucket hash), otherwise it is reconstructed as well.
+    //
+    // This format is more complex, but significantly smaller (at most 1.5 MiB), and supports
+    // changes to the ADDRMAN_ parameters without breaking the on-disk structure.
+    template<typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const
+    {
+        LOCK(cs);
+        unsigned char nFormat = 1;
+        ::Serialize(s, nFormat, nType, nVersion);
+        ::Serialize(s, nKey, nType, nVersion);
+        ::Serialize(s, nNew, nType, nVersion);
+        ::Serialize(s, nTried, nType, nVersion);
+
+        int nUBuckets = ADDRMAN_NEW_BUCKET_COUNT;
+        ::Serialize(s, nUBuckets, nType, nVersion);
+
+        // new entries are numbered in the order they are written
+        std::vector<int> vUnkIds(vInfo.size(), -1);
+        int nIds = 0;
+        for (unsigned int nId = 0; nId < vInfo.size(); nId++)
         {
-            LOCK(cs);
-            unsigned char nVersion = 0;
-            READWRITE(nVersion);
-            READWRITE(nKey);
-            READWRITE(nNew);
-            READWRITE(nTried);
-
-            CAddrMan *am = const_cast<CAddrMan*>(this);
-            if (fWrite)
+            const CAddrInfo &info = vInfo[nId];
+            if (info.nRefCount)
             {
-                int nUBuckets = ADDRMAN_NEW_BUCKET_COUNT;
-                READWRITE(nUBuckets);
-                std::map<int, int> mapUnkIds;
-                int nIds = 0;
-                for (std::map<int, CAddrInfo>::iterator it = am->mapInfo.begin(); it != am->mapInfo.end(); it++)
-                {
-                    if (nIds == nNew) break; // this means nNew was wrong, oh ow
-                    mapUnkIds[(*it).first] = nIds;
-                    CAddrInfo &info = (*it).second;
-                    if (info.nRefCount)
-                    {
-                        READWRITE(info);
-                        nIds++;
-                    }
-                }
-                nIds = 0;
-                for (std::map<int, CAddrInfo>::iterator it = am->mapInfo.begin(); it != am->mapInfo.end(); it++)
-                {
-                    if (nIds == nTried) break; // this means nTried was wrong, oh ow
-                    CAddrInfo &info = (*it).second;
-                    if (info.fInTried)
-                    {
-                        READWRITE(info);
-                        nIds++;
-                    }
-                }
-                for (std::vector<std::set<int> >::iterator it = am->vvNew.begin(); it != am->vvNew.end(); it++)
-                {
-                    const std::set<int> &vNew = (*it);
-                    int nSize = vNew.size();
-                    READWRITE(nSize);
-                    for (std::set<int>::iterator it2 = vNew.begin(); it2 != vNew.end(); it2++)
-                    {
-                        int nIndex = mapUnkIds[*it2];
-                        READWRITE(nIndex);
-                    }
-                }
-            } else {
-                int nUBuckets = 0;
-                READWRITE(nUBuckets);
-                am->nIdCount = 0;
-                am->mapInfo.clear();
-                am->mapAddr.clear();
-                am->vRandom.clear();
-                am->vvTried = std::vector<std::vector<int> >(ADDRMAN_TRIED_BUCKET_COUNT, std::vector<int>(0));
-                am->vvNew = std::vector<std::set<int> >(ADDRMAN_NEW_BUCKET_COUNT, std::set<int>());
-                for (int n = 0; n < am->nNew; n++)
-                {
-                    CAddrInfo &info = am->mapInfo[n];
-                    READWRITE(info);
-                    am->mapAddr[info] = n;
-                    info.nRandomPos = vRandom.size();
-                    am->vRandom.push_back(n);
-                    if (nUBuckets != ADDRMAN_NEW_BUCKET_COUNT)
-                    {
-                        am->vvNew[info.GetNewBucket(am->nKey)].insert(n);
-                        info.nRefCount++;
-                    }
-                }
-                am->nIdCount = am->nNew;
-                int nLost = 0;
-                for (int n = 0; n < am->nTried; n++)
-                {
-                    CAddrInfo info;
-                    READWRITE(info);
-                    std::vector<int> &vTried = am->vvTried[info.GetTriedBucket(am->nKey)];
-                    if (vTried.size() < ADDRMAN_TRIED_BUCKET_SIZE)
-                    {
-                        info.nRandomPos = vRandom.size();
-                        info.fInTried = true;
-                        am->vRandom.push_back(am->nIdCount);
-                        am->mapInfo[am->nIdCount] = info;
-                        am->mapAddr[info] = am->nIdCount;
-                        vTried.push_back(am->nIdCount);
-                        am->nIdCount++;
-                    } else {
-                        nLost++;
-                    }
-                }
-                am->nTried -= nLost;
-                for (int b = 0; b < nUBuckets; b++)
-                {
-                    std::set<int> &vNew = am->vvNew[b];
-                    int nSize = 0;
-                    READWRITE(nSize);
-                    for (int n = 0; n < nSize; n++)
-                    {
-                        int nIndex = 0;
-                        READWRITE(nIndex);
-                        CAddrInfo &info = am->mapInfo[nIndex];
-                        if (nUBuckets == ADDRMAN_NEW_BUCKET_COUNT && info.nRefCount < ADDRMAN_NEW_BUCKETS_PER_ADDRESS)
-                        {
-                            info.nRefCount++;
-                            vNew.insert(nIndex);
-                        }
-                    }
-                }
+                ::Serialize(s, info, nType, nVersion);
+                vUnkIds[nId] = nIds++;
             }
         }
-    });)
-#else
-    IMPLEMENT_SERIALIZE
-            (
-            LOCK(cs);
-                unsigned char 
-                    nVersion = 0;
-
-                READWRITE(nVersion);
-                READWRITE(nKey);
-                READWRITE(nNew);
-                READWRITE(nTried);
-
-                CAddrMan 
-                    *am = const_cast<CAddrMan*>(this);
-
-                if (fWrite)
-                {
-                    int 
-                        nUBuckets = ADDRMAN_NEW_BUCKET_COUNT;
-
-                    READWRITE(nUBuckets);
-/************
-                    std::map<int, int>  
-                        mapUnkIds;
-************/  
-                    int 
-                        nIds = 0;
-                    for (std::map<int, CAddrInfo>::iterator it = am->mapInfo.begin(); it != am->mapInfo.end(); it++)
-                    {
-                        if (nIds == nNew) 
-                            break; // this means nNew was wrong, oh ow
-                        mapUnkIds[(*it).first] = nIds;
-
-                        CAddrInfo 
-                            &info = (*it).second;
-
-                        if (info.nRefCount)
-                        {
-                            READWRITE(info);
-                            nIds++;
-                        }
-                    }
-                    nIds = 0;
-                    for (std::map<int, CAddrInfo>::iterator it = am->mapInfo.begin(); it != am->mapInfo.end(); it++)
-                    {
-                        if (nIds == nTried) 
-                            break; /* this means nTried was wrong, oh ow */
-
-                        CAddrInfo 
-                            &info = (*it).second;
-
-                        if (info.fInTried)
-                        {
-                            READWRITE(info);
-                            nIds++;
-                        }
-                    }
-                    for (
-                         std::vector<std::set<int> >::iterator it = am->vvNew.begin(); 
-                         it != am->vvNew.end(); 
-                         it++
-                        )
-                    {
-                        std::set<int> 
-                            &vNew = (*it);
-
-                        int 
-                            nSize = int( vNew.size() );
-
-                        READWRITE(nSize);
-                        for (std::set<int>::iterator it2 = vNew.begin(); it2 != vNew.end(); it2++)
-                        {
-                        int 
-                            nIndex = mapUnkIds[*it2];
-                        READWRITE(nIndex);
-                        }
-                    }
-                } 
-                else 
-                {
-                    int 
-                        nUBuckets = 0;
-
-                    READWRITE(nUBuckets);
-                    am->nIdCount = 0;
-                    am->mapInfo.clear();
-                    am->mapAddr.clear();
-                    am->vRandom.clear();
-                    am->vvTried = 
-                        std::vector<std::vector<int> >(
-                                                        ADDRMAN_TRIED_BUCKET_COUNT, 
-                                                        std::vector<int>(0)
-                                                      );
-                    am->vvNew = 
-                        std::vector<std::set<int> >(
-                                                    ADDRMAN_NEW_BUCKET_COUNT, 
-                                                    std::set<int>()
-                                                   );
-                    for (int n = 0; n < am->nNew; n++)
-                    {
-                        CAddrInfo 
-                            &info = am->mapInfo[n];
-
-                        READWRITE(info);
-                        am->mapAddr[info] = n;
-                        info.nRandomPos = int( vRandom.size() );
-                        am->vRandom.push_back(n);
-                        if (nUBuckets != ADDRMAN_NEW_BUCKET_COUNT)
-                        {
-                            am->vvNew[info.GetNewBucket(am->nKey)].insert(n);
-                            info.nRefCount++;
-                        }
-                    }
-                    am->nIdCount = am->nNew;
-
-                    int 
-                        nLost = 0;
-
-                    for (int n = 0; n < am->nTried; n++)
-                    {
-                        CAddrInfo 
-                            info;
-
-                        READWRITE(info);
-
-                        std::vector<int> 
-                            &vTried = am->vvTried[info.GetTriedBucket(am->nKey)];
-
-                        if (vTried.size() < ADDRMAN_TRIED_BUCKET_SIZE)
-                        {
-                            info.nRandomPos = int( vRandom.size() );
-                            info.fInTried = true;
-                            am->vRandom.push_back(am->nIdCount);
-                            am->mapInfo[am->nIdCount] = info;
-                            am->mapAddr[info] = am->nIdCount;
-                            vTried.push_back(am->nIdCount);
-                            am->nIdCount++;
-                        } 
-                        else 
-                        {
-                            nLost++;
-                        }
-                    }
-                    am->nTried -= nLost;
-                    for (int b = 0; b < nUBuckets; b++)
-                    {
-                        std::set<int> 
-                            &vNew = am->vvNew[b];
-
-                        int 
-                            nSize = 0;
-
-                        READWRITE(nSize);
-                        for (int n = 0; n < nSize; n++)
-                        {
-                            int 
-                                nIndex = 0;
-
-                            READWRITE(nIndex);
-
-                            CAddrInfo 
-                                &info = am->mapInfo[nIndex];
-
-                            if (
-                                (nUBuckets == ADDRMAN_NEW_BUCKET_COUNT) && 
-                                (info.nRefCount < ADDRMAN_NEW_BUCKETS_PER_ADDRESS)
-                               )
-                            {
-                                info.nRefCount++;
-                                vNew.insert(nIndex);
-                            }
-                        }
-                    }
-                }
-            )
-
-#endif  //_MSC_VER
-    CAddrMan() : vRandom(0), vvTried(ADDRMAN_TRIED_BUCKET_COUNT, std::vector<int>(0)), vvNew(ADDRMAN_NEW_BUCKET_COUNT, std::set<int>())
+        for (unsigned int nId = 0; nId < vInfo.size(); nId++)
+        {
+            const CAddrInfo &info = vInfo[nId];
+            if (info.fInTried)
+                ::Serialize(s, info, nType, nVersion);
+        }
+        for (int b = 0; b < ADDRMAN_NEW_BUCKET_COUNT; b++)
+        {
+            int nSize = vNewSize[b];
+            ::Serialize(s, nSize, nType, nVersion);
+            for (int n = 0; n < nSize; n++)
+            {
+                int nIndex = vUnkIds[vvNew[b][n]];
+                ::Serialize(s, nIndex, nType, nVersion);
+            }
+        }
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion)
+    {
+        LOCK(cs);
+        Clear_();
+
+        unsigned char nFormat = 0;
+        ::Unserialize(s, nFormat, nType, nVersion);
+        ::Unserialize(s, nKey, nType, nVersion);
+        if (nKey.size() < 2 * sizeof(uint64_t))
+            throw std::ios_base::failure("CAddrMan::Unserialize() : invalid key");
+        SetKey_();
+
+        int nNewIn = 0, nTriedIn = 0, nUBuckets = 0;
+        ::Unserialize(s, nNewIn, nType, nVersion);
+        ::Unserialize(s, nTriedIn, nType, nVersion);
+        ::Unserialize(s, nUBuckets, nType, nVersion);
+        bool fRebucket = (nFormat == 0 || nUBuckets != ADDRMAN_NEW_BUCKET_COUNT);
+
+        for (int n = 0; n < nNewIn; n++)
+        {
+            CAddrInfo info;
+            ::Unserialize(s, info, nType, nVersion);
+            info.SetHashes(nKey0, nKey1);
+            info.nRandomPos = vRandom.size();
+            vInfo.push_back(info);
+            mapAddr[info] = n;
+            vRandom.push_back(n);
+            nNew++;
+            if (fRebucket)
+            {
+                int nUBucket = info.GetNewBucket(nKey0, nKey1);
+                if (vNewSize[nUBucket] < ADDRMAN_NEW_BUCKET_SIZE)
+                    InsertNew(nUBucket, n);
+            }
+        }
+
+        for (int n = 0; n < nTriedIn; n++)
+        {
+            CAddrInfo info;
+            ::Unserialize(s, info, nType, nVersion);
+            info.SetHashes(nKey0, nKey1);
+            int nKBucket = info.GetTriedBucket(nKey0, nKey1);
+            if (vTriedSize[nKBucket] < ADDRMAN_TRIED_BUCKET_SIZE)
+            {
+                int nId = vInfo.size();
+                info.nRandomPos = vRandom.size();
+                info.fInTried = true;
+                vInfo.push_back(info);
+                mapAddr[info] = nId;
+                vRandom.push_back(nId);
+                vvTried[nKBucket][vTriedSize[nKBucket]++] = nId;
+                nTried++;
+            }
+        }
+
+        for (int b = 0; b < nUBuckets; b++)
+        {
+            int nSize = 0;
+            ::Unserialize(s, nSize, nType, nVersion);
+            for (int n = 0; n < nSize; n++)
+            {
+                int nIndex = 0;
+                ::Unserialize(s, nIndex, nType, nVersion);
+                if (fRebucket || nIndex < 0 || nIndex >= nNewIn)
+                    continue;
+                const CAddrInfo &info = vInfo[nIndex];
+                if (vNewSize[b] < ADDRMAN_NEW_BUCKET_SIZE && info.nRefCount < ADDRMAN_NEW_BUCKETS_PER_ADDRESS && !info.IsInNewBucket(b))
+                    InsertNew(b, nIndex);
+            }
+        }
+
+        // new entries which ended up in no bucket
+        for (int n = 0; n < nNewIn; n++)
+            if (vInfo[n].nRefCount == 0)
+                Delete(n);
+    }
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const
+    {
+        CDataStream ss(nType, nVersion);
+        Serialize(ss, nType, nVersion);
+        return ss.size();
+    }
+
+    CAddrMan()
     {
          nKey.resize(32);
          RAND_bytes(&nKey[0], 32);
+         SetKey_();
 
-         nIdCount = 0;
-         nTried = 0;
-         nNew = 0;
+         Clear_();
     }
 
     // Return the number of (unique) addresses in all tables.
@@ -593,7 +521,7 @@ public:
         {
             LOCK(cs);
             Check();
-            fRet |= Add_(addr, source, nTimePenalty);
+            fRet |= Add_(addr, source, CAddrInfo::GetGroupHash(nKey0, nKey1, source), nTimePenalty);
             Check();
         }
         if (fRet)
@@ -608,8 +536,9 @@ public:
         {
             LOCK(cs);
             Check();
+            uint64_t nSourceGroupHash = CAddrInfo::GetGroupHash(nKey0, nKey1, source);
             for (std::vector<CAddress>::const_iterator it = vAddr.begin(); it != vAddr.end(); it++)
-                nAdd += Add_(*it, source, nTimePenalty) ? 1 : 0;
+                nAdd += Add_(*it, source, nSourceGroupHash, nTimePenalty) ? 1 : 0;
             Check();
         }
         if (nAdd)
@@ -617,6 +546,28 @@ public:
         return nAdd > 0;
     }
 
+    // Add multiple addresses with a source each, sources are expected to be grouped.
+    bool Add(const std::vector<CAddress> &vAddr, const std::vector<CNetAddr> &vSource, int64_t nTimePenalty = 0)
+    {
+        assert(vAddr.size() == vSource.size());
+        int nAdd = 0;
+        {
+            LOCK(cs);
+            Check();
+            uint64_t nSourceGroupHash = 0;
+            for (unsigned int i = 0; i < vAddr.size(); i++)
+            {
+                if (i == 0 || vSource[i] != vSource[i-1])
+                    nSourceGroupHash = CAddrInfo::GetGroupHash(nKey0, nKey1, vSource[i]);
+                nAdd += Add_(vAddr[i], vSource[i], nSourceGroupHash, nTimePenalty) ? 1 : 0;
+            }
+            Check();
+        }
+        if (nAdd)
+            printf("Added %i addresses: %i tried, %i new\n", nAdd, nTried, nNew);
+        return nAdd > 0;
+    }
+
     // Mark an entry as accessible.
     void Good(const CService &addr, int64_t nTime = GetAdjustedTime())
     {
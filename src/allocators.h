@@ -9,6 +9,8 @@
 #include <string>
 #include <boost/thread/mutex.hpp>
 #include <map>
+#include <new>
+#include <vector>
 #include <openssl/crypto.h> // for OPENSSL_cleanse()
 
 #ifdef WIN32
@@ -252,6 +254,124 @@ struct zero_after_free_allocator : public std::allocator<T>
     }
 };
 
+/**
+ * Monotonic memory arena for short-lived objects that all die together,
+ * such as the temporaries of validating one block. Allocations are carved
+ * from large chunks and only given back when the arena is destroyed.
+ * Not thread safe.
+ */
+class CArena
+{
+private:
+    std::vector<char*> vChunks;
+    size_t nChunkSize;
+    char* pchNext;
+    size_t nAvail;
+    size_t nUsed;
+    size_t nReserved;
+
+    CArena(const CArena&);
+    CArena& operator=(const CArena&);
+
+    char* NewChunk(size_t n)
+    {
+        vChunks.reserve(vChunks.size() + 1);
+        char* pch = static_cast<char*>(::operator new(n));
+        vChunks.push_back(pch);
+        nReserved += n;
+        return pch;
+    }
+
+public:
+    explicit CArena(size_t nChunkSizeIn = 256 * 1024) :
+        nChunkSize(nChunkSizeIn), pchNext(NULL), nAvail(0), nUsed(0), nReserved(0)
+    {
+    }
+
+    ~CArena()
+    {
+        for (std::vector<char*>::iterator it = vChunks.begin(); it != vChunks.end(); ++it)
+            ::operator delete(*it);
+    }
+
+    void* Allocate(size_t n)
+    {
+        // Keep every allocation aligned like operator new does
+        n = (n + 15) & ~(size_t)15;
+        if (n > nAvail)
+        {
+            // Large requests get a chunk of their own so that the rest of
+            // the current chunk stays usable
+            if (n > nChunkSize / 4)
+            {
+                nUsed += n;
+                return NewChunk(n);
+            }
+            pchNext = NewChunk(nChunkSize);
+            nAvail = nChunkSize;
+        }
+        void* p = pchNext;
+        pchNext += n;
+        nAvail -= n;
+        nUsed += n;
+        return p;
+    }
+
+    // Bytes handed out, which is also the peak since nothing is freed
+    size_t GetUsed() const { return nUsed; }
+    // Bytes obtained from the heap
+    size_t GetReserved() const { return nReserved; }
+    size_t GetChunks() const { return vChunks.size(); }
+};
+
+//
+// Allocator that takes its memory from a CArena. Deallocation is a no-op,
+// the memory is released with the arena, which must outlive the container.
+// Without an arena it behaves like std::allocator.
+//
+template<typename T>
+struct arena_allocator : public std::allocator<T>
+{
+    // MSVC8 default copy constructor is broken
+    typedef std::allocator<T> base;
+    typedef typename base::size_type size_type;
+    typedef typename base::difference_type  difference_type;
+    typedef typename base::pointer pointer;
+    typedef typename base::const_pointer const_pointer;
+    typedef typename base::reference reference;
+    typedef typename base::const_reference const_reference;
+    typedef typename base::value_type value_type;
+
+    CArena* pArena;
+
+    arena_allocator() throw() : pArena(NULL) {}
+    explicit arena_allocator(CArena* pArenaIn) throw() : pArena(pArenaIn) {}
+    arena_allocator(const arena_allocator& a) throw() : base(a), pArena(a.pArena) {}
+    template <typename U>
+    arena_allocator(const arena_allocator<U>& a) throw() : base(a), pArena(a.pArena) {}
+    ~arena_allocator() throw() {}
+    template<typename _Other> struct rebind
+    { typedef arena_allocator<_Other> other; };
+
+    T* allocate(std::size_t n, const void *hint = 0)
+    {
+        if (pArena == NULL)
+            return std::allocator<T>::allocate(n, hint);
+        return static_cast<T*>(pArena->Allocate(sizeof(T) * n));
+    }
+
+    void deallocate(T* p, std::size_t n)
+    {
+        if (pArena == NULL)
+            std::allocator<T>::deallocate(p, n);
+    }
+};
+
+template<typename T, typename U>
+bool operator==(const arena_allocator<T>& a, const arena_allocator<U>& b) { return a.pArena == b.pArena; }
+template<typename T, typename U>
+bool operator!=(const arena_allocator<T>& a, const arena_allocator<U>& b) { return a.pArena != b.pArena; }
+
 // This is exactly like std::string, but with a custom allocator.
 typedef std::basic_string<char, std::char_traits<char>, secure_allocator<char> > SecureString;
 
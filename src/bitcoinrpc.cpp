@@ -37,6 +37,10 @@ void ThreadRPCServer2(void* parg);
 
 static std::string strRPCUserColonPass;
 
+static CCriticalSection cs_rpcWarmup;
+static RPCReadiness nRPCReady = RPC_READY_ALWAYS;
+static std::string strRPCWarmupStatus("RPC server started");
+
 const Object emptyobj;
 
 void ThreadRPCServer3(void* parg);
@@ -223,10 +227,55 @@ Value stop(const Array& params, bool fHelp)
     // Shutdown will take long enough that the response should get back
     if (params.size() > 0)
         bitdb.SetDetach(params[0].get_bool());
-    StartShutdown();
+    // Init is still running, it checks for the request between and within
+    // its long stages and shuts down on its way out
+    if (RPCIsInWarmup(NULL))
+        fRequestShutdown = true;
+    else
+        StartShutdown();
     return "NovaCoin server stopping";
 }
 
+Value getstartupinfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getstartupinfo\n"
+            "Returns the stages of the last startup with their begin and end\n"
+            "in milliseconds since startup, end is -1 while a stage runs.\n"
+            "Served while the node is still starting, \"ready\" tells which calls\n"
+            "are served already: chain calls once the block index is loaded,\n"
+            "wallet calls once the wallet is loaded and rescanned.");
+
+    vector<CStartupStage> vStages;
+    GetStartupStages(vStages);
+    string strStatus;
+    bool fWarmup = RPCIsInWarmup(&strStatus);
+
+    Object result;
+    result.push_back(Pair("finished", !fWarmup));
+    if (fWarmup)
+    {
+        static const char* pszReady[] = { "none", "chain", "wallet", "full" };
+        result.push_back(Pair("stage", strStatus));
+        result.push_back(Pair("ready", pszReady[GetRPCReady()]));
+    }
+    Array stages;
+    BOOST_FOREACH(const CStartupStage& stage, vStages)
+    {
+        Object entry;
+        entry.push_back(Pair("stage", stage.strName));
+        entry.push_back(Pair("parallel", stage.fParallel));
+        entry.push_back(Pair("begin", stage.nBegin));
+        entry.push_back(Pair("end", stage.nEnd));
+        if (stage.nEnd >= 0)
+            entry.push_back(Pair("time", stage.nEnd - stage.nBegin));
+        stages.push_back(entry);
+    }
+    result.push_back(Pair("stages", stages));
+    return result;
+}
+
 
 
 //
@@ -235,85 +284,96 @@ Value stop(const Array& params, bool fHelp)
 
 
 static const CRPCCommand vRPCCommands[] =
-{ //  name                      function                 safemd  unlocked
-  //  ------------------------  -----------------------  ------  --------
-    { "help",                   &help,                   true,   true },
-    { "stop",                   &stop,                   true,   true },
-    { "getbestblockhash",       &getbestblockhash,       true,   false },
-    { "getblockcount",          &getblockcount,          true,   false },
-    { "getconnectioncount",     &getconnectioncount,     true,   false },
-    { "getaddrmaninfo",         &getaddrmaninfo,         true,   false },
-    { "getpeerinfo",            &getpeerinfo,            true,   false },
-    { "addnode",                &addnode,                true,   true  },
-    { "getaddednodeinfo",       &getaddednodeinfo,       true,   true  },
-    { "getdifficulty",          &getdifficulty,          true,   false },
-    { "getinfo",                &getinfo,                true,   false },
-    { "getsubsidy",             &getsubsidy,             true,   false },
-    { "getmininginfo",          &getmininginfo,          true,   false },
-    { "scaninput",              &scaninput,              true,   true },
-    { "getnewaddress",          &getnewaddress,          true,   false },
-    { "getnettotals",           &getnettotals,           true,   true  },
-    { "getaccountaddress",      &getaccountaddress,      true,   false },
-    { "setaccount",             &setaccount,             true,   false },
-    { "getaccount",             &getaccount,             false,  false },
-    { "getaddressesbyaccount",  &getaddressesbyaccount,  true,   false },
-    { "sendtoaddress",          &sendtoaddress,          false,  false },
-    { "mergecoins",             &mergecoins,             false,  false },
-    { "getreceivedbyaddress",   &getreceivedbyaddress,   false,  false },
-    { "getreceivedbyaccount",   &getreceivedbyaccount,   false,  false },
-    { "listreceivedbyaddress",  &listreceivedbyaddress,  false,  false },
-    { "listreceivedbyaccount",  &listreceivedbyaccount,  false,  false },
-    { "backupwallet",           &backupwallet,           true,   false },
-    { "keypoolrefill",          &keypoolrefill,          true,   false },
-    { "keypoolreset",           &keypoolreset,           true,   false },
-    { "walletpassphrase",       &walletpassphrase,       true,   false },
-    { "walletpassphrasechange", &walletpassphrasechange, false,  false },
-    { "walletlock",             &walletlock,             true,   false },
-    { "encryptwallet",          &encryptwallet,          false,  false },
-    { "validateaddress",        &validateaddress,        true,   false },
-    { "getbalance",             &getbalance,             false,  false },
-    { "move",                   &movecmd,                false,  false },
-    { "sendfrom",               &sendfrom,               false,  false },
-    { "sendmany",               &sendmany,               false,  false },
-    { "addmultisigaddress",     &addmultisigaddress,     false,  false },
-    { "addredeemscript",        &addredeemscript,        false,  false },
-    { "getrawmempool",          &getrawmempool,          true,   false },
-    { "getblock",               &getblock,               false,  false },
-    { "getblockbynumber",       &getblockbynumber,       false,  false },
-    { "getblockhash",           &getblockhash,           false,  false },
-    { "gettransaction",         &gettransaction,         false,  false },
-    { "listtransactions",       &listtransactions,       false,  false },
-    { "listaddressgroupings",   &listaddressgroupings,   false,  false },
-    { "signmessage",            &signmessage,            false,  false },
-    { "verifymessage",          &verifymessage,          false,  false },
-    { "getwork",                &getwork,                true,   false },
-    { "getworkex",              &getworkex,              true,   false },
-    { "listaccounts",           &listaccounts,           false,  false },
-    { "settxfee",               &settxfee,               false,  false },
-    { "getblocktemplate",       &getblocktemplate,       true,   false },
-    { "submitblock",            &submitblock,            false,  false },
-    { "listsinceblock",         &listsinceblock,         false,  false },
-    { "dumpprivkey",            &dumpprivkey,            false,  false },
-    { "dumpwallet",             &dumpwallet,             true,   false },
-    { "importwallet",           &importwallet,           false,  false },
-    { "importprivkey",          &importprivkey,          false,  false },
-    { "importaddress",          &importaddress,          false,  true  },
-    { "removeaddress",          &removeaddress,          false,  true  },
-    { "listunspent",            &listunspent,            false,  false },
-    { "getrawtransaction",      &getrawtransaction,      false,  false },
-    { "createrawtransaction",   &createrawtransaction,   false,  false },
-    { "decoderawtransaction",   &decoderawtransaction,   false,  false },
-    { "createmultisig",         &createmultisig,         false,  false },
-    { "decodescript",           &decodescript,           false,  false },
-    { "signrawtransaction",     &signrawtransaction,     false,  false },
-    { "sendrawtransaction",     &sendrawtransaction,     false,  false },
-    { "getcheckpoint",          &getcheckpoint,          true,   false },
-    { "reservebalance",         &reservebalance,         false,  true},
-    { "checkwallet",            &checkwallet,            false,  true},
-    { "repairwallet",           &repairwallet,           false,  true},
-    { "resendtx",               &resendtx,               false,  true},
-    { "makekeypair",            &makekeypair,            false,  true},
-    { "sendalert",              &sendalert,              false,  false},
+{ //  name                      function                 safemd  unlocked  ready
+  //  ------------------------  -----------------------  ------  --------  ----------------
+    { "help",                   &help,                   true,   true,     RPC_READY_ALWAYS },
+    { "stop",                   &stop,                   true,   true,     RPC_READY_ALWAYS },
+    { "getstartupinfo",         &getstartupinfo,         true,   true,     RPC_READY_ALWAYS },
+    { "getbestblockhash",       &getbestblockhash,       true,   false,    RPC_READY_CHAIN },
+    { "getblockcount",          &getblockcount,          true,   false,    RPC_READY_CHAIN },
+    { "getconnectioncount",     &getconnectioncount,     true,   false,    RPC_READY_FULL },
+    { "getaddrmaninfo",         &getaddrmaninfo,         true,   false,    RPC_READY_FULL },
+    { "getpeerinfo",            &getpeerinfo,            true,   false,    RPC_READY_FULL },
+    { "addnode",                &addnode,                true,   true,     RPC_READY_FULL },
+    { "getaddednodeinfo",       &getaddednodeinfo,       true,   true,     RPC_READY_FULL },
+    { "getdifficulty",          &getdifficulty,          true,   false,    RPC_READY_CHAIN },
+    { "getsigcacheinfo",        &getsigcacheinfo,        true,   false,    RPC_READY_CHAIN },
+    { "getinfo",                &getinfo,                true,   false,    RPC_READY_FULL },
+    { "getsubsidy",             &getsubsidy,             true,   false,    RPC_READY_CHAIN },
+    { "getmininginfo",          &getmininginfo,          true,   false,    RPC_READY_FULL },
+    { "getstratuminfo",         &getstratuminfo,         true,   true,     RPC_READY_FULL },
+    { "scaninput",              &scaninput,              true,   true,     RPC_READY_FULL },
+    { "forecaststake",          &forecaststake,          true,   true,     RPC_READY_FULL },
+    { "getstakeforecast",       &getstakeforecast,       true,   true,     RPC_READY_FULL },
+    { "stopstakeforecast",      &stopstakeforecast,      true,   true,     RPC_READY_FULL },
+    { "getnewaddress",          &getnewaddress,          true,   false,    RPC_READY_WALLET },
+    { "getnettotals",           &getnettotals,           true,   true,     RPC_READY_FULL },
+    { "getlockprofile",         &getlockprofile,         true,   false,    RPC_READY_CHAIN },
+    { "getaccountaddress",      &getaccountaddress,      true,   false,    RPC_READY_WALLET },
+    { "setaccount",             &setaccount,             true,   false,    RPC_READY_WALLET },
+    { "getaccount",             &getaccount,             false,  false,    RPC_READY_WALLET },
+    { "getaddressesbyaccount",  &getaddressesbyaccount,  true,   false,    RPC_READY_WALLET },
+    { "sendtoaddress",          &sendtoaddress,          false,  false,    RPC_READY_FULL },
+    { "mergecoins",             &mergecoins,             false,  false,    RPC_READY_FULL },
+    { "getreceivedbyaddress",   &getreceivedbyaddress,   false,  false,    RPC_READY_WALLET },
+    { "getreceivedbyaccount",   &getreceivedbyaccount,   false,  false,    RPC_READY_WALLET },
+    { "listreceivedbyaddress",  &listreceivedbyaddress,  false,  false,    RPC_READY_WALLET },
+    { "listreceivedbyaccount",  &listreceivedbyaccount,  false,  false,    RPC_READY_WALLET },
+    { "backupwallet",           &backupwallet,           true,   false,    RPC_READY_WALLET },
+    { "keypoolrefill",          &keypoolrefill,          true,   false,    RPC_READY_WALLET },
+    { "keypoolreset",           &keypoolreset,           true,   false,    RPC_READY_WALLET },
+    { "walletpassphrase",       &walletpassphrase,       true,   false,    RPC_READY_WALLET },
+    { "walletpassphrasechange", &walletpassphrasechange, false,  false,   RPC_READY_WALLET },
+    { "walletlock",             &walletlock,             true,   false,    RPC_READY_WALLET },
+    { "encryptwallet",          &encryptwallet,          false,  false,    RPC_READY_WALLET },
+    { "validateaddress",        &validateaddress,        true,   false,    RPC_READY_WALLET },
+    { "getbalance",             &getbalance,             false,  false,    RPC_READY_WALLET },
+    { "move",                   &movecmd,                false,  false,    RPC_READY_WALLET },
+    { "sendfrom",               &sendfrom,               false,  false,    RPC_READY_FULL },
+    { "sendmany",               &sendmany,               false,  false,    RPC_READY_FULL },
+    { "addmultisigaddress",     &addmultisigaddress,     false,  false,    RPC_READY_WALLET },
+    { "addredeemscript",        &addredeemscript,        false,  false,    RPC_READY_WALLET },
+    { "getrawmempool",          &getrawmempool,          true,   false,    RPC_READY_CHAIN },
+    { "getblock",               &getblock,               false,  false,    RPC_READY_CHAIN },
+    { "getblockbynumber",       &getblockbynumber,       false,  false,    RPC_READY_CHAIN },
+    { "getblockhash",           &getblockhash,           false,  false,    RPC_READY_CHAIN },
+    { "gettransaction",         &gettransaction,         false,  false,    RPC_READY_WALLET },
+    { "listtransactions",       &listtransactions,       false,  false,    RPC_READY_WALLET },
+    { "listaddressgroupings",   &listaddressgroupings,   false,  false,    RPC_READY_WALLET },
+    { "signmessage",            &signmessage,            false,  false,    RPC_READY_WALLET },
+    { "verifymessage",          &verifymessage,          false,  false,    RPC_READY_CHAIN },
+    { "getwork",                &getwork,                true,   false,    RPC_READY_FULL },
+    { "getworkex",              &getworkex,              true,   false,    RPC_READY_FULL },
+    { "listaccounts",           &listaccounts,           false,  false,    RPC_READY_WALLET },
+    { "settxfee",               &settxfee,               false,  false,    RPC_READY_WALLET },
+    { "getblocktemplate",       &getblocktemplate,       true,   true,     RPC_READY_FULL },
+    { "submitblock",            &submitblock,            false,  false,    RPC_READY_FULL },
+    { "listsinceblock",         &listsinceblock,         false,  false,    RPC_READY_WALLET },
+    { "dumpprivkey",            &dumpprivkey,            false,  false,    RPC_READY_WALLET },
+    { "dumpwallet",             &dumpwallet,             true,   false,    RPC_READY_WALLET },
+    { "importwallet",           &importwallet,           false,  false,    RPC_READY_WALLET },
+    { "importprivkey",          &importprivkey,          false,  false,    RPC_READY_WALLET },
+    { "importaddress",          &importaddress,          false,  true,     RPC_READY_WALLET },
+    { "removeaddress",          &removeaddress,          false,  true,     RPC_READY_WALLET },
+    { "listunspent",            &listunspent,            false,  false,    RPC_READY_WALLET },
+    { "getrawtransaction",      &getrawtransaction,      false,  false,    RPC_READY_CHAIN },
+    { "createrawtransaction",   &createrawtransaction,   false,  false,    RPC_READY_CHAIN },
+    { "decoderawtransaction",   &decoderawtransaction,   false,  false,    RPC_READY_CHAIN },
+    { "createmultisig",         &createmultisig,         false,  false,    RPC_READY_WALLET },
+    { "decodescript",           &decodescript,           false,  false,    RPC_READY_CHAIN },
+    { "checkscripttemplates",   &checkscripttemplates,   true,   true,     RPC_READY_FULL },
+    { "signrawtransaction",     &signrawtransaction,     false,  false,    RPC_READY_WALLET },
+    { "sendrawtransaction",     &sendrawtransaction,     false,  false,    RPC_READY_FULL },
+    { "getcheckpoint",          &getcheckpoint,          true,   false,    RPC_READY_CHAIN },
+    { "getassumevalidinfo",     &getassumevalidinfo,     true,   false,    RPC_READY_CHAIN },
+    { "dumpsnapshot",           &dumpsnapshot,           false,  true,     RPC_READY_FULL },
+    { "getsnapshotinfo",        &getsnapshotinfo,        true,   true,     RPC_READY_CHAIN },
+    { "reservebalance",         &reservebalance,         false,  true,     RPC_READY_WALLET },
+    { "checkwallet",            &checkwallet,            false,  true,     RPC_READY_WALLET },
+    { "repairwallet",           &repairwallet,           false,  true,     RPC_READY_WALLET },
+    { "resendtx",               &resendtx,               false,  true,     RPC_READY_FULL },
+    { "makekeypair",            &makekeypair,            false,  true,     RPC_READY_CHAIN },
+    { "sendalert",              &sendalert,              false,  false,    RPC_READY_FULL },
 };
 
 CRPCTable::CRPCTable()
@@ -1062,6 +1122,32 @@ void ThreadRPCServer3(void* parg)
     }
 }
 
+void SetRPCWarmupStatus(const std::string& strStatus)
+{
+    LOCK(cs_rpcWarmup);
+    strRPCWarmupStatus = strStatus;
+}
+
+void SetRPCReady(RPCReadiness ready)
+{
+    LOCK(cs_rpcWarmup);
+    nRPCReady = ready;
+}
+
+bool RPCIsInWarmup(std::string* pstrStatus)
+{
+    LOCK(cs_rpcWarmup);
+    if (pstrStatus)
+        *pstrStatus = strRPCWarmupStatus;
+    return nRPCReady < RPC_READY_FULL;
+}
+
+RPCReadiness GetRPCReady()
+{
+    LOCK(cs_rpcWarmup);
+    return nRPCReady;
+}
+
 json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_spirit::Array &params) const
 {
     // Find method
@@ -1069,6 +1155,11 @@ json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_s
     if (!pcmd)
         throw JSONRPCError(RPC_METHOD_NOT_FOUND, "Method not found");
 
+    // What the command needs isn't loaded yet
+    string strStatus;
+    if (RPCIsInWarmup(&strStatus) && pcmd->ready > GetRPCReady())
+        throw JSONRPCError(RPC_IN_WARMUP, "Loading: " + strStatus);
+
     // Observe safe mode
     string strWarning = GetWarnings("rpc");
     if (strWarning != "" && !GetBoolArg("-disablesafemode") &&
@@ -1082,6 +1173,11 @@ json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_s
         {
             if (pcmd->unlocked)
                 result = pcmd->actor(params, false);
+            else if (pcmd->ready == RPC_READY_CHAIN) {
+                // Served before the wallet is loaded, doesn't touch it
+                LOCK(cs_main);
+                result = pcmd->actor(params, false);
+            }
             else {
                 LOCK2(cs_main, pwalletMain->cs_wallet);
                 result = pcmd->actor(params, false);
@@ -1185,6 +1281,7 @@ Array RPCConvertValues(const std::string &strMethod, const std::vector<std::stri
     //
     if (strMethod == "stop"                   && n > 0) ConvertTo<bool>(params[0]);
     if (strMethod == "getaddednodeinfo"       && n > 0) ConvertTo<bool>(params[0]);
+    if (strMethod == "getlockprofile"         && n > 0) ConvertTo<bool>(params[0]);
     if (strMethod == "sendtoaddress"          && n > 1) ConvertTo<double>(params[1]);
     if (strMethod == "mergecoins"            && n > 0) ConvertTo<double>(params[0]);
     if (strMethod == "mergecoins"            && n > 1) ConvertTo<double>(params[1]);
@@ -1200,6 +1297,7 @@ Array RPCConvertValues(const std::string &strMethod, const std::vector<std::stri
     if (strMethod == "getblock"               && n > 1) ConvertTo<bool>(params[1]);
     if (strMethod == "getblockbynumber"       && n > 0) ConvertTo<int64_t>(params[0]);
     if (strMethod == "getblockbynumber"       && n > 1) ConvertTo<bool>(params[1]);
+    if (strMethod == "dumpsnapshot"           && n > 1) ConvertTo<int64_t>(params[1]);
     if (strMethod == "getblockhash"           && n > 0) ConvertTo<int64_t>(params[0]);
     if (strMethod == "move"                   && n > 2) ConvertTo<double>(params[2]);
     if (strMethod == "move"                   && n > 3) ConvertTo<int64_t>(params[3]);
@@ -1216,6 +1314,14 @@ Array RPCConvertValues(const std::string &strMethod, const std::vector<std::stri
     if (strMethod == "scaninput"              && n > 1) ConvertTo<int>(params[1]);
     if (strMethod == "scaninput"              && n > 2) ConvertTo<double>(params[2]);
     if (strMethod == "scaninput"              && n > 3) ConvertTo<int>(params[3]);
+    if (strMethod == "forecaststake"          && n > 0) ConvertTo<Array>(params[0]);
+    if (strMethod == "forecaststake"          && n > 1) ConvertTo<int>(params[1]);
+    if (strMethod == "forecaststake"          && n > 2) ConvertTo<double>(params[2]);
+    if (strMethod == "forecaststake"          && n > 3) ConvertTo<double>(params[3]);
+    if (strMethod == "forecaststake"          && n > 4) ConvertTo<int>(params[4]);
+    if (strMethod == "getstakeforecast"       && n > 0) ConvertTo<int>(params[0]);
+    if (strMethod == "getstakeforecast"       && n > 1) ConvertTo<bool>(params[1]);
+    if (strMethod == "stopstakeforecast"      && n > 0) ConvertTo<int>(params[0]);
 
     if (strMethod == "sendalert"              && n > 2) ConvertTo<int64_t>(params[2]);
     if (strMethod == "sendalert"              && n > 3) ConvertTo<int64_t>(params[3]);
@@ -1237,6 +1343,8 @@ Array RPCConvertValues(const std::string &strMethod, const std::vector<std::stri
     if (strMethod == "createrawtransaction"   && n > 1) ConvertTo<Object>(params[1]);
     if (strMethod == "createmultisig"         && n > 0) ConvertTo<int64_t>(params[0]);
     if (strMethod == "createmultisig"         && n > 1) ConvertTo<Array>(params[1]);
+    if (strMethod == "checkscripttemplates"   && n > 0) ConvertTo<int64_t>(params[0]);
+    if (strMethod == "checkscripttemplates"   && n > 1) ConvertTo<int64_t>(params[1]);
     if (strMethod == "signrawtransaction"     && n > 1) ConvertTo<Array>(params[1], true);
     if (strMethod == "signrawtransaction"     && n > 2) ConvertTo<Array>(params[2], true);
     if (strMethod == "keypoolrefill"          && n > 0) ConvertTo<int64_t>(params[0]);
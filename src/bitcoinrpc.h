@@ -49,6 +49,7 @@ enum RPCErrorCode
     RPC_INVALID_PARAMETER           = -8,  // Invalid, missing or duplicate parameter
     RPC_DATABASE_ERROR              = -20, // Database error
     RPC_DESERIALIZATION_ERROR       = -22, // Error parsing or validating structure in raw format
+    RPC_IN_WARMUP                   = -28, // Client still warming up
 
     // P2P client errors
     RPC_CLIENT_NOT_CONNECTED        = -9,  // Bitcoin is not connected
@@ -69,6 +70,21 @@ enum RPCErrorCode
 json_spirit::Object JSONRPCError(int code, const std::string& message);
 
 void ThreadRPCServer(void* parg);
+
+// Startup stage after which a command is served, until then calls fail
+// with RPC_IN_WARMUP and the current startup stage
+enum RPCReadiness
+{
+    RPC_READY_ALWAYS, // help, stop and getstartupinfo
+    RPC_READY_CHAIN,  // block index loaded
+    RPC_READY_WALLET, // wallet loaded and rescanned
+    RPC_READY_FULL,   // init finished, node started
+};
+
+void SetRPCWarmupStatus(const std::string& strStatus);
+void SetRPCReady(RPCReadiness ready);
+bool RPCIsInWarmup(std::string* pstrStatus);
+RPCReadiness GetRPCReady();
 int CommandLineRPC(int argc, char *argv[]);
 
 /** Convert parameter values for RPC call from strings to command-specific JSON objects. */
@@ -97,6 +113,7 @@ public:
     rpcfn_type actor;
     bool okSafeMode;
     bool unlocked;
+    RPCReadiness ready;
 };
 
 /**
@@ -156,12 +173,17 @@ extern json_spirit::Value importprivkey(const json_spirit::Array& params, bool f
 extern json_spirit::Value importaddress(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value removeaddress(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getnettotals(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getlockprofile(const json_spirit::Array& params, bool fHelp);
 
 extern json_spirit::Value sendalert(const json_spirit::Array& params, bool fHelp);
 
 extern json_spirit::Value getsubsidy(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getmininginfo(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getstratuminfo(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value scaninput(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value forecaststake(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getstakeforecast(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value stopstakeforecast(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getwork(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getworkex(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getblocktemplate(const json_spirit::Array& params, bool fHelp);
@@ -212,17 +234,23 @@ extern json_spirit::Value createrawtransaction(const json_spirit::Array& params,
 extern json_spirit::Value decoderawtransaction(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value createmultisig(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value decodescript(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value checkscripttemplates(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value signrawtransaction(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value sendrawtransaction(const json_spirit::Array& params, bool fHelp);
 
 extern json_spirit::Value getbestblockhash(const json_spirit::Array& params, bool fHelp); // in rpcblockchain.cpp
 extern json_spirit::Value getblockcount(const json_spirit::Array& params, bool fHelp); // in rpcblockchain.cpp
 extern json_spirit::Value getdifficulty(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getsigcacheinfo(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value settxfee(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getrawmempool(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getblockhash(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getblock(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getblockbynumber(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getcheckpoint(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getassumevalidinfo(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getstartupinfo(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value dumpsnapshot(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getsnapshotinfo(const json_spirit::Array& params, bool fHelp);
 
 #endif
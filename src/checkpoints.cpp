@@ -60,6 +60,29 @@ namespace Checkpoints
         return checkpoints.rbegin()->second.second;
     }
 
+    uint256 GetLastCheckpointHash()
+    {
+        MapCheckpoints& checkpoints = (fTestNet ? mapCheckpointsTestnet : mapCheckpoints);
+
+        return checkpoints.rbegin()->second.first;
+    }
+
+    bool GetCheckpoint(const uint256& hash, int& nHeight, unsigned int& nTime)
+    {
+        MapCheckpoints& checkpoints = (fTestNet ? mapCheckpointsTestnet : mapCheckpoints);
+
+        BOOST_FOREACH(const MapCheckpoints::value_type& i, checkpoints)
+        {
+            if (i.second.first == hash)
+            {
+                nHeight = i.first;
+                nTime = i.second.second;
+                return true;
+            }
+        }
+        return false;
+    }
+
     CBlockIndex* GetLastCheckpoint(const std::map<uint256, CBlockIndex*>& mapBlockIndex)
     {
         MapCheckpoints& checkpoints = (fTestNet ? mapCheckpointsTestnet : mapCheckpoints);
@@ -48,6 +48,12 @@ namespace Checkpoints
     // Returns last checkpoint timestamp
     unsigned int GetLastCheckpointTime();
 
+    // Returns last checkpoint hash
+    uint256 GetLastCheckpointHash();
+
+    // Height and timestamp of a hardened checkpoint, false if hash is not one
+    bool GetCheckpoint(const uint256& hash, int& nHeight, unsigned int& nTime);
+
     extern uint256 hashSyncCheckpoint;
     extern CSyncCheckpoint checkpointMessage;
     extern uint256 hashInvalidCheckpoint;
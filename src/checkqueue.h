@@ -140,7 +140,8 @@ public:
     }
 
     // Add a batch of checks to the queue
-    void Add(std::vector<T> &vChecks) {
+    template<typename A>
+    void Add(std::vector<T, A> &vChecks) {
         boost::unique_lock<boost::mutex> lock(mutex);
         BOOST_FOREACH(T &check, vChecks) {
             queue.push_back(T());
@@ -201,7 +202,8 @@ public:
         return fRet;
     }
 
-    void Add(std::vector<T> &vChecks) {
+    template<typename A>
+    void Add(std::vector<T, A> &vChecks) {
         if (pqueue != NULL)
             pqueue->Add(vChecks);
     }
@@ -52,6 +52,10 @@ typedef int socklen_t;
 #define WSAEINPROGRESS      EINPROGRESS
 #define WSAEADDRINUSE       EADDRINUSE
 #define WSAENOTSOCK         EBADF
+#define WSAENETDOWN         ENETDOWN
+#define WSAENETUNREACH      ENETUNREACH
+#define WSAEHOSTUNREACH     EHOSTUNREACH
+#define WSAEAFNOSUPPORT     EAFNOSUPPORT
 #define INVALID_SOCKET      (SOCKET)(~0)
 #define SOCKET_ERROR        -1
 #endif
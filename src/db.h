@@ -134,7 +134,7 @@ protected:
 
         // Unserialize value
         try {
-            CDataStream ssValue((char*)datValue.get_data(), (char*)datValue.get_data() + datValue.get_size(), SER_DISK, CLIENT_VERSION);
+            CSecureDataStream ssValue((char*)datValue.get_data(), (char*)datValue.get_data() + datValue.get_size(), SER_DISK, CLIENT_VERSION);
             ssValue >> value;
         }
         catch (std::exception &e) {
@@ -162,8 +162,8 @@ protected:
         ssKey << key;
         Dbt datKey(&ssKey[0], (uint32_t)ssKey.size());
 
-        // Value
-        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+        // Value, may be a private key
+        CSecureDataStream ssValue(SER_DISK, CLIENT_VERSION);
         ssValue.reserve(10000);
         ssValue << value;
         Dbt datValue(&ssValue[0], (uint32_t)ssValue.size());
@@ -230,7 +230,8 @@ protected:
         return pcursor;
     }
 
-    int ReadAtCursor(Dbc* pcursor, CDataStream& ssKey, CDataStream& ssValue, unsigned int fFlags=DB_NEXT)
+    template<typename KeyStream, typename ValueStream>
+    int ReadAtCursor(Dbc* pcursor, KeyStream& ssKey, ValueStream& ssValue, unsigned int fFlags=DB_NEXT)
     {
         // Read at cursor
         Dbt datKey;
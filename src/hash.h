@@ -43,6 +43,13 @@ public:
         Init();
     }
 
+    // Continue from a saved midstate (see GetState)
+    CHashWriter(const SHA256_CTX& ctxIn, int nTypeIn, int nVersionIn) : ctx(ctxIn), nType(nTypeIn), nVersion(nVersionIn) { }
+
+    const SHA256_CTX& GetState() const {
+        return ctx;
+    }
+
     CHashWriter& write(const char *pch, size_t size) {
         SHA256_Update(&ctx, pch, size);
         return (*this);
@@ -126,6 +133,87 @@ inline uint160 Hash160(const std::vector<unsigned char>& vch)
 
 unsigned int MurmurHash3(unsigned int nHashSeed, const std::vector<unsigned char>& vDataToHash);
 
+/** SipHash-2-4, a fast keyed hash for hash tables and bucket selection */
+class CSipHasher
+{
+private:
+    uint64_t v[4];
+    uint64_t tmp;
+    int count;
+
+    static inline uint64_t Rotl(uint64_t x, int b)
+    {
+        return (x << b) | (x >> (64 - b));
+    }
+
+    static inline void Round(uint64_t& v0, uint64_t& v1, uint64_t& v2, uint64_t& v3)
+    {
+        v0 += v1; v1 = Rotl(v1, 13); v1 ^= v0; v0 = Rotl(v0, 32);
+        v2 += v3; v3 = Rotl(v3, 16); v3 ^= v2;
+        v0 += v3; v3 = Rotl(v3, 21); v3 ^= v0;
+        v2 += v1; v1 = Rotl(v1, 17); v1 ^= v2; v2 = Rotl(v2, 32);
+    }
+
+    void Compress(uint64_t m)
+    {
+        v[3] ^= m;
+        Round(v[0], v[1], v[2], v[3]);
+        Round(v[0], v[1], v[2], v[3]);
+        v[0] ^= m;
+    }
+
+public:
+    CSipHasher(uint64_t k0, uint64_t k1)
+    {
+        v[0] = 0x736f6d6570736575ULL ^ k0;
+        v[1] = 0x646f72616e646f6dULL ^ k1;
+        v[2] = 0x6c7967656e657261ULL ^ k0;
+        v[3] = 0x7465646279746573ULL ^ k1;
+        tmp = 0;
+        count = 0;
+    }
+
+    // Hash a 64-bit integer, only allowed on a multiple of 8 bytes written
+    CSipHasher& Write(uint64_t data)
+    {
+        assert(count % 8 == 0);
+        Compress(data);
+        count += 8;
+        return *this;
+    }
+
+    CSipHasher& Write(const unsigned char* data, size_t size)
+    {
+        while (size--)
+        {
+            tmp |= ((uint64_t)(*data++)) << (8 * (count % 8));
+            count++;
+            if ((count & 7) == 0)
+            {
+                Compress(tmp);
+                tmp = 0;
+            }
+        }
+        return *this;
+    }
+
+    uint64_t Finalize() const
+    {
+        uint64_t v0 = v[0], v1 = v[1], v2 = v[2], v3 = v[3];
+        uint64_t m = tmp | (((uint64_t)count) << 56);
+        v3 ^= m;
+        Round(v0, v1, v2, v3);
+        Round(v0, v1, v2, v3);
+        v0 ^= m;
+        v2 ^= 0xFF;
+        Round(v0, v1, v2, v3);
+        Round(v0, v1, v2, v3);
+        Round(v0, v1, v2, v3);
+        Round(v0, v1, v2, v3);
+        return v0 ^ v1 ^ v2 ^ v3;
+    }
+};
+
 typedef struct
 {
     SHA512_CTX ctxInner;
@@ -10,6 +10,8 @@
 #include "util.h"
 #include "ui_interface.h"
 #include "checkpoints.h"
+#include "stratum.h"
+#include "snapshot.h"
 #include <boost/format.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
@@ -40,6 +42,10 @@ extern int64_t nPingInterval;
 extern int64_t nBroadcastInterval;
 extern int64_t nReserveBalance;
 
+static CCriticalSection cs_startup;
+static vector<CStartupStage> vStartupStages;
+static int64_t nStartupBegin = 0;
+
 //////////////////////////////////////////////////////////////////////////////
 //
 // Shutdown
@@ -96,7 +102,10 @@ void Shutdown(void* parg)
         delete pwalletMain;
         NewThread(ExitTimeout, NULL);
         Sleep(50);
+        if (fLockProfile)
+            PrintLockProfile(50);
         printf("NovaCoin exited\n\n");
+        StopLogWriter();
         fExit = true;
 #ifndef QT_GUI
         // ensure non-UI client gets exited here, but let Bitcoin-Qt reach 'return 0;' in bitcoin.cpp
@@ -240,6 +249,7 @@ std::string HelpMessage()
         "  -wallet=<file>         " + _("Specify wallet file (within data directory)") + "\n" +
         "  -dbcache=<n>           " + _("Set database cache size in megabytes (default: 25)") + "\n" +
         "  -dblogsize=<n>         " + _("Set database disk log size in megabytes (default: 100)") + "\n" +
+        "  -sigcachesize=<n>      " + _("Set signature cache size in megabytes (default: 16)") + "\n" +
         "  -timeout=<n>           " + _("Specify connection timeout in milliseconds (default: 5000)") + "\n" +
         "  -proxy=<ip:port>       " + _("Connect through socks proxy") + "\n" +
         "  -socks=<n>             " + _("Select the version of socks proxy to use (4-5, default: 5)") + "\n" +
@@ -248,6 +258,7 @@ std::string HelpMessage()
         "  -dns                   " + _("Allow DNS lookups for -addnode, -seednode and -connect") + "\n" +
         "  -port=<port>           " + _("Listen for connections on <port> (default: 7777 or testnet: 17777)") + "\n" +
         "  -maxconnections=<n>    " + _("Maintain at most <n> connections to peers (default: 125)") + "\n" +
+        "  -maxorphanblocksmb=<n> " + _("Keep at most <n> megabytes of blocks with unknown parents, a peer may use a quarter of it (default: 40)") + "\n" +
         "  -addnode=<ip>          " + _("Add a node to connect to and attempt to keep the connection open") + "\n" +
         "  -connect=<ip>          " + _("Connect only to the specified node(s)") + "\n" +
         "  -seednode=<ip>         " + _("Connect to a node to retrieve peer addresses, and disconnect") + "\n" +
@@ -258,6 +269,9 @@ std::string HelpMessage()
         "  -listen                " + _("Accept connections from outside (default: 1 if no -proxy or -connect)") + "\n" +
         "  -bind=<addr>           " + _("Bind to given address. Use [host]:port notation for IPv6") + "\n" +
         "  -dnsseed               " + _("Find peers using DNS lookup (default: 1)") + "\n" +
+        "  -dnsseedhost=<host>    " + _("Query only this DNS seed, can be given more than once, <host>@<server>[:port] asks that DNS server directly") + "\n" +
+        "  -dnsseedtimeout=<n>    " + _("Milliseconds to wait for a DNS seed to answer (default: 10000)") + "\n" +
+        "  -dnsseedttl=<n>        " + _("Seconds to reuse cached DNS seed answers, 0 to disable the cache (default: 21600)") + "\n" +
         "  -cppolicy              " + _("Sync checkpoints policy (default: strict)") + "\n" +
         "  -banscore=<n>          " + _("Threshold for disconnecting misbehaving peers (default: 100)") + "\n" +
         "  -bantime=<n>           " + _("Number of seconds to keep misbehaving peers from reconnecting (default: 86400)") + "\n" +
@@ -285,10 +299,14 @@ std::string HelpMessage()
         "  -daemon                " + _("Run in the background as a daemon and accept commands") + "\n" +
 #endif
         "  -testnet               " + _("Use the test network") + "\n" +
-        "  -debug                 " + _("Output extra debugging information. Implies all other -debug* options") + "\n" +
+        "  -debug=<category>      " + _("Output debugging information (default: 0, supplying <category> is optional)") + "\n" +
+        "                         " + _("If <category> is not supplied, output all debugging information.") + "\n" +
+        "                         " + _("<category> can be:") + " " + LogCategoriesHelp() + "\n" +
         "  -debugnet              " + _("Output extra network debugging information") + "\n" +
         "  -logtimestamps         " + _("Prepend debug output with timestamp") + "\n" +
-        "  -shrinkdebugfile       " + _("Shrink debug.log file on client startup (default: 1 when no -debug)") + "\n" +
+        "  -maxlogsize=<n>        " + _("Rotate debug.log when it grows beyond <n> MB, 0 to disable (default: 10)") + "\n" +
+        "  -logfiles=<n>          " + _("Number of rotated debug.log files to keep (default: 1)") + "\n" +
+        "  -lockprofile           " + _("Collect lock contention statistics, see getlockprofile") + "\n" +
         "  -printtoconsole        " + _("Send trace/debug info to console instead of debug.log file") + "\n" +
 #ifdef WIN32
         "  -printtodebugger       " + _("Send trace/debug info to debugger") + "\n" +
@@ -298,6 +316,13 @@ std::string HelpMessage()
         "  -rpcport=<port>        " + _("Listen for JSON-RPC connections on <port> (default: 8344 or testnet: 18344)") + "\n" +
         "  -rpcallowip=<ip>       " + _("Allow JSON-RPC connections from specified IP address") + "\n" +
         "  -rpcconnect=<ip>       " + _("Send commands to node running on <ip> (default: 127.0.0.1)") + "\n" +
+        "  -stratum               " + _("Accept stratum mining connections") + "\n" +
+        "  -stratumport=<port>    " + _("Listen for stratum connections on <port> (default: 8345 or testnet: 18345)") + "\n" +
+        "  -stratumallowip=<ip>   " + _("Allow stratum connections from specified IP address") + "\n" +
+        "  -stratumthreads=<n>    " + _("Number of threads checking stratum shares (default: half the cores)") + "\n" +
+        "  -stratumdifficulty=<n> " + _("Initial share difficulty of stratum connections (default: 1)") + "\n" +
+        "  -stratummindifficulty=<n> " + _("Lowest share difficulty of stratum connections (default: 0.001)") + "\n" +
+        "  -stratumsharetime=<n>  " + _("Adjust share difficulty to one share every <n> seconds (default: 15)") + "\n" +
         "  -blocknotify=<cmd>     " + _("Execute command when the best block changes (%s in cmd is replaced by block hash)") + "\n" +
         "  -walletnotify=<cmd>    " + _("Execute command when a wallet transaction changes (%s in cmd is replaced by TxID)") + "\n" +
         "  -confchange            " + _("Require a confirmations for change (default: 0)") + "\n" +
@@ -308,8 +333,11 @@ std::string HelpMessage()
         "  -salvagewallet         " + _("Attempt to recover private keys from a corrupt wallet.dat") + "\n" +
         "  -checkblocks=<n>       " + _("How many blocks to check at startup (default: 2500, 0 = all)") + "\n" +
         "  -checklevel=<n>        " + _("How thorough the block verification is (0-6, default: 1)") + "\n" +
+        "  -assumevalid=<hash>    " + _("Skip signature and script checks of this block and its ancestors, it has to be a checkpoint or a known block (default: last checkpoint, 0 = verify all)") + "\n" +
         "  -par=N                 " + _("Set the number of script verification threads (1-16, 0=auto, default: 0)") + "\n" +
         "  -loadblock=<file>      " + _("Imports blocks from external blk000?.dat file") + "\n" +
+        "  -loadsnapshot=<file>   " + _("Import a chain snapshot made by dumpsnapshot into an empty data directory, the blocks are verified in the background") + "\n" +
+        "  -snapshothash=<hash>   " + _("Expected content hash of the -loadsnapshot file") + "\n" +
 
         "\n" + _("Block creation options:") + "\n" +
         "  -blockminsize=<n>      "   + _("Set minimum block size in bytes (default: 0)") + "\n" +
@@ -325,11 +353,197 @@ std::string HelpMessage()
     return strUsage;
 }
 
+//
+// Startup stages
+//
+// Loading the wallet and peers.dat doesn't need the block index, they run
+// in their own threads while the block index loads. The wallet is joined
+// before the rescan and the peers before the node starts. RPC is served
+// from the start, answering with the current stage until init is done.
+//
+
+static int BeginStartupStage(const string& strName, bool fParallel=false)
+{
+    LOCK(cs_startup);
+    CStartupStage stage;
+    stage.strName = strName;
+    stage.fParallel = fParallel;
+    stage.nBegin = GetTimeMillis() - nStartupBegin;
+    stage.nEnd = -1;
+    vStartupStages.push_back(stage);
+    if (!fParallel)
+        SetRPCWarmupStatus(strName);
+    return vStartupStages.size() - 1;
+}
+
+static void EndStartupStage(int nStage)
+{
+    LOCK(cs_startup);
+    vStartupStages[nStage].nEnd = GetTimeMillis() - nStartupBegin;
+}
+
+void GetStartupStages(vector<CStartupStage>& vStages)
+{
+    LOCK(cs_startup);
+    vStages = vStartupStages;
+}
+
+static void PrintStartupReport()
+{
+    LOCK(cs_startup);
+    printf("Startup report (ms since start):\n");
+    printf("  %-16s %8s %8s %8s\n", "stage", "begin", "end", "time");
+    BOOST_FOREACH(const CStartupStage& stage, vStartupStages)
+        printf("  %-16s %8" PRId64 " %8" PRId64 " %8" PRId64 "%s\n", stage.strName.c_str(), stage.nBegin, stage.nEnd, stage.nEnd - stage.nBegin, stage.fParallel ? "  (parallel)" : "");
+    printf("  %-16s %8s %8" PRId64 "\n", "total", "", GetTimeMillis() - nStartupBegin);
+}
+
+/** Joins the parallel stages on every way out of AppInit2 */
+class CStartupThreads
+{
+private:
+    boost::thread_group group;
+
+public:
+    boost::thread* Start(const boost::function<void()>& fn)
+    {
+        return group.create_thread(fn);
+    }
+
+    static void Join(boost::thread* pthread)
+    {
+        if (pthread && pthread->joinable())
+            pthread->join();
+    }
+
+    ~CStartupThreads()
+    {
+        group.join_all();
+    }
+};
+
+/** Wallet stage results, read after the thread is joined */
+struct CWalletStage
+{
+    int nStage;
+    bool fZapFailed;
+    bool fFirstRun;
+    DBErrors nLoadWalletRet;
+    string strErrors;
+};
+
+static void LoadWalletStage(CWalletStage* pstage)
+{
+    ostringstream strErrors;
+    pstage->fZapFailed = false;
+    pstage->fFirstRun = true;
+    pstage->nLoadWalletRet = DB_LOAD_OK;
+
+    if (GetBoolArg("-zapwallettxes", false)) {
+        printf("Zapping all transactions from wallet...\n");
+
+        pwalletMain = new CWallet(strWalletFileName);
+        DBErrors nZapWalletRet = pwalletMain->ZapWalletTx();
+        delete pwalletMain;
+        pwalletMain = NULL;
+        if (nZapWalletRet != DB_LOAD_OK) {
+            pstage->fZapFailed = true;
+            EndStartupStage(pstage->nStage);
+            return;
+        }
+    }
+
+    printf("Loading wallet...\n");
+    int64_t nStart = GetTimeMillis();
+    CWallet* pwallet = new CWallet(strWalletFileName);
+    DBErrors nLoadWalletRet = pwallet->LoadWallet(pstage->fFirstRun);
+    pstage->nLoadWalletRet = nLoadWalletRet;
+    if (nLoadWalletRet != DB_LOAD_OK)
+    {
+        if (nLoadWalletRet == DB_CORRUPT)
+            strErrors << _("Error loading wallet.dat: Wallet corrupted") << "\n";
+        else if (nLoadWalletRet == DB_NONCRITICAL_ERROR)
+        {
+            string msg(_("Warning: error reading wallet.dat! All keys read correctly, but transaction data"
+                         " or address book entries might be missing or incorrect."));
+            uiInterface.ThreadSafeMessageBox(msg, _("NovaCoin"), CClientUIInterface::OK | CClientUIInterface::ICON_EXCLAMATION | CClientUIInterface::MODAL);
+        }
+        else if (nLoadWalletRet == DB_TOO_NEW)
+            strErrors << _("Error loading wallet.dat: Wallet requires newer version of NovaCoin") << "\n";
+        else if (nLoadWalletRet == DB_NEED_REWRITE)
+        {
+            strErrors << _("Wallet needed to be rewritten: restart NovaCoin to complete") << "\n";
+            pstage->strErrors = strErrors.str();
+            pwalletMain = pwallet;
+            EndStartupStage(pstage->nStage);
+            return;
+        }
+        else
+            strErrors << _("Error loading wallet.dat") << "\n";
+    }
+
+    if (GetBoolArg("-upgradewallet", pstage->fFirstRun))
+    {
+        int nMaxVersion = (int)(GetArg("-upgradewallet", 0));
+        if (nMaxVersion == 0) // the -upgradewallet without argument case
+        {
+            printf("Performing wallet upgrade to %i\n", FEATURE_LATEST);
+            nMaxVersion = CLIENT_VERSION;
+            pwallet->SetMinVersion(FEATURE_LATEST); // permanently upgrade the wallet immediately
+        }
+        else
+            printf("Allowing wallet upgrade up to %i\n", nMaxVersion);
+        if (nMaxVersion < pwallet->GetVersion())
+            strErrors << _("Cannot downgrade wallet") << "\n";
+        pwallet->SetMaxVersion(nMaxVersion);
+    }
+
+    if (pstage->fFirstRun)
+    {
+        // Create new keyUser and set as default key
+        RandAddSeedPerfmon();
+
+        CPubKey newDefaultKey;
+        if (!pwallet->GetKeyFromPool(newDefaultKey, false))
+            strErrors << _("Cannot initialize keypool") << "\n";
+        pwallet->SetDefaultKey(newDefaultKey);
+        if (!pwallet->SetAddressBookName(pwallet->vchDefaultKey.GetID(), ""))
+            strErrors << _("Cannot write default address") << "\n";
+    }
+
+    printf("%s", strErrors.str().c_str());
+    printf(" wallet      %15" PRId64 "ms\n", GetTimeMillis() - nStart);
+    pstage->strErrors = strErrors.str();
+    pwalletMain = pwallet;
+    EndStartupStage(pstage->nStage);
+}
+
+static void LoadPeersStage(int nStage)
+{
+    printf("Loading addresses...\n");
+    int64_t nStart = GetTimeMillis();
+
+    {
+        CAddrDB adb;
+        if (!adb.Read(addrman))
+            printf("Invalid or missing peers.dat; recreating\n");
+    }
+
+    printf("Loaded %i addresses from peers.dat  %" PRId64 "ms\n",
+           addrman.size(), GetTimeMillis() - nStart);
+    EndStartupStage(nStage);
+}
+
 /** Initialize bitcoin.
  *  @pre Parameters should be parsed and config file should be read.
  */
 bool AppInit2()
 {
+    nStartupBegin = GetTimeMillis();
+    // Declared first, the stage threads are joined before it goes away
+    CWalletStage walletStage;
+    CStartupThreads threads;
+
     // ********************************************************* Step 1: setup
 #ifdef _MSC_VER
     // Turn off Microsoft heap dump noise
@@ -453,13 +667,18 @@ bool AppInit2()
     else if (nScriptCheckThreads > MAX_SCRIPTCHECK_THREADS)
         nScriptCheckThreads = MAX_SCRIPTCHECK_THREADS;
 
-    fDebug = GetBoolArg("-debug");
+    // -debug enables every category, -debug=<category> only that one
+    if (mapArgs.count("-debug"))
+    {
+        std::string strUnknown;
+        if (!SetLogCategories(mapMultiArgs["-debug"], strUnknown))
+            return InitError(strprintf(_("Unknown debug category: '%s'"), strUnknown.c_str()));
+    }
+    if (GetBoolArg("-debugnet"))
+        nLogCategories |= LOG_NET;
 
-    // -debug implies fDebug*
-    if (fDebug)
-        fDebugNet = true;
-    else
-        fDebugNet = GetBoolArg("-debugnet");
+    fDebug = (nLogCategories == LOG_ALL);
+    fDebugNet = LogAcceptCategory(LOG_NET);
 
     bitdb.SetDetach(GetBoolArg("-detachdb", false));
 
@@ -481,6 +700,7 @@ bool AppInit2()
     fPrintToConsole = GetBoolArg("-printtoconsole");
     fPrintToDebugger = GetBoolArg("-printtodebugger");
     fLogTimestamps = GetBoolArg("-logtimestamps");
+    fLockProfile = GetBoolArg("-lockprofile");
 
     if (mapArgs.count("-timeout"))
     {
@@ -551,8 +771,11 @@ bool AppInit2()
     }
 #endif
 
-    if (GetBoolArg("-shrinkdebugfile", !fDebug))
-        ShrinkDebugFile();
+    if (!fPrintToConsole && !fPrintToDebugger)
+    {
+        SetLogRotation(GetArg("-maxlogsize", 10) * 1000000, GetArg("-logfiles", 1));
+        StartLogWriter();
+    }
     printf("\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n");
     printf("NovaCoin version %s (%s)\n", FormatFullVersion().c_str(), CLIENT_DATE.c_str());
     printf("Using OpenSSL version %s\n", SSLeay_version(SSLEAY_VERSION));
@@ -753,6 +976,10 @@ bool AppInit2()
     BOOST_FOREACH(string strDest, mapMultiArgs["-seednode"])
         AddOneShot(strDest);
 
+    // Calls are answered with the startup stage until init is done
+    if (fServer)
+        NewThread(ThreadRPCServer, NULL);
+
     // ********************************************************* Step 7: load blockchain
 
     if (!bitdb.Open(GetDataDir()))
@@ -771,8 +998,34 @@ bool AppInit2()
         return false;
     }
 
+    // Independent of the block index, see LoadWalletStage
+    walletStage.nStage = BeginStartupStage("wallet", true);
+    boost::thread* pthreadWallet = threads.Start(boost::bind(LoadWalletStage, &walletStage));
+    boost::thread* pthreadPeers = threads.Start(boost::bind(LoadPeersStage, BeginStartupStage("peers", true)));
+
+    if (mapArgs.count("-loadsnapshot"))
+    {
+        if (!mapArgs.count("-snapshothash"))
+            return InitError(_("Error: -loadsnapshot requires -snapshothash"));
+
+        uiInterface.InitMessage(_("Importing chain snapshot..."));
+        printf("Importing chain snapshot...\n");
+        nStart = GetTimeMillis();
+        int nStage = BeginStartupStage("snapshot");
+        std::string strError;
+        if (!LoadSnapshot(mapArgs["-loadsnapshot"], uint256(mapArgs["-snapshothash"]), strError))
+            return InitError(strprintf(_("Error loading snapshot: %s"), strError.c_str()));
+        EndStartupStage(nStage);
+        printf(" snapshot    %15" PRId64 "ms\n", GetTimeMillis() - nStart);
+    }
+
+    // Blocks up to a hardened checkpoint can be trusted before the block
+    // index is loaded, other blocks have to be found in it
+    uint256 hashAssumeValid = mapArgs.count("-assumevalid") ? uint256(mapArgs["-assumevalid"]) : Checkpoints::GetLastCheckpointHash();
+    bool fAssumeValidSet = SetAssumeValid(hashAssumeValid);
 
     printf("Loading block index...\n");
+    int nStageBlockIndex = BeginStartupStage("block index");
     bool fLoaded = false;
     while (!fLoaded) {
         std::string strLoadError;
@@ -811,6 +1064,14 @@ bool AppInit2()
         return false;
     }
     printf(" block index %15" PRId64 "ms\n", GetTimeMillis() - nStart);
+    EndStartupStage(nStageBlockIndex);
+
+    // Set it again to find the ancestors of the trusted block in the index
+    if (!SetAssumeValid(hashAssumeValid) && !fAssumeValidSet)
+        InitWarning(strprintf(_("Warning: -assumevalid block %s is not a checkpoint or a known block, all blocks will be verified."), hashAssumeValid.ToString().c_str()));
+    if (GetAssumeValidHeight() >= 0)
+        printf("Assuming blocks up to %s (height %d) are valid\n", hashAssumeValid.ToString().c_str(), GetAssumeValidHeight());
+    SetRPCReady(RPC_READY_CHAIN);
 
     if (GetBoolArg("-printblockindex") || GetBoolArg("-printblocktree"))
     {
@@ -843,79 +1104,20 @@ bool AppInit2()
 
     // ********************************************************* Step 8: load wallet
 
-    if (GetBoolArg("-zapwallettxes", false)) {
-        uiInterface.InitMessage(_("Zapping all transactions from wallet..."));
-
-        pwalletMain = new CWallet(strWalletFileName);
-        DBErrors nZapWalletRet = pwalletMain->ZapWalletTx();
-        if (nZapWalletRet != DB_LOAD_OK) {
-            uiInterface.InitMessage(_("Error loading wallet.dat: Wallet corrupted"));
-            return false;
-        }
-        delete pwalletMain;
-        pwalletMain = NULL;
-    }
-
     uiInterface.InitMessage(_("Loading wallet..."));
-    printf("Loading wallet...\n");
-    nStart = GetTimeMillis();
-    bool fFirstRun = true;
-    pwalletMain = new CWallet(strWalletFileName);
-    DBErrors nLoadWalletRet = pwalletMain->LoadWallet(fFirstRun);
-    if (nLoadWalletRet != DB_LOAD_OK)
-    {
-        if (nLoadWalletRet == DB_CORRUPT)
-            strErrors << _("Error loading wallet.dat: Wallet corrupted") << "\n";
-        else if (nLoadWalletRet == DB_NONCRITICAL_ERROR)
-        {
-            string msg(_("Warning: error reading wallet.dat! All keys read correctly, but transaction data"
-                         " or address book entries might be missing or incorrect."));
-            uiInterface.ThreadSafeMessageBox(msg, _("NovaCoin"), CClientUIInterface::OK | CClientUIInterface::ICON_EXCLAMATION | CClientUIInterface::MODAL);
-        }
-        else if (nLoadWalletRet == DB_TOO_NEW)
-            strErrors << _("Error loading wallet.dat: Wallet requires newer version of NovaCoin") << "\n";
-        else if (nLoadWalletRet == DB_NEED_REWRITE)
-        {
-            strErrors << _("Wallet needed to be rewritten: restart NovaCoin to complete") << "\n";
-            printf("%s", strErrors.str().c_str());
-            return InitError(strErrors.str());
-        }
-        else
-            strErrors << _("Error loading wallet.dat") << "\n";
-    }
-
-    if (GetBoolArg("-upgradewallet", fFirstRun))
-    {
-        int nMaxVersion = (int)(GetArg("-upgradewallet", 0));
-        if (nMaxVersion == 0) // the -upgradewallet without argument case
-        {
-            printf("Performing wallet upgrade to %i\n", FEATURE_LATEST);
-            nMaxVersion = CLIENT_VERSION;
-            pwalletMain->SetMinVersion(FEATURE_LATEST); // permanently upgrade the wallet immediately
-        }
-        else
-            printf("Allowing wallet upgrade up to %i\n", nMaxVersion);
-        if (nMaxVersion < pwalletMain->GetVersion())
-            strErrors << _("Cannot downgrade wallet") << "\n";
-        pwalletMain->SetMaxVersion(nMaxVersion);
+    SetRPCWarmupStatus("wallet");
+    CStartupThreads::Join(pthreadWallet);
+    if (walletStage.fZapFailed) {
+        uiInterface.InitMessage(_("Error loading wallet.dat: Wallet corrupted"));
+        return false;
     }
-
-    if (fFirstRun)
+    strErrors << walletStage.strErrors;
+    if (walletStage.nLoadWalletRet == DB_NEED_REWRITE)
     {
-        // Create new keyUser and set as default key
-        RandAddSeedPerfmon();
-
-        CPubKey newDefaultKey;
-        if (!pwalletMain->GetKeyFromPool(newDefaultKey, false))
-            strErrors << _("Cannot initialize keypool") << "\n";
-        pwalletMain->SetDefaultKey(newDefaultKey);
-        if (!pwalletMain->SetAddressBookName(pwalletMain->vchDefaultKey.GetID(), ""))
-            strErrors << _("Cannot write default address") << "\n";
+        printf("%s", strErrors.str().c_str());
+        return InitError(strErrors.str());
     }
 
-    printf("%s", strErrors.str().c_str());
-    printf(" wallet      %15" PRId64 "ms\n", GetTimeMillis() - nStart);
-
     RegisterWallet(pwalletMain);
 
     CBlockIndex *pindexRescan = pindexBest;
@@ -933,12 +1135,21 @@ bool AppInit2()
         uiInterface.InitMessage(_("Rescanning..."));
         printf("Rescanning last %i blocks (from block %i)...\n", pindexBest->nHeight - pindexRescan->nHeight, pindexRescan->nHeight);
         nStart = GetTimeMillis();
+        int nStage = BeginStartupStage("rescan");
         pwalletMain->ScanForWalletTransactions(pindexRescan, true);
+        EndStartupStage(nStage);
         printf(" rescan      %15" PRId64 "ms\n", GetTimeMillis() - nStart);
     }
+    if (fRequestShutdown)
+    {
+        printf("Shutdown requested. Exiting.\n");
+        return false;
+    }
+    SetRPCReady(RPC_READY_WALLET);
 
     // ********************************************************* Step 9: import blocks
 
+    int nStageImport = BeginStartupStage("import");
     if (mapArgs.count("-loadblock"))
     {
         uiInterface.InitMessage(_("Importing blockchain data file."));
@@ -964,20 +1175,18 @@ bool AppInit2()
         }
     }
 
-    // ********************************************************* Step 10: load peers
-
-    uiInterface.InitMessage(_("Loading addresses..."));
-    printf("Loading addresses...\n");
-    nStart = GetTimeMillis();
-
+    EndStartupStage(nStageImport);
+    if (fRequestShutdown)
     {
-        CAddrDB adb;
-        if (!adb.Read(addrman))
-            printf("Invalid or missing peers.dat; recreating\n");
+        printf("Shutdown requested. Exiting.\n");
+        return false;
     }
 
-    printf("Loaded %i addresses from peers.dat  %" PRId64 "ms\n",
-           addrman.size(), GetTimeMillis() - nStart);
+    // ********************************************************* Step 10: load peers
+
+    uiInterface.InitMessage(_("Loading addresses..."));
+    SetRPCWarmupStatus("peers");
+    CStartupThreads::Join(pthreadPeers);
 
     // ********************************************************* Step 11: start node
 
@@ -993,16 +1202,24 @@ bool AppInit2()
     printf("mapWallet.size() = %" PRIszu "\n",       pwalletMain->mapWallet.size());
     printf("mapAddressBook.size() = %" PRIszu "\n",  pwalletMain->mapAddressBook.size());
 
+    SetRPCWarmupStatus("start node");
     if (!NewThread(StartNode, NULL))
         InitError(_("Error: could not start node"));
 
-    if (fServer)
-        NewThread(ThreadRPCServer, NULL);
+    if (GetBoolArg("-stratum"))
+        if (!NewThread(ThreadStratumServer, NULL))
+            InitError(_("Error: could not start stratum server"));
+
+    // Validates the blocks of an imported snapshot, returns at once otherwise
+    if (!NewThread(ThreadSnapshotVerify, NULL))
+        printf("Error: NewThread(ThreadSnapshotVerify) failed\n");
 
     // ********************************************************* Step 12: finished
 
     uiInterface.InitMessage(_("Done loading"));
     printf("Done loading\n");
+    PrintStartupReport();
+    SetRPCReady(RPC_READY_FULL);
 
     if (!strErrors.str().empty())
         return InitError(strErrors.str());
@@ -14,4 +14,15 @@ void Shutdown(void* parg);
 bool AppInit2();
 std::string HelpMessage();
 
+/** Timing of one stage of AppInit2, in ms since startup began */
+struct CStartupStage
+{
+    std::string strName;
+    bool fParallel;     // ran beside the main init thread
+    int64_t nBegin;
+    int64_t nEnd;       // -1 while running
+};
+
+void GetStartupStages(std::vector<CStartupStage>& vStages);
+
 #endif
@@ -4,6 +4,8 @@
 
 #include <boost/assign/list_of.hpp>
 
+#include <deque>
+
 #include "kernel.h"
 #include "txdb.h"
 
@@ -124,47 +126,149 @@ static int64_t GetStakeModifierSelectionInterval()
     return nSelectionInterval;
 }
 
-// select a block from the candidate blocks in vSortedByTimestamp, excluding
-// already selected blocks in vSelectedBlocks, and with timestamp up to
+// Candidate blocks for the stake modifier selection: the chain suffix after
+// the last block timestamped before the selection interval start. The window
+// is kept between calls and moved along with the chain, so consecutive
+// modifiers don't walk and sort the whole selection interval again.
+class CModifierCandidateWindow
+{
+private:
+    typedef map<pair<int64_t, uint256>, const CBlockIndex*> MapByTimestamp;
+
+    deque<const CBlockIndex*> vChain; // by height
+    MapByTimestamp mapByTimestamp;
+
+    void PushBack(const CBlockIndex* pindex)
+    {
+        vChain.push_back(pindex);
+        mapByTimestamp.insert(make_pair(make_pair(pindex->GetBlockTime(), pindex->GetBlockHash()), pindex));
+    }
+
+    void PushFront(const CBlockIndex* pindex)
+    {
+        vChain.push_front(pindex);
+        mapByTimestamp.insert(make_pair(make_pair(pindex->GetBlockTime(), pindex->GetBlockHash()), pindex));
+    }
+
+    void PopBack()
+    {
+        mapByTimestamp.erase(make_pair(vChain.back()->GetBlockTime(), vChain.back()->GetBlockHash()));
+        vChain.pop_back();
+    }
+
+    void PopFront()
+    {
+        mapByTimestamp.erase(make_pair(vChain.front()->GetBlockTime(), vChain.front()->GetBlockHash()));
+        vChain.pop_front();
+    }
+
+public:
+    // Same candidates as walking pprev from pindexPrev while the block time
+    // is not before nSelectionIntervalStart
+    void Move(const CBlockIndex* pindexPrev, int64_t nSelectionIntervalStart)
+    {
+        // Find the fork with the current window, don't follow a far jump
+        if (!vChain.empty() && abs(pindexPrev->nHeight - vChain.back()->nHeight) > 10000)
+        {
+            vChain.clear();
+            mapByTimestamp.clear();
+        }
+        vector<const CBlockIndex*> vConnect;
+        const CBlockIndex* pindex = pindexPrev;
+        while (pindex && !vChain.empty() && pindex != vChain.back())
+        {
+            if (pindex->nHeight > vChain.back()->nHeight)
+            {
+                vConnect.push_back(pindex);
+                pindex = pindex->pprev;
+            }
+            else
+                PopBack();
+        }
+        if (!pindex || vChain.empty())
+        {
+            vChain.clear();
+            mapByTimestamp.clear();
+            vConnect.clear();
+            PushBack(pindexPrev);
+        }
+        BOOST_REVERSE_FOREACH(const CBlockIndex* pindexConnect, vConnect)
+            PushBack(pindexConnect);
+
+        // Drop blocks up to the last one timestamped before the start
+        for (int i = vChain.size() - 1; i >= 0; i--)
+        {
+            if (vChain[i]->GetBlockTime() < nSelectionIntervalStart)
+            {
+                for (int j = 0; j <= i; j++)
+                    PopFront();
+                return;
+            }
+        }
+
+        // Or extend the window back if the start moved back
+        while (vChain.front()->pprev && vChain.front()->pprev->GetBlockTime() >= nSelectionIntervalStart)
+            PushFront(vChain.front()->pprev);
+    }
+
+    int GetFirstHeight() const
+    {
+        return vChain.front()->nHeight;
+    }
+
+    // Candidates sorted by timestamp, then block hash
+    void GetSorted(vector<const CBlockIndex*>& vSorted) const
+    {
+        vSorted.clear();
+        vSorted.reserve(mapByTimestamp.size());
+        for (MapByTimestamp::const_iterator it = mapByTimestamp.begin(); it != mapByTimestamp.end(); it++)
+            vSorted.push_back(it->second);
+    }
+};
+
+static CCriticalSection cs_modifierCandidates;
+static CModifierCandidateWindow modifierCandidates;
+
+struct CModifierCandidate
+{
+    const CBlockIndex* pindex;
+    uint256 hashSelection;
+};
+
+// select a block from the candidate blocks in vCandidates, excluding
+// already selected blocks in vSelected, and with timestamp up to
 // nSelectionIntervalStop.
-static bool SelectBlockFromCandidates(vector<pair<int64_t, uint256> >& vSortedByTimestamp, map<uint256, const CBlockIndex*>& mapSelectedBlocks,
-    int64_t nSelectionIntervalStop, uint64_t nStakeModifierPrev, const CBlockIndex** pindexSelected)
+static bool SelectBlockFromCandidates(const vector<CModifierCandidate>& vCandidates, vector<bool>& vSelected,
+    int64_t nSelectionIntervalStop, const CBlockIndex** pindexSelected)
 {
     bool fSelected = false;
     uint256 hashBest = 0;
+    unsigned int nBest = 0;
     *pindexSelected = (const CBlockIndex*) 0;
-    BOOST_FOREACH(const PAIRTYPE(int64_t, uint256)& item, vSortedByTimestamp)
+    for (unsigned int i = 0; i < vCandidates.size(); i++)
     {
-        if (!mapBlockIndex.count(item.second))
-            return error("SelectBlockFromCandidates: failed to find block index for candidate block %s", item.second.ToString().c_str());
-        const CBlockIndex* pindex = mapBlockIndex[item.second];
-        if (fSelected && pindex->GetBlockTime() > nSelectionIntervalStop)
+        const CModifierCandidate& candidate = vCandidates[i];
+        if (fSelected && candidate.pindex->GetBlockTime() > nSelectionIntervalStop)
             break;
-        if (mapSelectedBlocks.count(pindex->GetBlockHash()) > 0)
+        if (vSelected[i])
             continue;
-        // compute the selection hash by hashing its proof-hash and the
-        // previous proof-of-stake modifier
-        uint256 hashProof = pindex->IsProofOfStake()? pindex->hashProofOfStake : pindex->GetBlockHash();
-        CDataStream ss(SER_GETHASH, 0);
-        ss << hashProof << nStakeModifierPrev;
-        uint256 hashSelection = Hash(ss.begin(), ss.end());
-        // the selection hash is divided by 2**32 so that proof-of-stake block
-        // is always favored over proof-of-work block. this is to preserve
-        // the energy efficiency property
-        if (pindex->IsProofOfStake())
-            hashSelection >>= 32;
-        if (fSelected && hashSelection < hashBest)
+        if (fSelected && candidate.hashSelection < hashBest)
         {
-            hashBest = hashSelection;
-            *pindexSelected = (const CBlockIndex*) pindex;
+            hashBest = candidate.hashSelection;
+            nBest = i;
         }
         else if (!fSelected)
         {
             fSelected = true;
-            hashBest = hashSelection;
-            *pindexSelected = (const CBlockIndex*) pindex;
+            hashBest = candidate.hashSelection;
+            nBest = i;
         }
     }
+    if (fSelected)
+    {
+        vSelected[nBest] = true;
+        *pindexSelected = vCandidates[nBest].pindex;
+    }
     if (fDebug && GetBoolArg("-printstakemodifier"))
         printf("SelectBlockFromCandidates: selection hash=%s\n", hashBest.ToString().c_str());
     return fSelected;
@@ -231,36 +335,50 @@ bool ComputeNextStakeModifier(const CBlockIndex* pindexCurrent, uint64_t& nStake
         }
     }
 
-    // Sort candidate blocks by timestamp
-    vector<pair<int64_t, uint256> > vSortedByTimestamp;
-    vSortedByTimestamp.reserve(64 * nModifierInterval / nStakeTargetSpacing);
+    // Candidate blocks sorted by timestamp
     int64_t nSelectionInterval = GetStakeModifierSelectionInterval();
     int64_t nSelectionIntervalStart = (pindexPrev->GetBlockTime() / nModifierInterval) * nModifierInterval - nSelectionInterval;
-    const CBlockIndex* pindex = pindexPrev;
-    while (pindex && pindex->GetBlockTime() >= nSelectionIntervalStart)
+    vector<const CBlockIndex*> vSortedByTimestamp;
+    int nHeightFirstCandidate;
     {
-        vSortedByTimestamp.push_back(make_pair(pindex->GetBlockTime(), pindex->GetBlockHash()));
-        pindex = pindex->pprev;
+        LOCK(cs_modifierCandidates);
+        modifierCandidates.Move(pindexPrev, nSelectionIntervalStart);
+        modifierCandidates.GetSorted(vSortedByTimestamp);
+        nHeightFirstCandidate = modifierCandidates.GetFirstHeight();
+    }
+
+    // The selection hash of each candidate is the hash of its proof-hash and
+    // the previous proof-of-stake modifier, the same in every round
+    vector<CModifierCandidate> vCandidates(vSortedByTimestamp.size());
+    for (unsigned int i = 0; i < vSortedByTimestamp.size(); i++)
+    {
+        const CBlockIndex* pindexCandidate = vSortedByTimestamp[i];
+        uint256 hashProof = pindexCandidate->IsProofOfStake()? pindexCandidate->hashProofOfStake : pindexCandidate->GetBlockHash();
+        CFixedDataStream<64> ss(SER_GETHASH, 0);
+        ss << hashProof << nStakeModifier;
+        vCandidates[i].pindex = pindexCandidate;
+        vCandidates[i].hashSelection = Hash(ss.begin(), ss.end());
+        // the selection hash is divided by 2**32 so that proof-of-stake block
+        // is always favored over proof-of-work block. this is to preserve
+        // the energy efficiency property
+        if (pindexCandidate->IsProofOfStake())
+            vCandidates[i].hashSelection >>= 32;
     }
-    int nHeightFirstCandidate = pindex ? (pindex->nHeight + 1) : 0;
-    reverse(vSortedByTimestamp.begin(), vSortedByTimestamp.end());
-    sort(vSortedByTimestamp.begin(), vSortedByTimestamp.end());
 
     // Select 64 blocks from candidate blocks to generate stake modifier
     uint64_t nStakeModifierNew = 0;
     int64_t nSelectionIntervalStop = nSelectionIntervalStart;
-    map<uint256, const CBlockIndex*> mapSelectedBlocks;
-    for (int nRound=0; nRound<min(64, (int)vSortedByTimestamp.size()); nRound++)
+    vector<bool> vSelected(vCandidates.size(), false);
+    const CBlockIndex* pindex;
+    for (int nRound=0; nRound<min(64, (int)vCandidates.size()); nRound++)
     {
         // add an interval section to the current selection round
         nSelectionIntervalStop += GetStakeModifierSelectionIntervalSection(nRound);
         // select a block from the candidates of current round
-        if (!SelectBlockFromCandidates(vSortedByTimestamp, mapSelectedBlocks, nSelectionIntervalStop, nStakeModifier, &pindex))
+        if (!SelectBlockFromCandidates(vCandidates, vSelected, nSelectionIntervalStop, &pindex))
             return error("ComputeNextStakeModifier: unable to select block at round %d", nRound);
         // write the entropy bit of the selected block
         nStakeModifierNew |= (((uint64_t)pindex->GetStakeEntropyBit()) << nRound);
-        // add the selected block from candidates to selected list
-        mapSelectedBlocks.insert(make_pair(pindex->GetBlockHash(), pindex));
         if (fDebug && GetBoolArg("-printstakemodifier"))
             printf("ComputeNextStakeModifier: selected round %d stop=%s height=%d bit=%d\n", nRound, DateTimeStrFormat(nSelectionIntervalStop).c_str(), pindex->nHeight, pindex->GetStakeEntropyBit());
     }
@@ -279,11 +397,13 @@ bool ComputeNextStakeModifier(const CBlockIndex* pindexCurrent, uint64_t& nStake
                 strSelectionMap.replace(pindex->nHeight - nHeightFirstCandidate, 1, "=");
             pindex = pindex->pprev;
         }
-        BOOST_FOREACH(const PAIRTYPE(uint256, const CBlockIndex*)& item, mapSelectedBlocks)
+        for (unsigned int i = 0; i < vCandidates.size(); i++)
         {
+            if (!vSelected[i])
+                continue;
             // 'S' indicates selected proof-of-stake blocks
             // 'W' indicates selected proof-of-work blocks
-            strSelectionMap.replace(item.second->nHeight - nHeightFirstCandidate, 1, item.second->IsProofOfStake()? "S" : "W");
+            strSelectionMap.replace(vCandidates[i].pindex->nHeight - nHeightFirstCandidate, 1, vCandidates[i].pindex->IsProofOfStake()? "S" : "W");
         }
         printf("ComputeNextStakeModifier: selection height [%d, %d] map %s\n", nHeightFirstCandidate, pindexPrev->nHeight, strSelectionMap.c_str());
     }
@@ -297,36 +417,109 @@ bool ComputeNextStakeModifier(const CBlockIndex* pindexCurrent, uint64_t& nStake
     return true;
 }
 
+// Main chain blocks that generated a stake modifier, in height order. The
+// kernel modifier of a coin is the first one generated a selection interval
+// after the coin's block, so it can be found by binary search instead of
+// following pnext. Block times are not monotonic, lookups search the running
+// maximum of the times.
+struct CStakeModifierEntry
+{
+    const CBlockIndex* pindex;
+    int nHeight;
+    int64_t nMaxTime; // latest block time up to and including this entry
+};
+
+static CCriticalSection cs_stakeModifierIndex;
+static vector<CStakeModifierEntry> vStakeModifierIndex;
+static const CBlockIndex* pindexStakeModifierIndexed = NULL; // last main chain block scanned
+
+static bool CompareEntryHeight(int nHeight, const CStakeModifierEntry& entry)
+{
+    return nHeight < entry.nHeight;
+}
+
+static bool CompareEntryMaxTime(const CStakeModifierEntry& entry, int64_t nTime)
+{
+    return entry.nMaxTime < nTime;
+}
+
+void UpdateStakeModifierIndex()
+{
+    LOCK(cs_stakeModifierIndex);
+
+    // Roll back to the fork point
+    const CBlockIndex* pindex = pindexStakeModifierIndexed;
+    while (pindex && !pindex->IsInMainChain())
+        pindex = pindex->pprev;
+    while (!vStakeModifierIndex.empty() && (!pindex || vStakeModifierIndex.back().nHeight > pindex->nHeight))
+        vStakeModifierIndex.pop_back();
+
+    // Scan the connected blocks
+    pindex = pindex ? pindex->pnext : pindexGenesisBlock;
+    for (; pindex; pindex = pindex->pnext)
+    {
+        pindexStakeModifierIndexed = pindex;
+        if (!pindex->GeneratedStakeModifier())
+            continue;
+        CStakeModifierEntry entry;
+        entry.pindex = pindex;
+        entry.nHeight = pindex->nHeight;
+        entry.nMaxTime = pindex->GetBlockTime();
+        if (!vStakeModifierIndex.empty())
+            entry.nMaxTime = max(entry.nMaxTime, vStakeModifierIndex.back().nMaxTime);
+        vStakeModifierIndex.push_back(entry);
+    }
+}
+
+// Find the first stake modifier generated at a height above nHeightFrom with
+// a block time of at least nTime
+static const CBlockIndex* FindStakeModifier(int nHeightFrom, int64_t nTime)
+{
+    LOCK(cs_stakeModifierIndex);
+    if (pindexStakeModifierIndexed != pindexBest)
+        UpdateStakeModifierIndex();
+
+    vector<CStakeModifierEntry>::const_iterator itFrom = upper_bound(vStakeModifierIndex.begin(), vStakeModifierIndex.end(), nHeightFrom, CompareEntryHeight);
+    vector<CStakeModifierEntry>::const_iterator it = lower_bound(vStakeModifierIndex.begin(), vStakeModifierIndex.end(), nTime, CompareEntryMaxTime);
+    if (it >= itFrom)
+        return (it == vStakeModifierIndex.end() ? NULL : it->pindex);
+
+    // An earlier block is timestamped after nTime, scan from the first
+    // candidate
+    for (it = itFrom; it != vStakeModifierIndex.end(); it++)
+        if (it->pindex->GetBlockTime() >= nTime)
+            return it->pindex;
+    return NULL;
+}
+
 // The stake modifier used to hash for a stake kernel is chosen as the stake
 // modifier about a selection interval later than the coin generating the kernel
 static bool GetKernelStakeModifier(uint256 hashBlockFrom, uint64_t& nStakeModifier, int& nStakeModifierHeight, int64_t& nStakeModifierTime, bool fPrintProofOfStake)
 {
     nStakeModifier = 0;
-    if (!mapBlockIndex.count(hashBlockFrom))
+    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlockFrom);
+    if (mi == mapBlockIndex.end())
         return error("GetKernelStakeModifier() : block not indexed");
-    const CBlockIndex* pindexFrom = mapBlockIndex[hashBlockFrom];
+    const CBlockIndex* pindexFrom = mi->second;
     nStakeModifierHeight = pindexFrom->nHeight;
     nStakeModifierTime = pindexFrom->GetBlockTime();
     int64_t nStakeModifierSelectionInterval = GetStakeModifierSelectionInterval();
-    const CBlockIndex* pindex = pindexFrom;
-    // loop to find the stake modifier later by a selection interval
-    while (nStakeModifierTime < pindexFrom->GetBlockTime() + nStakeModifierSelectionInterval)
+
+    const CBlockIndex* pindex = NULL;
+    if (pindexFrom->IsInMainChain())
+        pindex = FindStakeModifier(pindexFrom->nHeight, pindexFrom->GetBlockTime() + nStakeModifierSelectionInterval);
+    if (!pindex)
     {
-        if (!pindex->pnext)
-        {   // reached best block; may happen if node is behind on block chain
-            if (fPrintProofOfStake || (pindex->GetBlockTime() + nStakeMinAge - nStakeModifierSelectionInterval > GetAdjustedTime()))
-                return error("GetKernelStakeModifier() : reached best block %s at height %d from block %s",
-                    pindex->GetBlockHash().ToString().c_str(), pindex->nHeight, hashBlockFrom.ToString().c_str());
-            else
-                return false;
-        }
-        pindex = pindex->pnext;
-        if (pindex->GeneratedStakeModifier())
-        {
-            nStakeModifierHeight = pindex->nHeight;
-            nStakeModifierTime = pindex->GetBlockTime();
-        }
+        // reached best block; may happen if node is behind on block chain
+        const CBlockIndex* pindexLast = pindexFrom->IsInMainChain() ? pindexBest : pindexFrom;
+        if (fPrintProofOfStake || (pindexLast->GetBlockTime() + nStakeMinAge - nStakeModifierSelectionInterval > GetAdjustedTime()))
+            return error("GetKernelStakeModifier() : reached best block %s at height %d from block %s",
+                pindexLast->GetBlockHash().ToString().c_str(), pindexLast->nHeight, hashBlockFrom.ToString().c_str());
+        else
+            return false;
     }
+    nStakeModifierHeight = pindex->nHeight;
+    nStakeModifierTime = pindex->GetBlockTime();
     nStakeModifier = pindex->nStakeModifier;
     return true;
 }
@@ -380,7 +573,7 @@ bool CheckStakeKernelHash(uint32_t nBits, const CBlock& blockFrom, uint32_t nTxP
     targetProofOfStake = (bnCoinDayWeight * bnTargetPerCoinDay).getuint256();
 
     // Calculate hash
-    CDataStream ss(SER_GETHASH, 0);
+    CFixedDataStream<64> ss(SER_GETHASH, 0);
     uint64_t nStakeModifier = 0;
     int nStakeModifierHeight = 0;
     int64_t nStakeModifierTime = 0;
@@ -426,10 +619,10 @@ bool CheckStakeKernelHash(uint32_t nBits, const CBlock& blockFrom, uint32_t nTxP
 void GetKernelMidstate(uint64_t nStakeModifier, uint32_t nBlockTime, uint32_t nTxOffset, uint32_t nInputTxTime, uint32_t nOut, SHA256_CTX &ctx)
 {
     // Build static part of kernel
-    CDataStream ssKernel(SER_GETHASH, 0);
+    CFixedDataStream<64> ssKernel(SER_GETHASH, 0);
     ssKernel << nStakeModifier;
     ssKernel << nBlockTime << nTxOffset << nInputTxTime << nOut;
-    CDataStream::const_iterator it = ssKernel.begin();
+    CFixedDataStream<64>::const_iterator it = ssKernel.begin();
 
     // Init sha256 context and update it 
     //   with first 24 bytes of kernel
@@ -532,7 +725,7 @@ bool ScanMidstateBackward(SHA256_CTX &ctx, uint32_t nBits, uint32_t nInputTxTime
 }
 
 // Check kernel hash target and coinstake signature
-bool CheckProofOfStake(const CTransaction& tx, unsigned int nBits, uint256& hashProofOfStake, uint256& targetProofOfStake)
+bool CheckProofOfStake(const CTransaction& tx, unsigned int nBits, uint256& hashProofOfStake, uint256& targetProofOfStake, bool fAssumeValid)
 {
     if (!tx.IsCoinStake())
         return error("CheckProofOfStake() : called on non-coinstake %s", tx.GetHash().ToString().c_str());
@@ -551,9 +744,15 @@ bool CheckProofOfStake(const CTransaction& tx, unsigned int nBits, uint256& hash
     txdb.Close();
 #endif
 
-    // Verify signature
-    if (!VerifySignature(txPrev, tx, 0, MANDATORY_SCRIPT_VERIFY_FLAGS, 0))
-        return tx.DoS(100, error("CheckProofOfStake() : VerifySignature failed on coinstake %s", tx.GetHash().ToString().c_str()));
+    // Verify signature, unless the block is covered by -assumevalid
+    if (!fAssumeValid || !AssumeValidSkip(AV_STAKESIG))
+    {
+        int64_t nStart = GetTimeMicros();
+        if (!VerifySignature(txPrev, tx, 0, MANDATORY_SCRIPT_VERIFY_FLAGS, 0))
+            return tx.DoS(100, error("CheckProofOfStake() : VerifySignature failed on coinstake %s", tx.GetHash().ToString().c_str()));
+        if (fAssumeValid)
+            AssumeValidSampled(AV_STAKESIG, GetTimeMicros() - nStart);
+    }
 
     // Read block header
     CBlock block;
@@ -571,7 +770,7 @@ uint32_t GetStakeModifierChecksum(const CBlockIndex* pindex)
 {
     assert (pindex->pprev || pindex->GetBlockHash() == (!fTestNet ? hashGenesisBlock : hashGenesisBlockTestNet));
     // Hash previous checksum with flags, hashProofOfStake and nStakeModifier
-    CDataStream ss(SER_GETHASH, 0);
+    CFixedDataStream<64> ss(SER_GETHASH, 0);
     if (pindex->pprev)
         ss << pindex->pprev->nStakeModifierChecksum;
     ss << pindex->nFlags << pindex->hashProofOfStake << pindex->nStakeModifier;
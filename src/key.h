@@ -97,6 +97,9 @@ public:
     std::vector<unsigned char> Raw() const {
         return vchPubKey;
     }
+
+    // Verify a DER signature (lax BER parsing, as OpenSSL does) of hash by this key
+    bool Verify(const uint256 &hash, const std::vector<unsigned char>& vchSig) const;
 };
 
 
@@ -0,0 +1,359 @@
+// Copyright (c) 2014 The NovaCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "logging.h"
+#include "util.h"
+
+#include <boost/algorithm/string/case_conv.hpp>
+#include <boost/foreach.hpp>
+
+using namespace std;
+
+unsigned int nLogCategories = LOG_NONE;
+
+namespace
+{
+    struct CCategoryName
+    {
+        unsigned int nCategory;
+        const char* pszName;
+    };
+
+    const CCategoryName categoryNames[] =
+    {
+        { LOG_NET,     "net" },
+        { LOG_MEMPOOL, "mempool" },
+        { LOG_BLOCK,   "block" },
+        { LOG_STAKE,   "stake" },
+        { LOG_MINER,   "miner" },
+        { LOG_RPC,     "rpc" },
+        { LOG_DB,      "db" },
+        { LOG_ADDRMAN, "addrman" },
+        { LOG_LOCK,    "lock" },
+    };
+
+    //
+    // Bounded multi-producer queue (Vyukov). A slot is free for the producer
+    // at position nPos when its sequence equals nPos and holds a message for
+    // the consumer when it equals nPos + 1. Sequences are stored relative to
+    // the slot index so that the zero-initialized ring is valid before any
+    // constructor runs, printf may be called from static initializers.
+    //
+    const unsigned int LOG_RING_SIZE = 2048; // power of two
+    const unsigned int LOG_SLOT_DATA = 232;
+
+    struct CLogSlot
+    {
+        volatile unsigned int nSeq;
+        unsigned int nLen;
+        int64_t nTime;
+        char* pchLong; // messages that do not fit in pch
+        char pch[LOG_SLOT_DATA];
+    };
+
+    CLogSlot vSlots[LOG_RING_SIZE];
+    volatile unsigned int nEnqueuePos = 0;
+    unsigned int nDequeuePos = 0; // guarded by LogMutex()
+
+    volatile bool fWriterRunning = false;
+    volatile bool fWriterStop = false;
+
+    FILE* fileout = NULL;
+    bool fStartedNewLine = true;
+    int64_t nMaxLogSize = 10 * 1000000;
+    int nLogFiles = 1;
+
+    // Never destroyed, printf may be called by global destructors
+    boost::mutex& LogMutex()
+    {
+        static boost::mutex* pmutex = new boost::mutex();
+        return *pmutex;
+    }
+
+    bool Enqueue(const char* pch, unsigned int nLen, int64_t nTime)
+    {
+        unsigned int nPos = nEnqueuePos;
+        CLogSlot* pslot;
+        while (true)
+        {
+            unsigned int nIndex = nPos & (LOG_RING_SIZE - 1);
+            pslot = &vSlots[nIndex];
+            int nDiff = (int)(pslot->nSeq + nIndex - nPos);
+            if (nDiff == 0)
+            {
+                if (__sync_bool_compare_and_swap(&nEnqueuePos, nPos, nPos + 1))
+                    break;
+                nPos = nEnqueuePos;
+            }
+            else if (nDiff < 0)
+                return false; // full
+            else
+                nPos = nEnqueuePos;
+        }
+
+        pslot->nLen = nLen;
+        pslot->nTime = nTime;
+        if (nLen <= LOG_SLOT_DATA)
+        {
+            memcpy(pslot->pch, pch, nLen);
+            pslot->pchLong = NULL;
+        }
+        else
+        {
+            pslot->pchLong = new char[nLen];
+            memcpy(pslot->pchLong, pch, nLen);
+        }
+        __sync_synchronize();
+        pslot->nSeq = nPos + 1 - (nPos & (LOG_RING_SIZE - 1));
+        return true;
+    }
+
+    void OpenDebugLog()
+    {
+        boost::filesystem::path pathDebug = GetDataDir() / "debug.log";
+        fileout = fopen(pathDebug.string().c_str(), "a");
+        if (fileout)
+            setvbuf(fileout, NULL, _IOFBF, 64 * 1024);
+    }
+
+    void RotateDebugLog()
+    {
+        fclose(fileout);
+        fileout = NULL;
+
+        boost::filesystem::path pathDebug = GetDataDir() / "debug.log";
+        for (int i = nLogFiles - 1; i >= 1; i--)
+        {
+            boost::filesystem::path pathFrom = strprintf("%s.%d", pathDebug.string().c_str(), i);
+            boost::filesystem::path pathTo = strprintf("%s.%d", pathDebug.string().c_str(), i + 1);
+            if (boost::filesystem::exists(pathFrom))
+                RenameOver(pathFrom, pathTo);
+        }
+        if (nLogFiles > 0)
+            RenameOver(pathDebug, pathDebug.string() + ".1");
+        else
+            boost::filesystem::remove(pathDebug);
+        OpenDebugLog();
+    }
+
+    void WriteToFile(const char* pch, unsigned int nLen, int64_t nTime)
+    {
+        static int64_t nLastTime = 0;
+        static char pszTime[64];
+
+        if (fLogTimestamps && fStartedNewLine)
+        {
+            if (nTime != nLastTime)
+            {
+                strncpy(pszTime, DateTimeStrFormat("%x %H:%M:%S ", nTime).c_str(), sizeof(pszTime) - 1);
+                nLastTime = nTime;
+            }
+            fputs(pszTime, fileout);
+        }
+        fStartedNewLine = (nLen > 0 && pch[nLen - 1] == '\n');
+        fwrite(pch, 1, nLen, fileout);
+    }
+
+    // Write out queued messages, LogMutex() must be held
+    unsigned int Drain()
+    {
+        if (!fileout)
+            OpenDebugLog();
+
+        // Reopen the log file, if requested
+        if (fReopenDebugLog && fileout)
+        {
+            fReopenDebugLog = false;
+            fclose(fileout);
+            OpenDebugLog();
+        }
+
+        unsigned int nWritten = 0;
+        while (true)
+        {
+            unsigned int nIndex = nDequeuePos & (LOG_RING_SIZE - 1);
+            CLogSlot& slot = vSlots[nIndex];
+            if (slot.nSeq + nIndex != nDequeuePos + 1)
+                break;
+            __sync_synchronize();
+
+            if (fileout)
+                WriteToFile(slot.pchLong ? slot.pchLong : slot.pch, slot.nLen, slot.nTime);
+            delete[] slot.pchLong;
+            slot.pchLong = NULL;
+
+            __sync_synchronize();
+            slot.nSeq = nDequeuePos + LOG_RING_SIZE - nIndex;
+            nDequeuePos++;
+            nWritten++;
+        }
+
+        if (nWritten && fileout)
+        {
+            fflush(fileout);
+            if (nMaxLogSize > 0 && ftell(fileout) > nMaxLogSize)
+                RotateDebugLog();
+        }
+        return nWritten;
+    }
+
+    void ThreadLogWriter(void* parg)
+    {
+        RenameThread("novacoin-log");
+
+        while (true)
+        {
+            bool fStop = fWriterStop;
+            unsigned int nWritten;
+            {
+                boost::mutex::scoped_lock lock(LogMutex());
+                nWritten = Drain();
+            }
+            if (nWritten == 0)
+            {
+                if (fStop)
+                    break;
+                Sleep(20);
+            }
+        }
+        fWriterRunning = false;
+    }
+}
+
+bool CLogRateLimit::Allow(unsigned int nPerMinute)
+{
+    static boost::mutex* pmutex = new boost::mutex();
+
+    int64_t nNow = GetTime();
+    unsigned int nSuppressedWindow = 0;
+    bool fAllow;
+    {
+        boost::mutex::scoped_lock lock(*pmutex);
+        if (nNow - nWindowStart >= 60)
+        {
+            nSuppressedWindow = nSuppressed;
+            nWindowStart = nNow;
+            nCount = 0;
+            nSuppressed = 0;
+        }
+        fAllow = nCount < nPerMinute;
+        if (fAllow)
+            nCount++;
+        else
+            nSuppressed++;
+    }
+    if (nSuppressedWindow)
+        OutputDebugStringF("(%u similar messages suppressed)\n", nSuppressedWindow);
+    return fAllow;
+}
+
+bool SetLogCategories(const vector<string>& vCategories, string& strUnknown)
+{
+    unsigned int nCategories = LOG_NONE;
+    BOOST_FOREACH(string strCategory, vCategories)
+    {
+        boost::to_lower(strCategory);
+        if (strCategory.empty() || strCategory == "1" || strCategory == "all")
+        {
+            nCategories = LOG_ALL;
+            continue;
+        }
+        if (strCategory == "0")
+            continue;
+
+        bool fFound = false;
+        for (unsigned int i = 0; i < ARRAYLEN(categoryNames); i++)
+        {
+            if (strCategory == categoryNames[i].pszName)
+            {
+                nCategories |= categoryNames[i].nCategory;
+                fFound = true;
+            }
+        }
+        if (!fFound)
+        {
+            strUnknown = strCategory;
+            return false;
+        }
+    }
+    nLogCategories = nCategories;
+    return true;
+}
+
+string LogCategoriesHelp()
+{
+    string strRet;
+    for (unsigned int i = 0; i < ARRAYLEN(categoryNames); i++)
+    {
+        if (i)
+            strRet += ", ";
+        strRet += categoryNames[i].pszName;
+    }
+    return strRet;
+}
+
+void LogWrite(const char* pch, unsigned int nLen)
+{
+    int64_t nTime = GetTime();
+    while (fWriterRunning)
+    {
+        if (Enqueue(pch, nLen, nTime))
+            return;
+        // Full, wait for the writer to catch up
+        Sleep(1);
+    }
+
+    // No writer thread, write out what was left in the queue and this line
+    boost::mutex::scoped_lock lock(LogMutex());
+    Drain();
+    if (fileout)
+    {
+        WriteToFile(pch, nLen, nTime);
+        fflush(fileout);
+    }
+}
+
+void SetLogRotation(int64_t nMaxSize, int nFiles)
+{
+    boost::mutex::scoped_lock lock(LogMutex());
+    nMaxLogSize = nMaxSize;
+    nLogFiles = std::max(nFiles, 0);
+
+    // Rotate right away if the log already is too large, this replaces
+    // shrinking it on startup
+    if (!fileout)
+        OpenDebugLog();
+    if (fileout && nMaxLogSize > 0)
+    {
+        fseek(fileout, 0, SEEK_END);
+        if (ftell(fileout) > nMaxLogSize)
+            RotateDebugLog();
+    }
+}
+
+void StartLogWriter()
+{
+    if (fWriterRunning)
+        return;
+    fWriterStop = false;
+    fWriterRunning = true;
+    if (!NewThread(ThreadLogWriter, NULL))
+        fWriterRunning = false;
+}
+
+void StopLogWriter()
+{
+    if (!fWriterRunning)
+        return;
+    fWriterStop = true;
+    while (fWriterRunning)
+        Sleep(10);
+    LogFlush();
+}
+
+void LogFlush()
+{
+    boost::mutex::scoped_lock lock(LogMutex());
+    Drain();
+}
@@ -0,0 +1,76 @@
+// Copyright (c) 2014 The NovaCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef NOVACOIN_LOGGING_H
+#define NOVACOIN_LOGGING_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+//
+// debug.log backend.
+//
+// Lines are queued in a lock-free ring buffer and written by a background
+// thread, so printf from the message handler or the miner never blocks on
+// file I/O. Before the writer is started and after it is stopped, output is
+// written synchronously.
+//
+
+/** Debug categories, enabled with -debug=<category> */
+enum LogCategory
+{
+    LOG_NONE    = 0,
+    LOG_NET     = (1U << 0),
+    LOG_MEMPOOL = (1U << 1),
+    LOG_BLOCK   = (1U << 2),
+    LOG_STAKE   = (1U << 3),
+    LOG_MINER   = (1U << 4),
+    LOG_RPC     = (1U << 5),
+    LOG_DB      = (1U << 6),
+    LOG_ADDRMAN = (1U << 7),
+    LOG_LOCK    = (1U << 8),
+    LOG_ALL     = ~0U,
+};
+
+extern unsigned int nLogCategories;
+
+inline bool LogAcceptCategory(unsigned int nCategory)
+{
+    return (nLogCategories & nCategory) != 0;
+}
+
+// Arguments are not evaluated when the category is disabled
+#define LogPrint(nCategory, ...) do { if (LogAcceptCategory(nCategory)) OutputDebugStringF(__VA_ARGS__); } while (0)
+
+/** Per call site limit on the number of lines logged per minute */
+struct CLogRateLimit
+{
+    int64_t nWindowStart;
+    unsigned int nCount;
+    unsigned int nSuppressed;
+
+    bool Allow(unsigned int nPerMinute);
+};
+
+// For messages a peer can trigger at will
+#define LogPrintLimited(nPerMinute, ...) do { static CLogRateLimit rateLimit = { 0, 0, 0 }; if (rateLimit.Allow(nPerMinute)) OutputDebugStringF(__VA_ARGS__); } while (0)
+
+// Parse -debug=<category> values, returns false and the offending name if
+// one is unknown
+bool SetLogCategories(const std::vector<std::string>& vCategories, std::string& strUnknown);
+std::string LogCategoriesHelp();
+
+// Queue a formatted message for debug.log
+void LogWrite(const char* pch, unsigned int nLen);
+
+// debug.log is renamed to debug.log.1 (and so on, up to nFiles) when it
+// grows beyond nMaxSize bytes, 0 disables rotation
+void SetLogRotation(int64_t nMaxSize, int nFiles);
+
+void StartLogWriter();
+void StopLogWriter();
+// Write out everything queued so far
+void LogFlush();
+
+#endif
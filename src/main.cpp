@@ -12,6 +12,7 @@
 #include "ui_interface.h"
 #include "checkqueue.h"
 #include "kernel.h"
+#include "txview.h"
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
@@ -31,6 +32,10 @@ CCriticalSection cs_main;
 CTxMemPool mempool;
 unsigned int nTransactionsUpdated = 0;
 
+// Signalled when the best chain changes
+CWaitableCriticalSection csBestBlock;
+boost::condition_variable cvBlockChange;
+
 map<uint256, CBlockIndex*> mapBlockIndex;
 set<pair<COutPoint, unsigned int> > setStakeSeen;
 
@@ -62,8 +67,24 @@ int nScriptCheckThreads = 0;
 
 CMedianFilter<int> cPeerBlockCounts(5, 0); // Amount of blocks that other nodes claim to have
 
-map<uint256, CBlock*> mapOrphanBlocks;
-multimap<uint256, CBlock*> mapOrphanBlocksByPrev;
+/** Block with an unknown parent, kept serialized until the parent arrives */
+struct COrphanBlock
+{
+    uint256 hashBlock;
+    uint256 hashPrev;
+    pair<COutPoint, unsigned int> stake;
+    vector<unsigned char> vchBlock;
+    CNetAddr addrFrom;
+    bool fFromPeer;
+    uint64_t nSequence;
+};
+
+map<uint256, COrphanBlock*> mapOrphanBlocks;
+multimap<uint256, COrphanBlock*> mapOrphanBlocksByPrev;
+static map<uint64_t, COrphanBlock*> mapOrphanBlocksBySequence; // oldest first
+static map<CNetAddr, size_t> mapOrphanBlocksPeerSize;
+static size_t nOrphanBlocksSize = 0;
+static uint64_t nOrphanBlocksSequence = 0;
 set<pair<COutPoint, unsigned int> > setStakeSeenOrphan;
 map<uint256, uint256> mapProofOfStake;
 
@@ -396,7 +417,7 @@ bool CTransaction::AreInputsStandard(const MapPrevTx& mapInputs) const
         // be quick, because if there are any operations
         // beside "push data" in the scriptSig the
         // IsStandard() call returns false
-        vector<vector<unsigned char> > stack;
+        CScriptStack stack;
         if (!EvalScript(stack, vin[i].scriptSig, *this, i, false, 0))
             return false;
 
@@ -676,7 +697,7 @@ bool CTxMemPool::accept(CTxDB& txdb, CTransaction &tx, bool fCheckInputs,
     if (fCheckInputs)
     {
         MapPrevTx mapInputs;
-        map<uint256, CTxIndex> mapUnused;
+        MapTestPool mapUnused;
         bool fInvalid = false;
         if (!tx.FetchInputs(txdb, mapUnused, false, false, mapInputs, fInvalid))
         {
@@ -978,28 +999,116 @@ bool CBlock::ReadFromDisk(const CBlockIndex* pindex, bool fReadTransactions)
         *this = pindex->GetBlockHeader();
         return true;
     }
-    if (!ReadFromDisk(pindex->nFile, pindex->nBlockPos, fReadTransactions))
+    // The header of blocks covered by -assumevalid was checked when received
+    bool fAssumeValid = IsAssumedValid(pindex);
+    if (!ReadFromDisk(pindex->nFile, pindex->nBlockPos, fReadTransactions, !fAssumeValid))
         return false;
+    if (fAssumeValid && IsProofOfWork() && !AssumeValidSkip(AV_READPOW))
+    {
+        int64_t nStart = GetTimeMicros();
+        if (!CheckProofOfWork(GetHash(), nBits))
+            return error("CBlock::ReadFromDisk() : errors in block header");
+        AssumeValidSampled(AV_READPOW, GetTimeMicros() - nStart);
+    }
     if (GetHash() != pindex->GetBlockHash())
         return error("CBlock::ReadFromDisk() : GetHash() doesn't match index");
     return true;
 }
 
-uint256 static GetOrphanRoot(const CBlock* pblock)
+uint256 static GetOrphanRoot(const COrphanBlock* pblock)
 {
     // Work back to the first block in the orphan chain
-    while (mapOrphanBlocks.count(pblock->hashPrevBlock))
-        pblock = mapOrphanBlocks[pblock->hashPrevBlock];
-    return pblock->GetHash();
+    while (mapOrphanBlocks.count(pblock->hashPrev))
+        pblock = mapOrphanBlocks[pblock->hashPrev];
+    return pblock->hashBlock;
 }
 
 // ppcoin: find block wanted by given orphan block
-uint256 WantedByOrphan(const CBlock* pblockOrphan)
+uint256 WantedByOrphan(const COrphanBlock* pblockOrphan)
 {
     // Work back to the first block in the orphan chain
-    while (mapOrphanBlocks.count(pblockOrphan->hashPrevBlock))
-        pblockOrphan = mapOrphanBlocks[pblockOrphan->hashPrevBlock];
-    return pblockOrphan->hashPrevBlock;
+    while (mapOrphanBlocks.count(pblockOrphan->hashPrev))
+        pblockOrphan = mapOrphanBlocks[pblockOrphan->hashPrev];
+    return pblockOrphan->hashPrev;
+}
+
+static size_t GetOrphanBlockSize(const COrphanBlock* pblock)
+{
+    return sizeof(COrphanBlock) + pblock->vchBlock.size();
+}
+
+static COrphanBlock* AddOrphanBlock(const CBlock* pblock, CNode* pfrom)
+{
+    COrphanBlock* pblockOrphan = new COrphanBlock();
+    pblockOrphan->hashBlock = pblock->GetHash();
+    pblockOrphan->hashPrev = pblock->hashPrevBlock;
+    pblockOrphan->stake = pblock->GetProofOfStake();
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << *pblock;
+    pblockOrphan->vchBlock.assign(ss.begin(), ss.end());
+    pblockOrphan->fFromPeer = (pfrom != NULL);
+    if (pfrom)
+        pblockOrphan->addrFrom = pfrom->addr;
+    pblockOrphan->nSequence = nOrphanBlocksSequence++;
+
+    mapOrphanBlocks.insert(make_pair(pblockOrphan->hashBlock, pblockOrphan));
+    mapOrphanBlocksByPrev.insert(make_pair(pblockOrphan->hashPrev, pblockOrphan));
+    mapOrphanBlocksBySequence.insert(make_pair(pblockOrphan->nSequence, pblockOrphan));
+    nOrphanBlocksSize += GetOrphanBlockSize(pblockOrphan);
+    if (pblockOrphan->fFromPeer)
+        mapOrphanBlocksPeerSize[pblockOrphan->addrFrom] += GetOrphanBlockSize(pblockOrphan);
+    return pblockOrphan;
+}
+
+void static EraseOrphanBlock(COrphanBlock* pblockOrphan)
+{
+    for (multimap<uint256, COrphanBlock*>::iterator mi = mapOrphanBlocksByPrev.lower_bound(pblockOrphan->hashPrev);
+         mi != mapOrphanBlocksByPrev.upper_bound(pblockOrphan->hashPrev); ++mi)
+    {
+        if (mi->second == pblockOrphan)
+        {
+            mapOrphanBlocksByPrev.erase(mi);
+            break;
+        }
+    }
+    mapOrphanBlocks.erase(pblockOrphan->hashBlock);
+    mapOrphanBlocksBySequence.erase(pblockOrphan->nSequence);
+    setStakeSeenOrphan.erase(pblockOrphan->stake);
+    nOrphanBlocksSize -= GetOrphanBlockSize(pblockOrphan);
+    if (pblockOrphan->fFromPeer)
+    {
+        map<CNetAddr, size_t>::iterator mi = mapOrphanBlocksPeerSize.find(pblockOrphan->addrFrom);
+        mi->second -= GetOrphanBlockSize(pblockOrphan);
+        if (mi->second == 0)
+            mapOrphanBlocksPeerSize.erase(mi);
+    }
+    delete pblockOrphan;
+}
+
+// Evict the oldest orphans of a peer over its quota, then the oldest of all
+// while the pool is over its size
+unsigned int static LimitOrphanBlocks(const COrphanBlock* pblockNew)
+{
+    size_t nMaxSize = (size_t)GetArg("-maxorphanblocksmb", DEFAULT_MAX_ORPHAN_BLOCKS_MB) << 20;
+    unsigned int nEvicted = 0;
+    if (pblockNew->fFromPeer)
+    {
+        CNetAddr addrFrom = pblockNew->addrFrom;
+        map<uint64_t, COrphanBlock*>::iterator mi = mapOrphanBlocksBySequence.begin();
+        while (mapOrphanBlocksPeerSize.count(addrFrom) && mapOrphanBlocksPeerSize[addrFrom] > nMaxSize / 4)
+        {
+            while (!mi->second->fFromPeer || mi->second->addrFrom != addrFrom)
+                ++mi;
+            EraseOrphanBlock((mi++)->second);
+            nEvicted++;
+        }
+    }
+    while (nOrphanBlocksSize > nMaxSize && !mapOrphanBlocksBySequence.empty())
+    {
+        EraseOrphanBlock(mapOrphanBlocksBySequence.begin()->second);
+        nEvicted++;
+    }
+    return nEvicted;
 }
 
 // select stake target limit according to hard-coded conditions
@@ -1250,6 +1359,135 @@ bool CheckProofOfWork(uint256 hash, unsigned int nBits)
     return true;
 }
 
+//
+// -assumevalid: blocks up to a trusted block were accepted by the network
+// long ago, their signatures and scripts are not verified and they are not
+// checked again after they were received. Every AV_SAMPLE_INTERVAL-th
+// skipped check is done anyway, to estimate the time saved.
+//
+// Only ancestors of the trusted block are skipped, a block on another fork
+// is checked in full whatever its height. The ancestors can't be told apart
+// before the trusted block is in the block index. Until then a trusted
+// hardened checkpoint falls back to the old cut-offs, scripts below its
+// height and block signatures up to its time, as the hardened checkpoints
+// pin that part of the chain. Any other trusted block is verified in full
+// until it arrives.
+//
+static const unsigned int AV_SAMPLE_INTERVAL = 256;
+
+static CCriticalSection cs_assumevalid;
+static uint256 hashAssumeValid = 0;
+static int nAssumeValidHeight = -1;
+static unsigned int nAssumeValidTime = 0;
+static bool fAssumeValidCheckpoint = false; // trusted checkpoint not in the block index yet
+static std::vector<CBlockIndex*> vAssumeValidChain; // trusted block and its ancestors by height
+static CAssumeValidStats assumeValidStats[AV_MAX];
+
+static void SetAssumeValidChain(CBlockIndex* pindex)
+{
+    vAssumeValidChain.assign(pindex->nHeight + 1, (CBlockIndex*)NULL);
+    for (; pindex; pindex = pindex->pprev)
+        vAssumeValidChain[pindex->nHeight] = pindex;
+}
+
+bool SetAssumeValid(const uint256& hashBlock)
+{
+    LOCK2(cs_main, cs_assumevalid);
+    int nHeight = -1;
+    unsigned int nTime = 0;
+    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
+    bool fKnown = hashBlock != 0 && mi != mapBlockIndex.end();
+    if (hashBlock != 0 && !fKnown && !Checkpoints::GetCheckpoint(hashBlock, nHeight, nTime))
+        return false;
+
+    hashAssumeValid = hashBlock;
+    nAssumeValidHeight = fKnown ? mi->second->nHeight : nHeight;
+    nAssumeValidTime = fKnown ? mi->second->nTime : nTime;
+    fAssumeValidCheckpoint = hashBlock != 0 && !fKnown;
+    vAssumeValidChain.clear();
+    if (fKnown)
+        SetAssumeValidChain(mi->second);
+    return true;
+}
+
+uint256 GetAssumeValidHash()
+{
+    LOCK(cs_assumevalid);
+    return hashAssumeValid;
+}
+
+int GetAssumeValidHeight()
+{
+    return nAssumeValidHeight;
+}
+
+bool IsAssumedValid(const CBlockIndex* pindex)
+{
+    LOCK(cs_assumevalid);
+    if (fAssumeValidCheckpoint)
+        return pindex->nHeight < nAssumeValidHeight;
+    return pindex->nHeight < (int)vAssumeValidChain.size() && vAssumeValidChain[pindex->nHeight] == pindex;
+}
+
+bool IsAssumedValid(const uint256& hashBlock, int nHeight, unsigned int nTime)
+{
+    LOCK(cs_assumevalid);
+    if (fAssumeValidCheckpoint)
+        return nTime <= nAssumeValidTime;
+    return nHeight >= 0 && nHeight < (int)vAssumeValidChain.size() && vAssumeValidChain[nHeight]->GetBlockHash() == hashBlock;
+}
+
+bool AssumeValidSkip(AssumeValidCheck check)
+{
+    LOCK(cs_assumevalid);
+    CAssumeValidStats& stats = assumeValidStats[check];
+    if ((stats.nSkipped + stats.nSampled) % AV_SAMPLE_INTERVAL == AV_SAMPLE_INTERVAL - 1)
+        return false;
+    stats.nSkipped++;
+    return true;
+}
+
+void AssumeValidSampled(AssumeValidCheck check, int64_t nMicros)
+{
+    LOCK(cs_assumevalid);
+    assumeValidStats[check].nSampled++;
+    assumeValidStats[check].nSampleMicros += nMicros;
+}
+
+void GetAssumeValidStats(vector<CAssumeValidStats>& vStats)
+{
+    LOCK(cs_assumevalid);
+    vStats.assign(assumeValidStats, assumeValidStats + AV_MAX);
+}
+
+const char* GetAssumeValidCheckName(AssumeValidCheck check)
+{
+    switch (check)
+    {
+    case AV_SCRIPTS:  return "scripts";
+    case AV_BLOCKSIG: return "blocksignature";
+    case AV_STAKESIG: return "coinstakesignature";
+    case AV_RECHECK:  return "blockrecheck";
+    case AV_READPOW:  return "readproofofwork";
+    default:          return "unknown";
+    }
+}
+
+void PrintAssumeValidStats()
+{
+    vector<CAssumeValidStats> vStats;
+    GetAssumeValidStats(vStats);
+    for (int i = 0; i < AV_MAX; i++)
+    {
+        const CAssumeValidStats& stats = vStats[i];
+        if (stats.nSkipped == 0)
+            continue;
+        double dSaved = stats.nSampled ? (double)stats.nSampleMicros / stats.nSampled * stats.nSkipped / 1000000 : 0;
+        printf("assumevalid: %-20s skipped %9" PRIu64 "  sampled %7" PRIu64 "  saved ~%.1fs\n",
+            GetAssumeValidCheckName((AssumeValidCheck)i), stats.nSkipped, stats.nSampled, dSaved);
+    }
+}
+
 // Return maximum amount of blocks that other nodes claim to have
 int GetNumBlocksOfPeers()
 {
@@ -1347,7 +1585,7 @@ bool CTransaction::DisconnectInputs(CTxDB& txdb)
 }
 
 
-bool CTransaction::FetchInputs(CTxDB& txdb, const map<uint256, CTxIndex>& mapTestPool,
+bool CTransaction::FetchInputs(CTxDB& txdb, const MapTestPool& mapTestPool,
                                bool fBlock, bool fMiner, MapPrevTx& inputsRet, bool& fInvalid)
 {
     // FetchInputs can return false either because we just haven't seen some inputs
@@ -1466,7 +1704,7 @@ unsigned int CTransaction::GetP2SHSigOpCount(const MapPrevTx& inputs) const
 
 bool CScriptCheck::operator()() const {
     const CScript &scriptSig = ptxTo->vin[nIn].scriptSig;
-    if (!VerifyScript(scriptSig, scriptPubKey, *ptxTo, nIn, nFlags, nHashType))
+    if (!VerifyScript(scriptSig, scriptPubKey, *ptxTo, nIn, nFlags, nHashType, pSigHashCache.get()))
         return error("CScriptCheck() : %s VerifySignature failed", ptxTo->GetHash().ToString().substr(0,10).c_str());
     return true;
 }
@@ -1476,8 +1714,8 @@ bool VerifySignature(const CTransaction& txFrom, const CTransaction& txTo, unsig
     return CScriptCheck(txFrom, txTo, nIn, flags, nHashType)();
 }
 
-bool CTransaction::ConnectInputs(CTxDB& txdb, MapPrevTx inputs, map<uint256, CTxIndex>& mapTestPool, const CDiskTxPos& posThisTx,
-    const CBlockIndex* pindexBlock, bool fBlock, bool fMiner, bool fScriptChecks, unsigned int flags, std::vector<CScriptCheck> *pvChecks)
+bool CTransaction::ConnectInputs(CTxDB& txdb, MapPrevTx inputs, MapTestPool& mapTestPool, const CDiskTxPos& posThisTx,
+    const CBlockIndex* pindexBlock, bool fBlock, bool fMiner, bool fScriptChecks, unsigned int flags, ScriptCheckVector *pvChecks)
 {
     // Take over previous transactions' spent pointers
     // fBlock is true when this is called from AcceptBlock when a new best-block is added to the blockchain
@@ -1518,6 +1756,11 @@ bool CTransaction::ConnectInputs(CTxDB& txdb, MapPrevTx inputs, map<uint256, CTx
         if (pvChecks)
             pvChecks->reserve(vin.size());
 
+        // Serialize this transaction for signature hashing only once
+        boost::shared_ptr<const CSigHashCache> pSigHashCache;
+        if (fScriptChecks && vin.size() > 1)
+            pSigHashCache.reset(new CSigHashCache(*this));
+
         // The first loop above does all the inexpensive checks.
         // Only if ALL inputs pass do we perform expensive ECDSA signature checks.
         // Helps prevent CPU exhaustion attacks.
@@ -1540,7 +1783,7 @@ bool CTransaction::ConnectInputs(CTxDB& txdb, MapPrevTx inputs, map<uint256, CTx
             if (fScriptChecks)
             {
                 // Verify signature
-                CScriptCheck check(txPrev, *this, i, flags, 0);
+                CScriptCheck check(txPrev, *this, i, flags, 0, pSigHashCache);
                 if (pvChecks)
                 {
                     pvChecks->push_back(CScriptCheck());
@@ -1551,7 +1794,7 @@ bool CTransaction::ConnectInputs(CTxDB& txdb, MapPrevTx inputs, map<uint256, CTx
                     if (flags & STRICT_FLAGS)
                     {
                         // Don't trigger DoS code in case of STRICT_FLAGS caused failure.
-                        CScriptCheck check(txPrev, *this, i, flags & ~STRICT_FLAGS, 0);
+                        CScriptCheck check(txPrev, *this, i, flags & ~STRICT_FLAGS, 0, pSigHashCache);
                         if (check())
                             return error("ConnectInputs() : %s strict VerifySignature failed", GetHash().ToString().substr(0,10).c_str());
                     }
@@ -1690,11 +1933,19 @@ void ThreadScriptCheckQuit() {
     scriptcheckqueue.Quit();
 }
 
-bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex, bool fJustCheck)
+bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex, bool fJustCheck, bool fCheckAll)
 {
-    // Check it again in case a previous version let a bad block in, but skip BlockSig checking
-    if (!CheckBlock(!fJustCheck, !fJustCheck, false))
-        return false;
+    // Check it again in case a previous version let a bad block in, but skip BlockSig checking.
+    // Blocks covered by -assumevalid are trusted to be checked already, unless fCheckAll.
+    bool fAssumeValid = !fCheckAll && IsAssumedValid(pindex);
+    if (!fAssumeValid || !AssumeValidSkip(AV_RECHECK))
+    {
+        int64_t nStart = GetTimeMicros();
+        if (!CheckBlock(!fJustCheck, !fJustCheck, false))
+            return false;
+        if (fAssumeValid)
+            AssumeValidSampled(AV_RECHECK, GetTimeMicros() - nStart);
+    }
 
     // Do not allow blocks that contain transactions which 'overwrite' older transactions,
     // unless those are already completely spent.
@@ -1709,7 +1960,9 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex, bool fJustCheck)
     // two in the chain that violate it. This prevents exploiting the issue against nodes in their
     // initial block download.
     bool fEnforceBIP30 = true; // Always active in NovaCoin
-    bool fScriptChecks = pindex->nHeight >= Checkpoints::GetTotalBlocksEstimate();
+    bool fScriptChecks = !fAssumeValid;
+    bool fSampleScripts = fAssumeValid && !AssumeValidSkip(AV_SCRIPTS);
+    int64_t nScriptMicros = 0;
 
     //// issue here: it doesn't know the version
     unsigned int nTxPos;
@@ -1718,10 +1971,14 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex, bool fJustCheck)
         // Since we're just checking the block and not actually connecting it, it might not (and probably shouldn't) be on the disk to get the transaction from
         nTxPos = 1;
     else
-        nTxPos = pindex->nBlockPos + ::GetSerializeSize(CBlock(), SER_DISK, CLIENT_VERSION) - (2 * GetSizeOfCompactSize(0)) + GetSizeOfCompactSize(vtx.size());
+        nTxPos = GetTxPos(pindex->nBlockPos);
 
-    map<uint256, CTxIndex> mapQueuedChanges;
+    // Validation temporaries of this block are allocated from one arena and
+    // released together, it has to outlive the containers and the checks
+    CArena arena;
+    MapTestPool mapQueuedChanges((MapTestPool::key_compare()), MapTestPool::allocator_type(&arena));
     CCheckQueueControl<CScriptCheck> control(fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : NULL);
+    ScriptCheckVector vChecks((ScriptCheckVector::allocator_type(&arena)));
 
     int64_t nFees = 0;
     int64_t nValueIn = 0;
@@ -1748,7 +2005,7 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex, bool fJustCheck)
         if (!fJustCheck)
             nTxPos += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
 
-        MapPrevTx mapInputs;
+        MapPrevTx mapInputs((MapPrevTx::key_compare()), MapPrevTx::allocator_type(&arena));
         if (tx.IsCoinBase())
             nValueOut += tx.GetValueOut();
         else
@@ -1771,10 +2028,21 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex, bool fJustCheck)
             if (!tx.IsCoinStake())
                 nFees += nTxValueIn - nTxValueOut;
 
-            std::vector<CScriptCheck> vChecks;
-            if (!tx.ConnectInputs(txdb, mapInputs, mapQueuedChanges, posThisTx, pindex, true, false, fScriptChecks, SCRIPT_VERIFY_NOCACHE | SCRIPT_VERIFY_P2SH, nScriptCheckThreads ? &vChecks : NULL))
+            // The checks are moved to the queue, so the vector is reused
+            vChecks.clear();
+            if (!tx.ConnectInputs(txdb, mapInputs, mapQueuedChanges, posThisTx, pindex, true, false, fScriptChecks || fSampleScripts, SCRIPT_VERIFY_NOCACHE | SCRIPT_VERIFY_P2SH, (nScriptCheckThreads || fSampleScripts) ? &vChecks : NULL))
                 return false;
-            control.Add(vChecks);
+            if (fSampleScripts)
+            {
+                // Sampled scripts of an assumed valid block run here, to be timed
+                int64_t nStart = GetTimeMicros();
+                BOOST_FOREACH(const CScriptCheck& check, vChecks)
+                    if (!check())
+                        return DoS(100, error("ConnectBlock() : script check failed on assumed valid block"));
+                nScriptMicros += GetTimeMicros() - nStart;
+            }
+            else
+                control.Add(vChecks);
         }
 
         mapQueuedChanges[hashTx] = CTxIndex(posThisTx, tx.vout.size());
@@ -1782,6 +2050,10 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex, bool fJustCheck)
 
     if (!control.Wait())
         return DoS(100, false);
+    if (fSampleScripts)
+        AssumeValidSampled(AV_SCRIPTS, nScriptMicros);
+
+    LogPrint(LOG_BLOCK, "ConnectBlock() : arena peak %" PRIszu " bytes in %" PRIszu " chunks for %" PRIszu " transactions\n", arena.GetUsed(), arena.GetChunks(), vtx.size());
 
     if (IsProofOfWork())
     {
@@ -1809,7 +2081,7 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex, bool fJustCheck)
         return true;
 
     // Write queued txindex changes
-    for (map<uint256, CTxIndex>::iterator mi = mapQueuedChanges.begin(); mi != mapQueuedChanges.end(); ++mi)
+    for (MapTestPool::iterator mi = mapQueuedChanges.begin(); mi != mapQueuedChanges.end(); ++mi)
     {
         if (!txdb.UpdateTxIndex((*mi).first, (*mi).second))
             return error("ConnectBlock() : UpdateTxIndex failed");
@@ -2033,10 +2305,19 @@ bool CBlock::SetBestChain(CTxDB& txdb, CBlockIndex* pindexNew)
     pindexBest = pindexNew;
     pblockindexFBBHLast = NULL;
     nBestHeight = pindexBest->nHeight;
+    UpdateStakeModifierIndex();
     nBestChainTrust = pindexNew->nChainTrust;
     nTimeBestReceived = GetTime();
     nTransactionsUpdated++;
 
+    if (nBestHeight == GetAssumeValidHeight())
+        PrintAssumeValidStats();
+
+    {
+        boost::lock_guard<CWaitableCriticalSection> lock(csBestBlock);
+        cvBlockChange.notify_all();
+    }
+
     uint256 nBestBlockTrust = pindexBest->nHeight != 0 ? (pindexBest->nChainTrust - pindexBest->pprev->nChainTrust) : pindexBest->nChainTrust;
 
     printf("SetBestChain: new best=%s  height=%d  trust=%s  blocktrust=%" PRId64 "  date=%s\n",
@@ -2192,6 +2473,16 @@ bool CBlock::AddToBlockIndex(unsigned int nFile, unsigned int nBlockPos)
         setStakeSeen.insert(make_pair(pindexNew->prevoutStake, pindexNew->nStakeTime));
     pindexNew->phashBlock = &((*mi).first);
 
+    // The ancestors of the trusted block are known once it arrives
+    {
+        LOCK(cs_assumevalid);
+        if (hash == hashAssumeValid)
+        {
+            SetAssumeValidChain(pindexNew);
+            fAssumeValidCheckpoint = false;
+        }
+    }
+
     // Write to disk block index
     CTxDB txdb;
     if (!txdb.TxnBegin())
@@ -2333,18 +2624,10 @@ bool CBlock::CheckBlock(bool fCheckPOW, bool fCheckMerkleRoot, bool fCheckSig) c
     return true;
 }
 
-bool CBlock::AcceptBlock()
+// Checks against the previous block, done before the block is stored
+bool CBlock::CheckContext(const CBlockIndex* pindexPrev)
 {
-    // Check for duplicate
     uint256 hash = GetHash();
-    if (mapBlockIndex.count(hash))
-        return error("AcceptBlock() : block already in mapBlockIndex");
-
-    // Get prev block index
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashPrevBlock);
-    if (mi == mapBlockIndex.end())
-        return DoS(10, error("AcceptBlock() : prev block not found"));
-    CBlockIndex* pindexPrev = (*mi).second;
     int nHeight = pindexPrev->nHeight+1;
 
     // Check proof-of-work or proof-of-stake
@@ -2364,6 +2647,31 @@ bool CBlock::AcceptBlock()
     if (!Checkpoints::CheckHardened(nHeight, hash))
         return DoS(100, error("AcceptBlock() : rejected by hardened checkpoint lock-in at %d", nHeight));
 
+    // Enforce rule that the coinbase starts with serialized block height
+    CScript expect = CScript() << nHeight;
+    if (vtx[0].vin[0].scriptSig.size() < expect.size() ||
+        !std::equal(expect.begin(), expect.end(), vtx[0].vin[0].scriptSig.begin()))
+        return DoS(100, error("AcceptBlock() : block height mismatch in coinbase"));
+
+    return true;
+}
+
+bool CBlock::AcceptBlock()
+{
+    // Check for duplicate
+    uint256 hash = GetHash();
+    if (mapBlockIndex.count(hash))
+        return error("AcceptBlock() : block already in mapBlockIndex");
+
+    // Get prev block index
+    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashPrevBlock);
+    if (mi == mapBlockIndex.end())
+        return DoS(10, error("AcceptBlock() : prev block not found"));
+    CBlockIndex* pindexPrev = (*mi).second;
+
+    if (!CheckContext(pindexPrev))
+        return false;
+
     bool cpSatisfies = Checkpoints::CheckSync(hash, pindexPrev);
 
     // Check that the block satisfies synchronized checkpoint
@@ -2373,12 +2681,6 @@ bool CBlock::AcceptBlock()
     if (CheckpointsMode == Checkpoints::ADVISORY && !cpSatisfies)
         strMiscWarning = _("WARNING: syncronized checkpoint violation detected, but skipped!");
 
-    // Enforce rule that the coinbase starts with serialized block height
-    CScript expect = CScript() << nHeight;
-    if (vtx[0].vin[0].scriptSig.size() < expect.size() ||
-        !std::equal(expect.begin(), expect.end(), vtx[0].vin[0].scriptSig.begin()))
-        return DoS(100, error("AcceptBlock() : block height mismatch in coinbase"));
-
     // Write block to history file
     if (!CheckDiskSpace(::GetSerializeSize(*this, SER_DISK, CLIENT_VERSION)))
         return error("AcceptBlock() : out of disk space");
@@ -2541,15 +2843,29 @@ bool ProcessBlock(CNode* pfrom, CBlock* pblock)
             printf("WARNING: ProcessBlock() : ReserealizeBlockSignature FAILED\n");
     }
 
+    // Signatures of blocks covered by -assumevalid are not checked. The height
+    // of an orphan is not known yet, it is only skipped by time.
+    map<uint256, CBlockIndex*>::iterator miPrev = mapBlockIndex.find(pblock->hashPrevBlock);
+    int nHeight = miPrev != mapBlockIndex.end() ? miPrev->second->nHeight + 1 : -1;
+    bool fAssumeValid = IsAssumedValid(hash, nHeight, pblock->nTime);
+
     // Preliminary checks
-    if (!pblock->CheckBlock(true, true, (pblock->nTime > Checkpoints::GetLastCheckpointTime())))
+    if (!pblock->CheckBlock(true, true, !fAssumeValid))
         return error("ProcessBlock() : CheckBlock FAILED");
 
+    if (fAssumeValid && pblock->IsProofOfStake() && !AssumeValidSkip(AV_BLOCKSIG))
+    {
+        int64_t nStart = GetTimeMicros();
+        if (!pblock->CheckBlockSignature())
+            return pblock->DoS(100, error("ProcessBlock() : bad proof-of-stake block signature"));
+        AssumeValidSampled(AV_BLOCKSIG, GetTimeMicros() - nStart);
+    }
+
     // ppcoin: verify hash target and signature of coinstake tx
     if (pblock->IsProofOfStake())
     {
         uint256 hashProofOfStake = 0, targetProofOfStake = 0;
-        if (!CheckProofOfStake(pblock->vtx[1], pblock->nBits, hashProofOfStake, targetProofOfStake))
+        if (!CheckProofOfStake(pblock->vtx[1], pblock->nBits, hashProofOfStake, targetProofOfStake, fAssumeValid))
         {
             printf("WARNING: ProcessBlock(): check proof-of-stake failed for block %s\n", hash.ToString().c_str());
             return false; // do not error here as we expect this during initial block download
@@ -2598,18 +2914,20 @@ bool ProcessBlock(CNode* pfrom, CBlock* pblock)
             else
                 setStakeSeenOrphan.insert(pblock->GetProofOfStake());
         }
-        CBlock* pblock2 = new CBlock(*pblock);
-        mapOrphanBlocks.insert(make_pair(hash, pblock2));
-        mapOrphanBlocksByPrev.insert(make_pair(pblock2->hashPrevBlock, pblock2));
+        COrphanBlock* pblock2 = AddOrphanBlock(pblock, pfrom);
+        unsigned int nEvicted = LimitOrphanBlocks(pblock2);
+        if (nEvicted > 0)
+            printf("ProcessBlock: evicted %u orphan blocks (%" PRIszu " left, %" PRIszu " bytes)\n", nEvicted, mapOrphanBlocks.size(), nOrphanBlocksSize);
+        if (!mapOrphanBlocks.count(hash))
+            return true;
 
         // Ask this guy to fill in what we're missing
         if (pfrom)
         {
             pfrom->PushGetBlocks(pindexBest, GetOrphanRoot(pblock2));
-            // ppcoin: getblocks may not obtain the ancestor block rejected
-            // earlier by duplicate-stake check so we ask for it again directly
-            if (!IsInitialBlockDownload())
-                pfrom->AskFor(CInv(MSG_BLOCK, WantedByOrphan(pblock2)));
+            // Request the missing parent by hash as well, getblocks may not
+            // obtain an ancestor rejected earlier by the duplicate-stake check
+            pfrom->AskFor(CInv(MSG_BLOCK, WantedByOrphan(pblock2)));
         }
         return true;
     }
@@ -2624,18 +2942,21 @@ bool ProcessBlock(CNode* pfrom, CBlock* pblock)
     for (unsigned int i = 0; i < vWorkQueue.size(); i++)
     {
         uint256 hashPrev = vWorkQueue[i];
-        for (multimap<uint256, CBlock*>::iterator mi = mapOrphanBlocksByPrev.lower_bound(hashPrev);
+        vector<COrphanBlock*> vOrphans;
+        for (multimap<uint256, COrphanBlock*>::iterator mi = mapOrphanBlocksByPrev.lower_bound(hashPrev);
              mi != mapOrphanBlocksByPrev.upper_bound(hashPrev);
              ++mi)
+            vOrphans.push_back((*mi).second);
+
+        BOOST_FOREACH(COrphanBlock* pblockOrphan, vOrphans)
         {
-            CBlock* pblockOrphan = (*mi).second;
-            if (pblockOrphan->AcceptBlock())
-                vWorkQueue.push_back(pblockOrphan->GetHash());
-            mapOrphanBlocks.erase(pblockOrphan->GetHash());
-            setStakeSeenOrphan.erase(pblockOrphan->GetProofOfStake());
-            delete pblockOrphan;
+            CBlock block;
+            CDataStream ss(pblockOrphan->vchBlock, SER_DISK, CLIENT_VERSION);
+            ss >> block;
+            if (block.AcceptBlock())
+                vWorkQueue.push_back(pblockOrphan->hashBlock);
+            EraseOrphanBlock(pblockOrphan);
         }
-        mapOrphanBlocksByPrev.erase(hashPrev);
     }
 
     printf("ProcessBlock: ACCEPTED\n");
@@ -2660,11 +2981,8 @@ bool CBlock::CheckBlockSignature() const
 
     if (whichType == TX_PUBKEY)
     {
-        valtype& vchPubKey = vSolutions[0];
-        CKey key;
-        if (!key.SetPubKey(vchPubKey))
-            return false;
-        return key.Verify(GetHash(), vchBlockSig);
+        const CPubKey pubkey(vSolutions[0]);
+        return pubkey.Verify(GetHash(), vchBlockSig);
     }
 
     return false;
@@ -2953,63 +3271,292 @@ void PrintBlockTree()
     }
 }
 
+// External block files are imported by a pipeline: a reader thread cuts
+// the file into raw blocks with large sequential reads, worker threads
+// deserialize them and compute the scrypt header hash, which the block
+// caches, and the calling thread hands them to ProcessBlock in file order,
+// taking cs_main for each block only.
+static const unsigned int IMPORT_BUFFER_SIZE = 16 << 20;   // has to hold a block of MAX_BLOCK_SIZE
+static const unsigned int IMPORT_MAX_PENDING = 1000;       // blocks read but not yet connected
+
+class CBlockImport
+{
+public:
+    FILE* file;
+    boost::mutex mutex;
+    boost::condition_variable condRaw;     // raw blocks queued or reading done
+    boost::condition_variable condParsed;  // block parsed
+    boost::condition_variable condSpace;   // block connected
+    std::deque<std::pair<unsigned int, std::vector<char>*> > queueRaw;
+    std::map<unsigned int, CBlock*> mapParsed; // NULL if the block didn't deserialize
+    unsigned int nRead;        // blocks cut from the file
+    unsigned int nConnected;
+    bool fReadDone;
+    bool fStop;
+    int nThreadsRunning;
+
+    // Statistics
+    uint64_t nBytesRead;
+    int64_t nReadMicros;
+    int64_t nParseMicros;
+    int64_t nConnectMicros;
+    int64_t nConnectWaitMicros;
+
+    CBlockImport(FILE* fileIn) : file(fileIn), nRead(0), nConnected(0), fReadDone(false), fStop(false), nThreadsRunning(0),
+        nBytesRead(0), nReadMicros(0), nParseMicros(0), nConnectMicros(0), nConnectWaitMicros(0)
+    {
+    }
+
+    ~CBlockImport()
+    {
+        for (unsigned int i = 0; i < queueRaw.size(); i++)
+            delete queueRaw[i].second;
+        for (std::map<unsigned int, CBlock*>::iterator mi = mapParsed.begin(); mi != mapParsed.end(); ++mi)
+            delete mi->second;
+    }
+
+    void Stop()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fStop = true;
+        condRaw.notify_all();
+        condSpace.notify_all();
+    }
+
+    bool Push(std::vector<char>* pvData)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (nRead - nConnected >= IMPORT_MAX_PENDING && !fStop)
+            condSpace.wait(lock);
+        if (fStop)
+        {
+            delete pvData;
+            return false;
+        }
+        queueRaw.push_back(std::make_pair(nRead++, pvData));
+        condRaw.notify_one();
+        return true;
+    }
+};
+
+static void ReadExternalBlockFile(CBlockImport& import)
+{
+    std::vector<char> vBuf(IMPORT_BUFFER_SIZE);
+    unsigned int nBegin = 0, nEnd = 0;
+    bool fEof = false;
+    while (!import.fStop)
+    {
+        // Refill once the rest of the buffer may not hold a whole block
+        if (!fEof && nEnd - nBegin < MAX_BLOCK_SIZE + 8)
+        {
+            memmove(&vBuf[0], &vBuf[nBegin], nEnd - nBegin);
+            nEnd -= nBegin;
+            nBegin = 0;
+            int64_t nStart = GetTimeMicros();
+            size_t nWant = vBuf.size() - nEnd;
+            size_t nGot = fread(&vBuf[nEnd], 1, nWant, import.file);
+            import.nReadMicros += GetTimeMicros() - nStart;
+            import.nBytesRead += nGot;
+            nEnd += nGot;
+            if (nGot < nWant)
+                fEof = true;
+        }
+
+        char* pBegin = &vBuf[0] + nBegin;
+        char* pEnd = &vBuf[0] + nEnd;
+        char* pFind = std::search(pBegin, pEnd, (char*)pchMessageStart, (char*)pchMessageStart + sizeof(pchMessageStart));
+        if (pFind == pEnd)
+        {
+            if (fEof)
+                break;
+            // A partial message start may be at the end
+            nBegin = std::max(nBegin, nEnd - (unsigned int)std::min(nEnd, (unsigned int)sizeof(pchMessageStart) - 1));
+            continue;
+        }
+        nBegin = pFind - &vBuf[0];
+        if (nEnd - nBegin < sizeof(pchMessageStart) + 4)
+        {
+            if (fEof)
+                break;
+            continue;
+        }
+
+        unsigned int nSize;
+        memcpy(&nSize, &vBuf[nBegin + sizeof(pchMessageStart)], sizeof(nSize));
+        if (nSize == 0 || nSize > MAX_BLOCK_SIZE)
+        {
+            nBegin++;
+            continue;
+        }
+        if (nEnd - nBegin < sizeof(pchMessageStart) + 4 + nSize)
+        {
+            if (fEof)
+                break;
+            continue;
+        }
+
+        unsigned int nData = nBegin + sizeof(pchMessageStart) + 4;
+        std::vector<char>* pvData = new std::vector<char>(vBuf.begin() + nData, vBuf.begin() + nData + nSize);
+        nBegin = nData + nSize;
+        if (!import.Push(pvData))
+            break;
+    }
+}
+
+static void ThreadImportReader(void* parg)
+{
+    RenameThread("novacoin-importread");
+    CBlockImport& import = *(CBlockImport*)parg;
+    try {
+        ReadExternalBlockFile(import);
+    }
+    catch (std::exception& e) {
+        PrintException(&e, "ThreadImportReader()");
+    }
+
+    boost::unique_lock<boost::mutex> lock(import.mutex);
+    import.fReadDone = true;
+    import.nThreadsRunning--;
+    import.condRaw.notify_all();
+    import.condParsed.notify_all();
+}
+
+static void ThreadImportWorker(void* parg)
+{
+    RenameThread("novacoin-importparse");
+    CBlockImport& import = *(CBlockImport*)parg;
+    while (true)
+    {
+        std::pair<unsigned int, std::vector<char>*> item;
+        {
+            boost::unique_lock<boost::mutex> lock(import.mutex);
+            while (import.queueRaw.empty() && !import.fReadDone && !import.fStop)
+                import.condRaw.wait(lock);
+            if (import.queueRaw.empty() || import.fStop)
+                break;
+            item = import.queueRaw.front();
+            import.queueRaw.pop_front();
+        }
+
+        int64_t nStart = GetTimeMicros();
+        CBlock* pblock = new CBlock();
+        try {
+            CDataStream ss(item.second->begin(), item.second->end(), SER_DISK, CLIENT_VERSION);
+            ss >> *pblock;
+            pblock->GetHash();
+        }
+        catch (std::exception& e) {
+            (void)e;
+            delete pblock;
+            pblock = NULL;
+        }
+        delete item.second;
+
+        boost::unique_lock<boost::mutex> lock(import.mutex);
+        import.nParseMicros += GetTimeMicros() - nStart;
+        import.mapParsed[item.first] = pblock;
+        import.condParsed.notify_all();
+    }
+
+    boost::unique_lock<boost::mutex> lock(import.mutex);
+    import.nThreadsRunning--;
+    import.condParsed.notify_all();
+}
+
 bool LoadExternalBlockFile(FILE* fileIn)
 {
     int64_t nStart = GetTimeMillis();
+    int nThreads = std::max((int)boost::thread::hardware_concurrency() - 1, 1);
 
     int nLoaded = 0;
+    int nBad = 0;
+    CBlockImport import(fileIn);
     {
-        LOCK(cs_main);
-        try {
-            CAutoFile blkdat(fileIn, SER_DISK, CLIENT_VERSION);
-            unsigned int nPos = 0;
-            while (nPos != (unsigned int)-1 && blkdat.good() && !fRequestShutdown)
+        boost::unique_lock<boost::mutex> lock(import.mutex);
+        for (int i = 0; i < nThreads; i++)
+        {
+            import.nThreadsRunning++;
+            if (!NewThread(ThreadImportWorker, &import))
+                import.nThreadsRunning--;
+        }
+        bool fReader = false;
+        if (import.nThreadsRunning > 0)
+        {
+            import.nThreadsRunning++;
+            fReader = NewThread(ThreadImportReader, &import);
+            if (!fReader)
+                import.nThreadsRunning--;
+        }
+        if (!fReader)
+        {
+            // Nothing is read, the workers exit and no block is connected
+            printf("LoadExternalBlockFile() : unable to start import threads\n");
+            import.fReadDone = true;
+            import.condRaw.notify_all();
+        }
+    }
+
+    // Connect in file order
+    while (true)
+    {
+        CBlock* pblock = NULL;
+        {
+            int64_t nWaitStart = GetTimeMicros();
+            boost::unique_lock<boost::mutex> lock(import.mutex);
+            std::map<unsigned int, CBlock*>::iterator mi;
+            while ((mi = import.mapParsed.find(import.nConnected)) == import.mapParsed.end())
             {
-                unsigned char pchData[65536];
-                do {
-                    fseek(blkdat, nPos, SEEK_SET);
-                    int nRead = fread(pchData, 1, sizeof(pchData), blkdat);
-                    if (nRead <= 8)
-                    {
-                        nPos = (unsigned int)-1;
-                        break;
-                    }
-                    void* nFind = memchr(pchData, pchMessageStart[0], nRead+1-sizeof(pchMessageStart));
-                    if (nFind)
-                    {
-                        if (memcmp(nFind, pchMessageStart, sizeof(pchMessageStart))==0)
-                        {
-                            nPos += ((unsigned char*)nFind - pchData) + sizeof(pchMessageStart);
-                            break;
-                        }
-                        nPos += ((unsigned char*)nFind - pchData) + 1;
-                    }
-                    else
-                        nPos += sizeof(pchData) - sizeof(pchMessageStart) + 1;
-                } while(!fRequestShutdown);
-                if (nPos == (unsigned int)-1)
+                // Done, or no thread left to parse the block
+                if ((import.fReadDone && import.nConnected >= import.nRead) || import.nThreadsRunning == 0)
                     break;
-                fseek(blkdat, nPos, SEEK_SET);
-                unsigned int nSize;
-                blkdat >> nSize;
-                if (nSize > 0 && nSize <= MAX_BLOCK_SIZE)
-                {
-                    CBlock block;
-                    blkdat >> block;
-                    if (ProcessBlock(NULL,&block))
-                    {
-                        nLoaded++;
-                        nPos += 4 + nSize;
-                    }
-                }
+                import.condParsed.wait(lock);
             }
+            if (mi == import.mapParsed.end())
+                break;
+            pblock = mi->second;
+            import.mapParsed.erase(mi);
+            import.nConnectWaitMicros += GetTimeMicros() - nWaitStart;
         }
-        catch (const std::exception&) {
-            printf("%s() : Deserialize or I/O error caught during load\n",
-                   BOOST_CURRENT_FUNCTION);
+
+        if (pblock)
+        {
+            int64_t nConnectStart = GetTimeMicros();
+            {
+                LOCK(cs_main);
+                if (ProcessBlock(NULL, pblock))
+                    nLoaded++;
+            }
+            import.nConnectMicros += GetTimeMicros() - nConnectStart;
+            delete pblock;
         }
+        else
+            nBad++;
+
+        {
+            boost::unique_lock<boost::mutex> lock(import.mutex);
+            import.nConnected++;
+            import.condSpace.notify_one();
+        }
+
+        if (fRequestShutdown)
+            break;
+        if (import.nConnected % 10000 == 0)
+            printf("LoadExternalBlockFile() : %u blocks, %" PRIu64 " MB read\n", import.nConnected, import.nBytesRead >> 20);
+    }
+
+    import.Stop();
+    {
+        boost::unique_lock<boost::mutex> lock(import.mutex);
+        while (import.nThreadsRunning > 0)
+            import.condParsed.wait(lock);
     }
-    printf("Loaded %i blocks from external file in %" PRId64 "ms\n", nLoaded, GetTimeMillis() - nStart);
+    fclose(fileIn);
+
+    int64_t nElapsed = std::max(GetTimeMillis() - nStart, (int64_t)1);
+    printf("Loaded %i blocks from external file in %" PRId64 "ms\n", nLoaded, nElapsed);
+    printf("LoadExternalBlockFile() : %.1f MB/s, %.0f blocks/s, %d undecodable; read %" PRId64 "ms, parse and hash %" PRId64 "ms on %d threads, connect %" PRId64 "ms, connect waited %" PRId64 "ms\n",
+        (double)import.nBytesRead / 1048576 * 1000 / nElapsed, (double)import.nConnected * 1000 / nElapsed, nBad,
+        import.nReadMicros / 1000, import.nParseMicros / 1000, nThreads, import.nConnectMicros / 1000, import.nConnectWaitMicros / 1000);
     return nLoaded > 0;
 }
 
@@ -3125,8 +3672,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
 {
     static map<CService, CPubKey> mapReuseKey;
     RandAddSeedPerfmon();
-    if (fDebug)
-        printf("received: %s (%" PRIszu " bytes)\n", strCommand.c_str(), vRecv.size());
+    LogPrint(LOG_NET, "received: %s (%" PRIszu " bytes)\n", strCommand.c_str(), vRecv.size());
     if (mapArgs.count("-dropmessagestest") && GetRand(atoi(mapArgs["-dropmessagestest"])) == 0)
     {
         printf("dropmessagestest DROPPING RECV MESSAGE\n");
@@ -3373,8 +3919,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
             pfrom->AddInventoryKnown(inv);
 
             bool fAlreadyHave = AlreadyHave(txdb, inv);
-            if (fDebug)
-                printf("  got inventory: %s  %s\n", inv.ToString().c_str(), fAlreadyHave ? "have" : "new");
+            LogPrint(LOG_NET, "  got inventory: %s  %s\n", inv.ToString().c_str(), fAlreadyHave ? "have" : "new");
 
             if (!fAlreadyHave)
                 pfrom->AskFor(inv);
@@ -3385,8 +3930,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
                 // the last block in an inv bundle sent in response to getblocks. Try to detect
                 // this situation and push another getblocks to continue.
                 pfrom->PushGetBlocks(mapBlockIndex[inv.hash], uint256(0));
-                if (fDebug)
-                    printf("force request: %s\n", inv.ToString().c_str());
+                LogPrint(LOG_NET, "force request: %s\n", inv.ToString().c_str());
             }
 
             // Track requests for our stuff
@@ -3559,8 +4103,24 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
     {
         vector<uint256> vWorkQueue;
         vector<uint256> vEraseQueue;
-        CDataStream vMsg(vRecv);
         CTxDB txdb("r");
+
+        // Hash the raw message first, a transaction we already have would
+        // be refused by AcceptToMemoryPool anyway
+        CTransactionView txView;
+        const unsigned char* pchBegin = vRecv.empty() ? NULL : (const unsigned char*)&vRecv[0];
+        const unsigned char* pch = pchBegin;
+        bool fView = pch && txView.Parse(pch, pchBegin + vRecv.size());
+        if (fView)
+        {
+            CInv inv(MSG_TX, txView.GetHash());
+            if (AlreadyHave(txdb, inv))
+            {
+                pfrom->AddInventoryKnown(inv);
+                return true;
+            }
+        }
+
         CTransaction tx;
         vRecv >> tx;
 
@@ -3571,7 +4131,14 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
         if (tx.AcceptToMemoryPool(txdb, true, &fMissingInputs))
         {
             SyncWithWallets(tx, NULL, true);
-            RelayTransaction(tx, inv.hash);
+            if (fView && txView.IsCanonical())
+            {
+                // Relay the bytes we received instead of serializing again
+                CDataStream ss((const char*)txView.begin(), (const char*)txView.end(), SER_NETWORK, PROTOCOL_VERSION);
+                RelayTransaction(tx, inv.hash, ss);
+            }
+            else
+                RelayTransaction(tx, inv.hash);
             mapAlreadyAskedFor.erase(inv);
             vWorkQueue.push_back(inv.hash);
             vEraseQueue.push_back(inv.hash);
@@ -3624,9 +4191,22 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
 
     else if (strCommand == "block")
     {
+        // Duplicates are detected from the header alone, without
+        // deserializing the transactions
+        if (vRecv.size() >= 80)
+        {
+            uint256 hashBlock = scrypt_blockhash((const unsigned char*)&vRecv[0]);
+            if (mapBlockIndex.count(hashBlock) || mapOrphanBlocks.count(hashBlock))
+            {
+                LogPrintLimited(60, "received block %s, already have it\n", hashBlock.ToString().substr(0,20).c_str());
+                pfrom->AddInventoryKnown(CInv(MSG_BLOCK, hashBlock));
+                return true;
+            }
+        }
+
         CBlock block;
         vRecv >> block;
-        uint256 hashBlock = block.GetHash();
+        uint256 hashBlock = block.CacheHash();
 
         printf("received block %s\n", hashBlock.ToString().substr(0,20).c_str());
         // block.print();
@@ -3813,13 +4393,13 @@ bool ProcessMessages(CNode* pfrom)
         {
             if ((int)vRecv.size() > nHeaderSize)
             {
-                printf("\n\nPROCESSMESSAGE MESSAGESTART NOT FOUND\n\n");
+                LogPrintLimited(10, "\n\nPROCESSMESSAGE MESSAGESTART NOT FOUND\n\n");
                 vRecv.erase(vRecv.begin(), vRecv.end() - nHeaderSize);
             }
             break;
         }
         if (pstart - vRecv.begin() > 0)
-            printf("\n\nPROCESSMESSAGE SKIPPED %" PRIpdd " BYTES\n\n", pstart - vRecv.begin());
+            LogPrintLimited(10, "\n\nPROCESSMESSAGE SKIPPED %" PRIpdd " BYTES\n\n", pstart - vRecv.begin());
         vRecv.erase(vRecv.begin(), pstart);
 
         // Read header
@@ -3828,7 +4408,7 @@ bool ProcessMessages(CNode* pfrom)
         vRecv >> hdr;
         if (!hdr.IsValid())
         {
-            printf("\n\nPROCESSMESSAGE: ERRORS IN HEADER %s\n\n\n", hdr.GetCommand().c_str());
+            LogPrintLimited(10, "\n\nPROCESSMESSAGE: ERRORS IN HEADER %s\n\n\n", hdr.GetCommand().c_str());
             continue;
         }
         string strCommand = hdr.GetCommand();
@@ -3853,7 +4433,7 @@ bool ProcessMessages(CNode* pfrom)
         memcpy(&nChecksum, &hash, sizeof(nChecksum));
         if (nChecksum != hdr.nChecksum)
         {
-            printf("ProcessMessages(%s, %u bytes) : CHECKSUM ERROR nChecksum=%08x hdr.nChecksum=%08x\n",
+            LogPrintLimited(10, "ProcessMessages(%s, %u bytes) : CHECKSUM ERROR nChecksum=%08x hdr.nChecksum=%08x\n",
                strCommand.c_str(), nMessageSize, nChecksum, hdr.nChecksum);
             continue;
         }
@@ -3897,7 +4477,7 @@ bool ProcessMessages(CNode* pfrom)
         }
 
         if (!fRet)
-            printf("ProcessMessage(%s, %u bytes) FAILED\n", strCommand.c_str(), nMessageSize);
+            LogPrintLimited(60, "ProcessMessage(%s, %u bytes) FAILED\n", strCommand.c_str(), nMessageSize);
     }
 
     vRecv.Compact();
@@ -4084,7 +4664,7 @@ public:
         mapBlockIndex.clear();
 
         // orphan blocks
-        std::map<uint256, CBlock*>::iterator it2 = mapOrphanBlocks.begin();
+        std::map<uint256, COrphanBlock*>::iterator it2 = mapOrphanBlocks.begin();
         for (; it2 != mapOrphanBlocks.end(); it2++)
             delete (*it2).second;
         mapOrphanBlocks.clear();
@@ -17,6 +17,8 @@
 #include <list>
 #include <map>
 
+#include <boost/shared_ptr.hpp>
+
 class CWallet;
 class CBlock;
 class CBlockIndex;
@@ -28,6 +30,7 @@ class CAddress;
 class CInv;
 class CRequestTracker;
 class CNode;
+struct COrphanBlock;
 
 //
 // Global state
@@ -37,6 +40,7 @@ static const unsigned int MAX_BLOCK_SIZE = 1000000;
 static const unsigned int MAX_BLOCK_SIZE_GEN = MAX_BLOCK_SIZE/2;
 static const unsigned int MAX_BLOCK_SIGOPS = MAX_BLOCK_SIZE/50;
 static const unsigned int MAX_ORPHAN_TRANSACTIONS = MAX_BLOCK_SIZE/100;
+static const unsigned int DEFAULT_MAX_ORPHAN_BLOCKS_MB = 40;
 static const unsigned int MAX_INV_SZ = 50000;
 
 static const int64_t MIN_TX_FEE = CENT/10;
@@ -79,6 +83,8 @@ extern uint256 nBestInvalidTrust;
 extern uint256 hashBestChain;
 extern CBlockIndex* pindexBest;
 extern unsigned int nTransactionsUpdated;
+extern CWaitableCriticalSection csBestBlock;
+extern boost::condition_variable cvBlockChange;
 extern uint64_t nLastBlockTx;
 extern uint64_t nLastBlockSize;
 extern uint32_t nLastCoinStakeSearchInterval;
@@ -87,7 +93,7 @@ extern int64_t nTimeBestReceived;
 extern CCriticalSection cs_setpwalletRegistered;
 extern std::set<CWallet*> setpwalletRegistered;
 extern unsigned char pchMessageStart[4];
-extern std::map<uint256, CBlock*> mapOrphanBlocks;
+extern std::map<uint256, COrphanBlock*> mapOrphanBlocks;
 
 // Settings
 extern int64_t nTransactionFee;
@@ -126,6 +132,39 @@ void ThreadScriptCheck(void* parg);
 void ThreadScriptCheckQuit();
 
 bool CheckProofOfWork(uint256 hash, unsigned int nBits);
+
+/** Checks skipped for blocks covered by -assumevalid */
+enum AssumeValidCheck
+{
+    AV_SCRIPTS,     // input scripts of a block
+    AV_BLOCKSIG,    // proof-of-stake block signature
+    AV_STAKESIG,    // coinstake kernel input signature
+    AV_RECHECK,     // CheckBlock again in ConnectBlock
+    AV_READPOW,     // proof-of-work of blocks read from disk
+    AV_MAX
+};
+
+struct CAssumeValidStats
+{
+    uint64_t nSkipped;
+    uint64_t nSampled;      // done anyway to measure what skipping saves
+    int64_t nSampleMicros;
+};
+
+// Trust hashBlock and its ancestors, hashBlock has to be a checkpoint or a
+// known block. 0 disables -assumevalid.
+bool SetAssumeValid(const uint256& hashBlock);
+uint256 GetAssumeValidHash();
+int GetAssumeValidHeight();
+bool IsAssumedValid(const CBlockIndex* pindex);
+bool IsAssumedValid(const uint256& hashBlock, int nHeight, unsigned int nTime);
+// True if the check should be skipped, every AV_SAMPLE_INTERVAL-th one
+// is done and has to be reported with AssumeValidSampled
+bool AssumeValidSkip(AssumeValidCheck check);
+void AssumeValidSampled(AssumeValidCheck check, int64_t nMicros);
+void GetAssumeValidStats(std::vector<CAssumeValidStats>& vStats);
+const char* GetAssumeValidCheckName(AssumeValidCheck check);
+void PrintAssumeValidStats();
 unsigned int GetNextTargetRequired(const CBlockIndex* pindexLast, bool fProofOfStake);
 int64_t GetProofOfWorkReward(unsigned int nBits, int64_t nFees=0);
 int64_t GetProofOfStakeReward(int64_t nCoinAge, unsigned int nBits, int64_t nTime, bool bCoinYearOnly=false);
@@ -135,7 +174,7 @@ int GetNumBlocksOfPeers();
 bool IsInitialBlockDownload();
 std::string GetWarnings(std::string strFor);
 bool GetTransaction(const uint256 &hash, CTransaction &tx, uint256 &hashBlock);
-uint256 WantedByOrphan(const CBlock* pblockOrphan);
+uint256 WantedByOrphan(const COrphanBlock* pblockOrphan);
 const CBlockIndex* GetLastBlockIndex(const CBlockIndex* pindex, bool fProofOfStake);
 void StakeMiner(CWallet *pwallet);
 void ResendWalletTransactions();
@@ -436,7 +475,13 @@ enum GetMinFee_mode
     GMF_SEND,
 };
 
-typedef std::map<uint256, std::pair<CTxIndex, CTransaction> > MapPrevTx;
+// Containers of block validation temporaries, they can take their memory
+// from a per-block arena (see CBlock::ConnectBlock)
+typedef std::map<uint256, std::pair<CTxIndex, CTransaction>, std::less<uint256>,
+                 arena_allocator<std::pair<const uint256, std::pair<CTxIndex, CTransaction> > > > MapPrevTx;
+typedef std::map<uint256, CTxIndex, std::less<uint256>,
+                 arena_allocator<std::pair<const uint256, CTxIndex> > > MapTestPool;
+typedef std::vector<CScriptCheck, arena_allocator<CScriptCheck> > ScriptCheckVector;
 
 /** The basic transaction that is broadcasted on the network and contained in
  * blocks.  A transaction can contain multiple inputs and outputs.
@@ -700,7 +745,7 @@ public:
      @param[out] fInvalid	returns true if transaction is invalid
      @return	Returns true if all inputs are in txdb or mapTestPool
      */
-    bool FetchInputs(CTxDB& txdb, const std::map<uint256, CTxIndex>& mapTestPool,
+    bool FetchInputs(CTxDB& txdb, const MapTestPool& mapTestPool,
                      bool fBlock, bool fMiner, MapPrevTx& inputsRet, bool& fInvalid);
 
     /** Sanity check previous transactions, then, if all checks succeed,
@@ -717,9 +762,9 @@ public:
         @param[in] pvChecks	NULL If pvChecks is not NULL, script checks are pushed onto it instead of being performed inline.
         @return Returns true if all checks succeed
      */
-    bool ConnectInputs(CTxDB& txdb, MapPrevTx inputs, std::map<uint256, CTxIndex>& mapTestPool, const CDiskTxPos& posThisTx, const CBlockIndex* pindexBlock, 
+    bool ConnectInputs(CTxDB& txdb, MapPrevTx inputs, MapTestPool& mapTestPool, const CDiskTxPos& posThisTx, const CBlockIndex* pindexBlock, 
                      bool fBlock, bool fMiner, bool fScriptChecks=true, 
-                     unsigned int flags=STRICT_FLAGS, std::vector<CScriptCheck> *pvChecks = NULL);
+                     unsigned int flags=STRICT_FLAGS, ScriptCheckVector *pvChecks = NULL);
     bool ClientConnectInputs();
     bool CheckTransaction() const;
     bool AcceptToMemoryPool(CTxDB& txdb, bool fCheckInputs=true, bool* pfMissingInputs=NULL);
@@ -739,12 +784,14 @@ private:
     unsigned int nIn;
     unsigned int nFlags;
     int nHashType;
+    boost::shared_ptr<const CSigHashCache> pSigHashCache; // shared by all inputs of ptxTo
 
 public:
     CScriptCheck() {}
-    CScriptCheck(const CTransaction& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, int nHashTypeIn) :
+    CScriptCheck(const CTransaction& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, int nHashTypeIn,
+                 const boost::shared_ptr<const CSigHashCache>& pSigHashCacheIn = boost::shared_ptr<const CSigHashCache>()) :
         scriptPubKey(txFromIn.vout[txToIn.vin[nInIn].prevout.n].scriptPubKey),
-        ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), nHashType(nHashTypeIn) { }
+        ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), nHashType(nHashTypeIn), pSigHashCache(pSigHashCacheIn) { }
 
     bool operator()() const;
 
@@ -754,6 +801,7 @@ public:
         std::swap(nIn, check.nIn);
         std::swap(nFlags, check.nFlags);
         std::swap(nHashType, check.nHashType);
+        pSigHashCache.swap(check.pSigHashCache);
     }
 };
 
@@ -897,6 +945,9 @@ public:
 
     // memory only
     mutable std::vector<uint256> vMerkleTree;
+    bool fHashCached;
+    unsigned char pchHashedHeader[80];
+    uint256 hashCached;
 
     // Denial-of-service detection:
     mutable int nDoS;
@@ -941,6 +992,7 @@ public:
         vtx.clear();
         vchBlockSig.clear();
         vMerkleTree.clear();
+        fHashCached = false;
         nDoS = 0;
     }
 
@@ -949,11 +1001,24 @@ public:
         return (nBits == 0);
     }
 
+    // Scrypt is slow, the hash kept by CacheHash is used until the header
+    // changes. GetHash only reads the cache, so a block shared between
+    // threads has to be cached before it is shared.
     uint256 GetHash() const
     {
+        if (fHashCached && memcmp(pchHashedHeader, &nVersion, sizeof(pchHashedHeader)) == 0)
+            return hashCached;
         return scrypt_blockhash((const uint8_t*)&nVersion);
     }
 
+    const uint256& CacheHash()
+    {
+        hashCached = scrypt_blockhash((const uint8_t*)&nVersion);
+        memcpy(pchHashedHeader, &nVersion, sizeof(pchHashedHeader));
+        fHashCached = true;
+        return hashCached;
+    }
+
     int64_t GetBlockTime() const
     {
         return (int64_t)nTime;
@@ -1059,6 +1124,12 @@ public:
         return hash;
     }
 
+    // Position of the first transaction when the block is stored at nBlockPos
+    unsigned int GetTxPos(unsigned int nBlockPos) const
+    {
+        return nBlockPos + ::GetSerializeSize(CBlock(), SER_DISK, CLIENT_VERSION) - (2 * GetSizeOfCompactSize(0)) + GetSizeOfCompactSize(vtx.size());
+    }
+
 
     bool WriteToDisk(unsigned int& nFileRet, unsigned int& nBlockPosRet)
     {
@@ -1086,7 +1157,7 @@ public:
         return true;
     }
 
-    bool ReadFromDisk(unsigned int nFile, unsigned int nBlockPos, bool fReadTransactions=true)
+    bool ReadFromDisk(unsigned int nFile, unsigned int nBlockPos, bool fReadTransactions=true, bool fCheckHeader=true)
     {
         SetNull();
 
@@ -1107,7 +1178,8 @@ public:
         }
 
         // Check the header
-        if (fReadTransactions && IsProofOfWork() && !CheckProofOfWork(GetHash(), nBits))
+        CacheHash();
+        if (fReadTransactions && fCheckHeader && IsProofOfWork() && !CheckProofOfWork(GetHash(), nBits))
             return error("CBlock::ReadFromDisk() : errors in block header");
 
         return true;
@@ -1138,11 +1210,12 @@ public:
 
 
     bool DisconnectBlock(CTxDB& txdb, CBlockIndex* pindex);
-    bool ConnectBlock(CTxDB& txdb, CBlockIndex* pindex, bool fJustCheck=false);
+    bool ConnectBlock(CTxDB& txdb, CBlockIndex* pindex, bool fJustCheck=false, bool fCheckAll=false);
     bool ReadFromDisk(const CBlockIndex* pindex, bool fReadTransactions=true);
     bool SetBestChain(CTxDB& txdb, CBlockIndex* pindexNew);
     bool AddToBlockIndex(unsigned int nFile, unsigned int nBlockPos);
     bool CheckBlock(bool fCheckPOW=true, bool fCheckMerkleRoot=true, bool fCheckSig=true) const;
+    bool CheckContext(const CBlockIndex* pindexPrev);
     bool AcceptBlock();
     bool GetCoinAge(uint64_t& nCoinAge) const; // ppcoin: calculate total coin age spent in block
     bool CheckBlockSignature() const;
@@ -1412,6 +1485,7 @@ public:
     {
         hashPrev = (pprev ? pprev->GetBlockHash() : 0);
         hashNext = (pnext ? pnext->GetBlockHash() : 0);
+        blockHash = (phashBlock ? *phashBlock : 0);
     }
 
     IMPLEMENT_SERIALIZE
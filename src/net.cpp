@@ -25,6 +25,8 @@ using namespace std;
 using namespace boost;
 
 static const int MAX_OUTBOUND_CONNECTIONS = 16;
+static const int MAX_CONNECT_ATTEMPTS_NET = 8;   // concurrent outbound connection attempts per network
+static const int MAX_CONNECT_ATTEMPTS_PROXY = 2; // ... for a network reached through a proxy
 
 void ThreadMessageHandler2(void* parg);
 void ThreadSocketHandler2(void* parg);
@@ -88,6 +90,40 @@ CCriticalSection cs_vAddedNodes;
 
 static CSemaphore *semOutbound = NULL;
 
+/** An outbound connection being established, driven by ThreadSocketHandler */
+class COutboundAttempt
+{
+public:
+    CAddress addr;
+    SOCKET hSocket;
+    CSocksHandshake* psocks; // NULL when connecting directly
+    bool fConnecting;        // TCP connection still in progress
+    int64_t nStart;
+    bool fNetworkError;      // failed in a way that affects the whole network
+    CSemaphoreGrant grantOutbound;
+
+    COutboundAttempt(const CAddress& addrIn) : addr(addrIn), hSocket(INVALID_SOCKET), psocks(NULL), fConnecting(true), nStart(GetTimeMillis()), fNetworkError(false)
+    {
+    }
+
+    ~COutboundAttempt()
+    {
+        delete psocks;
+        if (hSocket != INVALID_SOCKET)
+            closesocket(hSocket);
+    }
+
+    bool WantSend() const
+    {
+        return fConnecting || (psocks && psocks->WantSend());
+    }
+};
+
+static vector<COutboundAttempt*> vOutboundAttempts;
+static CCriticalSection cs_vOutboundAttempts;
+static int vnNetFailures[NET_MAX] = {};
+static int64_t vnNetRetryTime[NET_MAX] = {};
+
 void AddOneShot(string strDest)
 {
     LOCK(cs_vOneShots);
@@ -450,6 +486,161 @@ CNode* ConnectNode(CAddress addrConnect, const char *pszDest, int64_t nTimeout)
     }
 }
 
+// No route to the network or the proxy for it, unlike a refused or timed out connection
+bool static IsNetworkError(int nErr)
+{
+    return nErr == WSAENETDOWN || nErr == WSAENETUNREACH || nErr == WSAEHOSTUNREACH || nErr == WSAEAFNOSUPPORT;
+}
+
+void static OutboundAttemptFailed(const CAddress& addr, bool fNetworkError)
+{
+    // failed addresses are tried less often and not again for a while
+    addrman.Attempt(addr);
+    if (!fNetworkError)
+        return;
+
+    // back off from a network which can't be reached, e.g. no IPv6 route
+    LOCK(cs_vOutboundAttempts);
+    enum Network net = addr.GetNetwork();
+    int nFailures = ++vnNetFailures[net];
+    vnNetRetryTime[net] = GetTime() + min(1 << min(nFailures - 1, 6), 60);
+}
+
+// Start connecting to addrConnect without blocking, moves the grant to the attempt
+bool static StartOutboundAttempt(const CAddress& addrConnect, CSemaphoreGrant& grant)
+{
+    /// debug print
+    printf("trying connection %s lastseen=%.1fhrs\n",
+        addrConnect.ToString().c_str(),
+        (double)(GetAdjustedTime() - addrConnect.nTime)/3600.0);
+
+    COutboundAttempt* pattempt = new COutboundAttempt(addrConnect);
+    proxyType proxy;
+    bool fProxy = GetProxy(addrConnect.GetNetwork(), proxy);
+    int nErr;
+    if (!ConnectSocketStart(fProxy ? proxy.first : (CService)addrConnect, pattempt->hSocket, &nErr))
+    {
+        delete pattempt;
+        OutboundAttemptFailed(addrConnect, fProxy || IsNetworkError(nErr));
+        return false;
+    }
+    if (fProxy)
+        pattempt->psocks = new CSocksHandshake(proxy.second, addrConnect);
+    grant.MoveTo(pattempt->grantOutbound);
+
+    LOCK(cs_vOutboundAttempts);
+    vOutboundAttempts.push_back(pattempt);
+    return true;
+}
+
+void static OutboundAttemptConnected(COutboundAttempt* pattempt)
+{
+    {
+        LOCK(cs_vOutboundAttempts);
+        enum Network net = pattempt->addr.GetNetwork();
+        vnNetFailures[net] = 0;
+        vnNetRetryTime[net] = 0;
+    }
+
+    // somebody may have connected meanwhile
+    if (IsLocal(pattempt->addr) || FindNode((CNetAddr)pattempt->addr))
+        return;
+
+    addrman.Attempt(pattempt->addr);
+
+    /// debug print
+    printf("connected %s\n", pattempt->addr.ToString().c_str());
+
+    // Add node, the socket is already non-blocking
+    CNode* pnode = new CNode(pattempt->hSocket, pattempt->addr, "", false);
+    pattempt->hSocket = INVALID_SOCKET;
+    pnode->AddRef();
+    pattempt->grantOutbound.MoveTo(pnode->grantOutbound);
+    pnode->fNetworkNode = true;
+    pnode->nTimeConnected = GetTime();
+
+    LOCK(cs_vNodes);
+    vNodes.push_back(pnode);
+}
+
+// Add the sockets of outbound attempts to the select() sets
+void static SelectOutboundAttempts(fd_set& fdsetRecv, fd_set& fdsetSend, fd_set& fdsetError, SOCKET& hSocketMax, bool& have_fds)
+{
+    LOCK(cs_vOutboundAttempts);
+    BOOST_FOREACH(COutboundAttempt* pattempt, vOutboundAttempts)
+    {
+        if (pattempt->WantSend())
+            FD_SET(pattempt->hSocket, &fdsetSend);
+        else
+            FD_SET(pattempt->hSocket, &fdsetRecv);
+        FD_SET(pattempt->hSocket, &fdsetError);
+        hSocketMax = max(hSocketMax, pattempt->hSocket);
+        have_fds = true;
+    }
+}
+
+// Advance outbound attempts after select(), connected ones become nodes
+void static ProcessOutboundAttempts(fd_set& fdsetRecv, fd_set& fdsetSend, fd_set& fdsetError)
+{
+    vector<COutboundAttempt*> vConnected;
+    vector<COutboundAttempt*> vFailed;
+    {
+        LOCK(cs_vOutboundAttempts);
+        int64_t nNow = GetTimeMillis();
+        vector<COutboundAttempt*>::iterator it = vOutboundAttempts.begin();
+        while (it != vOutboundAttempts.end())
+        {
+            COutboundAttempt* pattempt = *it;
+            SOCKET hSocket = pattempt->hSocket;
+            bool fSend = FD_ISSET(hSocket, &fdsetSend);
+            bool fReady = fSend || FD_ISSET(hSocket, &fdsetRecv) || FD_ISSET(hSocket, &fdsetError);
+
+            // Failing to reach the proxy affects every address behind it
+            bool fFailed = false;
+            int nErr;
+            if (fReady && pattempt->fConnecting && (fSend || FD_ISSET(hSocket, &fdsetError)))
+            {
+                if (ConnectSocketFinish(hSocket, &nErr))
+                    pattempt->fConnecting = false;
+                else
+                {
+                    fFailed = true;
+                    pattempt->fNetworkError = pattempt->psocks || IsNetworkError(nErr);
+                }
+            }
+            if (!fFailed && !pattempt->fConnecting && pattempt->psocks && fReady)
+                fFailed = !pattempt->psocks->Advance(hSocket);
+
+            bool fDone = !pattempt->fConnecting && (!pattempt->psocks || pattempt->psocks->IsDone());
+            if (!fFailed && !fDone && nNow - pattempt->nStart > nConnectTimeout)
+            {
+                printf("connection timeout %s\n", pattempt->addr.ToString().c_str());
+                fFailed = true;
+                pattempt->fNetworkError = pattempt->fConnecting && pattempt->psocks;
+            }
+
+            if (fFailed || fDone)
+            {
+                (fFailed ? vFailed : vConnected).push_back(pattempt);
+                it = vOutboundAttempts.erase(it);
+            }
+            else
+                it++;
+        }
+    }
+
+    BOOST_FOREACH(COutboundAttempt* pattempt, vConnected)
+    {
+        OutboundAttemptConnected(pattempt);
+        delete pattempt;
+    }
+    BOOST_FOREACH(COutboundAttempt* pattempt, vFailed)
+    {
+        OutboundAttemptFailed(pattempt->addr, pattempt->fNetworkError);
+        delete pattempt;
+    }
+}
+
 void CNode::CloseSocketDisconnect()
 {
     fDisconnect = true;
@@ -728,6 +919,8 @@ void ThreadSocketHandler2(void* parg)
             }
         }
 
+        SelectOutboundAttempts(fdsetRecv, fdsetSend, fdsetError, hSocketMax, have_fds);
+
         vnThreadsRunning[THREAD_SOCKETHANDLER]--;
         int nSelect = select(have_fds ? hSocketMax + 1 : 0,
                              &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
@@ -808,6 +1001,12 @@ void ThreadSocketHandler2(void* parg)
         }
 
 
+        //
+        // Advance outbound connections being established
+        //
+        ProcessOutboundAttempts(fdsetRecv, fdsetSend, fdsetError);
+
+
         //
         // Service each socket
         //
@@ -1134,35 +1333,334 @@ void ThreadDNSAddressSeed(void* parg)
     printf("ThreadDNSAddressSeed exited\n");
 }
 
+static const int DNSSEED_THREADS = 4;                 // concurrent seed lookups
+static const int DNSSEED_TIMEOUT = 10000;             // milliseconds to wait for a seed to answer
+static const int64_t DNSSEED_CACHE_TTL = 6 * 60 * 60; // seconds to reuse the answers kept in dnsseeds.dat
+
+/** Answer of a DNS seed, kept in dnsseeds.dat */
+class CDNSSeedEntry
+{
+public:
+    std::string strHost;
+    CNetAddr addrSource;
+    int64_t nTime;
+    std::vector<CNetAddr> vAddr;
+
+    CDNSSeedEntry()
+    {
+        nTime = 0;
+    }
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(strHost);
+        READWRITE(addrSource);
+        READWRITE(nTime);
+        READWRITE(vAddr);
+    )
+};
+
+/** DNS seed to look up, through the system resolver unless addrServer is set */
+class CDNSSeed
+{
+public:
+    std::string strHost;
+    std::string strSource; // name of the seed operator, used as the address source
+    CService addrServer;   // DNS server to ask directly, for -dnsseedhost=<host>@<server>
+
+    CDNSSeed(const std::string& strHostIn, const std::string& strSourceIn) : strHost(strHostIn), strSource(strSourceIn)
+    {
+    }
+};
+
+/** Seed lookups shared with the resolver threads, which outlive a timed out lookup */
+class CDNSSeedResolver
+{
+public:
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    std::vector<CDNSSeed> vSeed;
+    std::vector<CDNSSeedEntry> vResult;
+    std::vector<int64_t> vStart; // 0 while queued
+    std::vector<bool> vfDone;
+    unsigned int nNext;
+    int nTimeout; // milliseconds, for lookups sent to addrServer
+
+    CDNSSeedResolver() : nNext(0), nTimeout(DNSSEED_TIMEOUT)
+    {
+    }
+};
+
+void static ThreadDNSSeedLookup(void* parg)
+{
+    RenameThread("novacoin-dnslookup");
+
+    boost::shared_ptr<CDNSSeedResolver>* presolver = (boost::shared_ptr<CDNSSeedResolver>*)parg;
+    boost::shared_ptr<CDNSSeedResolver> resolver = *presolver;
+    delete presolver;
+
+    while (!fShutdown)
+    {
+        unsigned int nQuery;
+        int nTimeout;
+        {
+            boost::unique_lock<boost::mutex> lock(resolver->mutex);
+            if (resolver->nNext >= resolver->vSeed.size())
+                break;
+            nQuery = resolver->nNext++;
+            resolver->vStart[nQuery] = GetTimeMillis();
+            nTimeout = resolver->nTimeout;
+        }
+        const CDNSSeed& seed = resolver->vSeed[nQuery];
+
+        CDNSSeedEntry entry;
+        entry.strHost = seed.strHost;
+        if (seed.addrServer.IsValid())
+        {
+            LookupHostDNS(seed.strHost.c_str(), seed.addrServer, entry.vAddr, nTimeout);
+            entry.addrSource = seed.addrServer;
+        }
+        else
+        {
+            LookupHost(seed.strHost.c_str(), entry.vAddr);
+            entry.addrSource = CNetAddr(seed.strSource, true);
+        }
+        entry.nTime = GetTime();
+
+        {
+            boost::unique_lock<boost::mutex> lock(resolver->mutex);
+            resolver->vResult[nQuery] = entry;
+            resolver->vfDone[nQuery] = true;
+        }
+        resolver->cond.notify_all();
+    }
+}
+
+bool static ReadDNSSeedCache(vector<CDNSSeedEntry>& vEntry)
+{
+    boost::filesystem::path pathCache = GetDataDir() / "dnsseeds.dat";
+    FILE *file = fopen(pathCache.string().c_str(), "rb");
+    CAutoFile filein = CAutoFile(file, SER_DISK, CLIENT_VERSION);
+    if (!filein)
+        return false;
+
+    int nDataSize = (int)GetFilesize(filein) - (int)sizeof(uint256);
+    if (nDataSize <= 0)
+        return error("ReadDNSSeedCache() : file too short");
+    vector<unsigned char> vchData(nDataSize);
+    uint256 hashIn;
+    try {
+        filein.read((char *)&vchData[0], nDataSize);
+        filein >> hashIn;
+    }
+    catch (const std::exception&) {
+        return error("ReadDNSSeedCache() : I/O error or stream data corrupted");
+    }
+    filein.fclose();
+
+    CDataStream ssCache(vchData, SER_DISK, CLIENT_VERSION);
+    if (hashIn != Hash(ssCache.begin(), ssCache.end()))
+        return error("ReadDNSSeedCache() : checksum mismatch; data corrupted");
+
+    unsigned char pchMsgTmp[4];
+    try {
+        ssCache >> FLATDATA(pchMsgTmp);
+        if (memcmp(pchMsgTmp, pchMessageStart, sizeof(pchMsgTmp)))
+            return error("ReadDNSSeedCache() : invalid network magic number");
+        ssCache >> vEntry;
+    }
+    catch (const std::exception&) {
+        return error("ReadDNSSeedCache() : I/O error or stream data corrupted");
+    }
+    return true;
+}
+
+bool static WriteDNSSeedCache(const vector<CDNSSeedEntry>& vEntry)
+{
+    CDataStream ssCache(SER_DISK, CLIENT_VERSION);
+    ssCache << FLATDATA(pchMessageStart);
+    ssCache << vEntry;
+    uint256 hash = Hash(ssCache.begin(), ssCache.end());
+    ssCache << hash;
+
+    boost::filesystem::path pathTmp = GetDataDir() / "dnsseeds.dat.new";
+    FILE *file = fopen(pathTmp.string().c_str(), "wb");
+    CAutoFile fileout = CAutoFile(file, SER_DISK, CLIENT_VERSION);
+    if (!fileout)
+        return error("WriteDNSSeedCache() : open failed");
+    try {
+        fileout << ssCache;
+    }
+    catch (const std::exception&) {
+        return error("WriteDNSSeedCache() : I/O error");
+    }
+    FileCommit(fileout);
+    fileout.fclose();
+
+    if (!RenameOver(pathTmp, GetDataDir() / "dnsseeds.dat"))
+        return error("WriteDNSSeedCache() : Rename-into-place failed");
+    return true;
+}
+
 void ThreadDNSAddressSeed2(void* parg)
 {
     printf("ThreadDNSAddressSeed started\n");
     int found = 0;
 
-    if (!fTestNet)
+    // -dnsseedhost replaces the built-in seeds, it is also allowed on testnet
+    // -dnsseedhost=<host>@<server>[:port] asks that DNS server directly
+    vector<CDNSSeed> vSeed;
+    if (mapArgs.count("-dnsseedhost"))
+    {
+        BOOST_FOREACH(const string& strArg, mapMultiArgs["-dnsseedhost"])
+        {
+            size_t nAt = strArg.find('@');
+            CDNSSeed seed(strArg.substr(0, nAt), strArg.substr(0, nAt));
+            if (nAt != string::npos && !Lookup(strArg.substr(nAt + 1).c_str(), seed.addrServer, 53, false))
+            {
+                printf("Invalid -dnsseedhost server: '%s'\n", strArg.c_str());
+                continue;
+            }
+            vSeed.push_back(seed);
+        }
+    }
+    else if (!fTestNet)
+    {
+        for (unsigned int seed_idx = 0; seed_idx < ARRAYLEN(strDNSSeed); seed_idx++)
+            vSeed.push_back(CDNSSeed(strDNSSeed[seed_idx][1], strDNSSeed[seed_idx][0]));
+    }
+
+    if (HaveNameProxy())
+    {
+        // a seed with its own server is still asked directly
+        vector<CDNSSeed> vDirect;
+        for (unsigned int i = 0; i < vSeed.size(); i++)
+        {
+            if (vSeed[i].addrServer.IsValid())
+                vDirect.push_back(vSeed[i]);
+            else
+                AddOneShot(vSeed[i].strHost);
+        }
+        vSeed.swap(vDirect);
+    }
+
+    if (!vSeed.empty())
     {
         printf("Loading addresses from DNS seeds (could take a while)\n");
 
-        for (unsigned int seed_idx = 0; seed_idx < ARRAYLEN(strDNSSeed); seed_idx++) {
-            if (HaveNameProxy()) {
-                AddOneShot(strDNSSeed[seed_idx][1]);
-            } else {
-                vector<CNetAddr> vaddr;
-                vector<CAddress> vAdd;
-                if (LookupHost(strDNSSeed[seed_idx][1], vaddr))
+        // Answers younger than -dnsseedttl are used without asking the seed again
+        int64_t nTTL = GetArg("-dnsseedttl", DNSSEED_CACHE_TTL);
+        vector<CDNSSeedEntry> vCache;
+        if (nTTL > 0)
+            ReadDNSSeedCache(vCache);
+
+        vector<CDNSSeedEntry> vEntry;
+        boost::shared_ptr<CDNSSeedResolver> resolver(new CDNSSeedResolver());
+        int64_t nNow = GetTime();
+        for (unsigned int i = 0; i < vSeed.size(); i++)
+        {
+            bool fCached = false;
+            BOOST_FOREACH(const CDNSSeedEntry& entry, vCache)
+            {
+                if (entry.strHost == vSeed[i].strHost && entry.nTime <= nNow && entry.nTime + nTTL > nNow)
                 {
-                    BOOST_FOREACH(CNetAddr& ip, vaddr)
-                    {
-                        int nOneDay = 24*3600;
-                        CAddress addr = CAddress(CService(ip, GetDefaultPort()));
-                        addr.nTime = GetTime() - 3*nOneDay - GetRand(4*nOneDay); // use a random age between 3 and 7 days old
-                        vAdd.push_back(addr);
-                        found++;
-                    }
+                    printf("DNS seed %s answered %" PRIszu " addresses %" PRId64 "s ago\n", entry.strHost.c_str(), entry.vAddr.size(), nNow - entry.nTime);
+                    vEntry.push_back(entry);
+                    fCached = true;
+                    break;
                 }
-                addrman.Add(vAdd, CNetAddr(strDNSSeed[seed_idx][0], true));
             }
+            if (!fCached)
+                resolver->vSeed.push_back(vSeed[i]);
         }
+
+        // Look the others up concurrently, a seed which doesn't answer in
+        // time is given up on without waiting for getaddrinfo
+        unsigned int nQueries = resolver->vSeed.size();
+        int64_t nTimeout = GetArg("-dnsseedtimeout", DNSSEED_TIMEOUT);
+        if (nQueries > 0)
+        {
+            resolver->nTimeout = (int)nTimeout;
+            resolver->vResult.resize(nQueries);
+            resolver->vStart.assign(nQueries, 0);
+            resolver->vfDone.assign(nQueries, false);
+
+            int nThreads = 0;
+            for (int i = 0; i < min((int)nQueries, DNSSEED_THREADS); i++)
+            {
+                boost::shared_ptr<CDNSSeedResolver>* presolver = new boost::shared_ptr<CDNSSeedResolver>(resolver);
+                if (NewThread(ThreadDNSSeedLookup, presolver))
+                    nThreads++;
+                else
+                {
+                    printf("Error: NewThread(ThreadDNSSeedLookup) failed\n");
+                    delete presolver;
+                }
+            }
+
+            boost::unique_lock<boost::mutex> lock(resolver->mutex);
+            while (!fShutdown && nThreads > 0)
+            {
+                // wait for lookups in time, and for queued ones unless all
+                // threads are stuck
+                int nActive = 0, nStuck = 0, nQueued = 0;
+                int64_t nNowMillis = GetTimeMillis();
+                for (unsigned int i = 0; i < nQueries; i++)
+                {
+                    if (resolver->vfDone[i])
+                        continue;
+                    if (resolver->vStart[i] == 0)
+                        nQueued++;
+                    else if (nNowMillis - resolver->vStart[i] > nTimeout)
+                        nStuck++;
+                    else
+                        nActive++;
+                }
+                if (nActive == 0 && (nQueued == 0 || nStuck >= nThreads))
+                    break;
+                resolver->cond.timed_wait(lock, boost::posix_time::milliseconds(100));
+            }
+
+            // lookups not started by now never will be
+            resolver->nNext = nQueries;
+            for (unsigned int i = 0; i < nQueries; i++)
+            {
+                if (resolver->vfDone[i])
+                    vEntry.push_back(resolver->vResult[i]);
+                else
+                    printf("DNS seed %s didn't answer in time\n", resolver->vSeed[i].strHost.c_str());
+            }
+        }
+
+        if (fShutdown)
+            return;
+
+        // Keep the seeds which answered
+        if (nTTL > 0 && nQueries > 0)
+        {
+            vector<CDNSSeedEntry> vCacheNew;
+            BOOST_FOREACH(const CDNSSeedEntry& entry, vEntry)
+                if (!entry.vAddr.empty())
+                    vCacheNew.push_back(entry);
+            WriteDNSSeedCache(vCacheNew);
+        }
+
+        // Add the addresses of all seeds at once
+        vector<CAddress> vAdd;
+        vector<CNetAddr> vSource;
+        BOOST_FOREACH(const CDNSSeedEntry& entry, vEntry)
+        {
+            BOOST_FOREACH(const CNetAddr& ip, entry.vAddr)
+            {
+                int nOneDay = 24*3600;
+                CAddress addr = CAddress(CService(ip, GetDefaultPort()));
+                addr.nTime = GetTime() - 3*nOneDay - GetRand(4*nOneDay); // use a random age between 3 and 7 days old
+                vAdd.push_back(addr);
+                vSource.push_back(entry.addrSource);
+                found++;
+            }
+        }
+        addrman.Add(vAdd, vSource);
     }
 
     printf("%d addresses found from DNS seeds\n", found);
@@ -1342,15 +1840,36 @@ void ThreadOpenConnections2(void* parg)
         }
     }
 
+    // Add Tor nodes if we have connection with onion router
+    if (mapArgs.count("-tor"))
+    {
+        std::vector<CAddress> vAdd;
+        for (unsigned int i = 0; i < ARRAYLEN(pchTorSeed); i++)
+        {
+            const int64_t nOneWeek = 7*24*60*60;
+            CAddress addr(CService(pchTorSeed[i], GetDefaultPort()));
+            addr.nTime = GetTime()-GetRand(nOneWeek)-nOneWeek;
+            vAdd.push_back(addr);
+        }
+        addrman.Add(vAdd, CNetAddr("dummyaddress.onion"));
+    }
+
     // Initiate network connections
     int64_t nStart = GetTime();
+    bool fStarted = false;
     while (true)
     {
         ProcessOneShot();
 
-        vnThreadsRunning[THREAD_OPENCONNECTIONS]--;
-        Sleep(500);
-        vnThreadsRunning[THREAD_OPENCONNECTIONS]++;
+        // Connections are established by ThreadSocketHandler, keep starting
+        // them without waiting while outbound slots are free
+        if (!fStarted)
+        {
+            vnThreadsRunning[THREAD_OPENCONNECTIONS]--;
+            Sleep(500);
+            vnThreadsRunning[THREAD_OPENCONNECTIONS]++;
+        }
+        fStarted = false;
         if (fShutdown)
             return;
 
@@ -1381,20 +1900,6 @@ void ThreadOpenConnections2(void* parg)
             addrman.Add(vAdd, CNetAddr("127.0.0.1"));
         }
 
-        // Add Tor nodes if we have connection with onion router
-        if (mapArgs.count("-tor"))
-        {
-            std::vector<CAddress> vAdd;
-            for (unsigned int i = 0; i < ARRAYLEN(pchTorSeed); i++)
-            {
-                const int64_t nOneWeek = 7*24*60*60;
-                CAddress addr(CService(pchTorSeed[i], GetDefaultPort()));
-                addr.nTime = GetTime()-GetRand(nOneWeek)-nOneWeek;
-                vAdd.push_back(addr);
-            }
-            addrman.Add(vAdd, CNetAddr("dummyaddress.onion"));
-        }
-
         //
         // Choose an address to connect to based on most recently seen
         //
@@ -1414,6 +1919,25 @@ void ThreadOpenConnections2(void* parg)
             }
         }
 
+        // Groups with an attempt in progress count as connected. Networks
+        // backing off or at their limit of concurrent attempts are skipped.
+        bool vfNetBusy[NET_MAX] = {};
+        {
+            LOCK(cs_vOutboundAttempts);
+            int vnAttempts[NET_MAX] = {};
+            BOOST_FOREACH(COutboundAttempt* pattempt, vOutboundAttempts) {
+                setConnected.insert(pattempt->addr.GetGroup());
+                vnAttempts[pattempt->addr.GetNetwork()]++;
+            }
+            int64_t nNow = GetTime();
+            for (int n = 0; n < NET_MAX; n++)
+            {
+                proxyType proxy;
+                int nMaxAttempts = GetProxy((enum Network)n, proxy) ? MAX_CONNECT_ATTEMPTS_PROXY : MAX_CONNECT_ATTEMPTS_NET;
+                vfNetBusy[n] = (vnAttempts[n] >= nMaxAttempts || vnNetRetryTime[n] > nNow);
+            }
+        }
+
         int64_t nANow = GetAdjustedTime();
 
         int nTries = 0;
@@ -1433,7 +1957,7 @@ void ThreadOpenConnections2(void* parg)
             if (nTries > 100)
                 break;
 
-            if (IsLimited(addr))
+            if (IsLimited(addr) || vfNetBusy[addr.GetNetwork()])
                 continue;
 
             // only consider very recently tried nodes after 30 failed attempts
@@ -1448,8 +1972,8 @@ void ThreadOpenConnections2(void* parg)
             break;
         }
 
-        if (addrConnect.IsValid())
-            OpenNetworkConnection(addrConnect, &grant);
+        if (addrConnect.IsValid() && !FindNode((CNetAddr)addrConnect) && !CNode::IsBanned(addrConnect))
+            fStarted = StartOutboundAttempt(addrConnect, grant);
     }
 }
 
@@ -1987,6 +2511,8 @@ bool StopNode()
     if (vnThreadsRunning[THREAD_DUMPADDRESS] > 0) printf("ThreadDumpAddresses still running\n");
     if (vnThreadsRunning[THREAD_MINTER] > 0) printf("ThreadStakeMinter still running\n");
     if (vnThreadsRunning[THREAD_SCRIPTCHECK] > 0) printf("ThreadScriptCheck still running\n");
+    if (vnThreadsRunning[THREAD_STRATUM] > 0) printf("ThreadStratumServer still running\n");
+    if (vnThreadsRunning[THREAD_SNAPSHOT] > 0) printf("ThreadSnapshotVerify still running\n");
     while (vnThreadsRunning[THREAD_MESSAGEHANDLER] > 0 || vnThreadsRunning[THREAD_RPCHANDLER] > 0 || vnThreadsRunning[THREAD_SCRIPTCHECK] > 0)
         Sleep(20);
     Sleep(50);
@@ -2017,8 +2543,11 @@ public:
             delete pnode;
         BOOST_FOREACH(CNode *pnode, vNodesDisconnected)
             delete pnode;
+        BOOST_FOREACH(COutboundAttempt *pattempt, vOutboundAttempts)
+            delete pattempt;
         vNodes.clear();
         vNodesDisconnected.clear();
+        vOutboundAttempts.clear();
         delete semOutbound;
         semOutbound = NULL;
         delete pnodeLocalHost;
@@ -112,6 +112,8 @@ enum threadId
     THREAD_RPCHANDLER,
     THREAD_MINTER,
     THREAD_SCRIPTCHECK,
+    THREAD_STRATUM,
+    THREAD_SNAPSHOT,
 
     THREAD_MAX
 };
@@ -141,6 +141,165 @@ bool LookupHostNumeric(const char *pszName, std::vector<CNetAddr>& vIP, unsigned
     return LookupHost(pszName, vIP, nMaxSolutions, false);
 }
 
+// Skip a possibly compressed name in a DNS message
+static bool SkipDNSName(const std::vector<unsigned char>& vch, unsigned int& nPos)
+{
+    while (nPos < vch.size())
+    {
+        unsigned int nLen = vch[nPos];
+        if ((nLen & 0xC0) == 0xC0)
+        {
+            nPos += 2;
+            return nPos <= vch.size();
+        }
+        nPos += 1 + nLen;
+        if (nLen == 0)
+            return true;
+    }
+    return false;
+}
+
+// Addresses in the answer to a query with id nId
+static bool ParseDNSAnswer(const std::vector<unsigned char>& vch, unsigned short nId, std::vector<CNetAddr>& vIP)
+{
+    if (vch.size() < 12 || ((vch[0] << 8) | vch[1]) != nId || !(vch[2] & 0x80))
+        return false;
+    if ((vch[3] & 0x0F) != 0)
+        return true; // name error or server failure, no addresses
+    unsigned int nQuestions = (vch[4] << 8) | vch[5];
+    unsigned int nAnswers = (vch[6] << 8) | vch[7];
+    unsigned int nPos = 12;
+    for (unsigned int i = 0; i < nQuestions; i++)
+    {
+        if (!SkipDNSName(vch, nPos))
+            return false;
+        nPos += 4;
+    }
+    for (unsigned int i = 0; i < nAnswers; i++)
+    {
+        if (!SkipDNSName(vch, nPos) || nPos + 10 > vch.size())
+            return false;
+        unsigned int nType = (vch[nPos] << 8) | vch[nPos + 1];
+        unsigned int nClass = (vch[nPos + 2] << 8) | vch[nPos + 3];
+        unsigned int nLen = (vch[nPos + 8] << 8) | vch[nPos + 9];
+        nPos += 10;
+        if (nPos + nLen > vch.size())
+            return false;
+        if (nClass == 1 && nType == 1 && nLen == 4)
+        {
+            struct in_addr ip4;
+            memcpy(&ip4, &vch[nPos], 4);
+            vIP.push_back(CNetAddr(ip4));
+        }
+#ifdef USE_IPV6
+        if (nClass == 1 && nType == 28 && nLen == 16)
+        {
+            struct in6_addr ip6;
+            memcpy(&ip6, &vch[nPos], 16);
+            vIP.push_back(CNetAddr(ip6));
+        }
+#endif
+        nPos += nLen;
+    }
+    return true;
+}
+
+bool LookupHostDNS(const char *pszName, const CService& addrServer, std::vector<CNetAddr>& vIP, int nTimeout)
+{
+    vIP.clear();
+
+#ifdef USE_IPV6
+    struct sockaddr_storage sockaddr;
+#else
+    struct sockaddr sockaddr;
+#endif
+    socklen_t len = sizeof(sockaddr);
+    if (!addrServer.GetSockAddr((struct sockaddr*)&sockaddr, &len))
+        return false;
+
+    // One query for A and, with IPv6, one for AAAA records
+    std::vector<unsigned char> vchName;
+    for (const char* psz = pszName; *psz; )
+    {
+        const char* pszEnd = strchr(psz, '.');
+        size_t nLen = pszEnd ? pszEnd - psz : strlen(psz);
+        if (nLen > 63)
+            return false;
+        if (nLen > 0)
+        {
+            vchName.push_back(nLen);
+            vchName.insert(vchName.end(), psz, psz + nLen);
+        }
+        psz += nLen + (pszEnd ? 1 : 0);
+    }
+    vchName.push_back(0);
+
+#ifdef USE_IPV6
+    const unsigned short pnType[] = { 1, 28 };
+#else
+    const unsigned short pnType[] = { 1 };
+#endif
+    const unsigned int nQueries = sizeof(pnType) / sizeof(pnType[0]);
+    unsigned short pnId[2];
+
+    SOCKET hSocket = socket(((struct sockaddr*)&sockaddr)->sa_family, SOCK_DGRAM, IPPROTO_UDP);
+    if (hSocket == INVALID_SOCKET)
+        return false;
+    for (unsigned int i = 0; i < nQueries; i++)
+    {
+        pnId[i] = (unsigned short)GetRand(0x10000);
+        std::vector<unsigned char> vchQuery;
+        unsigned char pchHeader[12] = { (unsigned char)(pnId[i] >> 8), (unsigned char)pnId[i], 0x01, 0, 0, 1, 0, 0, 0, 0, 0, 0 };
+        vchQuery.insert(vchQuery.end(), pchHeader, pchHeader + sizeof(pchHeader));
+        vchQuery.insert(vchQuery.end(), vchName.begin(), vchName.end());
+        vchQuery.push_back(pnType[i] >> 8);
+        vchQuery.push_back(pnType[i] & 0xFF);
+        vchQuery.push_back(0);
+        vchQuery.push_back(1);
+        if (sendto(hSocket, (const char*)&vchQuery[0], vchQuery.size(), MSG_NOSIGNAL, (struct sockaddr*)&sockaddr, len) == SOCKET_ERROR)
+        {
+            closesocket(hSocket);
+            return false;
+        }
+    }
+
+    // Collect the answers until all came or the time is up
+    bool fAnswered[2] = { false, false };
+    unsigned int nAnswered = 0;
+    int64_t nStop = GetTimeMillis() + nTimeout;
+    while (nAnswered < nQueries)
+    {
+        int64_t nWait = nStop - GetTimeMillis();
+        if (nWait <= 0)
+            break;
+        struct timeval timeout;
+        timeout.tv_sec  = nWait / 1000;
+        timeout.tv_usec = (nWait % 1000) * 1000;
+        fd_set fdset;
+        FD_ZERO(&fdset);
+        FD_SET(hSocket, &fdset);
+        if (select(hSocket + 1, &fdset, NULL, NULL, &timeout) <= 0)
+            break;
+
+        std::vector<unsigned char> vchAnswer(512);
+        int nRecv = recv(hSocket, (char*)&vchAnswer[0], vchAnswer.size(), 0);
+        if (nRecv <= 0)
+            break;
+        vchAnswer.resize(nRecv);
+        for (unsigned int i = 0; i < nQueries; i++)
+        {
+            if (!fAnswered[i] && ParseDNSAnswer(vchAnswer, pnId[i], vIP))
+            {
+                fAnswered[i] = true;
+                nAnswered++;
+            }
+        }
+    }
+    closesocket(hSocket);
+
+    return (vIP.size() > 0);
+}
+
 bool Lookup(const char *pszName, std::vector<CService>& vAddr, int portDefault, bool fAllowLookup, unsigned int nMaxSolutions)
 {
     if (pszName[0] == 0)
@@ -322,9 +481,12 @@ bool static Socks5(string strDest, int port, SOCKET& hSocket)
     return true;
 }
 
-bool static ConnectSocketDirectly(const CService &addrConnect, SOCKET& hSocketRet, int nTimeout)
+bool ConnectSocketStart(const CService &addrConnect, SOCKET& hSocketRet, int* pnErrRet)
 {
     hSocketRet = INVALID_SOCKET;
+    int nErrDummy;
+    int& nErrRet = pnErrRet ? *pnErrRet : nErrDummy;
+    nErrRet = 0;
 
 #ifdef USE_IPV6
     struct sockaddr_storage sockaddr;
@@ -334,12 +496,16 @@ bool static ConnectSocketDirectly(const CService &addrConnect, SOCKET& hSocketRe
     socklen_t len = sizeof(sockaddr);
     if (!addrConnect.GetSockAddr((struct sockaddr*)&sockaddr, &len)) {
         printf("Cannot connect to %s: unsupported network\n", addrConnect.ToString().c_str());
+        nErrRet = WSAEAFNOSUPPORT;
         return false;
     }
 
     SOCKET hSocket = socket(((struct sockaddr*)&sockaddr)->sa_family, SOCK_STREAM, IPPROTO_TCP);
     if (hSocket == INVALID_SOCKET)
+    {
+        nErrRet = WSAGetLastError();
         return false;
+    }
 #ifdef SO_NOSIGPIPE
     int set = 1;
     setsockopt(hSocket, SOL_SOCKET, SO_NOSIGPIPE, (void*)&set, sizeof(int));
@@ -353,73 +519,97 @@ bool static ConnectSocketDirectly(const CService &addrConnect, SOCKET& hSocketRe
     if (fcntl(hSocket, F_SETFL, fFlags | O_NONBLOCK) == -1)
 #endif
     {
+        nErrRet = WSAGetLastError();
         closesocket(hSocket);
         return false;
     }
 
     if (connect(hSocket, (struct sockaddr*)&sockaddr, len) == SOCKET_ERROR)
     {
+        int nErr = WSAGetLastError();
         // WSAEINVAL is here because some legacy version of winsock uses it
-        if (WSAGetLastError() == WSAEINPROGRESS || WSAGetLastError() == WSAEWOULDBLOCK || WSAGetLastError() == WSAEINVAL)
-        {
-            struct timeval timeout;
-            timeout.tv_sec  = nTimeout / 1000;
-            timeout.tv_usec = (nTimeout % 1000) * 1000;
-
-            fd_set fdset;
-            FD_ZERO(&fdset);
-            FD_SET(hSocket, &fdset);
-            int nRet = select(hSocket + 1, NULL, &fdset, NULL, &timeout);
-            if (nRet == 0)
-            {
-                printf("connection timeout\n");
-                closesocket(hSocket);
-                return false;
-            }
-            if (nRet == SOCKET_ERROR)
-            {
-                printf("select() for connection failed: %i\n",WSAGetLastError());
-                closesocket(hSocket);
-                return false;
-            }
-            socklen_t nRetSize = sizeof(nRet);
-#ifdef WIN32
-            if (getsockopt(hSocket, SOL_SOCKET, SO_ERROR, (char*)(&nRet), &nRetSize) == SOCKET_ERROR)
-#else
-            if (getsockopt(hSocket, SOL_SOCKET, SO_ERROR, &nRet, &nRetSize) == SOCKET_ERROR)
-#endif
-            {
-                printf("getsockopt() for connection failed: %i\n",WSAGetLastError());
-                closesocket(hSocket);
-                return false;
-            }
-            if (nRet != 0)
-            {
-                printf("connect() failed after select(): %s\n",strerror(nRet));
-                closesocket(hSocket);
-                return false;
-            }
-        }
+        if (nErr != WSAEINPROGRESS && nErr != WSAEWOULDBLOCK && nErr != WSAEINVAL
 #ifdef WIN32
-        else if (WSAGetLastError() != WSAEISCONN)
-#else
-        else
+            && nErr != WSAEISCONN
 #endif
+           )
         {
-            printf("connect() failed: %i\n",WSAGetLastError());
+            printf("connect() failed: %i\n", nErr);
+            nErrRet = nErr;
             closesocket(hSocket);
             return false;
         }
     }
 
+    hSocketRet = hSocket;
+    return true;
+}
+
+bool ConnectSocketFinish(SOCKET hSocket, int* pnErrRet)
+{
+    int nErrDummy;
+    int& nErrRet = pnErrRet ? *pnErrRet : nErrDummy;
+    int nRet = 0;
+    socklen_t nRetSize = sizeof(nRet);
+#ifdef WIN32
+    if (getsockopt(hSocket, SOL_SOCKET, SO_ERROR, (char*)(&nRet), &nRetSize) == SOCKET_ERROR)
+#else
+    if (getsockopt(hSocket, SOL_SOCKET, SO_ERROR, &nRet, &nRetSize) == SOCKET_ERROR)
+#endif
+    {
+        nErrRet = WSAGetLastError();
+        printf("getsockopt() for connection failed: %i\n", nErrRet);
+        return false;
+    }
+    nErrRet = nRet;
+    if (nRet != 0)
+    {
+        printf("connect() failed after select(): %s\n",strerror(nRet));
+        return false;
+    }
+    return true;
+}
+
+bool static ConnectSocketDirectly(const CService &addrConnect, SOCKET& hSocketRet, int nTimeout)
+{
+    SOCKET hSocket;
+    if (!ConnectSocketStart(addrConnect, hSocket))
+        return false;
+
+    struct timeval timeout;
+    timeout.tv_sec  = nTimeout / 1000;
+    timeout.tv_usec = (nTimeout % 1000) * 1000;
+
+    fd_set fdset;
+    FD_ZERO(&fdset);
+    FD_SET(hSocket, &fdset);
+    int nRet = select(hSocket + 1, NULL, &fdset, NULL, &timeout);
+    if (nRet == 0)
+    {
+        printf("connection timeout\n");
+        closesocket(hSocket);
+        return false;
+    }
+    if (nRet == SOCKET_ERROR)
+    {
+        printf("select() for connection failed: %i\n",WSAGetLastError());
+        closesocket(hSocket);
+        return false;
+    }
+    if (!ConnectSocketFinish(hSocket))
+    {
+        closesocket(hSocket);
+        return false;
+    }
+
     // this isn't even strictly necessary
     // CNode::ConnectNode immediately turns the socket back to non-blocking
     // but we'll turn it back to blocking just in case
 #ifdef WIN32
-    fNonblock = 0;
+    u_long fNonblock = 0;
     if (ioctlsocket(hSocket, FIONBIO, &fNonblock) == SOCKET_ERROR)
 #else
-    fFlags = fcntl(hSocket, F_GETFL, 0);
+    int fFlags = fcntl(hSocket, F_GETFL, 0);
     if (fcntl(hSocket, F_SETFL, fFlags & ~O_NONBLOCK) == SOCKET_ERROR)
 #endif
     {
@@ -431,6 +621,162 @@ bool static ConnectSocketDirectly(const CService &addrConnect, SOCKET& hSocketRe
     return true;
 }
 
+CSocksHandshake::CSocksHandshake(int nVersionIn, const CService &addrDestIn) : nVersion(nVersionIn), addrDest(addrDestIn), nRecvNeeded(0)
+{
+    if (nVersion == 4)
+    {
+        printf("SOCKS4 connecting %s\n", addrDest.ToString().c_str());
+        struct sockaddr_in addr;
+        socklen_t len = sizeof(addr);
+        if (!addrDest.IsIPv4() || !addrDest.GetSockAddr((struct sockaddr*)&addr, &len) || addr.sin_family != AF_INET)
+        {
+            printf("ERROR: Proxy destination is not IPv4\n");
+            nStep = SOCKS_FAILED;
+            return;
+        }
+        char pszSocks4IP[] = "\4\1\0\0\0\0\0\0user";
+        memcpy(pszSocks4IP + 2, &addr.sin_port, 2);
+        memcpy(pszSocks4IP + 4, &addr.sin_addr, 4);
+        strSend.assign(pszSocks4IP, sizeof(pszSocks4IP));
+        nRecvNeeded = 8;
+        nStep = SOCKS4_REPLY;
+    }
+    else
+    {
+        printf("SOCKS5 connecting %s\n", addrDest.ToString().c_str());
+        strSend.assign("\5\1\0", 3);
+        nRecvNeeded = 2;
+        nStep = SOCKS5_METHOD;
+    }
+}
+
+bool CSocksHandshake::Advance(SOCKET hSocket)
+{
+    while (nStep != SOCKS_DONE)
+    {
+        if (nStep == SOCKS_FAILED)
+            return false;
+
+        // send the pending request
+        while (!strSend.empty())
+        {
+            int ret = send(hSocket, strSend.data(), strSend.size(), MSG_NOSIGNAL);
+            if (ret == SOCKET_ERROR)
+            {
+                int nErr = WSAGetLastError();
+                if (nErr == WSAEWOULDBLOCK || nErr == WSAEINPROGRESS)
+                    return true;
+                return Fail("Error sending to proxy");
+            }
+            strSend.erase(0, ret);
+        }
+
+        // read the reply, without reading past it
+        while (vchRecv.size() < nRecvNeeded)
+        {
+            char pchBuf[256];
+            int ret = recv(hSocket, pchBuf, min((unsigned int)sizeof(pchBuf), nRecvNeeded - (unsigned int)vchRecv.size()), 0);
+            if (ret == SOCKET_ERROR)
+            {
+                int nErr = WSAGetLastError();
+                if (nErr == WSAEWOULDBLOCK || nErr == WSAEINPROGRESS)
+                    return true;
+            }
+            if (ret <= 0)
+                return Fail("Error reading proxy response");
+            vchRecv.insert(vchRecv.end(), pchBuf, pchBuf + ret);
+        }
+
+        if (!ProcessReply())
+            return false;
+    }
+    return true;
+}
+
+bool CSocksHandshake::Fail(const char* pszError)
+{
+    nStep = SOCKS_FAILED;
+    return error("%s", pszError);
+}
+
+bool CSocksHandshake::ProcessReply()
+{
+    switch (nStep)
+    {
+    case SOCKS4_REPLY:
+        if (vchRecv[1] != 0x5a)
+        {
+            nStep = SOCKS_FAILED;
+            if (vchRecv[1] != 0x5b)
+                printf("ERROR: Proxy returned error %d\n", vchRecv[1]);
+            return false;
+        }
+        printf("SOCKS4 connected %s\n", addrDest.ToString().c_str());
+        nStep = SOCKS_DONE;
+        return true;
+
+    case SOCKS5_METHOD:
+    {
+        if (vchRecv[0] != 0x05 || vchRecv[1] != 0x00)
+            return Fail("Proxy failed to initialize");
+        string strDest = addrDest.ToStringIP();
+        int port = addrDest.GetPort();
+        strSend = "\5\1";
+        strSend += '\000'; strSend += '\003';
+        strSend += static_cast<char>(std::min((int)strDest.size(), 255));
+        strSend += strDest.substr(0, 255);
+        strSend += static_cast<char>((port >> 8) & 0xFF);
+        strSend += static_cast<char>((port >> 0) & 0xFF);
+        // header and the first byte of the bound address
+        vchRecv.clear();
+        nRecvNeeded = 5;
+        nStep = SOCKS5_REPLY;
+        return true;
+    }
+
+    case SOCKS5_REPLY:
+    {
+        if (vchRecv[0] != 0x05)
+            return Fail("Proxy failed to accept request");
+        switch (vchRecv[1])
+        {
+            case 0x00: break;
+            case 0x01: return Fail("Proxy error: general failure");
+            case 0x02: return Fail("Proxy error: connection not allowed");
+            case 0x03: return Fail("Proxy error: network unreachable");
+            case 0x04: return Fail("Proxy error: host unreachable");
+            case 0x05: return Fail("Proxy error: connection refused");
+            case 0x06: return Fail("Proxy error: TTL expired");
+            case 0x07: return Fail("Proxy error: protocol error");
+            case 0x08: return Fail("Proxy error: address type not supported");
+            default:   return Fail("Proxy error: unknown");
+        }
+        if (vchRecv[2] != 0x00)
+            return Fail("Error: malformed proxy response");
+        // bound address and port
+        unsigned int nReplySize;
+        switch (vchRecv[3])
+        {
+            case 0x01: nReplySize = 4 + 4 + 2; break;
+            case 0x04: nReplySize = 4 + 16 + 2; break;
+            case 0x03: nReplySize = 4 + 1 + (unsigned char)vchRecv[4] + 2; break;
+            default: return Fail("Error: malformed proxy response");
+        }
+        if (vchRecv.size() < nReplySize)
+        {
+            nRecvNeeded = nReplySize;
+            return true;
+        }
+        printf("SOCKS5 connected %s\n", addrDest.ToString().c_str());
+        nStep = SOCKS_DONE;
+        return true;
+    }
+
+    default:
+        return Fail("Error: invalid proxy handshake state");
+    }
+}
+
 bool SetProxy(enum Network net, CService addrProxy, int nSocksVersion) {
     assert(net >= 0 && net < NET_MAX);
     if (nSocksVersion != 0 && nSocksVersion != 4 && nSocksVersion != 5)
@@ -929,6 +1275,11 @@ uint64_t CNetAddr::GetHash() const
     return nRet;
 }
 
+uint64_t CNetAddr::GetSipHash(uint64_t k0, uint64_t k1) const
+{
+    return CSipHasher(k0, k1).Write(ip, sizeof(ip)).Finalize();
+}
+
 void CNetAddr::print() const
 {
     printf("CNetAddr(%s)\n", ToString().c_str());
@@ -68,6 +68,7 @@ class CNetAddr
         std::string ToStringIP() const;
         uint8_t GetByte(int n) const;
         uint64_t GetHash() const;
+        uint64_t GetSipHash(uint64_t k0, uint64_t k1) const; // keyed hash for hash tables
         bool GetInAddr(struct in_addr* pipv4Addr) const;
         std::vector<unsigned char> GetGroup() const;
         int GetReachabilityFrom(const CNetAddr *paddrPartner = NULL) const;
@@ -144,10 +145,49 @@ bool SetNameProxy(CService addrProxy, int nSocksVersion = 5);
 bool HaveNameProxy();
 bool LookupHost(const char *pszName, std::vector<CNetAddr>& vIP, unsigned int nMaxSolutions = 0, bool fAllowLookup = true);
 bool LookupHostNumeric(const char *pszName, std::vector<CNetAddr>& vIP, unsigned int nMaxSolutions = 0);
+// Ask the DNS server at addrServer for the A and AAAA records of pszName
+bool LookupHostDNS(const char *pszName, const CService& addrServer, std::vector<CNetAddr>& vIP, int nTimeout = nConnectTimeout);
 bool Lookup(const char *pszName, CService& addr, int portDefault = 0, bool fAllowLookup = true);
 bool Lookup(const char *pszName, std::vector<CService>& vAddr, int portDefault = 0, bool fAllowLookup = true, unsigned int nMaxSolutions = 0);
 bool LookupNumeric(const char *pszName, CService& addr, int portDefault = 0);
 bool ConnectSocket(const CService &addr, SOCKET& hSocketRet, int nTimeout = nConnectTimeout);
 bool ConnectSocketByName(CService &addr, SOCKET& hSocketRet, const char *pszDest, int portDefault = 0, int nTimeout = nConnectTimeout);
+// Start a non-blocking connection, the socket becomes writable when it completes
+bool ConnectSocketStart(const CService &addr, SOCKET& hSocketRet, int* pnErrRet = NULL);
+// Check the result of a non-blocking connection once the socket is writable
+bool ConnectSocketFinish(SOCKET hSocket, int* pnErrRet = NULL);
+
+/** Non-blocking SOCKS4/5 client handshake over a connected proxy socket */
+class CSocksHandshake
+{
+private:
+    enum
+    {
+        SOCKS4_REPLY,
+        SOCKS5_METHOD,
+        SOCKS5_REPLY,
+        SOCKS_DONE,
+        SOCKS_FAILED,
+    };
+
+    int nVersion;
+    CService addrDest;
+    int nStep;
+    std::string strSend;        // request bytes not sent yet
+    std::vector<char> vchRecv;  // reply bytes received so far
+    unsigned int nRecvNeeded;
+
+    bool Fail(const char* pszError);
+    bool ProcessReply();
+
+public:
+    CSocksHandshake(int nVersionIn, const CService &addrDestIn);
+
+    // Send and receive what the socket allows, returns false if the handshake failed
+    bool Advance(SOCKET hSocket);
+
+    bool WantSend() const { return !strSend.empty(); }
+    bool IsDone() const { return nStep == SOCKS_DONE; }
+};
 
 #endif
@@ -4,6 +4,9 @@
 /* Milliseconds between model updates */
 static const int MODEL_UPDATE_DELAY = 500;
 
+/* Wallet transactions loaded into a table model per event loop pass */
+static const int MODEL_LOAD_CHUNK = 500;
+
 /* AskPassphraseDialog -- Maximum passphrase length */
 static const int MAX_PASSPHRASE_SIZE = 1024;
 
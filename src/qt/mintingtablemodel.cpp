@@ -55,7 +55,8 @@ class MintingTablePriv
 public:
     MintingTablePriv(CWallet *wallet, MintingTableModel *parent):
         wallet(wallet),
-        parent(parent)
+        parent(parent),
+        loading(false)
     {
     }
     CWallet *wallet;
@@ -63,25 +64,54 @@ public:
 
     QList<KernelRecord> cachedWallet;
 
+    /* While loading, transactions with a hash above lastLoaded are not
+     * in the model yet and are picked up by loadMore().
+     */
+    bool loading;
+    uint256 lastLoaded;
+
     void refreshWallet()
     {
 #ifdef WALLET_UPDATE_DEBUG
         qDebug() << "refreshWallet";
 #endif
         cachedWallet.clear();
+        loading = true;
+        lastLoaded = 0;
+    }
+
+    /* Append the outputs of the next maxTransactions wallet transactions.
+       Returns false once the whole wallet is loaded.
+     */
+    bool loadMore(int maxTransactions)
+    {
+        if(!loading)
+            return false;
+
+        QList<KernelRecord> toInsert;
         {
             LOCK(wallet->cs_wallet);
-            for(std::map<uint256, CWalletTx>::iterator it = wallet->mapWallet.begin(); it != wallet->mapWallet.end(); ++it)
+            std::map<uint256, CWalletTx>::iterator it = wallet->mapWallet.upper_bound(lastLoaded);
+            for(int n = 0; it != wallet->mapWallet.end() && n < maxTransactions; ++it, ++n)
             {
                 std::vector<KernelRecord> txList = KernelRecord::decomposeOutput(wallet, it->second);
                 BOOST_FOREACH(KernelRecord& kr, txList) {
                     if(!kr.spent) {
-                        cachedWallet.append(kr);
+                        toInsert.append(kr);
                     }
                 }
-
+                lastLoaded = it->first;
             }
+            loading = (it != wallet->mapWallet.end());
         }
+
+        if(!toInsert.isEmpty())
+        {
+            parent->beginInsertRows(QModelIndex(), cachedWallet.size(), cachedWallet.size()+toInsert.size()-1);
+            cachedWallet.append(toInsert);
+            parent->endInsertRows();
+        }
+        return loading;
     }
 
     /* Update our model of the wallet incrementally, to synchronize our model of the wallet
@@ -106,6 +136,8 @@ public:
             for(int update_idx = updated_sorted.size()-1; update_idx >= 0; --update_idx)
             {
                 const uint256 &hash = updated_sorted.at(update_idx);
+                if(loading && lastLoaded < hash)
+                    continue;
                 // Find transaction in wallet
                 std::map<uint256, CWalletTx>::iterator mi = wallet->mapWallet.find(hash);
                 bool inWallet = mi != wallet->mapWallet.end();
@@ -223,14 +255,12 @@ MintingTableModel::MintingTableModel(CWallet *wallet, WalletModel *parent):
         wallet(wallet),
         walletModel(parent),
         mintingInterval(10),
-        priv(new MintingTablePriv(wallet, this))
+        priv(new MintingTablePriv(wallet, this)),
+        mintingProxyModel(0)
 {
     columns << tr("Transaction") <<  tr("Address") << tr("Balance") << tr("Age") << tr("CoinDay") << tr("MintProbability") << tr("MintReward");
     priv->refreshWallet();
-
-    QTimer *timer = new QTimer(this);
-    connect(timer, SIGNAL(timeout()), this, SLOT(update()));
-    timer->start(MODEL_UPDATE_DELAY);
+    loadMore();
 }
 
 MintingTableModel::~MintingTableModel()
@@ -244,18 +274,18 @@ void MintingTableModel::update()
 
     // Check if there are changes to wallet map
     {
-        TRY_LOCK(wallet->cs_wallet, lockWallet);
-        if (lockWallet && !wallet->vMintingWalletUpdated.empty())
+        LOCK(wallet->cs_wallet);
+        if (!wallet->vMintingWalletUpdated.empty())
         {
             BOOST_FOREACH(uint256 hash, wallet->vMintingWalletUpdated)
             {
                 updated.append(hash);
 
                 // Also check the inputs to remove spent outputs from the table if necessary
-                CWalletTx wtx;
-                if(wallet->GetTransaction(hash, wtx))
+                std::map<uint256, CWalletTx>::const_iterator mi = wallet->mapWallet.find(hash);
+                if(mi != wallet->mapWallet.end())
                 {
-                    BOOST_FOREACH(const CTxIn& txin, wtx.vin)
+                    BOOST_FOREACH(const CTxIn& txin, mi->second.vin)
                     {
                         updated.append(txin.prevout.hash);
                     }
@@ -268,10 +298,18 @@ void MintingTableModel::update()
     if(!updated.empty())
     {
         priv->updateWallet(updated);
-        mintingProxyModel->invalidate(); // Force deletion of empty rows
+        if(mintingProxyModel)
+            mintingProxyModel->invalidate(); // Force deletion of empty rows
     }
 }
 
+void MintingTableModel::loadMore()
+{
+    // Keep the GUI responsive while large wallets load
+    if(priv->loadMore(MODEL_LOAD_CHUNK))
+        QTimer::singleShot(0, this, SLOT(loadMore()));
+}
+
 void MintingTableModel::setMintingProxyModel(MintingFilterProxy *mintingProxy)
 {
     mintingProxyModel = mintingProxy;
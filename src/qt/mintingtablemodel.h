@@ -36,6 +36,8 @@ public:
     QModelIndex index(int row, int column, const QModelIndex & parent = QModelIndex()) const;
 
     void setMintingInterval(int interval);
+    /* Pick up transactions changed in the wallet */
+    void update();
 
 private:
     CWallet* wallet;
@@ -56,7 +58,8 @@ private:
     QString formatTxCoinDay(const KernelRecord *wtx) const;
     QString formatTxPoSReward(KernelRecord *wtx) const;
 private slots:
-    void update();
+    /* Load the next part of the wallet into the model */
+    void loadMore();
 
     friend class MintingTablePriv;
 };
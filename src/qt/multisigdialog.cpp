@@ -432,7 +432,7 @@ void MultisigDialog::on_signTransactionButton_clicked()
         CTransaction tempTx;
         MapPrevTx mapPrevTx;
         CTxDB txdb("r");
-        std::map<uint256, CTxIndex> unused;
+        MapTestPool unused;
         bool fInvalid;
 
         tempTx.vin.push_back(mergedTx.vin[i]);
@@ -51,7 +51,8 @@ class TransactionTablePriv
 public:
     TransactionTablePriv(CWallet *wallet, TransactionTableModel *parent):
             wallet(wallet),
-            parent(parent)
+            parent(parent),
+            loading(false)
     {
     }
     CWallet *wallet;
@@ -63,20 +64,50 @@ public:
      */
     QList<TransactionRecord> cachedWallet;
 
-    /* Query entire wallet anew from core.
+    /* While loading, transactions with a hash above lastLoaded are not
+     * in the model yet and are picked up by loadMore().
+     */
+    bool loading;
+    uint256 lastLoaded;
+
+    /* Query entire wallet anew from core, the rows are filled in by loadMore().
      */
     void refreshWallet()
     {
         OutputDebugStringF("refreshWallet\n");
         cachedWallet.clear();
+        loading = true;
+        lastLoaded = 0;
+    }
+
+    /* Append the next maxTransactions wallet transactions to the model.
+       Returns false once the whole wallet is loaded.
+     */
+    bool loadMore(int maxTransactions)
+    {
+        if(!loading)
+            return false;
+
+        QList<TransactionRecord> toInsert;
         {
             LOCK(wallet->cs_wallet);
-            for(std::map<uint256, CWalletTx>::iterator it = wallet->mapWallet.begin(); it != wallet->mapWallet.end(); ++it)
+            std::map<uint256, CWalletTx>::iterator it = wallet->mapWallet.upper_bound(lastLoaded);
+            for(int n = 0; it != wallet->mapWallet.end() && n < maxTransactions; ++it, ++n)
             {
                 if(TransactionRecord::showTransaction(it->second))
-                    cachedWallet.append(TransactionRecord::decomposeTransaction(wallet, it->second));
+                    toInsert.append(TransactionRecord::decomposeTransaction(wallet, it->second));
+                lastLoaded = it->first;
             }
+            loading = (it != wallet->mapWallet.end());
         }
+
+        if(!toInsert.isEmpty())
+        {
+            parent->beginInsertRows(QModelIndex(), cachedWallet.size(), cachedWallet.size()+toInsert.size()-1);
+            cachedWallet.append(toInsert);
+            parent->endInsertRows();
+        }
+        return loading;
     }
 
     /* Update our model of the wallet incrementally, to synchronize our model of the wallet
@@ -87,6 +118,8 @@ public:
     void updateWallet(const uint256 &hash, int status)
     {
         OutputDebugStringF("updateWallet %s %i\n", hash.ToString().c_str(), status);
+        if(loading && lastLoaded < hash)
+            return;
         {
             LOCK(wallet->cs_wallet);
 
@@ -226,10 +259,7 @@ TransactionTableModel::TransactionTableModel(CWallet* wallet, WalletModel *paren
     columns << QString() << tr("Date") << tr("Type") << tr("Address") << BitcoinUnits::getAmountColumnTitle(walletModel->getOptionsModel()->getDisplayUnit());
 
     priv->refreshWallet();
-
-    QTimer *timer = new QTimer(this);
-    connect(timer, SIGNAL(timeout()), this, SLOT(updateConfirmations()));
-    timer->start(MODEL_UPDATE_DELAY);
+    loadMore();
 
     connect(walletModel->getOptionsModel(), SIGNAL(displayUnitChanged(int)), this, SLOT(updateDisplayUnit()));
 }
@@ -254,6 +284,18 @@ void TransactionTableModel::updateTransaction(const QString &hash, int status)
     priv->updateWallet(updated, status);
 }
 
+void TransactionTableModel::updateTransaction(const uint256 &hash, int status)
+{
+    priv->updateWallet(hash, status);
+}
+
+void TransactionTableModel::loadMore()
+{
+    // Keep the GUI responsive while large wallets load
+    if(priv->loadMore(MODEL_LOAD_CHUNK))
+        QTimer::singleShot(0, this, SLOT(loadMore()));
+}
+
 void TransactionTableModel::updateConfirmations()
 {
     if(nBestHeight != cachedNumBlocks)
@@ -270,8 +312,12 @@ void TransactionTableModel::updateConfirmations()
 
 void TransactionTableModel::refresh()
 {
+    bool wasLoading = priv->loading;
+    beginResetModel();
     priv->refreshWallet();
-    emit dataChanged(index(0, 0), index(priv->size() - 1, Amount));
+    endResetModel();
+    if(!wasLoading)
+        loadMore();
 }
 
 int TransactionTableModel::rowCount(const QModelIndex &parent) const
@@ -8,6 +8,7 @@ class CWallet;
 class TransactionTablePriv;
 class TransactionRecord;
 class WalletModel;
+class uint256;
 
 /** UI model for the transaction table of a wallet.
  */
@@ -58,6 +59,8 @@ public:
     QVariant headerData(int section, Qt::Orientation orientation, int role) const;
     QModelIndex index(int row, int column, const QModelIndex & parent = QModelIndex()) const;
     void refresh();
+    /* Transaction added, removed or changed in the wallet */
+    void updateTransaction(const uint256 &hash, int status);
 private:
     CWallet* wallet;
     WalletModel *walletModel;
@@ -79,6 +82,8 @@ private:
 public slots:
     void updateTransaction(const QString &hash, int status);
     void updateConfirmations();
+    /* Load the next part of the wallet into the model */
+    void loadMore();
     void updateDisplayUnit();
     /** Updates the column title to "Amount (DisplayUnit)" and emits headerDataChanged() signal for table headers to react. */
     void updateAmountColumnTitle();
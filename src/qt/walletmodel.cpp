@@ -19,7 +19,9 @@ WalletModel::WalletModel(CWallet *wallet, OptionsModel *optionsModel, QObject *p
     cachedBalance(0), cachedStake(0), cachedUnconfirmedBalance(0), cachedImmatureBalance(0),
     cachedNumTransactions(0),
     cachedEncryptionStatus(Unencrypted),
-    cachedNumBlocks(0)
+    cachedNumBlocks(0),
+    fPendingBlocks(false),
+    fUpdatePending(false)
 {
     fHaveWatchOnly = wallet->HaveWatchOnly();
 
@@ -27,10 +29,14 @@ WalletModel::WalletModel(CWallet *wallet, OptionsModel *optionsModel, QObject *p
     mintingTableModel = new MintingTableModel(wallet, this);
     transactionTableModel = new TransactionTableModel(wallet, this);
 
-    // This timer will be fired repeatedly to update the balance
-    pollTimer = new QTimer(this);
-    connect(pollTimer, SIGNAL(timeout()), this, SLOT(pollBalanceChanged()));
-    pollTimer->start(MODEL_UPDATE_DELAY);
+    // Fired once after the first change reported by the core, so that
+    // bursts of changes are handled together
+    updateTimer = new QTimer(this);
+    updateTimer->setSingleShot(true);
+    connect(updateTimer, SIGNAL(timeout()), this, SLOT(processPendingUpdates()));
+
+    cachedNumBlocks = nBestHeight;
+    checkBalanceChanged();
 
     subscribeToCoreSignals();
 }
@@ -88,46 +94,92 @@ void WalletModel::updateStatus()
         emit encryptionStatusChanged(newEncryptionStatus);
 }
 
-void WalletModel::pollBalanceChanged()
+void WalletModel::checkBalanceChanged()
 {
-    if(nBestHeight != cachedNumBlocks)
+    CWalletBalances balances;
+    wallet->GetBalances(balances);
+
+    if(cachedBalance != balances.nBalance || cachedStake != balances.nStake || cachedUnconfirmedBalance != balances.nUnconfirmed || cachedImmatureBalance != balances.nImmature)
     {
-        // Balance and number of transactions might have changed
-        cachedNumBlocks = nBestHeight;
-        checkBalanceChanged();
+        cachedBalance = balances.nBalance;
+        cachedStake = balances.nStake;
+        cachedUnconfirmedBalance = balances.nUnconfirmed;
+        cachedImmatureBalance = balances.nImmature;
+        emit balanceChanged(balances.nBalance, balances.nWatchOnlyBalance, balances.nStake, balances.nUnconfirmed, balances.nImmature);
     }
 }
 
-void WalletModel::checkBalanceChanged()
+void WalletModel::queueTransactionChanged(const uint256 &hash)
 {
-    qint64 newBalanceTotal=getBalance(), newBalanceWatchOnly=getBalanceWatchOnly();
-    qint64 newStake = getStake();
-    qint64 newUnconfirmedBalance = getUnconfirmedBalance();
-    qint64 newImmatureBalance = getImmatureBalance();
+    LOCK(cs_pending);
+    setPendingTransactions.insert(hash);
+    if(!fUpdatePending)
+    {
+        fUpdatePending = true;
+        QMetaObject::invokeMethod(this, "scheduleUpdate", Qt::QueuedConnection);
+    }
+}
 
-    if(cachedBalance != newBalanceTotal || cachedStake != newStake || cachedUnconfirmedBalance != newUnconfirmedBalance || cachedImmatureBalance != newImmatureBalance)
+void WalletModel::queueBlocksChanged()
+{
+    LOCK(cs_pending);
+    fPendingBlocks = true;
+    if(!fUpdatePending)
     {
-        cachedBalance = newBalanceTotal;
-        cachedStake = newStake;
-        cachedUnconfirmedBalance = newUnconfirmedBalance;
-        cachedImmatureBalance = newImmatureBalance;
-        emit balanceChanged(newBalanceTotal, newBalanceWatchOnly, newStake, newUnconfirmedBalance, newImmatureBalance);
+        fUpdatePending = true;
+        QMetaObject::invokeMethod(this, "scheduleUpdate", Qt::QueuedConnection);
     }
 }
 
-void WalletModel::updateTransaction(const QString &hash, int status)
+void WalletModel::scheduleUpdate()
+{
+    if(!updateTimer->isActive())
+        updateTimer->start(MODEL_UPDATE_DELAY);
+}
+
+void WalletModel::processPendingUpdates()
 {
+    std::set<uint256> setUpdated;
+    bool fBlocks;
+    {
+        LOCK(cs_pending);
+        setUpdated.swap(setPendingTransactions);
+        fBlocks = fPendingBlocks;
+        fPendingBlocks = false;
+        fUpdatePending = false;
+    }
+
+    // A transaction changed several times is only looked up once. The table
+    // model derives added and removed rows from the wallet itself.
     if(transactionTableModel)
-        transactionTableModel->updateTransaction(hash, status);
+    {
+        BOOST_FOREACH(const uint256 &hash, setUpdated)
+            transactionTableModel->updateTransaction(hash, CT_UPDATED);
+    }
+
+    bool fNewBlocks = fBlocks && nBestHeight != cachedNumBlocks;
+    if(fNewBlocks)
+    {
+        cachedNumBlocks = nBestHeight;
+        if(transactionTableModel)
+            transactionTableModel->updateConfirmations();
+    }
+
+    if(mintingTableModel && (!setUpdated.empty() || fNewBlocks))
+        mintingTableModel->update();
 
     // Balance and number of transactions might have changed
-    checkBalanceChanged();
+    if(!setUpdated.empty() || fNewBlocks)
+        checkBalanceChanged();
 
-    int newNumTransactions = getNumTransactions();
-    if(cachedNumTransactions != newNumTransactions)
+    if(!setUpdated.empty())
     {
-        cachedNumTransactions = newNumTransactions;
-        emit numTransactionsChanged(newNumTransactions);
+        int newNumTransactions = getNumTransactions();
+        if(cachedNumTransactions != newNumTransactions)
+        {
+            cachedNumTransactions = newNumTransactions;
+            emit numTransactionsChanged(newNumTransactions);
+        }
     }
 }
 
@@ -372,9 +424,12 @@ static void NotifyAddressBookChanged(WalletModel *walletmodel, CWallet *wallet,
 static void NotifyTransactionChanged(WalletModel *walletmodel, CWallet *wallet, const uint256 &hash, ChangeType status)
 {
     OutputDebugStringF("NotifyTransactionChanged %s status=%i\n", hash.GetHex().c_str(), status);
-    QMetaObject::invokeMethod(walletmodel, "updateTransaction", Qt::QueuedConnection,
-                              Q_ARG(QString, QString::fromStdString(hash.GetHex())),
-                              Q_ARG(int, status));
+    walletmodel->queueTransactionChanged(hash);
+}
+
+static void NotifyBlocksChanged(WalletModel *walletmodel)
+{
+    walletmodel->queueBlocksChanged();
 }
 
 static void NotifyWatchonlyChanged(WalletModel *walletmodel, bool fHaveWatchonly)
@@ -390,6 +445,7 @@ void WalletModel::subscribeToCoreSignals()
     wallet->NotifyAddressBookChanged.connect(boost::bind(NotifyAddressBookChanged, this, _1, _2, _3, _4, _5));
     wallet->NotifyTransactionChanged.connect(boost::bind(NotifyTransactionChanged, this, _1, _2, _3));
     wallet->NotifyWatchonlyChanged.connect(boost::bind(NotifyWatchonlyChanged, this, _1));
+    uiInterface.NotifyBlocksChanged.connect(boost::bind(NotifyBlocksChanged, this));
 }
 
 void WalletModel::unsubscribeFromCoreSignals()
@@ -399,6 +455,7 @@ void WalletModel::unsubscribeFromCoreSignals()
     wallet->NotifyAddressBookChanged.disconnect(boost::bind(NotifyAddressBookChanged, this, _1, _2, _3, _4, _5));
     wallet->NotifyTransactionChanged.disconnect(boost::bind(NotifyTransactionChanged, this, _1, _2, _3));
     wallet->NotifyWatchonlyChanged.disconnect(boost::bind(NotifyWatchonlyChanged, this, _1));
+    uiInterface.NotifyBlocksChanged.disconnect(boost::bind(NotifyBlocksChanged, this));
 }
 
 // WalletModel::UnlockContext implementation
@@ -4,8 +4,11 @@
 #include <QObject>
 #include <vector>
 #include <map>
+#include <set>
 
 #include "allocators.h" /* for SecureString */
+#include "sync.h"
+#include "uint256.h"
 
 class OptionsModel;
 class AddressTableModel;
@@ -16,7 +19,6 @@ class CKeyID;
 class CPubKey;
 class COutput;
 class COutPoint;
-class uint256;
 class CCoinControl;
 
 QT_BEGIN_NAMESPACE
@@ -159,23 +161,34 @@ private:
     EncryptionStatus cachedEncryptionStatus;
     int cachedNumBlocks;
 
-    QTimer *pollTimer;
+    // Changes reported by the core since the last update, filled from
+    // any thread and handed to the models once per MODEL_UPDATE_DELAY
+    CCriticalSection cs_pending;
+    std::set<uint256> setPendingTransactions;
+    bool fPendingBlocks;
+    bool fUpdatePending;
+    QTimer *updateTimer;
 
     void subscribeToCoreSignals();
     void unsubscribeFromCoreSignals();
     void checkBalanceChanged();
 
+public:
+    // Called from core threads
+    void queueTransactionChanged(const uint256 &hash);
+    void queueBlocksChanged();
+
 public slots:
     /* Wallet status might have changed */
     void updateStatus();
-    /* New transaction, or transaction changed status */
-    void updateTransaction(const QString &hash, int status);
+    /* Start the update timer, if not running yet */
+    void scheduleUpdate();
+    /* Hand transactions changed since the last update to the models */
+    void processPendingUpdates();
     /* New, updated or removed address book entry */
     void updateAddressBook(const QString &address, const QString &label, bool isMine, int status);
     /* Watchonly added */
     void updateWatchOnlyFlag(bool fHaveWatchonly);
-    /* Current, immature or unconfirmed balance might have changed - emit 'balanceChanged' if so */
-    void pollBalanceChanged();
 
 signals:
     // Signal that balance in wallet changed
@@ -5,6 +5,7 @@
 
 #include "main.h"
 #include "bitcoinrpc.h"
+#include "snapshot.h"
 
 using namespace json_spirit;
 using namespace std;
@@ -167,6 +168,26 @@ Value getblockcount(const Array& params, bool fHelp)
 }
 
 
+Value getsigcacheinfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getsigcacheinfo\n"
+            "Returns usage statistics of the signature cache.");
+
+    CSignatureCacheStats stats;
+    GetSignatureCacheStats(stats);
+
+    Object obj;
+    obj.push_back(Pair("entries",     (uint64_t)stats.nEntries));
+    obj.push_back(Pair("capacity",    (uint64_t)stats.nCapacity));
+    obj.push_back(Pair("inserts",     (uint64_t)stats.nInserts));
+    obj.push_back(Pair("hits",        (uint64_t)stats.nHits));
+    obj.push_back(Pair("misses",      (uint64_t)stats.nMisses));
+    obj.push_back(Pair("hitrate",     stats.nHits + stats.nMisses ? (double)stats.nHits / (stats.nHits + stats.nMisses) : 0.0));
+    return obj;
+}
+
 Value getdifficulty(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() != 0)
@@ -273,6 +294,83 @@ Value getblockbynumber(const Array& params, bool fHelp)
     return blockToJSON(block, pblockindex, params.size() > 1 ? params[1].get_bool() : false);
 }
 
+Value getassumevalidinfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getassumevalidinfo\n"
+            "Returns the -assumevalid block and the checks skipped below it,\n"
+            "with the time saved estimated from sampled checks.");
+
+    Object result;
+    result.push_back(Pair("hash", GetAssumeValidHash().GetHex()));
+    result.push_back(Pair("height", GetAssumeValidHeight()));
+
+    vector<CAssumeValidStats> vStats;
+    GetAssumeValidStats(vStats);
+    Object checks;
+    for (int i = 0; i < AV_MAX; i++)
+    {
+        const CAssumeValidStats& stats = vStats[i];
+        Object check;
+        check.push_back(Pair("skipped", stats.nSkipped));
+        check.push_back(Pair("sampled", stats.nSampled));
+        double dAverage = stats.nSampled ? (double)stats.nSampleMicros / stats.nSampled : 0;
+        check.push_back(Pair("sampleaverageus", dAverage));
+        check.push_back(Pair("savedseconds", dAverage * stats.nSkipped / 1000000));
+        checks.push_back(Pair(GetAssumeValidCheckName((AssumeValidCheck)i), check));
+    }
+    result.push_back(Pair("checks", checks));
+    return result;
+}
+
+Value dumpsnapshot(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 2)
+        throw runtime_error(
+            "dumpsnapshot <filename> [height]\n"
+            "Writes the main chain up to [height] with its block index state to <filename>\n"
+            "for -loadsnapshot, and returns the content hash to give as -snapshothash.\n"
+            "Default height is the best block less the coinbase maturity.");
+
+    int nHeight;
+    {
+        LOCK(cs_main);
+        nHeight = max(0, nBestHeight - nCoinbaseMaturity);
+    }
+    if (params.size() > 1)
+        nHeight = params[1].get_int();
+
+    uint256 hashContent;
+    string strError;
+    if (!DumpSnapshot(params[0].get_str(), nHeight, hashContent, strError))
+        throw JSONRPCError(RPC_MISC_ERROR, strError);
+
+    Object result;
+    result.push_back(Pair("height", nHeight));
+    result.push_back(Pair("snapshothash", hashContent.GetHex()));
+    return result;
+}
+
+Value getsnapshotinfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getsnapshotinfo\n"
+            "Returns the imported chain snapshot and how far its blocks are verified.");
+
+    CSnapshotStatus status;
+    GetSnapshotStatus(status);
+
+    Object result;
+    result.push_back(Pair("hash", status.hashBlock.GetHex()));
+    result.push_back(Pair("height", status.nHeight));
+    result.push_back(Pair("verifiedheight", status.nVerifiedHeight));
+    result.push_back(Pair("verifying", status.fVerifying));
+    result.push_back(Pair("failed", status.fFailed));
+    return result;
+}
+
 // get information of sync-checkpoint
 Value getcheckpoint(const Array& params, bool fHelp)
 {
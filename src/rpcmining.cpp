@@ -9,6 +9,8 @@
 #include "init.h"
 #include "miner.h"
 #include "kernel.h"
+#include "stakeforecast.h"
+#include "stratum.h"
 #include "bitcoinrpc.h"
 
 using namespace json_spirit;
@@ -69,6 +71,63 @@ Value getmininginfo(const Array& params, bool fHelp)
     return obj;
 }
 
+Value getstratuminfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getstratuminfo\n"
+            "Returns an object containing stratum server statistics.");
+
+    CStratumStats stats;
+    GetStratumStats(stats);
+
+    Object obj;
+    obj.push_back(Pair("enabled",        GetBoolArg("-stratum")));
+    obj.push_back(Pair("connections",    stats.nConnections));
+    obj.push_back(Pair("jobs",           stats.nJobs));
+    obj.push_back(Pair("sharesaccepted", stats.nSharesAccepted));
+    obj.push_back(Pair("sharesrejected", stats.nSharesRejected));
+    obj.push_back(Pair("blocksfound",    stats.nBlocksFound));
+    return obj;
+}
+
+static const int MAX_STAKE_FORECASTS = 4;             // searches running at once
+static const int64_t STAKE_FORECAST_EXPIRY = 60 * 60; // seconds a finished search waits to be fetched
+
+struct CStakeForecastEntry
+{
+    boost::shared_ptr<CStakeForecast> forecast;
+    int64_t nTimeDone; // 0 until the search is seen finished
+};
+
+static CCriticalSection cs_stakeForecasts;
+static map<int, CStakeForecastEntry> mapStakeForecasts;
+static int nLastStakeForecast = 0;
+static int nStakeScansRunning = 0; // scaninput searches, they count against the same limit
+
+// Drop finished searches nobody fetched in time, returns the number still running
+static int PruneStakeForecasts()
+{
+    int nRunning = 0;
+    int64_t nNow = GetTime();
+    map<int, CStakeForecastEntry>::iterator mi = mapStakeForecasts.begin();
+    while (mi != mapStakeForecasts.end())
+    {
+        CStakeForecastEntry& entry = mi->second;
+        if (!entry.forecast->IsDone())
+            nRunning++;
+        else if (entry.nTimeDone == 0)
+            entry.nTimeDone = nNow;
+        else if (nNow - entry.nTimeDone > STAKE_FORECAST_EXPIRY)
+        {
+            mapStakeForecasts.erase(mi++);
+            continue;
+        }
+        mi++;
+    }
+    return nRunning + nStakeScansRunning;
+}
+
 Value scaninput(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() > 4 || params.size() < 2)
@@ -77,6 +136,7 @@ Value scaninput(const Array& params, bool fHelp)
             "Scan specified input for suitable kernel solutions.\n"
             "    [difficulty] - upper limit for difficulty, current difficulty by default;\n"
             "    [days] - time window, 365 days by default.\n"
+            "Counts against the limit of 4 forecaststake searches running at once.\n"
         );
 
 
@@ -86,68 +146,229 @@ Value scaninput(const Array& params, bool fHelp)
     uint32_t nOut = params[1].get_int(), nBits = GetNextTargetRequired(pindexBest, true), nDays = 365;
 
     if (params.size() > 2)
-    {
-        CBigNum bnTarget(nPoWBase);
-        bnTarget *= 1000;
-        bnTarget /= (int) (params[2].get_real() * 1000);
-        nBits = bnTarget.GetCompact();
-    }
+        nBits = GetStakeForecastBits(params[2].get_real());
 
     if (params.size() > 3)
     {
         nDays = params[3].get_int();
+        if (nDays <= 0 || nDays > 3650)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid number of days");
     }
 
-    CTransaction tx;
-    uint256 hashBlock = 0;
-    if (GetTransaction(hash, tx, hashBlock))
+    CStakeForecastInput input;
+    string strError;
+    if (!GetStakeForecastInput(COutPoint(hash, nOut), input, strError))
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, strError);
+
     {
-        if (nOut > tx.vout.size())
-            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Incorrect output number");
+        LOCK(cs_stakeForecasts);
+        if (PruneStakeForecasts() >= MAX_STAKE_FORECASTS)
+            throw JSONRPCError(RPC_MISC_ERROR, "Too many stake forecasts running, wait or use stopstakeforecast");
+        nStakeScansRunning++;
+    }
+    uint32_t nTimeBegin = GetTime();
+    CStakeForecast forecast(vector<CStakeForecastInput>(1, input), vector<unsigned int>(1, nBits), nTimeBegin, nTimeBegin + nDays * 86400);
+    forecast.Start(boost::thread::hardware_concurrency());
+    forecast.Wait();
+    {
+        LOCK(cs_stakeForecasts);
+        nStakeScansRunning--;
+    }
+
+    vector<vector<CStakeForecastSolution> > vSolutions;
+    forecast.GetSolutions(vSolutions);
+    const CStakeForecastSolution& solution = vSolutions[0][0];
+    if (solution.nTime)
+    {
+        Object r;
+        r.push_back(Pair("hash", solution.hashProofOfStake.GetHex()));
+        r.push_back(Pair("time", DateTimeStrFormat(solution.nTime)));
+
+        return r;
+    }
+
+    return Value::null;
+}
+
+Value forecaststake(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 5)
+        throw runtime_error(
+            "forecaststake <[{\"txid\":txid,\"vout\":n},...]> [days] [mindifficulty] [maxdifficulty] [steps]\n"
+            "Start a background search for the first kernel solution of each input,\n"
+            "an empty list stands for all confirmed wallet outputs.\n"
+            "    [days] - time window, 365 days by default;\n"
+            "    [mindifficulty] - current difficulty by default;\n"
+            "    [maxdifficulty] [steps] - also search at (steps - 1) higher difficulties.\n"
+            "Returns the forecast id for getstakeforecast and stopstakeforecast.\n"
+            "At most 4 searches can run at once.");
+
+    // Checked again when the search is started
+    {
+        LOCK(cs_stakeForecasts);
+        if (PruneStakeForecasts() >= MAX_STAKE_FORECASTS)
+            throw JSONRPCError(RPC_MISC_ERROR, "Too many stake forecasts running, wait or use stopstakeforecast");
+    }
 
-        if (hashBlock == 0)
-            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unable to find transaction in the blockchain");
+    vector<COutPoint> vPrevout;
+    BOOST_FOREACH(const Value& value, params[0].get_array())
+    {
+        const Object& o = value.get_obj();
+        const Value& txid = find_value(o, "txid");
+        const Value& vout = find_value(o, "vout");
+        if (txid.type() != str_type || vout.type() != int_type)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid parameter, expected txid and vout");
+        vPrevout.push_back(COutPoint(uint256(txid.get_str()), vout.get_int()));
+    }
+    if (vPrevout.empty())
+    {
+        vector<COutput> vCoins;
+        {
+            LOCK2(cs_main, pwalletMain->cs_wallet);
+            pwalletMain->AvailableCoinsMinConf(vCoins, 1, 0, MAX_MONEY);
+        }
+        BOOST_FOREACH(const COutput& out, vCoins)
+            vPrevout.push_back(COutPoint(out.tx->GetHash(), out.i));
+    }
 
-        CTxDB txdb("r");
+    int nDays = params.size() > 1 ? params[1].get_int() : 365;
+    if (nDays <= 0 || nDays > 3650)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid number of days");
 
-        CBlock block;
-        CTxIndex txindex;
+    vector<unsigned int> vBits;
+    if (params.size() > 2)
+    {
+        double dMin = params[2].get_real();
+        double dMax = params.size() > 3 ? params[3].get_real() : dMin;
+        int nSteps = params.size() > 4 ? params[4].get_int() : (dMax > dMin ? 10 : 1);
+        if (dMin <= 0 || dMax < dMin || nSteps < 1 || nSteps > 100)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid difficulty range");
+        for (int i = 0; i < nSteps; i++)
+            vBits.push_back(GetStakeForecastBits(nSteps > 1 ? dMin + (dMax - dMin) * i / (nSteps - 1) : dMin));
+    }
+    else
+        vBits.push_back(GetNextTargetRequired(pindexBest, true));
 
-        // Load transaction index item
-        if (!txdb.ReadTxIndex(tx.GetHash(), txindex))
-            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unable to read block index item");
+    vector<CStakeForecastInput> vInputs;
+    BOOST_FOREACH(const COutPoint& prevout, vPrevout)
+    {
+        CStakeForecastInput input;
+        string strError;
+        if (!GetStakeForecastInput(prevout, input, strError))
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, strprintf("%s:%u: %s", prevout.hash.ToString().c_str(), prevout.n, strError.c_str()));
+        vInputs.push_back(input);
+    }
 
-        // Read block header
-        if (!block.ReadFromDisk(txindex.pos.nFile, txindex.pos.nBlockPos, false))
-            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "CBlock::ReadFromDisk() failed");
+    uint32_t nTimeBegin = GetTime();
+    boost::shared_ptr<CStakeForecast> forecast(new CStakeForecast(vInputs, vBits, nTimeBegin, nTimeBegin + nDays * 86400));
+
+    LOCK(cs_stakeForecasts);
+    if (PruneStakeForecasts() >= MAX_STAKE_FORECASTS)
+        throw JSONRPCError(RPC_MISC_ERROR, "Too many stake forecasts running, wait or use stopstakeforecast");
+    forecast->Start(boost::thread::hardware_concurrency());
+    CStakeForecastEntry entry;
+    entry.forecast = forecast;
+    entry.nTimeDone = 0;
+    mapStakeForecasts[++nLastStakeForecast] = entry;
+    return nLastStakeForecast;
+}
 
-        uint64_t nStakeModifier = 0;
-        if (!GetKernelStakeModifier(block.GetHash(), nStakeModifier))
-            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No kernel stake modifier generated yet");
+static double GetStakeForecastDifficulty(unsigned int nBits)
+{
+    CBlockIndex index;
+    index.nBits = nBits;
+    return GetDifficulty(&index);
+}
 
-        std::pair<uint32_t, uint32_t> interval;
-        interval.first = GetTime();
-        // Only count coins meeting min age requirement
-        if (nStakeMinAge + block.nTime > interval.first)
-            interval.first += (nStakeMinAge + block.nTime - interval.first);
-        interval.second = interval.first + nDays * 86400;
+static boost::shared_ptr<CStakeForecast> GetStakeForecast(int nId)
+{
+    LOCK(cs_stakeForecasts);
+    PruneStakeForecasts();
+    map<int, CStakeForecastEntry>::iterator mi = mapStakeForecasts.find(nId);
+    if (mi == mapStakeForecasts.end())
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Unknown forecast id");
+    return mi->second.forecast;
+}
 
-        SHA256_CTX ctx;
-        GetKernelMidstate(nStakeModifier, block.nTime, txindex.pos.nTxPos - txindex.pos.nBlockPos, tx.nTime, nOut, ctx);
+Value getstakeforecast(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 2)
+        throw runtime_error(
+            "getstakeforecast <id> [curves=false]\n"
+            "Returns progress and the solutions found so far by a forecaststake search.\n"
+            "With curves=true, also the probability of staking by the end of each day.\n"
+            "A finished search is discarded once its results are returned, or an hour\n"
+            "after it finished if they are never asked for.");
+
+    int nId = params[0].get_int();
+    boost::shared_ptr<CStakeForecast> forecast = GetStakeForecast(nId);
+    bool fCurves = params.size() > 1 && params[1].get_bool();
+    bool fDone = forecast->IsDone(); // before reading, so the results are final if set
+
+    const vector<CStakeForecastInput>& vInputs = forecast->GetInputs();
+    const vector<unsigned int>& vBits = forecast->GetBits();
+    vector<vector<CStakeForecastSolution> > vSolutions;
+    forecast->GetSolutions(vSolutions);
+
+    Array inputs;
+    for (unsigned int i = 0; i < vInputs.size(); i++)
+    {
+        Object input;
+        input.push_back(Pair("txid", vInputs[i].prevout.hash.GetHex()));
+        input.push_back(Pair("vout", (int)vInputs[i].prevout.n));
+        input.push_back(Pair("amount", ValueFromAmount(vInputs[i].nValue)));
 
-        std::pair<uint256, uint32_t> solution;
-        if (ScanMidstateForward(ctx, nBits, tx.nTime, tx.vout[nOut].nValue, interval, solution))
+        Array solutions;
+        for (unsigned int j = 0; j < vBits.size(); j++)
         {
-            Object r;
-            r.push_back(Pair("hash", solution.first.GetHex()));
-            r.push_back(Pair("time", DateTimeStrFormat(solution.second)));
-
-            return r;
+            Object solution;
+            solution.push_back(Pair("difficulty", GetStakeForecastDifficulty(vBits[j])));
+            if (vSolutions[i][j].nTime)
+            {
+                solution.push_back(Pair("hash", vSolutions[i][j].hashProofOfStake.GetHex()));
+                solution.push_back(Pair("time", DateTimeStrFormat(vSolutions[i][j].nTime)));
+            }
+            if (fCurves)
+            {
+                vector<double> vProbability;
+                forecast->GetProbabilities(i, vBits[j], vProbability);
+                Array curve;
+                BOOST_FOREACH(double dProbability, vProbability)
+                    curve.push_back(dProbability);
+                solution.push_back(Pair("probability", curve));
+            }
+            solutions.push_back(solution);
         }
+        input.push_back(Pair("solutions", solutions));
+        inputs.push_back(input);
     }
-    else
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available about transaction");
 
+    Object result;
+    result.push_back(Pair("done", fDone));
+    result.push_back(Pair("progress", forecast->GetProgress()));
+    result.push_back(Pair("inputs", inputs));
+
+    if (fDone)
+    {
+        LOCK(cs_stakeForecasts);
+        mapStakeForecasts.erase(nId);
+    }
+    return result;
+}
+
+Value stopstakeforecast(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "stopstakeforecast <id>\n"
+            "Cancel a forecaststake search and discard its results.");
+
+    boost::shared_ptr<CStakeForecast> forecast = GetStakeForecast(params[0].get_int());
+    forecast->Cancel();
+    {
+        LOCK(cs_stakeForecasts);
+        mapStakeForecasts.erase(params[0].get_int());
+    }
     return Value::null;
 }
 
@@ -391,6 +612,103 @@ Value getwork(const Array& params, bool fHelp)
 }
 
 
+/** Block template shared by all getblocktemplate callers, never modified once built */
+struct CBlockTemplateCache
+{
+    CBlock block;
+    CBlockIndex* pindexPrev;
+    unsigned int nTransactionsUpdated;
+    int64_t nStart;
+    Array transactions;
+    Array coinbaseBranch;
+    std::string strLongPollId;
+};
+
+static CCriticalSection cs_blocktemplate;
+static boost::shared_ptr<const CBlockTemplateCache> pblocktemplate;
+
+static boost::shared_ptr<const CBlockTemplateCache> BuildBlockTemplate()
+{
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+
+    // Store the pindexBest used before CreateNewBlock, to avoid races
+    boost::shared_ptr<CBlockTemplateCache> ptemplate(new CBlockTemplateCache());
+    ptemplate->nTransactionsUpdated = nTransactionsUpdated;
+    ptemplate->pindexPrev = pindexBest;
+    ptemplate->nStart = GetTime();
+
+    // Create new block
+    auto_ptr<CBlock> pblock(CreateNewBlock(pwalletMain));
+    if (!pblock.get())
+        throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
+    CBlock& block = ptemplate->block;
+    block = *pblock;
+    block.nNonce = 0;
+
+    map<uint256, int64_t> setTxIndex;
+    int i = 0;
+    CTxDB txdb("r");
+    BOOST_FOREACH (CTransaction& tx, block.vtx)
+    {
+        uint256 txHash = tx.GetHash();
+        setTxIndex[txHash] = i++;
+
+        if (tx.IsCoinBase() || tx.IsCoinStake())
+            continue;
+
+        Object entry;
+
+        CDataStream ssTx(SER_NETWORK, PROTOCOL_VERSION);
+        ssTx << tx;
+        entry.push_back(Pair("data", HexStr(ssTx.begin(), ssTx.end())));
+
+        entry.push_back(Pair("hash", txHash.GetHex()));
+
+        MapPrevTx mapInputs;
+        MapTestPool mapUnused;
+        bool fInvalid = false;
+        if (tx.FetchInputs(txdb, mapUnused, false, false, mapInputs, fInvalid))
+        {
+            entry.push_back(Pair("fee", (int64_t)(tx.GetValueIn(mapInputs) - tx.GetValueOut())));
+
+            Array deps;
+            BOOST_FOREACH (MapPrevTx::value_type& inp, mapInputs)
+            {
+                if (setTxIndex.count(inp.first))
+                    deps.push_back(setTxIndex[inp.first]);
+            }
+            entry.push_back(Pair("depends", deps));
+
+            int64_t nSigOps = tx.GetLegacySigOpCount();
+            nSigOps += tx.GetP2SHSigOpCount(mapInputs);
+            entry.push_back(Pair("sigops", nSigOps));
+        }
+
+        ptemplate->transactions.push_back(entry);
+    }
+
+    // The coinbase is the only transaction miners change
+    block.BuildMerkleTree();
+    BOOST_FOREACH(const uint256& hash, block.GetMerkleBranch(0))
+        ptemplate->coinbaseBranch.push_back(hash.GetHex());
+
+    ptemplate->strLongPollId = block.hashPrevBlock.GetHex() + strprintf("%u", ptemplate->nTransactionsUpdated);
+
+    return ptemplate;
+}
+
+static boost::shared_ptr<const CBlockTemplateCache> GetBlockTemplateCache()
+{
+    LOCK(cs_blocktemplate);
+
+    // Update block
+    if (!pblocktemplate || pblocktemplate->pindexPrev != pindexBest ||
+        (pblocktemplate->nTransactionsUpdated != nTransactionsUpdated && GetTime() - pblocktemplate->nStart > 5))
+        pblocktemplate = BuildBlockTemplate();
+
+    return pblocktemplate;
+}
+
 Value getblocktemplate(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() > 1)
@@ -402,6 +720,8 @@ Value getblocktemplate(const Array& params, bool fHelp)
             "  \"transactions\" : contents of non-coinbase transactions that should be included in the next block\n"
             "  \"coinbaseaux\" : data that should be included in coinbase\n"
             "  \"coinbasevalue\" : maximum allowable input to coinbase transaction, including the generation award and transaction fees\n"
+            "  \"coinbasebranch\" : merkle branch of the coinbase transaction\n"
+            "  \"longpollid\" : id to pass as \"longpollid\" to wait for the next template\n"
             "  \"target\" : hash target\n"
             "  \"mintime\" : minimum timestamp appropriate for next block\n"
             "  \"curtime\" : current timestamp\n"
@@ -411,9 +731,12 @@ Value getblocktemplate(const Array& params, bool fHelp)
             "  \"sizelimit\" : limit of block size\n"
             "  \"bits\" : compressed target of next block\n"
             "  \"height\" : height of the next block\n"
+            "With \"longpollid\" in [params] the call waits until the best block changes,\n"
+            "or until the memory pool changed and a minute has passed.\n"
             "See https://en.bitcoin.it/wiki/BIP_0022 for full specification.");
 
     std::string strMode = "template";
+    Value lpval;
     if (params.size() > 0)
     {
         const Object& oparam = params[0].get_obj();
@@ -426,6 +749,7 @@ Value getblocktemplate(const Array& params, bool fHelp)
         }
         else
             throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid mode");
+        lpval = find_value(oparam, "longpollid");
     }
 
     if (strMode != "template")
@@ -437,113 +761,58 @@ Value getblocktemplate(const Array& params, bool fHelp)
     if (IsInitialBlockDownload())
         throw JSONRPCError(RPC_CLIENT_IN_INITIAL_DOWNLOAD, "NovaCoin is downloading blocks...");
 
-    static CReserveKey reservekey(pwalletMain);
-
-    // Update block
-    static unsigned int nTransactionsUpdatedLast;
-    static CBlockIndex* pindexPrev;
-    static int64_t nStart;
-    static CBlock* pblock;
-    if (pindexPrev != pindexBest ||
-        (nTransactionsUpdated != nTransactionsUpdatedLast && GetTime() - nStart > 5))
+    if (lpval.type() == str_type)
     {
-        // Clear pindexPrev so future calls make a new block, despite any failures from here on
-        pindexPrev = NULL;
-
-        // Store the pindexBest used before CreateNewBlock, to avoid races
-        nTransactionsUpdatedLast = nTransactionsUpdated;
-        CBlockIndex* pindexPrevNew = pindexBest;
-        nStart = GetTime();
-
-        // Create new block
-        if(pblock)
+        // Long polling, the id is the previous block hash followed by nTransactionsUpdated
+        const std::string& strLongPollId = lpval.get_str();
+        if (strLongPollId.size() <= 64)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid longpollid");
+        uint256 hashWatched(strLongPollId.substr(0, 64));
+        unsigned int nTransactionsUpdatedWatched = strtoul(strLongPollId.substr(64).c_str(), NULL, 10);
+
+        // Wait for the tip first, then return once the memory pool changed too
+        int64_t nMempoolDeadline = GetTime() + 60;
+        boost::unique_lock<CWaitableCriticalSection> lock(csBestBlock);
+        while (pindexBest->GetBlockHash() == hashWatched && !fShutdown)
         {
-            delete pblock;
-            pblock = NULL;
+            if (nTransactionsUpdated != nTransactionsUpdatedWatched && GetTime() >= nMempoolDeadline)
+                break;
+            cvBlockChange.timed_wait(lock, boost::posix_time::seconds(1));
         }
-        pblock = CreateNewBlock(pwalletMain);
-        if (!pblock)
-            throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
-
-        // Need to update only after we know CreateNewBlock succeeded
-        pindexPrev = pindexPrevNew;
+        if (fShutdown)
+            throw JSONRPCError(RPC_CLIENT_NOT_CONNECTED, "Shutting down");
     }
 
-    // Update nTime
-    pblock->UpdateTime(pindexPrev);
-    pblock->nNonce = 0;
-
-    Array transactions;
-    map<uint256, int64_t> setTxIndex;
-    int i = 0;
-    CTxDB txdb("r");
-    BOOST_FOREACH (CTransaction& tx, pblock->vtx)
-    {
-        uint256 txHash = tx.GetHash();
-        setTxIndex[txHash] = i++;
-
-        if (tx.IsCoinBase() || tx.IsCoinStake())
-            continue;
-
-        Object entry;
-
-        CDataStream ssTx(SER_NETWORK, PROTOCOL_VERSION);
-        ssTx << tx;
-        entry.push_back(Pair("data", HexStr(ssTx.begin(), ssTx.end())));
-
-        entry.push_back(Pair("hash", txHash.GetHex()));
-
-        MapPrevTx mapInputs;
-        map<uint256, CTxIndex> mapUnused;
-        bool fInvalid = false;
-        if (tx.FetchInputs(txdb, mapUnused, false, false, mapInputs, fInvalid))
-        {
-            entry.push_back(Pair("fee", (int64_t)(tx.GetValueIn(mapInputs) - tx.GetValueOut())));
-
-            Array deps;
-            BOOST_FOREACH (MapPrevTx::value_type& inp, mapInputs)
-            {
-                if (setTxIndex.count(inp.first))
-                    deps.push_back(setTxIndex[inp.first]);
-            }
-            entry.push_back(Pair("depends", deps));
-
-            int64_t nSigOps = tx.GetLegacySigOpCount();
-            nSigOps += tx.GetP2SHSigOpCount(mapInputs);
-            entry.push_back(Pair("sigops", nSigOps));
-        }
-
-        transactions.push_back(entry);
-    }
+    boost::shared_ptr<const CBlockTemplateCache> ptemplate = GetBlockTemplateCache();
+    const CBlock& block = ptemplate->block;
 
     Object aux;
     aux.push_back(Pair("flags", HexStr(COINBASE_FLAGS.begin(), COINBASE_FLAGS.end())));
 
-    uint256 hashTarget = CBigNum().SetCompact(pblock->nBits).getuint256();
+    uint256 hashTarget = CBigNum().SetCompact(block.nBits).getuint256();
 
-    static Array aMutable;
-    if (aMutable.empty())
-    {
-        aMutable.push_back("time");
-        aMutable.push_back("transactions");
-        aMutable.push_back("prevblock");
-    }
+    Array aMutable;
+    aMutable.push_back("time");
+    aMutable.push_back("transactions");
+    aMutable.push_back("prevblock");
 
     Object result;
-    result.push_back(Pair("version", pblock->nVersion));
-    result.push_back(Pair("previousblockhash", pblock->hashPrevBlock.GetHex()));
-    result.push_back(Pair("transactions", transactions));
+    result.push_back(Pair("version", block.nVersion));
+    result.push_back(Pair("previousblockhash", block.hashPrevBlock.GetHex()));
+    result.push_back(Pair("transactions", ptemplate->transactions));
     result.push_back(Pair("coinbaseaux", aux));
-    result.push_back(Pair("coinbasevalue", (int64_t)pblock->vtx[0].vout[0].nValue));
+    result.push_back(Pair("coinbasevalue", (int64_t)block.vtx[0].vout[0].nValue));
+    result.push_back(Pair("coinbasebranch", ptemplate->coinbaseBranch));
+    result.push_back(Pair("longpollid", ptemplate->strLongPollId));
     result.push_back(Pair("target", hashTarget.GetHex()));
-    result.push_back(Pair("mintime", (int64_t)pindexPrev->GetMedianTimePast()+1));
+    result.push_back(Pair("mintime", (int64_t)ptemplate->pindexPrev->GetMedianTimePast()+1));
     result.push_back(Pair("mutable", aMutable));
     result.push_back(Pair("noncerange", "00000000ffffffff"));
     result.push_back(Pair("sigoplimit", (int64_t)MAX_BLOCK_SIGOPS));
     result.push_back(Pair("sizelimit", (int64_t)MAX_BLOCK_SIZE));
-    result.push_back(Pair("curtime", (int64_t)pblock->nTime));
-    result.push_back(Pair("bits", HexBits(pblock->nBits)));
-    result.push_back(Pair("height", (int64_t)(pindexPrev->nHeight+1)));
+    result.push_back(Pair("curtime", max(block.GetBlockTime(), GetAdjustedTime())));
+    result.push_back(Pair("bits", HexBits(block.nBits)));
+    result.push_back(Pair("height", (int64_t)(ptemplate->pindexPrev->nHeight+1)));
 
     return result;
 }
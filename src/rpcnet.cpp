@@ -344,4 +344,60 @@ Value getnettotals(const Array& params, bool fHelp)
     obj.push_back(Pair("totalbytessent", static_cast<uint64_t>(CNode::GetTotalBytesSent())));
     obj.push_back(Pair("timemillis", static_cast<int64_t>(GetTimeMillis())));
     return obj;
-}
\ No newline at end of file
+}
+
+Value getlockprofile(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() > 1)
+        throw runtime_error(
+            "getlockprofile [reset=false]\n"
+            "Returns lock contention statistics per LOCK/TRY_LOCK call site, sorted by total wait.\n"
+            "Times are in microseconds, histogram bucket i counts times from 2^i up to 2^(i+1) us,\n"
+            "bucket 0 also counts times below 1 us and the last bucket all longer times.\n"
+            "Requires -lockprofile, or reset=true to start profiling now.");
+
+    bool fReset = params.size() > 0 && params[0].get_bool();
+
+    std::vector<CLockProfileEntry> vEntries;
+    GetLockProfile(vEntries);
+
+    Array ret;
+    BOOST_FOREACH(const CLockProfileEntry& entry, vEntries)
+    {
+        Object obj;
+        obj.push_back(Pair("lock",        entry.strName));
+        obj.push_back(Pair("location",    entry.strLocation));
+        obj.push_back(Pair("acquired",    entry.nAcquired));
+        obj.push_back(Pair("contended",   entry.nContended));
+        obj.push_back(Pair("waittime",    entry.nWaitMicros));
+        obj.push_back(Pair("holdtime",    entry.nHoldMicros));
+        obj.push_back(Pair("tryattempts", entry.nTryAttempts));
+        obj.push_back(Pair("tryfailed",   entry.nTryFailed));
+        obj.push_back(Pair("tryfailrate", entry.nTryAttempts ? (double)entry.nTryFailed / entry.nTryAttempts : 0.0));
+
+        // Histograms without the empty tail
+        Array waithist, holdhist;
+        int nWaitLast = -1, nHoldLast = -1;
+        for (int i = 0; i < LOCKPROFILE_BUCKETS; i++)
+        {
+            if (entry.vWaitHist[i])
+                nWaitLast = i;
+            if (entry.vHoldHist[i])
+                nHoldLast = i;
+        }
+        for (int i = 0; i <= nWaitLast; i++)
+            waithist.push_back(entry.vWaitHist[i]);
+        for (int i = 0; i <= nHoldLast; i++)
+            holdhist.push_back(entry.vHoldHist[i]);
+        obj.push_back(Pair("waithist",    waithist));
+        obj.push_back(Pair("holdhist",    holdhist));
+        ret.push_back(obj);
+    }
+
+    if (fReset)
+    {
+        ResetLockProfile();
+        fLockProfile = true;
+    }
+    return ret;
+}
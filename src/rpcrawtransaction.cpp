@@ -386,7 +386,7 @@ Value signrawtransaction(const Array& params, bool fHelp)
         CTransaction tempTx;
         MapPrevTx mapPrevTx;
         CTxDB txdb("r");
-        map<uint256, CTxIndex> unused;
+        MapTestPool unused;
         bool fInvalid;
 
         // FetchInputs aborts on failure, so we go one at a time.
@@ -665,3 +665,210 @@ Value createmultisig(const Array& params, bool fHelp)
 
     return result;
 }
+
+// Reproducible random numbers for checkscripttemplates
+class CScriptCheckRand
+{
+private:
+    uint256 state;
+
+public:
+    CScriptCheckRand(uint64_t nSeed) : state(nSeed) { }
+
+    uint64_t Next()
+    {
+        state = Hash(BEGIN(state), END(state));
+        return state.Get64();
+    }
+
+    int Next(int nMax)
+    {
+        return (int)(Next() % nMax);
+    }
+
+    vector<unsigned char> Bytes(int nSize)
+    {
+        vector<unsigned char> vch(nSize);
+        for (int i = 0; i < nSize; i++)
+            vch[i] = (unsigned char)Next();
+        return vch;
+    }
+};
+
+// Replace s of a DER signature by order - s, which is valid but not low S
+static void SetHighS(vector<unsigned char>& vchSig)
+{
+    unsigned int nLenR = vchSig[3];
+    unsigned int nLenS = vchSig[5 + nLenR];
+    CBigNum bnOrder, bnS;
+    bnOrder.SetHex("FFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFEBAAEDCE6AF48A03BBFD25E8CD0364141");
+    BN_bin2bn(&vchSig[6 + nLenR], nLenS, &bnS);
+    bnS = bnOrder - bnS;
+
+    vector<unsigned char> vchS(BN_num_bytes(&bnS));
+    BN_bn2bin(&bnS, &vchS[0]);
+    if (vchS[0] & 0x80)
+        vchS.insert(vchS.begin(), 0);
+
+    vector<unsigned char> vchNew(vchSig.begin(), vchSig.begin() + 4 + nLenR);
+    vchNew.push_back(0x02);
+    vchNew.push_back(vchS.size());
+    vchNew.insert(vchNew.end(), vchS.begin(), vchS.end());
+    vchNew.push_back(vchSig.back());
+    vchNew[1] = vchNew.size() - 3;
+    vchSig.swap(vchNew);
+}
+
+Value checkscripttemplates(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() > 2)
+        throw runtime_error(
+            "checkscripttemplates [rounds=1000] [seed=0]\n"
+            "Verifies random pay-to-pubkey, pay-to-pubkey-hash and pay-to-script-hash\n"
+            "spends, with and without damaged signatures, scripts and encodings, both\n"
+            "with the template fast path and the script interpreter, and reports any\n"
+            "spend on which they disagree. The same seed gives the same spends.\n"
+            "A debugging aid, only served with -debug, at most 10000 rounds.");
+
+    if (!mapArgs.count("-debug"))
+        throw JSONRPCError(RPC_METHOD_NOT_FOUND, "checkscripttemplates requires -debug");
+
+    int nRounds = params.size() > 0 ? params[0].get_int() : 1000;
+    uint64_t nSeed = params.size() > 1 ? params[1].get_int64() : 0;
+    if (nRounds < 0 || nRounds > 10000)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid rounds, 0 to 10000");
+
+    CScriptCheckRand rand(nSeed);
+
+    // Compressed and uncompressed keys
+    vector<CKey> vKey(4);
+    for (unsigned int i = 0; i < vKey.size(); i++)
+    {
+        vector<unsigned char> vch = rand.Bytes(32);
+        vKey[i].SetSecret(CSecret(vch.begin(), vch.end()), i % 2 == 0);
+    }
+
+    static const int pnHashType[] = { SIGHASH_ALL, SIGHASH_NONE, SIGHASH_SINGLE, SIGHASH_ALL|SIGHASH_ANYONECANPAY,
+                                      SIGHASH_NONE|SIGHASH_ANYONECANPAY, SIGHASH_SINGLE|SIGHASH_ANYONECANPAY, 0, 4 };
+    static const unsigned int pnFlags[] = { SCRIPT_VERIFY_P2SH, SCRIPT_VERIFY_STRICTENC, SCRIPT_VERIFY_LOW_S, SCRIPT_VERIFY_NULLDUMMY };
+
+    int nValid = 0, nInvalid = 0, nMismatches = 0;
+    Object firstMismatch;
+    for (int nRound = 0; nRound < nRounds; nRound++)
+    {
+        CTransaction txTo;
+        txTo.nTime = (unsigned int)rand.Next();
+        txTo.vin.resize(2);
+        for (unsigned int i = 0; i < txTo.vin.size(); i++)
+            txTo.vin[i].prevout = COutPoint(Hash(BEGIN(nRound), END(nRound), BEGIN(i), END(i)), rand.Next(4));
+        txTo.vout.resize(1 + rand.Next(2));
+        for (unsigned int i = 0; i < txTo.vout.size(); i++)
+        {
+            txTo.vout[i].nValue = rand.Next(100 * COIN);
+            txTo.vout[i].scriptPubKey << OP_DUP << OP_HASH160 << rand.Bytes(20) << OP_EQUALVERIFY << OP_CHECKSIG;
+        }
+        unsigned int nIn = rand.Next(2);
+
+        // Output being spent: 0 pubkey hash, 1 pubkey, 2-4 the same or
+        // 1-of-2 multisig behind a script hash
+        CKey& key = vKey[rand.Next(vKey.size())];
+        CKey& keyOther = vKey[rand.Next(vKey.size())];
+        int nType = rand.Next(5);
+        CScript scriptCode;
+        if (nType == 0 || nType == 2)
+            scriptCode.SetDestination(key.GetPubKey().GetID());
+        else if (nType == 1 || nType == 3)
+            scriptCode << key.GetPubKey().Raw() << OP_CHECKSIG;
+        else
+            scriptCode << OP_1 << key.GetPubKey().Raw() << keyOther.GetPubKey().Raw() << OP_2 << OP_CHECKMULTISIG;
+        CScript scriptPubKey = scriptCode;
+        if (nType >= 2)
+            scriptPubKey.SetDestination(scriptCode.GetID());
+
+        int nHashType = pnHashType[rand.Next(ARRAYLEN(pnHashType))];
+        vector<unsigned char> vchSig;
+        CKey& keySign = rand.Next(8) == 0 ? keyOther : key;
+        keySign.Sign(SignatureHash(scriptCode, txTo, nIn, nHashType), vchSig);
+        vchSig.push_back((unsigned char)nHashType);
+
+        vector<vector<unsigned char> > vPush;
+        if (nType == 4)
+            vPush.push_back(rand.Next(8) == 0 ? rand.Bytes(1) : vector<unsigned char>());
+        vPush.push_back(vchSig);
+        if (nType == 0 || nType == 2)
+            vPush.push_back((rand.Next(8) == 0 ? keyOther : key).GetPubKey().Raw());
+        if (nType >= 2)
+            vPush.push_back(vector<unsigned char>(scriptCode.begin(), scriptCode.end()));
+
+        // Damage about half of the spends, or make the signature high S
+        int nNonMinimal = -1;
+        bool fNonPush = false;
+        switch (rand.Next(16))
+        {
+        case 0: {
+            vector<unsigned char>& vch = vPush[rand.Next(vPush.size())];
+            if (!vch.empty())
+                vch[rand.Next(vch.size())] ^= 1 << rand.Next(8);
+            break;
+        }
+        case 1: vchSig.resize(rand.Next(vchSig.size())); vPush[nType == 4 ? 1 : 0] = vchSig; break;
+        case 2: vPush.erase(vPush.begin() + rand.Next(vPush.size())); break;
+        case 3: vPush.insert(vPush.begin() + rand.Next(vPush.size() + 1), rand.Bytes(rand.Next(3) * 20)); break;
+        case 4: nNonMinimal = rand.Next(vPush.size()); break;
+        case 5: fNonPush = true; break;
+        case 6: scriptPubKey[rand.Next(scriptPubKey.size())] ^= 1 << rand.Next(8); break;
+        case 7: if (vPush.size() > 1) swap(vPush[0], vPush[1]); break;
+        case 8: SetHighS(vPush[nType == 4 ? 1 : 0]); break;
+        }
+
+        CScript scriptSig;
+        for (unsigned int i = 0; i < vPush.size(); i++)
+        {
+            if (fNonPush && i == vPush.size() - 1)
+                scriptSig << OP_NOP;
+            if ((int)i == nNonMinimal && vPush[i].size() < 256)
+            {
+                scriptSig.insert(scriptSig.end(), (unsigned char)OP_PUSHDATA1);
+                scriptSig.insert(scriptSig.end(), (unsigned char)vPush[i].size());
+                scriptSig.insert(scriptSig.end(), vPush[i].begin(), vPush[i].end());
+            }
+            else if (vPush[i].empty())
+                scriptSig << OP_0;
+            else
+                scriptSig << vPush[i];
+        }
+
+        unsigned int flags = SCRIPT_VERIFY_NOCACHE;
+        for (unsigned int i = 0; i < ARRAYLEN(pnFlags); i++)
+            if (rand.Next(2))
+                flags |= pnFlags[i];
+        int nHashTypeRequired = rand.Next(4) == 0 ? pnHashType[rand.Next(ARRAYLEN(pnHashType))] : 0;
+
+        CSigHashCache sighashcache(txTo);
+        const CSigHashCache* pSigHashCache = rand.Next(2) ? &sighashcache : NULL;
+        bool fTemplate = VerifyScript(scriptSig, scriptPubKey, txTo, nIn, flags, nHashTypeRequired, pSigHashCache);
+        bool fInterpreter = VerifyScript(scriptSig, scriptPubKey, txTo, nIn, flags | SCRIPT_VERIFY_NOTEMPLATE, nHashTypeRequired, pSigHashCache);
+        if (fInterpreter)
+            nValid++;
+        else
+            nInvalid++;
+        if (fTemplate != fInterpreter && nMismatches++ == 0)
+        {
+            firstMismatch.push_back(Pair("round", nRound));
+            firstMismatch.push_back(Pair("scriptSig", HexStr(scriptSig.begin(), scriptSig.end())));
+            firstMismatch.push_back(Pair("scriptPubKey", HexStr(scriptPubKey.begin(), scriptPubKey.end())));
+            firstMismatch.push_back(Pair("flags", (int)flags));
+            firstMismatch.push_back(Pair("template", fTemplate));
+            firstMismatch.push_back(Pair("interpreter", fInterpreter));
+        }
+    }
+
+    Object result;
+    result.push_back(Pair("rounds", nRounds));
+    result.push_back(Pair("valid", nValid));
+    result.push_back(Pair("invalid", nInvalid));
+    result.push_back(Pair("mismatches", nMismatches));
+    if (nMismatches > 0)
+        result.push_back(Pair("firstmismatch", firstMismatch));
+    return result;
+}
@@ -3,7 +3,6 @@
 // Distributed under the MIT/X11 software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 #include <boost/foreach.hpp>
-#include <boost/tuple/tuple.hpp>
 
 using namespace std;
 using namespace boost;
@@ -16,27 +15,16 @@ using namespace boost;
 #include "sync.h"
 #include "util.h"
 
-bool CheckSig(vector<unsigned char> vchSig, const vector<unsigned char> &vchPubKey, const CScript &scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, int flags);
+bool CheckSig(vector<unsigned char> vchSig, const vector<unsigned char> &vchPubKey, const CScript &scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, int flags, const CSigHashCache* pSigHashCache = NULL);
 
-static const valtype vchFalse(0);
-static const valtype vchZero(0);
-static const valtype vchTrue(1, 1);
-static const CBigNum bnZero(0);
-static const CBigNum bnOne(1);
-static const CBigNum bnFalse(0);
-static const CBigNum bnTrue(1);
-static const size_t nMaxNumSize = 4;
+static const unsigned char pchTrue[] = { 1 };
+static const CScriptValue vchFalse;
+static const CScriptValue vchTrue(pchTrue, pchTrue + 1);
+static const CScriptNum bnZero(0);
+static const CScriptNum bnOne(1);
 
 
-CBigNum CastToBigNum(const valtype& vch)
-{
-    if (vch.size() > nMaxNumSize)
-        throw runtime_error("CastToBigNum() : overflow");
-    // Get rid of extra leading zeros
-    return CBigNum(CBigNum(vch).getvch());
-}
-
-bool CastToBool(const valtype& vch)
+bool CastToBool(const CScriptValue& vch)
 {
     for (unsigned int i = 0; i < vch.size(); i++)
     {
@@ -85,7 +73,7 @@ void MakeSameSize(valtype& vch1, valtype& vch2)
 //
 #define stacktop(i)  (stack.at(stack.size()+(i)))
 #define altstacktop(i)  (altstack.at(altstack.size()+(i)))
-static inline void popstack(vector<valtype>& stack)
+static inline void popstack(CScriptStack& stack)
 {
     if (stack.empty())
         throw runtime_error("popstack() : stack empty");
@@ -337,16 +325,29 @@ bool IsCanonicalSignature(const valtype &vchSig, unsigned int flags) {
     return IsDERSignature(vchSig, true, (flags & SCRIPT_VERIFY_LOW_S) != 0);
 }
 
-bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType)
+// Drop a signature from the script code, copying the script only if it is actually there
+static void DropSignature(const CScript*& pscriptCode, CScript& scriptTmp, const valtype& vchSig)
+{
+    CScript scriptSig(vchSig);
+    if (search(pscriptCode->begin(), pscriptCode->end(), scriptSig.begin(), scriptSig.end()) == pscriptCode->end())
+        return;
+    if (pscriptCode != &scriptTmp)
+    {
+        scriptTmp = *pscriptCode;
+        pscriptCode = &scriptTmp;
+    }
+    scriptTmp.FindAndDelete(scriptSig);
+}
+
+bool EvalScript(CScriptStack& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType, const CSigHashCache* pSigHashCache)
 {
-    CAutoBN_CTX pctx;
     CScript::const_iterator pc = script.begin();
     CScript::const_iterator pend = script.end();
     CScript::const_iterator pbegincodehash = script.begin();
     opcodetype opcode;
-    valtype vchPushValue;
+    CScript::const_iterator pvchPushValue;
     vector<bool> vfExec;
-    vector<valtype> altstack;
+    CScriptStack altstack;
     if (script.size() > 10000)
         return false;
     int nOpCount = 0;
@@ -360,9 +361,9 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
             //
             // Read instruction
             //
-            if (!script.GetOp(pc, opcode, vchPushValue))
+            if (!script.GetOp(pc, opcode, pvchPushValue))
                 return false;
-            if (vchPushValue.size() > MAX_SCRIPT_ELEMENT_SIZE)
+            if (pc - pvchPushValue > (ptrdiff_t)MAX_SCRIPT_ELEMENT_SIZE)
                 return false;
             if (opcode > OP_16 && ++nOpCount > 201)
                 return false;
@@ -385,7 +386,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                 return false; // Disabled opcodes.
 
             if (fExec && 0 <= opcode && opcode <= OP_PUSHDATA4)
-                stack.push_back(vchPushValue);
+                stack.push_back(CScriptValue(pvchPushValue, pc));
             else if (fExec || (OP_IF <= opcode && opcode <= OP_ENDIF))
             switch (opcode)
             {
@@ -411,7 +412,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                 case OP_16:
                 {
                     // ( -- value)
-                    CBigNum bn((int)opcode - (int)(OP_1 - 1));
+                    CScriptNum bn((int)opcode - (int)(OP_1 - 1));
                     stack.push_back(bn.getvch());
                 }
                 break;
@@ -434,7 +435,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     {
                         if (stack.size() < 1)
                             return false;
-                        valtype& vch = stacktop(-1);
+                        CScriptValue& vch = stacktop(-1);
                         fValue = CastToBool(vch);
                         if (opcode == OP_NOTIF)
                             fValue = !fValue;
@@ -517,8 +518,8 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x1 x2 -- x1 x2 x1 x2)
                     if (stack.size() < 2)
                         return false;
-                    valtype vch1 = stacktop(-2);
-                    valtype vch2 = stacktop(-1);
+                    CScriptValue vch1 = stacktop(-2);
+                    CScriptValue vch2 = stacktop(-1);
                     stack.push_back(vch1);
                     stack.push_back(vch2);
                 }
@@ -529,9 +530,9 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x1 x2 x3 -- x1 x2 x3 x1 x2 x3)
                     if (stack.size() < 3)
                         return false;
-                    valtype vch1 = stacktop(-3);
-                    valtype vch2 = stacktop(-2);
-                    valtype vch3 = stacktop(-1);
+                    CScriptValue vch1 = stacktop(-3);
+                    CScriptValue vch2 = stacktop(-2);
+                    CScriptValue vch3 = stacktop(-1);
                     stack.push_back(vch1);
                     stack.push_back(vch2);
                     stack.push_back(vch3);
@@ -543,8 +544,8 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x1 x2 x3 x4 -- x1 x2 x3 x4 x1 x2)
                     if (stack.size() < 4)
                         return false;
-                    valtype vch1 = stacktop(-4);
-                    valtype vch2 = stacktop(-3);
+                    CScriptValue vch1 = stacktop(-4);
+                    CScriptValue vch2 = stacktop(-3);
                     stack.push_back(vch1);
                     stack.push_back(vch2);
                 }
@@ -555,8 +556,8 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x1 x2 x3 x4 x5 x6 -- x3 x4 x5 x6 x1 x2)
                     if (stack.size() < 6)
                         return false;
-                    valtype vch1 = stacktop(-6);
-                    valtype vch2 = stacktop(-5);
+                    CScriptValue vch1 = stacktop(-6);
+                    CScriptValue vch2 = stacktop(-5);
                     stack.erase(stack.end()-6, stack.end()-4);
                     stack.push_back(vch1);
                     stack.push_back(vch2);
@@ -578,7 +579,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x - 0 | x x)
                     if (stack.size() < 1)
                         return false;
-                    valtype vch = stacktop(-1);
+                    CScriptValue vch = stacktop(-1);
                     if (CastToBool(vch))
                         stack.push_back(vch);
                 }
@@ -587,7 +588,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                 case OP_DEPTH:
                 {
                     // -- stacksize
-                    CBigNum bn((uint16_t) stack.size());
+                    CScriptNum bn((uint16_t) stack.size());
                     stack.push_back(bn.getvch());
                 }
                 break;
@@ -606,7 +607,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x -- x x)
                     if (stack.size() < 1)
                         return false;
-                    valtype vch = stacktop(-1);
+                    CScriptValue vch = stacktop(-1);
                     stack.push_back(vch);
                 }
                 break;
@@ -625,7 +626,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x1 x2 -- x1 x2 x1)
                     if (stack.size() < 2)
                         return false;
-                    valtype vch = stacktop(-2);
+                    CScriptValue vch = stacktop(-2);
                     stack.push_back(vch);
                 }
                 break;
@@ -637,11 +638,11 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (xn ... x2 x1 x0 n - ... x2 x1 x0 xn)
                     if (stack.size() < 2)
                         return false;
-                    int n = CastToBigNum(stacktop(-1)).getint32();
+                    int n = CScriptNum(stacktop(-1)).getint();
                     popstack(stack);
                     if (n < 0 || n >= (int)stack.size())
                         return false;
-                    valtype vch = stacktop(-n-1);
+                    CScriptValue vch = stacktop(-n-1);
                     if (opcode == OP_ROLL)
                         stack.erase(stack.end()-n-1);
                     stack.push_back(vch);
@@ -674,7 +675,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x1 x2 -- x2 x1 x2)
                     if (stack.size() < 2)
                         return false;
-                    valtype vch = stacktop(-1);
+                    CScriptValue vch = stacktop(-1);
                     stack.insert(stack.end()-2, vch);
                 }
                 break;
@@ -685,7 +686,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (in -- in size)
                     if (stack.size() < 1)
                         return false;
-                    CBigNum bn((uint16_t) stacktop(-1).size());
+                    CScriptNum bn((uint16_t) stacktop(-1).size());
                     stack.push_back(bn.getvch());
                 }
                 break;
@@ -701,8 +702,8 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x1 x2 - bool)
                     if (stack.size() < 2)
                         return false;
-                    valtype& vch1 = stacktop(-2);
-                    valtype& vch2 = stacktop(-1);
+                    CScriptValue& vch1 = stacktop(-2);
+                    CScriptValue& vch2 = stacktop(-1);
                     bool fEqual = (vch1 == vch2);
                     // OP_NOTEQUAL is disabled because it would be too easy to say
                     // something like n != 1 and have some wiseguy pass in 1 with extra
@@ -736,15 +737,15 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (in -- out)
                     if (stack.size() < 1)
                         return false;
-                    CBigNum bn = CastToBigNum(stacktop(-1));
+                    CScriptNum bn(stacktop(-1));
                     switch (opcode)
                     {
-                    case OP_1ADD:       bn += bnOne; break;
-                    case OP_1SUB:       bn -= bnOne; break;
+                    case OP_1ADD:       bn = bn + bnOne; break;
+                    case OP_1SUB:       bn = bn - bnOne; break;
                     case OP_NEGATE:     bn = -bn; break;
                     case OP_ABS:        if (bn < bnZero) bn = -bn; break;
-                    case OP_NOT:        bn = (bn == bnZero); break;
-                    case OP_0NOTEQUAL:  bn = (bn != bnZero); break;
+                    case OP_NOT:        bn = CScriptNum(bn == bnZero); break;
+                    case OP_0NOTEQUAL:  bn = CScriptNum(bn != bnZero); break;
                     default:            assert(!"invalid opcode"); break;
                     }
                     popstack(stack);
@@ -769,9 +770,9 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x1 x2 -- out)
                     if (stack.size() < 2)
                         return false;
-                    CBigNum bn1 = CastToBigNum(stacktop(-2));
-                    CBigNum bn2 = CastToBigNum(stacktop(-1));
-                    CBigNum bn;
+                    CScriptNum bn1(stacktop(-2));
+                    CScriptNum bn2(stacktop(-1));
+                    CScriptNum bn(0);
                     switch (opcode)
                     {
                     case OP_ADD:
@@ -782,15 +783,15 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                         bn = bn1 - bn2;
                         break;
 
-                    case OP_BOOLAND:             bn = (bn1 != bnZero && bn2 != bnZero); break;
-                    case OP_BOOLOR:              bn = (bn1 != bnZero || bn2 != bnZero); break;
-                    case OP_NUMEQUAL:            bn = (bn1 == bn2); break;
-                    case OP_NUMEQUALVERIFY:      bn = (bn1 == bn2); break;
-                    case OP_NUMNOTEQUAL:         bn = (bn1 != bn2); break;
-                    case OP_LESSTHAN:            bn = (bn1 < bn2); break;
-                    case OP_GREATERTHAN:         bn = (bn1 > bn2); break;
-                    case OP_LESSTHANOREQUAL:     bn = (bn1 <= bn2); break;
-                    case OP_GREATERTHANOREQUAL:  bn = (bn1 >= bn2); break;
+                    case OP_BOOLAND:             bn = CScriptNum(bn1 != bnZero && bn2 != bnZero); break;
+                    case OP_BOOLOR:              bn = CScriptNum(bn1 != bnZero || bn2 != bnZero); break;
+                    case OP_NUMEQUAL:            bn = CScriptNum(bn1 == bn2); break;
+                    case OP_NUMEQUALVERIFY:      bn = CScriptNum(bn1 == bn2); break;
+                    case OP_NUMNOTEQUAL:         bn = CScriptNum(bn1 != bn2); break;
+                    case OP_LESSTHAN:            bn = CScriptNum(bn1 < bn2); break;
+                    case OP_GREATERTHAN:         bn = CScriptNum(bn1 > bn2); break;
+                    case OP_LESSTHANOREQUAL:     bn = CScriptNum(bn1 <= bn2); break;
+                    case OP_GREATERTHANOREQUAL:  bn = CScriptNum(bn1 >= bn2); break;
                     case OP_MIN:                 bn = (bn1 < bn2 ? bn1 : bn2); break;
                     case OP_MAX:                 bn = (bn1 > bn2 ? bn1 : bn2); break;
                     default:                     assert(!"invalid opcode"); break;
@@ -814,9 +815,9 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x min max -- out)
                     if (stack.size() < 3)
                         return false;
-                    CBigNum bn1 = CastToBigNum(stacktop(-3));
-                    CBigNum bn2 = CastToBigNum(stacktop(-2));
-                    CBigNum bn3 = CastToBigNum(stacktop(-1));
+                    CScriptNum bn1(stacktop(-3));
+                    CScriptNum bn2(stacktop(-2));
+                    CScriptNum bn3(stacktop(-1));
                     bool fValue = (bn2 <= bn1 && bn1 < bn3);
                     popstack(stack);
                     popstack(stack);
@@ -838,17 +839,18 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (in -- hash)
                     if (stack.size() < 1)
                         return false;
-                    valtype& vch = stacktop(-1);
-                    valtype vchHash((opcode == OP_RIPEMD160 || opcode == OP_SHA1 || opcode == OP_HASH160) ? 20 : 32);
+                    CScriptValue& vch = stacktop(-1);
+                    CScriptValue vchHash;
+                    vchHash.resize((opcode == OP_RIPEMD160 || opcode == OP_SHA1 || opcode == OP_HASH160) ? 20 : 32);
                     if (opcode == OP_RIPEMD160)
-                        RIPEMD160(&vch[0], vch.size(), &vchHash[0]);
+                        RIPEMD160(vch.begin(), vch.size(), vchHash.begin());
                     else if (opcode == OP_SHA1)
-                        SHA1(&vch[0], vch.size(), &vchHash[0]);
+                        SHA1(vch.begin(), vch.size(), vchHash.begin());
                     else if (opcode == OP_SHA256)
-                        SHA256(&vch[0], vch.size(), &vchHash[0]);
+                        SHA256(vch.begin(), vch.size(), vchHash.begin());
                     else if (opcode == OP_HASH160)
                     {
-                        uint160 hash160 = Hash160(vch);
+                        uint160 hash160 = Hash160(vch.begin(), vch.end());
                         memcpy(&vchHash[0], &hash160, sizeof(hash160));
                     }
                     else if (opcode == OP_HASH256)
@@ -875,21 +877,27 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     if (stack.size() < 2)
                         return false;
 
-                    valtype& vchSig    = stacktop(-2);
-                    valtype& vchPubKey = stacktop(-1);
+                    valtype vchSig    = stacktop(-2).getvch();
+                    valtype vchPubKey = stacktop(-1).getvch();
 
                     ////// debug print
                     //PrintHex(vchSig.begin(), vchSig.end(), "sig: %s\n");
                     //PrintHex(vchPubKey.begin(), vchPubKey.end(), "pubkey: %s\n");
 
                     // Subset of script starting at the most recent codeseparator
-                    CScript scriptCode(pbegincodehash, pend);
+                    CScript scriptTmp;
+                    const CScript* pscriptCode = &script;
+                    if (pbegincodehash != script.begin())
+                    {
+                        scriptTmp = CScript(pbegincodehash, pend);
+                        pscriptCode = &scriptTmp;
+                    }
 
                     // Drop the signature, since there's no way for a signature to sign itself
-                    scriptCode.FindAndDelete(CScript(vchSig));
+                    DropSignature(pscriptCode, scriptTmp, vchSig);
 
                     bool fSuccess = IsCanonicalSignature(vchSig, flags) && IsCanonicalPubKey(vchPubKey, flags) &&
-                        CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType, flags);
+                        CheckSig(vchSig, vchPubKey, *pscriptCode, txTo, nIn, nHashType, flags, pSigHashCache);
 
                     popstack(stack);
                     popstack(stack);
@@ -913,7 +921,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     if ((int)stack.size() < i)
                         return false;
 
-                    int nKeysCount = CastToBigNum(stacktop(-i)).getint32();
+                    int nKeysCount = CScriptNum(stacktop(-i)).getint();
                     if (nKeysCount < 0 || nKeysCount > 20)
                         return false;
                     nOpCount += nKeysCount;
@@ -924,7 +932,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     if ((int)stack.size() < i)
                         return false;
 
-                    int nSigsCount = CastToBigNum(stacktop(-i)).getint32();
+                    int nSigsCount = CScriptNum(stacktop(-i)).getint();
                     if (nSigsCount < 0 || nSigsCount > nKeysCount)
                         return false;
                     int isig = ++i;
@@ -933,24 +941,27 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                         return false;
 
                     // Subset of script starting at the most recent codeseparator
-                    CScript scriptCode(pbegincodehash, pend);
+                    CScript scriptTmp;
+                    const CScript* pscriptCode = &script;
+                    if (pbegincodehash != script.begin())
+                    {
+                        scriptTmp = CScript(pbegincodehash, pend);
+                        pscriptCode = &scriptTmp;
+                    }
 
                     // Drop the signatures, since there's no way for a signature to sign itself
                     for (int k = 0; k < nSigsCount; k++)
-                    {
-                        valtype& vchSig = stacktop(-isig-k);
-                        scriptCode.FindAndDelete(CScript(vchSig));
-                    }
+                        DropSignature(pscriptCode, scriptTmp, stacktop(-isig-k).getvch());
 
                     bool fSuccess = true;
                     while (fSuccess && nSigsCount > 0)
                     {
-                        valtype& vchSig    = stacktop(-isig);
-                        valtype& vchPubKey = stacktop(-ikey);
+                        valtype vchSig    = stacktop(-isig).getvch();
+                        valtype vchPubKey = stacktop(-ikey).getvch();
 
                         // Check signature
                         bool fOk = IsCanonicalSignature(vchSig, flags) && IsCanonicalPubKey(vchPubKey, flags) &&
-                            CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType, flags);
+                            CheckSig(vchSig, vchPubKey, *pscriptCode, txTo, nIn, nHashType, flags, pSigHashCache);
 
                         if (fOk) {
                             isig++;
@@ -1021,134 +1032,317 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
 
 
 
-uint256 SignatureHash(CScript scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType)
+// Remove OP_CODESEPARATORs, copying scriptCode only if it has any
+static const CScript& StripCodeSeparators(const CScript& scriptCode, CScript& scriptTmp)
+{
+    // In case concatenating two scripts ends up with two codeseparators,
+    // or an extra one at the end, this prevents all those possible incompatibilities.
+    if (find(scriptCode.begin(), scriptCode.end(), (unsigned char)OP_CODESEPARATOR) == scriptCode.end())
+        return scriptCode;
+    scriptTmp = scriptCode;
+    scriptTmp.FindAndDelete(CScript(OP_CODESEPARATOR));
+    return scriptTmp;
+}
+
+uint256 SignatureHash(const CScript& scriptCodeIn, const CTransaction& txTo, unsigned int nIn, int nHashType)
 {
     if (nIn >= txTo.vin.size())
     {
         printf("ERROR: SignatureHash() : nIn=%d out of range\n", nIn);
         return 1;
     }
-    CTransaction txTmp(txTo);
 
-    // In case concatenating two scripts ends up with two codeseparators,
-    // or an extra one at the end, this prevents all those possible incompatibilities.
-    scriptCode.FindAndDelete(CScript(OP_CODESEPARATOR));
+    bool fAnyoneCanPay = (nHashType & SIGHASH_ANYONECANPAY) != 0;
+    bool fHashNone = (nHashType & 0x1f) == SIGHASH_NONE;
+    bool fHashSingle = (nHashType & 0x1f) == SIGHASH_SINGLE;
+    if (fHashSingle && nIn >= txTo.vout.size())
+    {
+        printf("ERROR: SignatureHash() : nOut=%d out of range\n", nIn);
+        return 1;
+    }
 
-    // Blank out other inputs' signatures
-    for (unsigned int i = 0; i < txTmp.vin.size(); i++)
-        txTmp.vin[i].scriptSig = CScript();
-    txTmp.vin[nIn].scriptSig = scriptCode;
+    CScript scriptTmp;
+    const CScript& scriptCode = StripCodeSeparators(scriptCodeIn, scriptTmp);
 
-    // Blank out some of the outputs
-    if ((nHashType & 0x1f) == SIGHASH_NONE)
-    {
-        // Wildcard payee
-        txTmp.vout.clear();
+    // Serialize the transaction as modified for signing, without copying it:
+    // other inputs' signatures are blanked out, SIGHASH_NONE/SINGLE let the
+    // others update at will and blank out some of the outputs,
+    // SIGHASH_ANYONECANPAY blanks out other inputs completely.
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << txTo.nVersion << txTo.nTime;
 
-        // Let the others update at will
-        for (unsigned int i = 0; i < txTmp.vin.size(); i++)
-            if (i != nIn)
-                txTmp.vin[i].nSequence = 0;
-    }
-    else if ((nHashType & 0x1f) == SIGHASH_SINGLE)
+    unsigned int nInputs = fAnyoneCanPay ? 1 : txTo.vin.size();
+    WriteCompactSize(ss, nInputs);
+    for (unsigned int i = 0; i < nInputs; i++)
     {
-        // Only lock-in the txout payee at same index as txin
-        unsigned int nOut = nIn;
-        if (nOut >= txTmp.vout.size())
-        {
-            printf("ERROR: SignatureHash() : nOut=%d out of range\n", nOut);
-            return 1;
-        }
-        txTmp.vout.resize(nOut+1);
-        for (unsigned int i = 0; i < nOut; i++)
-            txTmp.vout[i].SetNull();
-
-        // Let the others update at will
-        for (unsigned int i = 0; i < txTmp.vin.size(); i++)
-            if (i != nIn)
-                txTmp.vin[i].nSequence = 0;
+        unsigned int nInput = fAnyoneCanPay ? nIn : i;
+        const CTxIn& txin = txTo.vin[nInput];
+        ss << txin.prevout;
+        if (nInput == nIn)
+            ss << scriptCode << txin.nSequence;
+        else
+            ss << CScript() << ((fHashNone || fHashSingle) ? 0U : txin.nSequence);
     }
 
-    // Blank out other inputs completely, not recommended for open transactions
-    if (nHashType & SIGHASH_ANYONECANPAY)
+    unsigned int nOutputs = fHashNone ? 0 : (fHashSingle ? nIn + 1 : txTo.vout.size());
+    WriteCompactSize(ss, nOutputs);
+    for (unsigned int i = 0; i < nOutputs; i++)
     {
-        txTmp.vin[0] = txTmp.vin[nIn];
-        txTmp.vin.resize(1);
+        if (fHashSingle && i != nIn)
+            ss << CTxOut();
+        else
+            ss << txTo.vout[i];
     }
 
-    // Serialize and hash
+    ss << txTo.nLockTime << nHashType;
+    return ss.GetHash();
+}
+
+CSigHashCache::CSigHashCache(const CTransaction& txToIn) : txTo(txToIn)
+{
+    // SIGHASH_ALL layout with every input blanked out
     CDataStream ss(SER_GETHASH, 0);
-    ss.reserve(10000);
-    ss << txTmp << nHashType;
-    return Hash(ss.begin(), ss.end());
+    ss << txTo.nVersion << txTo.nTime;
+    WriteCompactSize(ss, txTo.vin.size());
+    vInputPos.reserve(txTo.vin.size() + 1);
+    for (unsigned int i = 0; i < txTo.vin.size(); i++)
+    {
+        vInputPos.push_back(ss.size());
+        ss << txTo.vin[i].prevout << CScript() << txTo.vin[i].nSequence;
+    }
+    vInputPos.push_back(ss.size());
+    ss << txTo.vout << txTo.nLockTime;
+    vchData.assign(ss.begin(), ss.end());
+
+    vMidstate.reserve(txTo.vin.size());
+    CHashWriter hasher(SER_GETHASH, 0);
+    unsigned int nPos = 0;
+    for (unsigned int i = 0; i < txTo.vin.size(); i++)
+    {
+        hasher.write(&vchData[0] + nPos, vInputPos[i] - nPos);
+        nPos = vInputPos[i];
+        vMidstate.push_back(hasher.GetState());
+    }
+}
+
+uint256 CSigHashCache::SignatureHash(const CScript& scriptCodeIn, unsigned int nIn, int nHashType) const
+{
+    if ((nHashType & SIGHASH_ANYONECANPAY) || (nHashType & 0x1f) == SIGHASH_NONE || (nHashType & 0x1f) == SIGHASH_SINGLE || nIn >= vMidstate.size())
+        return ::SignatureHash(scriptCodeIn, txTo, nIn, nHashType);
+
+    CScript scriptTmp;
+    const CScript& scriptCode = StripCodeSeparators(scriptCodeIn, scriptTmp);
+
+    CHashWriter ss(vMidstate[nIn], SER_GETHASH, 0);
+    ss << txTo.vin[nIn].prevout << scriptCode << txTo.vin[nIn].nSequence;
+    unsigned int nTail = vInputPos[nIn + 1];
+    ss.write(&vchData[0] + nTail, vchData.size() - nTail);
+    ss << nHashType;
+    return ss.GetHash();
 }
 
 
 // Valid signature cache, to avoid doing expensive ECDSA signature checking
 // twice for every transaction (once when accepted into memory pool, and
 // again when accepted into the block chain)
+//
+// Entries are salted hashes of (signature hash, signature, public key) in a
+// table of fixed size. The salt is secret, so nobody can make entries collide
+// on purpose. Every key has four possible slots; a new entry takes an empty or
+// the oldest of them, moving the displaced entry to one of its own other slots
+// (cuckoo hashing). Entries are stamped with a generation that is advanced
+// after every quarter table of inserts, and those that are three generations
+// old are dropped. The table is split into shards that are locked separately.
 
 class CSignatureCache
 {
 private:
-     // sigdata_type is (signature hash, signature, public key):
-    typedef boost::tuple<uint256, std::vector<unsigned char>, CPubKey > sigdata_type;
-    std::set< sigdata_type> setValid;
-    boost::shared_mutex cs_sigcache;
+    enum { SHARDS = 16, WAYS = 4, MAX_KICKS = 8 };
+
+    struct CShard
+    {
+        CCriticalSection cs;
+        std::vector<uint256> vKey; // 0 for an empty slot
+        std::vector<unsigned char> vGeneration;
+        unsigned char nGeneration;
+        unsigned int nGenerationInserts;
+        uint64_t nHits;
+        uint64_t nMisses;
+        uint64_t nInserts;
+        uint64_t nEntries;
+
+        CShard() : nGeneration(0), nGenerationInserts(0), nHits(0), nMisses(0), nInserts(0), nEntries(0) { }
+
+        // The low half of word nWay, the high halves are left for the shard
+        unsigned int Slot(const uint256& key, int nWay) const
+        {
+            return (uint32_t)key.Get64(nWay) % vKey.size();
+        }
+
+        unsigned int Age(unsigned int nSlot) const
+        {
+            return (unsigned char)(nGeneration - vGeneration[nSlot]);
+        }
+
+        bool Contains(const uint256& key) const
+        {
+            for (int i = 0; i < WAYS; i++)
+                if (vKey[Slot(key, i)] == key)
+                    return true;
+            return false;
+        }
+
+        void NextGeneration()
+        {
+            nGeneration++;
+            nGenerationInserts = 0;
+            for (unsigned int i = 0; i < vKey.size(); i++)
+            {
+                if (vKey[i] != 0 && Age(i) >= 3)
+                {
+                    vKey[i] = 0;
+                    nEntries--;
+                }
+            }
+        }
+
+        void Insert(uint256 key)
+        {
+            if (++nGenerationInserts > vKey.size() / 4)
+                NextGeneration();
+
+            unsigned char nKeyGeneration = nGeneration;
+            for (int nKick = 0; nKick < MAX_KICKS; nKick++)
+            {
+                // Take an empty slot if there is one, otherwise the oldest
+                unsigned int nVictim = Slot(key, nKick % WAYS);
+                for (int i = 0; i < WAYS; i++)
+                {
+                    unsigned int nSlot = Slot(key, i);
+                    if (vKey[nSlot] == 0)
+                    {
+                        vKey[nSlot] = key;
+                        vGeneration[nSlot] = nKeyGeneration;
+                        nEntries++;
+                        return;
+                    }
+                    if (Age(nSlot) > Age(nVictim))
+                        nVictim = nSlot;
+                }
+
+                // Stale entries are not worth moving
+                if (Age(nVictim) >= 2)
+                {
+                    vKey[nVictim] = key;
+                    vGeneration[nVictim] = nKeyGeneration;
+                    return;
+                }
+
+                std::swap(vKey[nVictim], key);
+                std::swap(vGeneration[nVictim], nKeyGeneration);
+            }
+            // Whatever is displaced last is dropped
+        }
+    };
+
+    CShard shards[SHARDS];
+    SHA256_CTX ctxSalted;
+
+    uint256 GetKey(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey) const
+    {
+        CHashWriter ss(ctxSalted, SER_GETHASH, 0);
+        ss << hash << vchSig << pubKey.Raw();
+        return ss.GetHash();
+    }
+
+    CShard& GetShard(const uint256& key)
+    {
+        return shards[(key.Get64(0) >> 32) % SHARDS];
+    }
 
 public:
-    bool
-    Get(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
+    CSignatureCache()
     {
-        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
+        uint256 salt = GetRandHash();
+        SHA256_Init(&ctxSalted);
+        SHA256_Update(&ctxSalted, &salt, sizeof(salt));
+
+        // Table size in megabytes. 32 bytes per entry, so the default holds
+        // about 500,000 signatures; there are at most 20,000 signature
+        // operations per block.
+        int64_t nMaxCacheSize = GetArg("-sigcachesize", 16);
+        if (nMaxCacheSize < 0)
+            nMaxCacheSize = 0;
+        uint64_t nSlots = (uint64_t)nMaxCacheSize * 1024 * 1024 / (sizeof(uint256) + 1) / SHARDS;
+        if (nSlots != 0 && nSlots < WAYS)
+            nSlots = WAYS;
+        for (int i = 0; i < SHARDS; i++)
+        {
+            shards[i].vKey.resize(nSlots);
+            shards[i].vGeneration.resize(nSlots);
+        }
+    }
 
-        sigdata_type k(hash, vchSig, pubKey);
-        std::set<sigdata_type>::iterator mi = setValid.find(k);
-        if (mi != setValid.end())
+    bool Get(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
+    {
+        uint256 key = GetKey(hash, vchSig, pubKey);
+        CShard& shard = GetShard(key);
+        LOCK(shard.cs);
+        if (shard.vKey.empty())
+            return false;
+        if (shard.Contains(key))
+        {
+            shard.nHits++;
             return true;
+        }
+        shard.nMisses++;
         return false;
     }
 
     void Set(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
     {
-        // DoS prevention: limit cache size to less than 10MB
-        // (~200 bytes per cache entry times 50,000 entries)
-        // Since there are a maximum of 20,000 signature operations per block
-        // 50,000 is a reasonable default.
-        int64_t nMaxCacheSize = GetArg("-maxsigcachesize", 50000);
-        if (nMaxCacheSize <= 0) return;
-
-        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
+        uint256 key = GetKey(hash, vchSig, pubKey);
+        CShard& shard = GetShard(key);
+        LOCK(shard.cs);
+        if (shard.vKey.empty() || shard.Contains(key))
+            return;
+        shard.Insert(key);
+        shard.nInserts++;
+    }
 
-        while (static_cast<int64_t>(setValid.size()) > nMaxCacheSize)
+    void GetStats(CSignatureCacheStats& stats)
+    {
+        stats.nHits = stats.nMisses = stats.nInserts = stats.nEntries = stats.nCapacity = 0;
+        for (int i = 0; i < SHARDS; i++)
         {
-            // Evict a random entry. Random because that helps
-            // foil would-be DoS attackers who might try to pre-generate
-            // and re-use a set of valid signatures just-slightly-greater
-            // than our cache size.
-            uint256 randomHash = GetRandHash();
-            std::vector<unsigned char> unused;
-            std::set<sigdata_type>::iterator it =
-                setValid.lower_bound(sigdata_type(randomHash, unused, unused));
-            if (it == setValid.end())
-                it = setValid.begin();
-            setValid.erase(*it);
+            LOCK(shards[i].cs);
+            stats.nHits += shards[i].nHits;
+            stats.nMisses += shards[i].nMisses;
+            stats.nInserts += shards[i].nInserts;
+            stats.nEntries += shards[i].nEntries;
+            stats.nCapacity += shards[i].vKey.size();
         }
-
-        sigdata_type k(hash, vchSig, pubKey);
-        setValid.insert(k);
     }
 };
 
-bool CheckSig(vector<unsigned char> vchSig, const vector<unsigned char> &vchPubKey, const CScript &scriptCode,
-              const CTransaction& txTo, unsigned int nIn, int nHashType, int flags)
+static CSignatureCache& GetSignatureCache()
 {
     static CSignatureCache signatureCache;
+    return signatureCache;
+}
 
-    CKey key;
-    if (!key.SetPubKey(vchPubKey))
-         return false;
-    CPubKey pubkey = key.GetPubKey();
+void GetSignatureCacheStats(CSignatureCacheStats& stats)
+{
+    GetSignatureCache().GetStats(stats);
+}
+
+bool CheckSig(vector<unsigned char> vchSig, const vector<unsigned char> &vchPubKey, const CScript &scriptCode,
+              const CTransaction& txTo, unsigned int nIn, int nHashType, int flags, const CSigHashCache* pSigHashCache)
+{
+    CSignatureCache& signatureCache = GetSignatureCache();
+
+    // The point itself is decoded and checked by the signature verification
+    CPubKey pubkey(vchPubKey);
     if (!pubkey.IsValid())
         return false;
 
@@ -1161,12 +1355,12 @@ bool CheckSig(vector<unsigned char> vchSig, const vector<unsigned char> &vchPubK
         return false;
     vchSig.pop_back();
 
-    uint256 sighash = SignatureHash(scriptCode, txTo, nIn, nHashType);
+    uint256 sighash = pSigHashCache ? pSigHashCache->SignatureHash(scriptCode, nIn, nHashType) : SignatureHash(scriptCode, txTo, nIn, nHashType);
 
     if (signatureCache.Get(sighash, vchSig, pubkey))
         return true;
 
-    if (!key.Verify(sighash, vchSig))
+    if (!pubkey.Verify(sighash, vchSig))
         return false;
 
     if (!(flags & SCRIPT_VERIFY_NOCACHE))
@@ -1605,15 +1799,111 @@ bool ExtractDestinations(const CScript& scriptPubKey, txnouttype& typeRet, vecto
     return true;
 }
 
+// Collect the data pushes of a script; false if it has anything else
+static bool GetPushedData(const CScript& script, CScriptStack& stack)
+{
+    if (script.size() > 10000)
+        return false;
+    CScript::const_iterator pc = script.begin();
+    CScript::const_iterator pvchPushValue;
+    opcodetype opcode;
+    while (pc < script.end())
+    {
+        if (!script.GetOp(pc, opcode, pvchPushValue) || opcode > OP_PUSHDATA4)
+            return false;
+        if (pc - pvchPushValue > (ptrdiff_t)MAX_SCRIPT_ELEMENT_SIZE || stack.size() >= 1000)
+            return false;
+        stack.push_back(CScriptValue(pvchPushValue, pc));
+    }
+    return true;
+}
+
+// Same as OP_CHECKSIG with a script code that has no OP_CODESEPARATOR before it
+static bool CheckSigOp(const CScriptValue& vchSigIn, const CScriptValue& vchPubKeyIn, const CScript& script,
+                       const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType, const CSigHashCache* pSigHashCache)
+{
+    valtype vchSig = vchSigIn.getvch();
+    valtype vchPubKey = vchPubKeyIn.getvch();
+
+    CScript scriptTmp;
+    const CScript* pscriptCode = &script;
+    DropSignature(pscriptCode, scriptTmp, vchSig);
+
+    return IsCanonicalSignature(vchSig, flags) && IsCanonicalPubKey(vchPubKey, flags) &&
+        CheckSig(vchSig, vchPubKey, *pscriptCode, txTo, nIn, nHashType, flags, pSigHashCache);
+}
+
+//
+// Verify the standard templates without running the interpreter. Returns
+// false if the scripts don't match a template, leaving them to EvalScript;
+// otherwise fResult is what VerifyScript would have returned.
+//
+static bool VerifyScriptTemplate(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn,
+                                 unsigned int flags, int nHashType, const CSigHashCache* pSigHashCache, bool& fResult)
+{
+    CScriptStack stack;
+    stack.reserve(4);
+    if (!GetPushedData(scriptSig, stack))
+        return false;
+
+    // Pay to pubkey hash: OP_DUP OP_HASH160 <hash> OP_EQUALVERIFY OP_CHECKSIG
+    if (scriptPubKey.size() == 25 && scriptPubKey[0] == OP_DUP && scriptPubKey[1] == OP_HASH160 && scriptPubKey[2] == 20 &&
+        scriptPubKey[23] == OP_EQUALVERIFY && scriptPubKey[24] == OP_CHECKSIG)
+    {
+        if (stack.size() != 2)
+            return false;
+        uint160 hash160 = Hash160(stack[1].begin(), stack[1].end());
+        if (memcmp(&hash160, &scriptPubKey[3], 20) != 0)
+            fResult = false;
+        else
+            fResult = CheckSigOp(stack[0], stack[1], scriptPubKey, txTo, nIn, flags, nHashType, pSigHashCache);
+        return true;
+    }
+
+    // Pay to pubkey: <pubkey> OP_CHECKSIG
+    if ((scriptPubKey.size() == 35 && scriptPubKey[0] == 33) || (scriptPubKey.size() == 67 && scriptPubKey[0] == 65))
+    {
+        if (scriptPubKey.back() != OP_CHECKSIG || stack.size() != 1)
+            return false;
+        CScriptValue vchPubKey(scriptPubKey.begin() + 1, scriptPubKey.end() - 1);
+        fResult = CheckSigOp(stack[0], vchPubKey, scriptPubKey, txTo, nIn, flags, nHashType, pSigHashCache);
+        return true;
+    }
+
+    // Pay to script hash: the subscript is the only thing left to interpret
+    if ((flags & SCRIPT_VERIFY_P2SH) && scriptPubKey.IsPayToScriptHash())
+    {
+        if (stack.empty())
+            return false;
+        uint160 hash160 = Hash160(stack.back().begin(), stack.back().end());
+        if (memcmp(&hash160, &scriptPubKey[2], 20) != 0)
+        {
+            fResult = false;
+            return true;
+        }
+        CScript pubKey2(stack.back().begin(), stack.back().end());
+        popstack(stack);
+        fResult = EvalScript(stack, pubKey2, txTo, nIn, flags, nHashType, pSigHashCache) && !stack.empty() && CastToBool(stack.back());
+        return true;
+    }
+
+    return false;
+}
+
 bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn,
-                  unsigned int flags, int nHashType)
+                  unsigned int flags, int nHashType, const CSigHashCache* pSigHashCache)
 {
-    vector<vector<unsigned char> > stack, stackCopy;
-    if (!EvalScript(stack, scriptSig, txTo, nIn, flags, nHashType))
+    bool fResult;
+    if (!(flags & SCRIPT_VERIFY_NOTEMPLATE) && VerifyScriptTemplate(scriptSig, scriptPubKey, txTo, nIn, flags, nHashType, pSigHashCache, fResult))
+        return fResult;
+
+    CScriptStack stack, stackCopy;
+    stack.reserve(16);
+    if (!EvalScript(stack, scriptSig, txTo, nIn, flags, nHashType, pSigHashCache))
         return false;
     if (flags & SCRIPT_VERIFY_P2SH)
         stackCopy = stack;
-    if (!EvalScript(stack, scriptPubKey, txTo, nIn, flags, nHashType))
+    if (!EvalScript(stack, scriptPubKey, txTo, nIn, flags, nHashType, pSigHashCache))
         return false;
     if (stack.empty())
         return false;
@@ -1632,11 +1922,11 @@ bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const C
         // an empty stack and the EvalScript above would return false.
         assert(!stackCopy.empty());
 
-        const valtype& pubKeySerialized = stackCopy.back();
+        const CScriptValue& pubKeySerialized = stackCopy.back();
         CScript pubKey2(pubKeySerialized.begin(), pubKeySerialized.end());
         popstack(stackCopy);
 
-        if (!EvalScript(stackCopy, pubKey2, txTo, nIn, flags, nHashType))
+        if (!EvalScript(stackCopy, pubKey2, txTo, nIn, flags, nHashType, pSigHashCache))
             return false;
         if (stackCopy.empty())
             return false;
@@ -1807,12 +2097,18 @@ CScript CombineSignatures(CScript scriptPubKey, const CTransaction& txTo, unsign
     vector<vector<unsigned char> > vSolutions;
     Solver(scriptPubKey, txType, vSolutions);
 
-    vector<valtype> stack1;
+    CScriptStack stack1;
     EvalScript(stack1, scriptSig1, CTransaction(), 0, SCRIPT_VERIFY_STRICTENC, 0);
-    vector<valtype> stack2;
+    CScriptStack stack2;
     EvalScript(stack2, scriptSig2, CTransaction(), 0, SCRIPT_VERIFY_STRICTENC, 0);
 
-    return CombineSignatures(scriptPubKey, txTo, nIn, txType, vSolutions, stack1, stack2);
+    vector<valtype> sigs1, sigs2;
+    BOOST_FOREACH(const CScriptValue& v, stack1)
+        sigs1.push_back(v.getvch());
+    BOOST_FOREACH(const CScriptValue& v, stack2)
+        sigs2.push_back(v.getvch());
+
+    return CombineSignatures(scriptPubKey, txTo, nIn, txType, vSolutions, sigs1, sigs2);
 }
 
 unsigned int CScript::GetSigOpCount(bool fAccurate) const
@@ -7,11 +7,14 @@
 
 #include <string>
 #include <vector>
+#include <limits>
+#include <stdexcept>
 
 #include <boost/foreach.hpp>
 
 #include "keystore.h"
 #include "bignum.h"
+#include "hash.h"
 
 typedef std::vector<uint8_t> valtype;
 
@@ -48,6 +51,7 @@ enum
     SCRIPT_VERIFY_LOW_S     = (1U << 2), // enforce low S values in signatures (depends on STRICTENC)
     SCRIPT_VERIFY_NOCACHE   = (1U << 3), // do not store results in signature cache (but do query it)
     SCRIPT_VERIFY_NULLDUMMY = (1U << 4), // verify dummy stack item consumed by CHECKMULTISIG is of zero-length
+    SCRIPT_VERIFY_NOTEMPLATE = (1U << 5), // always run the interpreter, to cross-check the template fast path
 };
 
 // Strict verification:
@@ -433,9 +437,21 @@ public:
 
     bool GetOp2(const_iterator& pc, opcodetype& opcodeRet, std::vector<uint8_t>* pvchRet) const
     {
-        opcodeRet = OP_INVALIDOPCODE;
+        const_iterator pvchBegin;
         if (pvchRet)
             pvchRet->clear();
+        if (!GetOp(pc, opcodeRet, pvchBegin))
+            return false;
+        if (pvchRet)
+            pvchRet->assign(pvchBegin, pc);
+        return true;
+    }
+
+    // Pushed data is returned as the range [pvchBeginRet, pc) of the script, without copying
+    bool GetOp(const_iterator& pc, opcodetype& opcodeRet, const_iterator& pvchBeginRet) const
+    {
+        opcodeRet = OP_INVALIDOPCODE;
+        pvchBeginRet = pc;
         if (pc >= end())
             return false;
 
@@ -474,10 +490,11 @@ public:
             }
             if (end() - pc < 0 || (uint32_t)(end() - pc) < nSize)
                 return false;
-            if (pvchRet)
-                pvchRet->assign(pc, pc + nSize);
+            pvchBeginRet = pc;
             pc += nSize;
         }
+        else
+            pvchBeginRet = pc;
 
         opcodeRet = (opcodetype)opcode;
         return true;
@@ -601,11 +618,207 @@ public:
     }
 };
 
+/** Byte string on the script interpreter stack.
+ *
+ * Elements of up to INLINE_SIZE bytes (signatures, public keys, hashes and
+ * numbers) are kept inside the object, so pushing them doesn't allocate.
+ * Only larger elements, like P2SH subscripts, go to the heap.
+ */
+class CScriptValue
+{
+public:
+    enum { INLINE_SIZE = 80 };
+
+    typedef unsigned char* iterator;
+    typedef const unsigned char* const_iterator;
+
+private:
+    unsigned int nSize;
+    unsigned int nCapacity; // 0 while the inline buffer is used
+    union
+    {
+        unsigned char chInline[INLINE_SIZE];
+        unsigned char* pchHeap;
+    };
+
+    void reserve(unsigned int nNewCapacity)
+    {
+        if (nNewCapacity <= capacity())
+            return;
+        unsigned char* pchNew = new unsigned char[nNewCapacity];
+        memcpy(pchNew, begin(), nSize);
+        if (nCapacity)
+            delete[] pchHeap;
+        pchHeap = pchNew;
+        nCapacity = nNewCapacity;
+    }
+
+public:
+    CScriptValue() : nSize(0), nCapacity(0) { }
+    template<typename InputIterator>
+    CScriptValue(InputIterator pbegin, InputIterator pend) : nSize(0), nCapacity(0) { assign(pbegin, pend); }
+    explicit CScriptValue(const valtype& vch) : nSize(0), nCapacity(0) { assign(vch.begin(), vch.end()); }
+    CScriptValue(const CScriptValue& b) : nSize(0), nCapacity(0) { assign(b.begin(), b.end()); }
+
+    ~CScriptValue()
+    {
+        if (nCapacity)
+            delete[] pchHeap;
+    }
+
+    CScriptValue& operator=(const CScriptValue& b)
+    {
+        if (this != &b)
+            assign(b.begin(), b.end());
+        return *this;
+    }
+
+    template<typename InputIterator>
+    void assign(InputIterator pbegin, InputIterator pend)
+    {
+        unsigned int nNewSize = pend - pbegin;
+        reserve(nNewSize);
+        std::copy(pbegin, pend, begin());
+        nSize = nNewSize;
+    }
+
+    // New bytes are left uninitialized
+    void resize(unsigned int nNewSize)
+    {
+        reserve(nNewSize);
+        nSize = nNewSize;
+    }
+
+    void clear() { nSize = 0; }
+    unsigned int size() const { return nSize; }
+    bool empty() const { return nSize == 0; }
+    unsigned int capacity() const { return nCapacity ? nCapacity : (unsigned int)INLINE_SIZE; }
+
+    iterator begin() { return nCapacity ? pchHeap : chInline; }
+    const_iterator begin() const { return nCapacity ? pchHeap : chInline; }
+    iterator end() { return begin() + nSize; }
+    const_iterator end() const { return begin() + nSize; }
+
+    unsigned char& operator[](unsigned int i) { return begin()[i]; }
+    const unsigned char& operator[](unsigned int i) const { return begin()[i]; }
+    const unsigned char& back() const { return begin()[nSize - 1]; }
+
+    valtype getvch() const { return valtype(begin(), end()); }
+
+    friend bool operator==(const CScriptValue& a, const CScriptValue& b) { return a.nSize == b.nSize && memcmp(a.begin(), b.begin(), a.nSize) == 0; }
+    friend bool operator!=(const CScriptValue& a, const CScriptValue& b) { return !(a == b); }
+};
+
+typedef std::vector<CScriptValue> CScriptStack;
+
+/** Numeric script operand.
+ *
+ * Operands are little-endian sign-magnitude values of at most nMaxNumSize
+ * bytes, so every result of the enabled opcodes fits in an int64_t. This
+ * gives the same results as the CBigNum arithmetic it replaces.
+ */
+class CScriptNum
+{
+private:
+    int64_t nValue;
+
+public:
+    static const unsigned int nMaxNumSize = 4;
+
+    explicit CScriptNum(int64_t n) : nValue(n) { }
+
+    explicit CScriptNum(const CScriptValue& vch)
+    {
+        if (vch.size() > nMaxNumSize)
+            throw std::runtime_error("CScriptNum() : overflow");
+        nValue = 0;
+        if (vch.empty())
+            return;
+        for (unsigned int i = 0; i < vch.size(); i++)
+            nValue |= (int64_t)vch[i] << (8 * i);
+        // The most significant bit of the last byte is the sign
+        if (vch.back() & 0x80)
+            nValue = -(nValue & ~((int64_t)0x80 << (8 * (vch.size() - 1))));
+    }
+
+    bool operator==(const CScriptNum& b) const { return nValue == b.nValue; }
+    bool operator!=(const CScriptNum& b) const { return nValue != b.nValue; }
+    bool operator<(const CScriptNum& b) const  { return nValue < b.nValue; }
+    bool operator<=(const CScriptNum& b) const { return nValue <= b.nValue; }
+    bool operator>(const CScriptNum& b) const  { return nValue > b.nValue; }
+    bool operator>=(const CScriptNum& b) const { return nValue >= b.nValue; }
+
+    CScriptNum operator+(const CScriptNum& b) const { return CScriptNum(nValue + b.nValue); }
+    CScriptNum operator-(const CScriptNum& b) const { return CScriptNum(nValue - b.nValue); }
+    CScriptNum operator-() const { return CScriptNum(-nValue); }
+
+    int getint() const
+    {
+        if (nValue > std::numeric_limits<int>::max())
+            return std::numeric_limits<int>::max();
+        if (nValue < std::numeric_limits<int>::min())
+            return std::numeric_limits<int>::min();
+        return (int)nValue;
+    }
+
+    // Minimal encoding, same as CBigNum::getvch()
+    CScriptValue getvch() const
+    {
+        unsigned char vch[9];
+        unsigned int nLen = 0;
+        bool fNegative = nValue < 0;
+        uint64_t nAbs = fNegative ? -(uint64_t)nValue : (uint64_t)nValue;
+        while (nAbs)
+        {
+            vch[nLen++] = nAbs & 0xff;
+            nAbs >>= 8;
+        }
+        // Keep room for the sign bit
+        if (nLen && (vch[nLen - 1] & 0x80))
+            vch[nLen++] = fNegative ? 0x80 : 0;
+        else if (fNegative)
+            vch[nLen - 1] |= 0x80;
+        return CScriptValue(vch, vch + nLen);
+    }
+};
+
+/** Signature cache counters, see GetSignatureCacheStats() */
+struct CSignatureCacheStats
+{
+    uint64_t nHits;
+    uint64_t nMisses;
+    uint64_t nInserts;
+    uint64_t nEntries;
+    uint64_t nCapacity;
+};
+
+void GetSignatureCacheStats(CSignatureCacheStats& stats);
 bool IsCanonicalPubKey(const std::vector<unsigned char> &vchPubKey, unsigned int flags);
 bool IsDERSignature(const valtype &vchSig, bool fWithHashType=false, bool fCheckLow=false);
 bool IsCanonicalSignature(const std::vector<unsigned char> &vchSig, unsigned int flags);
 
-bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType);
+/** Signature hashes of all inputs of one transaction without copying it.
+ *
+ * Every SIGHASH_ALL hash covers the same serialization except for the input
+ * being signed. It is built once, with a SHA256 midstate saved at the start
+ * of each input, so only the input and what follows it are hashed per input.
+ */
+class CSigHashCache
+{
+private:
+    const CTransaction& txTo;
+    std::vector<char> vchData;
+    std::vector<unsigned int> vInputPos;
+    std::vector<SHA256_CTX> vMidstate;
+
+public:
+    explicit CSigHashCache(const CTransaction& txToIn);
+
+    uint256 SignatureHash(const CScript& scriptCode, unsigned int nIn, int nHashType) const;
+};
+
+uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType);
+bool EvalScript(CScriptStack& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType, const CSigHashCache* pSigHashCache = NULL);
 bool Solver(const CScript& scriptPubKey, txnouttype& typeRet, std::vector<std::vector<unsigned char> >& vSolutionsRet);
 int ScriptSigArgsExpected(txnouttype t, const std::vector<std::vector<unsigned char> >& vSolutions);
 bool IsStandard(const CScript& scriptPubKey, txnouttype& whichType);
@@ -616,7 +829,7 @@ bool ExtractDestination(const CScript& scriptPubKey, CTxDestination& addressRet)
 bool ExtractDestinations(const CScript& scriptPubKey, txnouttype& typeRet, std::vector<CTxDestination>& addressRet, int& nRequiredRet);
 bool SignSignature(const CKeyStore& keystore, const CScript& fromPubKey, CTransaction& txTo, unsigned int nIn, int nHashType=SIGHASH_ALL);
 bool SignSignature(const CKeyStore& keystore, const CTransaction& txFrom, CTransaction& txTo, unsigned int nIn, int nHashType=SIGHASH_ALL);
-bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType);
+bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType, const CSigHashCache* pSigHashCache = NULL);
 
 // Given two sets of signatures for scriptPubKey, possibly with OP_0 placeholders,
 // combine them intelligently and return the result.
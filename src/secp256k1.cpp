@@ -0,0 +1,1685 @@
+// Copyright (c) 2014 The NovaCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <string.h>
+
+#include <openssl/crypto.h> // for OPENSSL_cleanse()
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+
+#include "secp256k1.h"
+
+using namespace std;
+
+namespace
+{
+
+//
+// Field elements: integers modulo p = 2^256 - 2^32 - 977 as eight little
+// endian 32-bit limbs, fully reduced after every operation. None of the
+// field operations branch on the values they work with.
+//
+struct CFieldElem
+{
+    uint32_t n[8];
+};
+
+static const uint32_t P[8] = {
+    0xFFFFFC2F, 0xFFFFFFFE, 0xFFFFFFFF, 0xFFFFFFFF,
+    0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF
+};
+
+static void FieldSetInt(CFieldElem& r, uint32_t a)
+{
+    memset(r.n, 0, sizeof(r.n));
+    r.n[0] = a;
+}
+
+// Load a big endian number, returns false if it is not below p
+static bool FieldSetB32(CFieldElem& r, const unsigned char* b32)
+{
+    for (int i = 0; i < 8; i++)
+    {
+        const unsigned char* p = b32 + 28 - 4 * i;
+        r.n[i] = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+    }
+    for (int i = 7; i >= 0; i--)
+    {
+        if (r.n[i] < P[i])
+            return true;
+        if (r.n[i] > P[i])
+            return false;
+    }
+    return false;
+}
+
+static void FieldGetB32(unsigned char* b32, const CFieldElem& a)
+{
+    for (int i = 0; i < 8; i++)
+    {
+        unsigned char* p = b32 + 28 - 4 * i;
+        p[0] = a.n[i] >> 24;
+        p[1] = a.n[i] >> 16;
+        p[2] = a.n[i] >> 8;
+        p[3] = a.n[i];
+    }
+}
+
+static bool FieldIsZero(const CFieldElem& a)
+{
+    uint32_t z = 0;
+    for (int i = 0; i < 8; i++)
+        z |= a.n[i];
+    return z == 0;
+}
+
+static bool FieldIsOdd(const CFieldElem& a)
+{
+    return a.n[0] & 1;
+}
+
+static bool FieldEqual(const CFieldElem& a, const CFieldElem& b)
+{
+    uint32_t z = 0;
+    for (int i = 0; i < 8; i++)
+        z |= a.n[i] ^ b.n[i];
+    return z == 0;
+}
+
+// r = fFlag ? a : r
+static void FieldCMov(CFieldElem& r, const CFieldElem& a, uint32_t fFlag)
+{
+    uint32_t mask = 0 - fFlag;
+    for (int i = 0; i < 8; i++)
+        r.n[i] = (r.n[i] & ~mask) | (a.n[i] & mask);
+}
+
+// Subtract p once if the 257-bit value (nCarry, r) is not below p
+static void FieldReduceOnce(uint32_t* r, uint32_t nCarry)
+{
+    uint32_t t[8];
+    uint64_t nBorrow = 0;
+    for (int i = 0; i < 8; i++)
+    {
+        uint64_t d = (uint64_t)r[i] - P[i] - nBorrow;
+        t[i] = (uint32_t)d;
+        nBorrow = d >> 63;
+    }
+    uint32_t mask = 0 - ((nCarry | (uint32_t)(nBorrow ^ 1)) & 1);
+    for (int i = 0; i < 8; i++)
+        r[i] = (t[i] & mask) | (r[i] & ~mask);
+}
+
+static void FieldAdd(CFieldElem& r, const CFieldElem& a, const CFieldElem& b)
+{
+    uint64_t c = 0;
+    for (int i = 0; i < 8; i++)
+    {
+        c += (uint64_t)a.n[i] + b.n[i];
+        r.n[i] = (uint32_t)c;
+        c >>= 32;
+    }
+    FieldReduceOnce(r.n, (uint32_t)c);
+}
+
+static void FieldSub(CFieldElem& r, const CFieldElem& a, const CFieldElem& b)
+{
+    uint64_t nBorrow = 0;
+    for (int i = 0; i < 8; i++)
+    {
+        uint64_t d = (uint64_t)a.n[i] - b.n[i] - nBorrow;
+        r.n[i] = (uint32_t)d;
+        nBorrow = d >> 63;
+    }
+    // add p back if the subtraction wrapped
+    uint32_t mask = 0 - (uint32_t)nBorrow;
+    uint64_t c = 0;
+    for (int i = 0; i < 8; i++)
+    {
+        c += (uint64_t)r.n[i] + (P[i] & mask);
+        r.n[i] = (uint32_t)c;
+        c >>= 32;
+    }
+}
+
+static void FieldNegate(CFieldElem& r, const CFieldElem& a)
+{
+    CFieldElem zero;
+    FieldSetInt(zero, 0);
+    FieldSub(r, zero, a);
+}
+
+#if defined(__SIZEOF_INT128__)
+// 64-bit limbs where the compiler offers a 128-bit product type
+static void FieldMul(CFieldElem& r, const CFieldElem& a, const CFieldElem& b)
+{
+    typedef unsigned __int128 uint128_t;
+    static const uint64_t C = 0x1000003D1ULL; // 2^256 - p
+
+    uint64_t x[4], y[4], t[8];
+    for (int i = 0; i < 4; i++)
+    {
+        x[i] = a.n[2 * i] | ((uint64_t)a.n[2 * i + 1] << 32);
+        y[i] = b.n[2 * i] | ((uint64_t)b.n[2 * i + 1] << 32);
+    }
+    memset(t, 0, sizeof(t));
+    for (int i = 0; i < 4; i++)
+    {
+        uint128_t c = 0;
+        for (int j = 0; j < 4; j++)
+        {
+            c += (uint128_t)x[i] * y[j] + t[i + j];
+            t[i + j] = (uint64_t)c;
+            c >>= 64;
+        }
+        t[i + 4] = (uint64_t)c;
+    }
+
+    // fold the upper half twice, then the final carry
+    uint128_t c = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        c += (uint128_t)t[4 + i] * C + t[i];
+        t[i] = (uint64_t)c;
+        c >>= 64;
+    }
+    c = c * C + t[0];
+    t[0] = (uint64_t)c;
+    c >>= 64;
+    for (int i = 1; i < 4; i++)
+    {
+        c += t[i];
+        t[i] = (uint64_t)c;
+        c >>= 64;
+    }
+    c = c * C + t[0];
+    t[0] = (uint64_t)c;
+    c >>= 64;
+    for (int i = 1; i < 4; i++)
+    {
+        c += t[i];
+        t[i] = (uint64_t)c;
+        c >>= 64;
+    }
+
+    uint32_t l[8];
+    for (int i = 0; i < 4; i++)
+    {
+        l[2 * i] = (uint32_t)t[i];
+        l[2 * i + 1] = (uint32_t)(t[i] >> 32);
+    }
+    FieldReduceOnce(l, 0);
+    memcpy(r.n, l, sizeof(l));
+}
+#else
+static void FieldMul(CFieldElem& r, const CFieldElem& a, const CFieldElem& b)
+{
+    uint32_t t[16];
+    memset(t, 0, sizeof(t));
+    for (int i = 0; i < 8; i++)
+    {
+        uint64_t c = 0;
+        for (int j = 0; j < 8; j++)
+        {
+            c += (uint64_t)a.n[i] * b.n[j] + t[i + j];
+            t[i + j] = (uint32_t)c;
+            c >>= 32;
+        }
+        t[i + 8] = (uint32_t)c;
+    }
+
+    // 2^256 = 2^32 + 977 (mod p): fold the upper half into the lower half
+    uint32_t l[8];
+    uint64_t c = 0;
+    for (int i = 0; i < 8; i++)
+    {
+        c += (uint64_t)t[i] + (uint64_t)t[8 + i] * 977;
+        if (i > 0)
+            c += t[7 + i];
+        l[i] = (uint32_t)c;
+        c >>= 32;
+    }
+    c += t[15];
+
+    // fold the remaining (at most 44 bit) overflow once more
+    uint64_t h = c;
+    uint64_t hl = h * 977;
+    c = (uint64_t)l[0] + (uint32_t)hl;
+    l[0] = (uint32_t)c;
+    c >>= 32;
+    c += (uint64_t)l[1] + (hl >> 32) + (uint32_t)h;
+    l[1] = (uint32_t)c;
+    c >>= 32;
+    c += (uint64_t)l[2] + (h >> 32);
+    l[2] = (uint32_t)c;
+    c >>= 32;
+    for (int i = 3; i < 8; i++)
+    {
+        c += l[i];
+        l[i] = (uint32_t)c;
+        c >>= 32;
+    }
+
+    // a last carry leaves a small value behind, so this cannot overflow
+    uint64_t d = (uint64_t)l[0] + c * 977;
+    l[0] = (uint32_t)d;
+    d >>= 32;
+    d += (uint64_t)l[1] + c;
+    l[1] = (uint32_t)d;
+    d >>= 32;
+    for (int i = 2; i < 8; i++)
+    {
+        d += l[i];
+        l[i] = (uint32_t)d;
+        d >>= 32;
+    }
+
+    FieldReduceOnce(l, 0);
+    memcpy(r.n, l, sizeof(l));
+}
+#endif
+
+static void FieldSqr(CFieldElem& r, const CFieldElem& a)
+{
+    FieldMul(r, a, a);
+}
+
+static void FieldSqrN(CFieldElem& r, const CFieldElem& a, int n)
+{
+    r = a;
+    for (int i = 0; i < n; i++)
+        FieldSqr(r, r);
+}
+
+// Computes a^(2^223 - 1) and the intermediate powers used by the
+// inversion and square root addition chains.
+static void FieldPow223(CFieldElem& x223, CFieldElem& x22, CFieldElem& x2, const CFieldElem& a)
+{
+    CFieldElem x3, x6, x9, x11, x44, x88, x176, x220, t;
+
+    FieldSqr(x2, a);
+    FieldMul(x2, x2, a);
+    FieldSqr(x3, x2);
+    FieldMul(x3, x3, a);
+    FieldSqrN(t, x3, 3);
+    FieldMul(x6, t, x3);
+    FieldSqrN(t, x6, 3);
+    FieldMul(x9, t, x3);
+    FieldSqrN(t, x9, 2);
+    FieldMul(x11, t, x2);
+    FieldSqrN(t, x11, 11);
+    FieldMul(x22, t, x11);
+    FieldSqrN(t, x22, 22);
+    FieldMul(x44, t, x22);
+    FieldSqrN(t, x44, 44);
+    FieldMul(x88, t, x44);
+    FieldSqrN(t, x88, 88);
+    FieldMul(x176, t, x88);
+    FieldSqrN(t, x176, 44);
+    FieldMul(x220, t, x44);
+    FieldSqrN(t, x220, 3);
+    FieldMul(x223, t, x3);
+}
+
+// r = a^(p-2)
+static void FieldInv(CFieldElem& r, const CFieldElem& a)
+{
+    CFieldElem x223, x22, x2, t;
+    FieldPow223(x223, x22, x2, a);
+    FieldSqrN(t, x223, 23);
+    FieldMul(t, t, x22);
+    FieldSqrN(t, t, 5);
+    FieldMul(t, t, a);
+    FieldSqrN(t, t, 3);
+    FieldMul(t, t, x2);
+    FieldSqrN(t, t, 2);
+    FieldMul(r, t, a);
+}
+
+// r = a^((p+1)/4), returns whether r is actually a square root of a
+static bool FieldSqrt(CFieldElem& r, const CFieldElem& a)
+{
+    CFieldElem x223, x22, x2, t;
+    FieldPow223(x223, x22, x2, a);
+    FieldSqrN(t, x223, 23);
+    FieldMul(t, t, x22);
+    FieldSqrN(t, t, 6);
+    FieldMul(t, t, x2);
+    FieldSqrN(r, t, 2);
+    FieldSqr(t, r);
+    return FieldEqual(t, a);
+}
+
+
+//
+// Scalars: integers modulo the group order n, same representation.
+//
+struct CScalar
+{
+    uint32_t n[8];
+};
+
+static const uint32_t N[8] = {
+    0xD0364141, 0xBFD25E8C, 0xAF48A03B, 0xBAAEDCE6,
+    0xFFFFFFFE, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF
+};
+
+// 2^256 - n
+static const uint32_t NC[5] = {
+    0x2FC9BEBF, 0x402DA173, 0x50B75FC4, 0x45512319, 0x00000001
+};
+
+static const uint32_t NHALF[8] = {
+    0x681B20A0, 0xDFE92F46, 0x57A4501D, 0x5D576E73,
+    0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0x7FFFFFFF
+};
+
+// Subtract n once if the 257-bit value (nCarry, r) is not below n
+static void ScalarReduceOnce(uint32_t* r, uint32_t nCarry)
+{
+    uint32_t t[8];
+    uint64_t c = 0;
+    for (int i = 0; i < 8; i++)
+    {
+        c += (uint64_t)r[i] + (i < 5 ? NC[i] : 0);
+        t[i] = (uint32_t)c;
+        c >>= 32;
+    }
+    uint32_t mask = 0 - ((nCarry | (uint32_t)c) & 1);
+    for (int i = 0; i < 8; i++)
+        r[i] = (t[i] & mask) | (r[i] & ~mask);
+}
+
+static void ScalarSetInt(CScalar& r, uint32_t a)
+{
+    memset(r.n, 0, sizeof(r.n));
+    r.n[0] = a;
+}
+
+// Load a big endian number reduced modulo n, fOverflow tells whether it was >= n
+static void ScalarSetB32(CScalar& r, const unsigned char* b32, bool* pfOverflow = NULL)
+{
+    for (int i = 0; i < 8; i++)
+    {
+        const unsigned char* p = b32 + 28 - 4 * i;
+        r.n[i] = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+    }
+    CScalar t = r;
+    ScalarReduceOnce(r.n, 0);
+    if (pfOverflow)
+        *pfOverflow = memcmp(t.n, r.n, sizeof(t.n)) != 0;
+}
+
+static void ScalarGetB32(unsigned char* b32, const CScalar& a)
+{
+    for (int i = 0; i < 8; i++)
+    {
+        unsigned char* p = b32 + 28 - 4 * i;
+        p[0] = a.n[i] >> 24;
+        p[1] = a.n[i] >> 16;
+        p[2] = a.n[i] >> 8;
+        p[3] = a.n[i];
+    }
+}
+
+static bool ScalarIsZero(const CScalar& a)
+{
+    uint32_t z = 0;
+    for (int i = 0; i < 8; i++)
+        z |= a.n[i];
+    return z == 0;
+}
+
+static bool ScalarIsOne(const uint32_t* a)
+{
+    uint32_t z = a[0] ^ 1;
+    for (int i = 1; i < 8; i++)
+        z |= a[i];
+    return z == 0;
+}
+
+// Greater than (n-1)/2
+static bool ScalarIsHigh(const CScalar& a)
+{
+    uint64_t nBorrow = 0;
+    for (int i = 0; i < 8; i++)
+    {
+        uint64_t d = (uint64_t)NHALF[i] - a.n[i] - nBorrow;
+        nBorrow = d >> 63;
+    }
+    return nBorrow != 0;
+}
+
+static void ScalarAdd(CScalar& r, const CScalar& a, const CScalar& b)
+{
+    uint64_t c = 0;
+    for (int i = 0; i < 8; i++)
+    {
+        c += (uint64_t)a.n[i] + b.n[i];
+        r.n[i] = (uint32_t)c;
+        c >>= 32;
+    }
+    ScalarReduceOnce(r.n, (uint32_t)c);
+}
+
+static void ScalarNegate(CScalar& r, const CScalar& a)
+{
+    uint32_t mask = 0 - (uint32_t)!ScalarIsZero(a);
+    uint64_t nBorrow = 0;
+    for (int i = 0; i < 8; i++)
+    {
+        uint64_t d = (uint64_t)N[i] - a.n[i] - nBorrow;
+        r.n[i] = (uint32_t)d & mask;
+        nBorrow = d >> 63;
+    }
+}
+
+// 512-bit product of two 256-bit numbers
+static void Mul256(uint32_t* t, const uint32_t* a, const uint32_t* b)
+{
+    memset(t, 0, 16 * sizeof(uint32_t));
+    for (int i = 0; i < 8; i++)
+    {
+        uint64_t c = 0;
+        for (int j = 0; j < 8; j++)
+        {
+            c += (uint64_t)a[i] * b[j] + t[i + j];
+            t[i + j] = (uint32_t)c;
+            c >>= 32;
+        }
+        t[i + 8] = (uint32_t)c;
+    }
+}
+
+static void ScalarMul(CScalar& r, const CScalar& a, const CScalar& b)
+{
+    uint32_t t[17];
+    Mul256(t, a.n, b.n);
+    t[16] = 0;
+
+    // 2^256 = 2^256 - n (mod n): three folds bring 512 bits below 2^256 + 2^133
+    for (int nRound = 0; nRound < 3; nRound++)
+    {
+        uint32_t u[17];
+        memcpy(u, t, 8 * sizeof(uint32_t));
+        memset(u + 8, 0, 9 * sizeof(uint32_t));
+        for (int i = 0; i < 9; i++)
+        {
+            uint64_t c = 0;
+            int k = i;
+            for (int j = 0; j < 5 && k < 17; j++, k++)
+            {
+                c += (uint64_t)t[8 + i] * NC[j] + u[k];
+                u[k] = (uint32_t)c;
+                c >>= 32;
+            }
+            for (; k < 17; k++)
+            {
+                c += u[k];
+                u[k] = (uint32_t)c;
+                c >>= 32;
+            }
+        }
+        memcpy(t, u, sizeof(u));
+    }
+    ScalarReduceOnce(t, t[8]);
+    memcpy(r.n, t, sizeof(r.n));
+}
+
+static void ScalarSqrN(CScalar& r, const CScalar& a, int n)
+{
+    r = a;
+    for (int i = 0; i < n; i++)
+        ScalarMul(r, r, r);
+}
+
+// r = a^(n-2) with a fixed 4-bit window: constant time
+static void ScalarInv(CScalar& r, const CScalar& a)
+{
+    CScalar pow[16];
+    ScalarSetInt(pow[0], 1);
+    for (int i = 1; i < 16; i++)
+        ScalarMul(pow[i], pow[i - 1], a);
+
+    uint32_t e[8];
+    memcpy(e, N, sizeof(e));
+    e[0] -= 2;
+
+    CScalar t;
+    ScalarSetInt(t, 1);
+    for (int i = 63; i >= 0; i--)
+    {
+        ScalarSqrN(t, t, 4);
+        ScalarMul(t, t, pow[(e[i / 8] >> (4 * (i % 8))) & 15]);
+    }
+    r = t;
+    OPENSSL_cleanse(pow, sizeof(pow));
+}
+
+static void ShiftRight1(uint32_t* a, int nWords)
+{
+    for (int i = 0; i < nWords - 1; i++)
+        a[i] = (a[i] >> 1) | (a[i + 1] << 31);
+    a[nWords - 1] >>= 1;
+}
+
+// x = x / 2 (mod n) for x < n
+static void ScalarHalve(uint32_t* x)
+{
+    uint32_t t[9];
+    uint32_t mask = 0 - (x[0] & 1);
+    uint64_t c = 0;
+    for (int i = 0; i < 8; i++)
+    {
+        c += (uint64_t)x[i] + (N[i] & mask);
+        t[i] = (uint32_t)c;
+        c >>= 32;
+    }
+    t[8] = (uint32_t)c;
+    ShiftRight1(t, 9);
+    memcpy(x, t, 8 * sizeof(uint32_t));
+}
+
+// r = a - b, returns the borrow
+static uint32_t Sub256(uint32_t* r, const uint32_t* a, const uint32_t* b)
+{
+    uint64_t nBorrow = 0;
+    for (int i = 0; i < 8; i++)
+    {
+        uint64_t d = (uint64_t)a[i] - b[i] - nBorrow;
+        r[i] = (uint32_t)d;
+        nBorrow = d >> 63;
+    }
+    return (uint32_t)nBorrow;
+}
+
+// x = x - y (mod n)
+static void ScalarSubMod(uint32_t* x, const uint32_t* y)
+{
+    if (Sub256(x, x, y))
+    {
+        uint64_t c = 0;
+        for (int i = 0; i < 8; i++)
+        {
+            c += (uint64_t)x[i] + N[i];
+            x[i] = (uint32_t)c;
+            c >>= 32;
+        }
+    }
+}
+
+// Binary extended Euclid, variable time: only for public values
+static void ScalarInvVar(CScalar& r, const CScalar& a)
+{
+    if (ScalarIsZero(a))
+    {
+        ScalarSetInt(r, 0);
+        return;
+    }
+
+    uint32_t u[8], v[8], x1[8], x2[8], t[8];
+    memcpy(u, a.n, sizeof(u));
+    memcpy(v, N, sizeof(v));
+    memset(x1, 0, sizeof(x1));
+    memset(x2, 0, sizeof(x2));
+    x1[0] = 1;
+
+    while (!ScalarIsOne(u) && !ScalarIsOne(v))
+    {
+        while (!(u[0] & 1))
+        {
+            ShiftRight1(u, 8);
+            ScalarHalve(x1);
+        }
+        while (!(v[0] & 1))
+        {
+            ShiftRight1(v, 8);
+            ScalarHalve(x2);
+        }
+        if (!Sub256(t, u, v))
+        {
+            memcpy(u, t, sizeof(u));
+            ScalarSubMod(x1, x2);
+        }
+        else
+        {
+            Sub256(v, v, u);
+            ScalarSubMod(x2, x1);
+        }
+    }
+    memcpy(r.n, ScalarIsOne(u) ? x1 : x2, sizeof(r.n));
+}
+
+// Bits [nPos, nPos + nCount) of a 256-bit number, nCount <= 32
+static uint32_t ScalarGetBits(const CScalar& a, int nPos, int nCount)
+{
+    uint64_t w = 0;
+    int nWord = nPos / 32;
+    if (nWord < 8)
+        w = a.n[nWord];
+    if (nWord + 1 < 8)
+        w |= (uint64_t)a.n[nWord + 1] << 32;
+    return (uint32_t)(w >> (nPos % 32)) & (uint32_t)((((uint64_t)1) << nCount) - 1);
+}
+
+// Rounded (a * b) >> 384 for the endomorphism split
+static void ScalarMulShift384(CScalar& r, const CScalar& a, const uint32_t* b)
+{
+    uint32_t t[16];
+    Mul256(t, a.n, b);
+    uint64_t c = (t[11] >> 31);
+    for (int i = 0; i < 4; i++)
+    {
+        c += t[12 + i];
+        r.n[i] = (uint32_t)c;
+        c >>= 32;
+    }
+    r.n[4] = (uint32_t)c;
+    r.n[5] = r.n[6] = r.n[7] = 0;
+}
+
+
+//
+// Group elements: affine and Jacobian coordinates (x = X/Z^2, y = Y/Z^3)
+//
+struct CPointAffine
+{
+    CFieldElem x, y;
+    bool fInfinity;
+};
+
+struct CPointJacobian
+{
+    CFieldElem x, y, z;
+    bool fInfinity;
+};
+
+static const unsigned char pchGx[32] = {
+    0x79,0xBE,0x66,0x7E,0xF9,0xDC,0xBB,0xAC,0x55,0xA0,0x62,0x95,0xCE,0x87,0x0B,0x07,
+    0x02,0x9B,0xFC,0xDB,0x2D,0xCE,0x28,0xD9,0x59,0xF2,0x81,0x5B,0x16,0xF8,0x17,0x98
+};
+static const unsigned char pchGy[32] = {
+    0x48,0x3A,0xDA,0x77,0x26,0xA3,0xC4,0x65,0x5D,0xA4,0xFB,0xFC,0x0E,0x11,0x08,0xA8,
+    0xFD,0x17,0xB4,0x48,0xA6,0x85,0x54,0x19,0x9C,0x47,0xD0,0x8F,0xFB,0x10,0xD4,0xB8
+};
+
+// beta^3 = 1 (mod p) and lambda^3 = 1 (mod n) with lambda * (x, y) = (beta * x, y)
+static const unsigned char pchBeta[32] = {
+    0x7A,0xE9,0x6A,0x2B,0x65,0x7C,0x07,0x10,0x6E,0x64,0x47,0x9E,0xAC,0x34,0x34,0xE9,
+    0x9C,0xF0,0x49,0x75,0x12,0xF5,0x89,0x95,0xC1,0x39,0x6C,0x28,0x71,0x95,0x01,0xEE
+};
+static const unsigned char pchLambda[32] = {
+    0x53,0x63,0xAD,0x4C,0xC0,0x5C,0x30,0xE0,0xA5,0x26,0x1C,0x02,0x88,0x12,0x64,0x5A,
+    0x12,0x2E,0x22,0xEA,0x20,0x81,0x66,0x78,0xDF,0x02,0x96,0x7C,0x1B,0x23,0xBD,0x72
+};
+
+// Lattice constants for splitting k = k1 + k2 * lambda with |k1|, |k2| < 2^128
+static const uint32_t G1[8] = {
+    0x45DBB031, 0xE893209A, 0x71E8CA7F, 0x3DAA8A14,
+    0x9284EB15, 0xE86C90E4, 0xA7D46BCD, 0x3086D221
+};
+static const uint32_t G2[8] = {
+    0x8AC47F71, 0x1571B4AE, 0x9DF506C6, 0x221208AC,
+    0x0ABFE4C4, 0x6F547FA9, 0x010E8828, 0xE4437ED6
+};
+static const uint32_t MINUS_B1[8] = {
+    0x0ABFE4C3, 0x6F547FA9, 0x010E8828, 0xE4437ED6,
+    0x00000000, 0x00000000, 0x00000000, 0x00000000
+};
+static const uint32_t MINUS_B2[8] = {
+    0x3DB1562C, 0xD765CDA8, 0x0774346D, 0x8A280AC5,
+    0xFFFFFFFE, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF
+};
+
+static CFieldElem feBeta;
+static CScalar scLambda;
+static CPointAffine geG;
+
+static void PointSetInfinity(CPointJacobian& r)
+{
+    FieldSetInt(r.x, 0);
+    FieldSetInt(r.y, 1);
+    FieldSetInt(r.z, 0);
+    r.fInfinity = true;
+}
+
+static void PointSetAffine(CPointJacobian& r, const CPointAffine& a)
+{
+    r.x = a.x;
+    r.y = a.y;
+    FieldSetInt(r.z, 1);
+    r.fInfinity = a.fInfinity;
+}
+
+static bool PointIsOnCurve(const CFieldElem& x, const CFieldElem& y)
+{
+    CFieldElem y2, x3, seven;
+    FieldSqr(y2, y);
+    FieldSqr(x3, x);
+    FieldMul(x3, x3, x);
+    FieldSetInt(seven, 7);
+    FieldAdd(x3, x3, seven);
+    return FieldEqual(y2, x3);
+}
+
+static bool PointSetXO(CPointAffine& r, const CFieldElem& x, bool fOdd)
+{
+    CFieldElem x3, seven;
+    FieldSqr(x3, x);
+    FieldMul(x3, x3, x);
+    FieldSetInt(seven, 7);
+    FieldAdd(x3, x3, seven);
+    if (!FieldSqrt(r.y, x3))
+        return false;
+    if (FieldIsOdd(r.y) != fOdd)
+        FieldNegate(r.y, r.y);
+    r.x = x;
+    r.fInfinity = false;
+    return true;
+}
+
+static void PointToAffine(CPointAffine& r, const CPointJacobian& a)
+{
+    if (a.fInfinity)
+    {
+        r.fInfinity = true;
+        return;
+    }
+    CFieldElem zi, zi2, zi3;
+    FieldInv(zi, a.z);
+    FieldSqr(zi2, zi);
+    FieldMul(zi3, zi2, zi);
+    FieldMul(r.x, a.x, zi2);
+    FieldMul(r.y, a.y, zi3);
+    r.fInfinity = false;
+}
+
+// Convert many points at once with a single field inversion
+static void PointBatchToAffine(CPointAffine* r, const CPointJacobian* a, size_t n)
+{
+    vector<CFieldElem> vProd(n);
+    CFieldElem acc;
+    FieldSetInt(acc, 1);
+    for (size_t i = 0; i < n; i++)
+    {
+        vProd[i] = acc;
+        FieldMul(acc, acc, a[i].z);
+    }
+    FieldInv(acc, acc);
+    for (size_t i = n; i-- > 0; )
+    {
+        CFieldElem zi, zi2, zi3;
+        FieldMul(zi, acc, vProd[i]);
+        FieldMul(acc, acc, a[i].z);
+        FieldSqr(zi2, zi);
+        FieldMul(zi3, zi2, zi);
+        FieldMul(r[i].x, a[i].x, zi2);
+        FieldMul(r[i].y, a[i].y, zi3);
+        r[i].fInfinity = false;
+    }
+}
+
+static void PointDouble(CPointJacobian& r, const CPointJacobian& a)
+{
+    if (a.fInfinity)
+    {
+        PointSetInfinity(r);
+        return;
+    }
+    // dbl-2009-l, the curve has a = 0
+    CFieldElem A, B, C, D, E, F, t;
+    FieldSqr(A, a.x);
+    FieldSqr(B, a.y);
+    FieldSqr(C, B);
+    FieldAdd(t, a.x, B);
+    FieldSqr(t, t);
+    FieldSub(t, t, A);
+    FieldSub(t, t, C);
+    FieldAdd(D, t, t);
+    FieldAdd(E, A, A);
+    FieldAdd(E, E, A);
+    FieldSqr(F, E);
+    FieldMul(r.z, a.y, a.z);
+    FieldAdd(r.z, r.z, r.z);
+    FieldSub(r.x, F, D);
+    FieldSub(r.x, r.x, D);
+    FieldSub(t, D, r.x);
+    FieldMul(t, E, t);
+    FieldAdd(C, C, C);
+    FieldAdd(C, C, C);
+    FieldAdd(C, C, C);
+    FieldSub(r.y, t, C);
+    r.fInfinity = false;
+}
+
+// Finish an addition given U1, S1, H = U2 - U1, R = S2 - S1 and the new Z
+static void PointAddFinish(CPointJacobian& r, const CFieldElem& u1, const CFieldElem& s1, const CFieldElem& h, const CFieldElem& rr)
+{
+    CFieldElem h2, h3, u1h2, t;
+    FieldSqr(h2, h);
+    FieldMul(h3, h2, h);
+    FieldMul(u1h2, u1, h2);
+    FieldSqr(r.x, rr);
+    FieldSub(r.x, r.x, h3);
+    FieldSub(r.x, r.x, u1h2);
+    FieldSub(r.x, r.x, u1h2);
+    FieldSub(t, u1h2, r.x);
+    FieldMul(t, t, rr);
+    FieldMul(h3, h3, s1);
+    FieldSub(r.y, t, h3);
+    r.fInfinity = false;
+}
+
+static void PointAddVar(CPointJacobian& r, const CPointJacobian& a, const CPointJacobian& b)
+{
+    if (a.fInfinity)
+    {
+        r = b;
+        return;
+    }
+    if (b.fInfinity)
+    {
+        r = a;
+        return;
+    }
+    CFieldElem z12, z22, u1, u2, s1, s2, h, rr;
+    FieldSqr(z12, a.z);
+    FieldSqr(z22, b.z);
+    FieldMul(u1, a.x, z22);
+    FieldMul(u2, b.x, z12);
+    FieldMul(s1, a.y, z22);
+    FieldMul(s1, s1, b.z);
+    FieldMul(s2, b.y, z12);
+    FieldMul(s2, s2, a.z);
+    FieldSub(h, u2, u1);
+    FieldSub(rr, s2, s1);
+    if (FieldIsZero(h))
+    {
+        if (FieldIsZero(rr))
+            PointDouble(r, a);
+        else
+            PointSetInfinity(r);
+        return;
+    }
+    CFieldElem z;
+    FieldMul(z, a.z, b.z);
+    FieldMul(r.z, z, h);
+    PointAddFinish(r, u1, s1, h, rr);
+}
+
+static void PointAddAffineVar(CPointJacobian& r, const CPointJacobian& a, const CPointAffine& b)
+{
+    if (a.fInfinity)
+    {
+        PointSetAffine(r, b);
+        return;
+    }
+    if (b.fInfinity)
+    {
+        r = a;
+        return;
+    }
+    CFieldElem z12, u2, s2, h, rr;
+    FieldSqr(z12, a.z);
+    FieldMul(u2, b.x, z12);
+    FieldMul(s2, b.y, z12);
+    FieldMul(s2, s2, a.z);
+    FieldSub(h, u2, a.x);
+    FieldSub(rr, s2, a.y);
+    if (FieldIsZero(h))
+    {
+        if (FieldIsZero(rr))
+            PointDouble(r, a);
+        else
+            PointSetInfinity(r);
+        return;
+    }
+    CFieldElem u1 = a.x, s1 = a.y;
+    FieldMul(r.z, a.z, h);
+    PointAddFinish(r, u1, s1, h, rr);
+}
+
+
+//
+// Precomputed tables
+//
+
+// Odd multiples 1G, 3G, ..., (2^(WINDOW_G-1)-1)G of the generator and of lambda*G
+static const int WINDOW_G = 12;
+static const int TABLE_SIZE_G = 1 << (WINDOW_G - 2);
+static CPointAffine vPreG[TABLE_SIZE_G];
+static CPointAffine vPreLambdaG[TABLE_SIZE_G];
+
+// Window for the per-call tables of public keys
+static const int WINDOW_A = 5;
+static const int TABLE_SIZE_A = 1 << (WINDOW_A - 2);
+
+// Signing comb: vComb[i][j-1] = j * 16^i * G
+static const int COMB_TEETH = 64;
+static CPointAffine vComb[COMB_TEETH][15];
+
+class CSecp256k1Init
+{
+public:
+    CSecp256k1Init()
+    {
+        FieldSetB32(feBeta, pchBeta);
+        ScalarSetB32(scLambda, pchLambda);
+        FieldSetB32(geG.x, pchGx);
+        FieldSetB32(geG.y, pchGy);
+        geG.fInfinity = false;
+
+        vector<CPointJacobian> vPoints(TABLE_SIZE_G);
+        CPointJacobian g, g2;
+        PointSetAffine(g, geG);
+        PointDouble(g2, g);
+        vPoints[0] = g;
+        for (int i = 1; i < TABLE_SIZE_G; i++)
+            PointAddVar(vPoints[i], vPoints[i - 1], g2);
+        PointBatchToAffine(vPreG, &vPoints[0], TABLE_SIZE_G);
+        for (int i = 0; i < TABLE_SIZE_G; i++)
+        {
+            FieldMul(vPreLambdaG[i].x, vPreG[i].x, feBeta);
+            vPreLambdaG[i].y = vPreG[i].y;
+            vPreLambdaG[i].fInfinity = false;
+        }
+
+        vPoints.resize(COMB_TEETH * 15);
+        CPointJacobian base = g;
+        for (int i = 0; i < COMB_TEETH; i++)
+        {
+            vPoints[i * 15] = base;
+            for (int j = 1; j < 15; j++)
+                PointAddVar(vPoints[i * 15 + j], vPoints[i * 15 + j - 1], base);
+            PointAddVar(base, vPoints[i * 15 + 14], base);
+        }
+        PointBatchToAffine(&vComb[0][0], &vPoints[0], COMB_TEETH * 15);
+    }
+}
+instance_of_csecp256k1init;
+
+
+//
+// Variable time multi-scalar multiplication for verification and recovery
+//
+
+// Width-w NAF of a scalar: nonzero digits are odd, |digit| < 2^(w-1) and
+// any w consecutive digits contain at most one nonzero one.
+static int ScalarToWNAF(int* pnWNAF, const CScalar& aIn, int w)
+{
+    CScalar a = aIn;
+    int nSign = 1;
+    if (a.n[7] >> 31)
+    {
+        ScalarNegate(a, a);
+        nSign = -1;
+    }
+
+    const int nLen = 257;
+    memset(pnWNAF, 0, nLen * sizeof(int));
+    int nLast = -1;
+    int nCarry = 0;
+    int nBit = 0;
+    while (nBit < nLen)
+    {
+        if ((int)ScalarGetBits(a, nBit, 1) == nCarry)
+        {
+            nBit++;
+            continue;
+        }
+        int nNow = w;
+        if (nNow > nLen - nBit)
+            nNow = nLen - nBit;
+        int nWord = (int)ScalarGetBits(a, nBit, nNow) + nCarry;
+        nCarry = (nWord >> (w - 1)) & 1;
+        nWord -= nCarry << w;
+        pnWNAF[nBit] = nSign * nWord;
+        nLast = nBit;
+        nBit += nNow;
+    }
+    return nLast + 1;
+}
+
+// Split k into k1 + k2 * lambda (mod n) with k1, k2 about 128 bits in absolute value
+static void ScalarSplitLambda(CScalar& r1, CScalar& r2, const CScalar& k)
+{
+    CScalar c1, c2, b1, b2;
+    ScalarMulShift384(c1, k, G1);
+    ScalarMulShift384(c2, k, G2);
+    memcpy(b1.n, MINUS_B1, sizeof(b1.n));
+    memcpy(b2.n, MINUS_B2, sizeof(b2.n));
+    ScalarMul(c1, c1, b1);
+    ScalarMul(c2, c2, b2);
+    ScalarAdd(r2, c1, c2);
+    ScalarMul(r1, r2, scLambda);
+    ScalarNegate(r1, r1);
+    ScalarAdd(r1, r1, k);
+}
+
+template<typename T>
+static void PointFromTable(T& r, const T* pTable, int n)
+{
+    if (n > 0)
+        r = pTable[(n - 1) / 2];
+    else
+    {
+        r = pTable[(-n - 1) / 2];
+        FieldNegate(r.y, r.y);
+    }
+}
+
+// r = na * A + ng * G
+static void EcMult(CPointJacobian& r, const CPointAffine& a, const CScalar& na, const CScalar& ng)
+{
+    // odd multiples of A and lambda * A, kept in Jacobian coordinates
+    CPointJacobian vPreA[TABLE_SIZE_A], vPreLambdaA[TABLE_SIZE_A];
+    CPointJacobian a2;
+    PointSetAffine(vPreA[0], a);
+    PointDouble(a2, vPreA[0]);
+    for (int i = 1; i < TABLE_SIZE_A; i++)
+        PointAddVar(vPreA[i], vPreA[i - 1], a2);
+    for (int i = 0; i < TABLE_SIZE_A; i++)
+    {
+        vPreLambdaA[i] = vPreA[i];
+        FieldMul(vPreLambdaA[i].x, vPreA[i].x, feBeta);
+    }
+
+    CScalar na1, na2, ng1, ng2;
+    ScalarSplitLambda(na1, na2, na);
+    ScalarSplitLambda(ng1, ng2, ng);
+
+    int vnA1[257], vnA2[257], vnG1[257], vnG2[257];
+    int nBits = 0;
+    nBits = max(nBits, ScalarToWNAF(vnA1, na1, WINDOW_A));
+    nBits = max(nBits, ScalarToWNAF(vnA2, na2, WINDOW_A));
+    nBits = max(nBits, ScalarToWNAF(vnG1, ng1, WINDOW_G));
+    nBits = max(nBits, ScalarToWNAF(vnG2, ng2, WINDOW_G));
+
+    PointSetInfinity(r);
+    for (int i = nBits - 1; i >= 0; i--)
+    {
+        PointDouble(r, r);
+        CPointJacobian tj;
+        CPointAffine ta;
+        if (vnA1[i])
+        {
+            PointFromTable(tj, vPreA, vnA1[i]);
+            PointAddVar(r, r, tj);
+        }
+        if (vnA2[i])
+        {
+            PointFromTable(tj, vPreLambdaA, vnA2[i]);
+            PointAddVar(r, r, tj);
+        }
+        if (vnG1[i])
+        {
+            PointFromTable(ta, vPreG, vnG1[i]);
+            PointAddAffineVar(r, r, ta);
+        }
+        if (vnG2[i])
+        {
+            PointFromTable(ta, vPreLambdaG, vnG2[i]);
+            PointAddAffineVar(r, r, ta);
+        }
+    }
+}
+
+
+//
+// Constant time k * G for signing
+//
+
+// Complete homogeneous projective coordinates (x = X/Z, y = Y/Z), identity (0:1:0)
+struct CPointProjective
+{
+    CFieldElem x, y, z;
+};
+
+// Renes-Costello-Batina complete addition for a = 0 (algorithm 7), no special cases
+static void PointAddComplete(CPointProjective& r, const CPointProjective& a, const CPointProjective& b)
+{
+    CFieldElem b3, t0, t1, t2, t3, t4, x3, y3, z3;
+    FieldSetInt(b3, 21);
+    FieldMul(t0, a.x, b.x);
+    FieldMul(t1, a.y, b.y);
+    FieldMul(t2, a.z, b.z);
+    FieldAdd(t3, a.x, a.y);
+    FieldAdd(t4, b.x, b.y);
+    FieldMul(t3, t3, t4);
+    FieldAdd(t4, t0, t1);
+    FieldSub(t3, t3, t4);
+    FieldAdd(t4, a.y, a.z);
+    FieldAdd(x3, b.y, b.z);
+    FieldMul(t4, t4, x3);
+    FieldAdd(x3, t1, t2);
+    FieldSub(t4, t4, x3);
+    FieldAdd(x3, a.x, a.z);
+    FieldAdd(y3, b.x, b.z);
+    FieldMul(x3, x3, y3);
+    FieldAdd(y3, t0, t2);
+    FieldSub(y3, x3, y3);
+    FieldAdd(x3, t0, t0);
+    FieldAdd(t0, x3, t0);
+    FieldMul(t2, b3, t2);
+    FieldAdd(z3, t1, t2);
+    FieldSub(t1, t1, t2);
+    FieldMul(y3, b3, y3);
+    FieldMul(x3, t4, y3);
+    FieldMul(t2, t3, t1);
+    FieldSub(x3, t2, x3);
+    FieldMul(y3, y3, t0);
+    FieldMul(t1, t1, z3);
+    FieldAdd(y3, t1, y3);
+    FieldMul(t0, t0, t3);
+    FieldMul(z3, z3, t4);
+    FieldAdd(z3, z3, t0);
+    r.x = x3;
+    r.y = y3;
+    r.z = z3;
+}
+
+// r = k * G, affine. The table is scanned completely for every digit.
+static void EcMultGen(CPointAffine& r, const CScalar& k)
+{
+    CPointProjective acc, t;
+    FieldSetInt(acc.x, 0);
+    FieldSetInt(acc.y, 1);
+    FieldSetInt(acc.z, 0);
+    CFieldElem one;
+    FieldSetInt(one, 1);
+
+    for (int i = 0; i < COMB_TEETH; i++)
+    {
+        uint32_t nDigit = ScalarGetBits(k, 4 * i, 4);
+        FieldSetInt(t.x, 0);
+        FieldSetInt(t.y, 1);
+        FieldSetInt(t.z, 0);
+        for (uint32_t j = 1; j < 16; j++)
+        {
+            uint32_t d = j ^ nDigit;
+            uint32_t fFlag = ((d | (0 - d)) >> 31) ^ 1;
+            FieldCMov(t.x, vComb[i][j - 1].x, fFlag);
+            FieldCMov(t.y, vComb[i][j - 1].y, fFlag);
+            FieldCMov(t.z, one, fFlag);
+        }
+        PointAddComplete(acc, acc, t);
+    }
+
+    CFieldElem zi;
+    FieldInv(zi, acc.z);
+    FieldMul(r.x, acc.x, zi);
+    FieldMul(r.y, acc.y, zi);
+    r.fInfinity = FieldIsZero(acc.z);
+    OPENSSL_cleanse(&acc, sizeof(acc));
+    OPENSSL_cleanse(&t, sizeof(t));
+}
+
+
+//
+// Encodings
+//
+
+static bool ParsePubKey(CPointAffine& r, const unsigned char* pch, size_t nSize)
+{
+    if (nSize == 33 && (pch[0] == 0x02 || pch[0] == 0x03))
+    {
+        CFieldElem x;
+        if (!FieldSetB32(x, pch + 1))
+            return false;
+        return PointSetXO(r, x, pch[0] == 0x03);
+    }
+    if (nSize == 65 && (pch[0] == 0x04 || pch[0] == 0x06 || pch[0] == 0x07))
+    {
+        if (!FieldSetB32(r.x, pch + 1) || !FieldSetB32(r.y, pch + 33))
+            return false;
+        // hybrid encoding carries the parity of y in the header
+        if (pch[0] != 0x04 && FieldIsOdd(r.y) != (pch[0] == 0x07))
+            return false;
+        r.fInfinity = false;
+        return PointIsOnCurve(r.x, r.y);
+    }
+    return false;
+}
+
+static void SerializePubKey(vector<unsigned char>& vch, const CPointAffine& a, bool fCompressed)
+{
+    vch.resize(fCompressed ? 33 : 65);
+    FieldGetB32(&vch[1], a.x);
+    if (fCompressed)
+        vch[0] = FieldIsOdd(a.y) ? 0x03 : 0x02;
+    else
+    {
+        vch[0] = 0x04;
+        FieldGetB32(&vch[33], a.y);
+    }
+}
+
+// Read an ASN.1 identifier and length like OpenSSL's ASN1_get_object
+static bool ReadASN1Header(const unsigned char*& p, const unsigned char* pend, unsigned int& nTag, bool& fConstructed, bool& fIndefinite, size_t& nLen)
+{
+    if (p >= pend)
+        return false;
+    unsigned char c = *p++;
+    // only the universal class is acceptable for SEQUENCE and INTEGER
+    if (c & 0xC0)
+        return false;
+    fConstructed = (c & 0x20) != 0;
+    nTag = c & 0x1F;
+    if (nTag == 0x1F)
+    {
+        // high tag number form
+        nTag = 0;
+        do
+        {
+            if (p >= pend || nTag > (0xFFFFFFFFU >> 7))
+                return false;
+            c = *p++;
+            nTag = (nTag << 7) | (c & 0x7F);
+        } while (c & 0x80);
+    }
+
+    if (p >= pend)
+        return false;
+    c = *p++;
+    fIndefinite = false;
+    nLen = 0;
+    if (c == 0x80)
+    {
+        if (!fConstructed)
+            return false;
+        fIndefinite = true;
+        return true;
+    }
+    if (c & 0x80)
+    {
+        int nBytes = c & 0x7F;
+        while (nBytes > 0 && p < pend && *p == 0)
+        {
+            p++;
+            nBytes--;
+        }
+        if (nBytes > 4)
+            return false;
+        while (nBytes-- > 0)
+        {
+            if (p >= pend)
+                return false;
+            nLen = (nLen << 8) | *p++;
+        }
+    }
+    else
+        nLen = c;
+    return nLen <= (size_t)(pend - p);
+}
+
+// Non-negative INTEGER below 2^256; other values can never verify
+static bool ReadASN1Integer(const unsigned char*& p, const unsigned char* pend, unsigned char* pch32)
+{
+    unsigned int nTag;
+    bool fConstructed, fIndefinite;
+    size_t nLen;
+    if (!ReadASN1Header(p, pend, nTag, fConstructed, fIndefinite, nLen))
+        return false;
+    if (nTag != 2 || fConstructed)
+        return false;
+    const unsigned char* pbegin = p;
+    p += nLen;
+    if (nLen == 0 || (pbegin[0] & 0x80))
+        return false;
+    while (nLen > 0 && *pbegin == 0)
+    {
+        pbegin++;
+        nLen--;
+    }
+    if (nLen > 32)
+        return false;
+    memset(pch32, 0, 32);
+    memcpy(pch32 + 32 - nLen, pbegin, nLen);
+    return true;
+}
+
+// Parse (r, s) the way d2i_ECDSA_SIG does
+static bool ParseSignature(CScalar& r, CScalar& s, const vector<unsigned char>& vchSig)
+{
+    if (vchSig.empty())
+        return false;
+    const unsigned char* p = &vchSig[0];
+    const unsigned char* pend = p + vchSig.size();
+
+    unsigned int nTag;
+    bool fConstructed, fIndefinite;
+    size_t nLen;
+    if (!ReadASN1Header(p, pend, nTag, fConstructed, fIndefinite, nLen))
+        return false;
+    if (nTag != 16 || !fConstructed)
+        return false;
+    const unsigned char* pseqend = fIndefinite ? pend : p + nLen;
+
+    unsigned char pchR[32], pchS[32];
+    if (!ReadASN1Integer(p, pseqend, pchR) || !ReadASN1Integer(p, pseqend, pchS))
+        return false;
+    if (fIndefinite)
+    {
+        // end-of-contents octets
+        if (pend - p < 2 || p[0] != 0 || p[1] != 0)
+            return false;
+    }
+    else if (p != pseqend)
+        return false;
+
+    bool fOverflowR, fOverflowS;
+    ScalarSetB32(r, pchR, &fOverflowR);
+    ScalarSetB32(s, pchS, &fOverflowS);
+    return !fOverflowR && !fOverflowS && !ScalarIsZero(r) && !ScalarIsZero(s);
+}
+
+static void AppendDERInteger(vector<unsigned char>& vch, const unsigned char* pch32)
+{
+    int nStart = 0;
+    while (nStart < 31 && pch32[nStart] == 0)
+        nStart++;
+    bool fPad = (pch32[nStart] & 0x80) != 0;
+    vch.push_back(0x02);
+    vch.push_back(32 - nStart + (fPad ? 1 : 0));
+    if (fPad)
+        vch.push_back(0x00);
+    vch.insert(vch.end(), pch32 + nStart, pch32 + 32);
+}
+
+
+//
+// ECDSA
+//
+
+// Is R = u1 * G + u2 * Q a point whose x coordinate is r modulo n?
+static bool VerifyInverted(const CScalar& r, const CScalar& sinv, const CScalar& e, const CPointAffine& q)
+{
+    CScalar u1, u2;
+    ScalarMul(u1, e, sinv);
+    ScalarMul(u2, r, sinv);
+
+    CPointJacobian R;
+    EcMult(R, q, u2, u1);
+    if (R.fInfinity)
+        return false;
+
+    // Compare in Jacobian coordinates: x(R) = r or r + n (if below p)
+    unsigned char pchR[32];
+    ScalarGetB32(pchR, r);
+    CFieldElem xr, z2, t;
+    FieldSetB32(xr, pchR);
+    FieldSqr(z2, R.z);
+    FieldMul(t, xr, z2);
+    if (FieldEqual(t, R.x))
+        return true;
+
+    static const uint32_t PMINUSN[8] = {
+        0x2FC9BAEE, 0x402DA172, 0x50B75FC4, 0x45512319, 1, 0, 0, 0
+    };
+    for (int i = 7; i >= 0; i--)
+    {
+        if (xr.n[i] < PMINUSN[i])
+            break;
+        if (xr.n[i] > PMINUSN[i])
+            return false;
+        if (i == 0)
+            return false;
+    }
+    CFieldElem nfe;
+    memcpy(nfe.n, N, sizeof(nfe.n));
+    FieldAdd(xr, xr, nfe);
+    FieldMul(t, xr, z2);
+    return FieldEqual(t, R.x);
+}
+
+static void ScalarFromHash(CScalar& e, const uint256& hash)
+{
+    // the hash bytes are taken as a big endian number, as OpenSSL does
+    ScalarSetB32(e, (const unsigned char*)&hash);
+}
+
+// RFC6979 deterministic nonce generation with HMAC-SHA256
+class CNonceRFC6979
+{
+private:
+    unsigned char K[32];
+    unsigned char V[32];
+
+    void Mac(unsigned char* pout, const unsigned char* pdata, size_t nSize)
+    {
+        unsigned char pchMac[32];
+        unsigned int nOut = 32;
+        HMAC(EVP_sha256(), K, 32, pdata, nSize, pchMac, &nOut);
+        memcpy(pout, pchMac, 32);
+        OPENSSL_cleanse(pchMac, sizeof(pchMac));
+    }
+
+    void Update(unsigned char nByte, const unsigned char* pchSecret, const unsigned char* pchHash)
+    {
+        unsigned char buf[97];
+        memcpy(buf, V, 32);
+        buf[32] = nByte;
+        size_t nSize = 33;
+        if (pchSecret)
+        {
+            memcpy(buf + 33, pchSecret, 32);
+            memcpy(buf + 65, pchHash, 32);
+            nSize = 97;
+        }
+        Mac(K, buf, nSize);
+        Mac(V, V, 32);
+        OPENSSL_cleanse(buf, sizeof(buf));
+    }
+
+public:
+    CNonceRFC6979(const unsigned char* pchSecret, const unsigned char* pchHash)
+    {
+        memset(V, 0x01, 32);
+        memset(K, 0x00, 32);
+        Update(0x00, pchSecret, pchHash);
+        Update(0x01, pchSecret, pchHash);
+    }
+
+    ~CNonceRFC6979()
+    {
+        OPENSSL_cleanse(K, sizeof(K));
+        OPENSSL_cleanse(V, sizeof(V));
+    }
+
+    void Generate(unsigned char* pch32)
+    {
+        Mac(V, V, 32);
+        memcpy(pch32, V, 32);
+        // prepare for a retry, should this candidate be rejected
+        Update(0x00, NULL, NULL);
+    }
+};
+
+// Produce (r, s) with low s and the recovery id of R
+static bool SignRaw(CScalar& r, CScalar& s, int& nRecId, const uint256& hash, const unsigned char* pchSecret)
+{
+    CScalar d, e;
+    bool fOverflow;
+    ScalarSetB32(d, pchSecret, &fOverflow);
+    if (fOverflow || ScalarIsZero(d))
+        return false;
+    ScalarFromHash(e, hash);
+
+    // bits2octets(h1) for the nonce derivation
+    unsigned char pchHash[32];
+    ScalarGetB32(pchHash, e);
+
+    unsigned char pchSecretReduced[32];
+    ScalarGetB32(pchSecretReduced, d);
+    CNonceRFC6979 nonce(pchSecretReduced, pchHash);
+    OPENSSL_cleanse(pchSecretReduced, sizeof(pchSecretReduced));
+
+    bool fOk = false;
+    for (int nTry = 0; nTry < 100 && !fOk; nTry++)
+    {
+        unsigned char pchNonce[32];
+        nonce.Generate(pchNonce);
+        CScalar k;
+        ScalarSetB32(k, pchNonce, &fOverflow);
+        OPENSSL_cleanse(pchNonce, sizeof(pchNonce));
+        if (fOverflow || ScalarIsZero(k))
+            continue;
+
+        CPointAffine R;
+        EcMultGen(R, k);
+        unsigned char pchX[32];
+        FieldGetB32(pchX, R.x);
+        bool fOverflowX;
+        ScalarSetB32(r, pchX, &fOverflowX);
+        nRecId = (FieldIsOdd(R.y) ? 1 : 0) | (fOverflowX ? 2 : 0);
+
+        // s = k^-1 * (e + r * d)
+        CScalar kinv;
+        ScalarInv(kinv, k);
+        ScalarMul(s, r, d);
+        ScalarAdd(s, s, e);
+        ScalarMul(s, s, kinv);
+        OPENSSL_cleanse(&k, sizeof(k));
+        OPENSSL_cleanse(&kinv, sizeof(kinv));
+        if (ScalarIsZero(r) || ScalarIsZero(s))
+            continue;
+
+        // enforce low S values, by negating the value (modulo the order) if above order/2.
+        if (ScalarIsHigh(s))
+        {
+            ScalarNegate(s, s);
+            nRecId ^= 1;
+        }
+        fOk = true;
+    }
+    OPENSSL_cleanse(&d, sizeof(d));
+    return fOk;
+}
+
+} // anonymous namespace
+
+
+namespace Secp256k1
+{
+
+bool IsValidPubKey(const vector<unsigned char>& vchPubKey)
+{
+    CPointAffine q;
+    return !vchPubKey.empty() && ParsePubKey(q, &vchPubKey[0], vchPubKey.size());
+}
+
+bool Verify(const uint256& hash, const vector<unsigned char>& vchSig, const vector<unsigned char>& vchPubKey)
+{
+    CPointAffine q;
+    if (vchPubKey.empty() || !ParsePubKey(q, &vchPubKey[0], vchPubKey.size()))
+        return false;
+    CScalar r, s, e, sinv;
+    if (!ParseSignature(r, s, vchSig))
+        return false;
+    ScalarFromHash(e, hash);
+    ScalarInvVar(sinv, s);
+    return VerifyInverted(r, sinv, e, q);
+}
+
+bool Sign(const uint256& hash, const unsigned char* pchSecret, vector<unsigned char>& vchSig)
+{
+    vchSig.clear();
+    CScalar r, s;
+    int nRecId;
+    if (!SignRaw(r, s, nRecId, hash, pchSecret))
+        return false;
+
+    unsigned char pchR[32], pchS[32];
+    ScalarGetB32(pchR, r);
+    ScalarGetB32(pchS, s);
+    vchSig.push_back(0x30);
+    vchSig.push_back(0x00);
+    AppendDERInteger(vchSig, pchR);
+    AppendDERInteger(vchSig, pchS);
+    vchSig[1] = vchSig.size() - 2;
+    return true;
+}
+
+bool SignCompact(const uint256& hash, const unsigned char* pchSecret, bool fCompressed, vector<unsigned char>& vchSig)
+{
+    vchSig.clear();
+    CScalar r, s;
+    int nRecId;
+    if (!SignRaw(r, s, nRecId, hash, pchSecret))
+        return false;
+
+    vchSig.resize(65);
+    vchSig[0] = nRecId + 27 + (fCompressed ? 4 : 0);
+    ScalarGetB32(&vchSig[1], r);
+    ScalarGetB32(&vchSig[33], s);
+    return true;
+}
+
+bool RecoverCompact(const uint256& hash, const vector<unsigned char>& vchSig, vector<unsigned char>& vchPubKey)
+{
+    if (vchSig.size() != 65)
+        return false;
+    int nV = vchSig[0];
+    if (nV < 27 || nV >= 35)
+        return false;
+    bool fCompressed = false;
+    if (nV >= 31)
+    {
+        fCompressed = true;
+        nV -= 4;
+    }
+    int nRecId = nV - 27;
+
+    CScalar r, s, e;
+    bool fOverflowR, fOverflowS;
+    ScalarSetB32(r, &vchSig[1], &fOverflowR);
+    ScalarSetB32(s, &vchSig[33], &fOverflowS);
+    if (fOverflowR || fOverflowS || ScalarIsZero(r) || ScalarIsZero(s))
+        return false;
+
+    // R has x coordinate r (+ n for the second key) and the given parity
+    unsigned char pchX[32];
+    memcpy(pchX, &vchSig[1], 32);
+    CFieldElem x;
+    if (!FieldSetB32(x, pchX))
+        return false;
+    if (nRecId & 2)
+    {
+        CFieldElem nfe;
+        memcpy(nfe.n, N, sizeof(nfe.n));
+        uint64_t c = 0;
+        for (int i = 0; i < 8; i++)
+        {
+            c += (uint64_t)x.n[i] + nfe.n[i];
+            x.n[i] = (uint32_t)c;
+            c >>= 32;
+        }
+        unsigned char pchSum[32];
+        FieldGetB32(pchSum, x);
+        if (c || !FieldSetB32(x, pchSum))
+            return false;
+    }
+    CPointAffine R;
+    if (!PointSetXO(R, x, nRecId & 1))
+        return false;
+
+    // Q = r^-1 * (s * R - e * G)
+    CScalar rinv, u1, u2;
+    ScalarFromHash(e, hash);
+    ScalarInvVar(rinv, r);
+    ScalarMul(u1, e, rinv);
+    ScalarNegate(u1, u1);
+    ScalarMul(u2, s, rinv);
+
+    CPointJacobian Q;
+    EcMult(Q, R, u2, u1);
+    if (Q.fInfinity)
+        return false;
+    CPointAffine q;
+    PointToAffine(q, Q);
+    SerializePubKey(vchPubKey, q, fCompressed);
+    return true;
+}
+
+} // namespace Secp256k1
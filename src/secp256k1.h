@@ -0,0 +1,39 @@
+// Copyright (c) 2014 The NovaCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef NOVACOIN_SECP256K1_H
+#define NOVACOIN_SECP256K1_H
+
+#include <vector>
+
+#include "uint256.h"
+
+//
+// Self-contained secp256k1 arithmetic used for ECDSA verification, signing
+// and public key recovery instead of the generic OpenSSL EC_KEY code paths.
+//
+// Verification uses precomputed tables of odd multiples of G, the curve
+// endomorphism to halve the length of both scalar multiplications and never
+// allocates. Signing uses RFC6979 nonces and a constant-time comb.
+//
+namespace Secp256k1
+{
+    // Same encodings as OpenSSL's o2i_ECPublicKey: compressed, uncompressed
+    // and hybrid points (the point at infinity is refused).
+    bool IsValidPubKey(const std::vector<unsigned char>& vchPubKey);
+
+    // Accepts exactly the signatures that the d2i_ECDSA_SIG/ECDSA_verify
+    // pair accepts, including BER encodings and trailing garbage.
+    bool Verify(const uint256& hash, const std::vector<unsigned char>& vchSig, const std::vector<unsigned char>& vchPubKey);
+
+    // Create a DER signature with a low S value using a 32 byte secret
+    bool Sign(const uint256& hash, const unsigned char* pchSecret, std::vector<unsigned char>& vchSig);
+
+    // Create a compact signature (65 bytes), see CKey::SignCompact
+    bool SignCompact(const uint256& hash, const unsigned char* pchSecret, bool fCompressed, std::vector<unsigned char>& vchSig);
+
+    // Reconstruct the serialized public key from a compact signature
+    bool RecoverCompact(const uint256& hash, const std::vector<unsigned char>& vchSig, std::vector<unsigned char>& vchPubKey);
+}
+
+#endif
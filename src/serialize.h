@@ -11,6 +11,7 @@
 #include <set>
 #include <cassert>
 #include <limits>
+#include <algorithm>
 #include <cstring>
 #include <cstdio>
 
@@ -31,7 +32,6 @@
 
 
 class CScript;
-class CDataStream;
 class CAutoFile;
 static const unsigned int MAX_SIZE = 0x02000000;
 
@@ -845,17 +845,22 @@ struct ser_streamplaceholder
 
 
 
-typedef std::vector<char, zero_after_free_allocator<char> > CSerializeData;
+typedef std::vector<char> CSerializeData;
+typedef std::vector<char, zero_after_free_allocator<char> > CSecureSerializeData;
 
 /** Double ended buffer combining vector and stream-like interfaces.
  *
  * >> and << read and write unformatted data using the above serialization templates.
  * Fills with data in linear time; some stringstream implementations take N^2 time.
+ *
+ * Use CBaseDataStream for public data and CSecureDataStream for anything that may
+ * hold secrets, its buffer is cleared when freed.
  */
-class CDataStream
+template<typename SerializeData>
+class CBaseDataStream
 {
 protected:
-    typedef CSerializeData vector_type;
+    typedef SerializeData vector_type;
     vector_type vch;
     unsigned int nReadPos;
     short state;
@@ -864,44 +869,40 @@ public:
     int nType;
     int nVersion;
 
-    typedef vector_type::allocator_type   allocator_type;
-    typedef vector_type::size_type        size_type;
-    typedef vector_type::difference_type  difference_type;
-    typedef vector_type::reference        reference;
-    typedef vector_type::const_reference  const_reference;
-    typedef vector_type::value_type       value_type;
-    typedef vector_type::iterator         iterator;
-    typedef vector_type::const_iterator   const_iterator;
-    typedef vector_type::reverse_iterator reverse_iterator;
-
-    explicit CDataStream(int nTypeIn, int nVersionIn)
+    typedef typename vector_type::allocator_type   allocator_type;
+    typedef typename vector_type::size_type        size_type;
+    typedef typename vector_type::difference_type  difference_type;
+    typedef typename vector_type::reference        reference;
+    typedef typename vector_type::const_reference  const_reference;
+    typedef typename vector_type::value_type       value_type;
+    typedef typename vector_type::iterator         iterator;
+    typedef typename vector_type::const_iterator   const_iterator;
+    typedef typename vector_type::reverse_iterator reverse_iterator;
+
+    explicit CBaseDataStream(int nTypeIn, int nVersionIn)
     {
         Init(nTypeIn, nVersionIn);
     }
 
-    CDataStream(const_iterator pbegin, const_iterator pend, int nTypeIn, int nVersionIn) : vch(pbegin, pend)
+    CBaseDataStream(const_iterator pbegin, const_iterator pend, int nTypeIn, int nVersionIn) : vch(pbegin, pend)
     {
         Init(nTypeIn, nVersionIn);
     }
 
 #if !defined(_MSC_VER) || _MSC_VER >= 1300
-    CDataStream(const char* pbegin, const char* pend, int nTypeIn, int nVersionIn) : vch(pbegin, pend)
+    CBaseDataStream(const char* pbegin, const char* pend, int nTypeIn, int nVersionIn) : vch(pbegin, pend)
     {
         Init(nTypeIn, nVersionIn);
     }
 #endif
 
-    CDataStream(const vector_type& vchIn, int nTypeIn, int nVersionIn) : vch(vchIn.begin(), vchIn.end())
-    {
-        Init(nTypeIn, nVersionIn);
-    }
-
-    CDataStream(const std::vector<char>& vchIn, int nTypeIn, int nVersionIn) : vch(vchIn.begin(), vchIn.end())
+    template<typename A>
+    CBaseDataStream(const std::vector<char, A>& vchIn, int nTypeIn, int nVersionIn) : vch(vchIn.begin(), vchIn.end())
     {
         Init(nTypeIn, nVersionIn);
     }
 
-    CDataStream(const std::vector<unsigned char>& vchIn, int nTypeIn, int nVersionIn) : vch(vchIn.begin(), vchIn.end())
+    CBaseDataStream(const std::vector<unsigned char>& vchIn, int nTypeIn, int nVersionIn) : vch(vchIn.begin(), vchIn.end())
     {
         Init(nTypeIn, nVersionIn);
     }
@@ -915,15 +916,15 @@ public:
         exceptmask = std::ios::badbit | std::ios::failbit;
     }
 
-    CDataStream& operator+=(const CDataStream& b)
+    CBaseDataStream& operator+=(const CBaseDataStream& b)
     {
         vch.insert(vch.end(), b.begin(), b.end());
         return *this;
     }
 
-    friend CDataStream operator+(const CDataStream& a, const CDataStream& b)
+    friend CBaseDataStream operator+(const CBaseDataStream& a, const CBaseDataStream& b)
     {
-        CDataStream ret = a;
+        CBaseDataStream ret = a;
         ret += b;
         return (ret);
     }
@@ -943,7 +944,7 @@ public:
     iterator end()                                   { return vch.end(); }
     size_type size() const                           { return vch.size() - nReadPos; }
     bool empty() const                               { return vch.size() == nReadPos; }
-    void resize(size_type n, value_type c=0)         { vch.resize(n + nReadPos, c); }
+    void resize(size_type n, value_type c=0)         { if (n > size()) ReserveAppend(n - size()); vch.resize(n + nReadPos, c); }
     void reserve(size_type n)                        { vch.reserve(n + nReadPos); }
     const_reference operator[](size_type pos) const  { return vch[pos + nReadPos]; }
     reference operator[](size_type pos)              { return vch[pos + nReadPos]; }
@@ -1039,6 +1040,19 @@ public:
         nReadPos = 0;
     }
 
+    void ReserveAppend(size_type n)
+    {
+        // Make room for n more bytes. The consumed front of the buffer is
+        // reclaimed first when it is at least as large as the unread data,
+        // which keeps the cost of moving it amortized constant.
+        if (vch.size() + n <= vch.capacity())
+            return;
+        if (nReadPos > 0 && nReadPos >= vch.size() - nReadPos)
+            Compact();
+        if (vch.size() + n > vch.capacity())
+            vch.reserve(std::max(vch.capacity() * 2, vch.size() + n));
+    }
+
     bool Rewind(size_type n)
     {
         // Rewind by n characters if the buffer hasn't been compacted yet
@@ -1065,7 +1079,7 @@ public:
     void clear(short n)          { state = n; }  // name conflict with vector clear()
     short exceptions()           { return exceptmask; }
     short exceptions(short mask) { short prev = exceptmask; exceptmask = mask; setstate(0, "CDataStream"); return prev; }
-    CDataStream* rdbuf()         { return this; }
+    CBaseDataStream* rdbuf()         { return this; }
     int in_avail()               { return (int)(size()); }
 
     void SetType(int n)          { nType = n; }
@@ -1075,7 +1089,7 @@ public:
     void ReadVersion()           { *this >> nVersion; }
     void WriteVersion()          { *this << nVersion; }
 
-    CDataStream& read(char* pch, int nSize)
+    CBaseDataStream& read(char* pch, int nSize)
     {
         // Read from the beginning of the buffer
         assert(nSize >= 0);
@@ -1098,7 +1112,7 @@ public:
         return (*this);
     }
 
-    CDataStream& ignore(int nSize)
+    CBaseDataStream& ignore(int nSize)
     {
         // Ignore from the beginning of the buffer
         assert(nSize >= 0);
@@ -1115,10 +1129,11 @@ public:
         return (*this);
     }
 
-    CDataStream& write(const char* pch, int nSize)
+    CBaseDataStream& write(const char* pch, int nSize)
     {
         // Write to the end of the buffer
         assert(nSize >= 0);
+        ReserveAppend(nSize);
         vch.insert(vch.end(), pch, pch + nSize);
         return (*this);
     }
@@ -1139,7 +1154,7 @@ public:
     }
 
     template<typename T>
-    CDataStream& operator<<(const T& obj)
+    CBaseDataStream& operator<<(const T& obj)
     {
         // Serialize to this stream
         ::Serialize(*this, obj, nType, nVersion);
@@ -1147,16 +1162,69 @@ public:
     }
 
     template<typename T>
-    CDataStream& operator>>(T& obj)
+    CBaseDataStream& operator>>(T& obj)
     {
         // Unserialize from this stream
         ::Unserialize(*this, obj, nType, nVersion);
         return (*this);
     }
 
-    void GetAndClear(CSerializeData &data) {
+    void GetAndClear(SerializeData &data) {
         vch.swap(data);
-        CSerializeData().swap(vch);
+        SerializeData().swap(vch);
+    }
+};
+
+typedef CBaseDataStream<CSerializeData> CDataStream;
+typedef CBaseDataStream<CSecureSerializeData> CSecureDataStream;
+
+/** Fixed capacity stream on the stack, for serializing small objects
+ *  to hash them without touching the heap.
+ */
+template<unsigned int N>
+class CFixedDataStream
+{
+protected:
+    char vch[N];
+    unsigned int nSize;
+public:
+    int nType;
+    int nVersion;
+
+    typedef const char* const_iterator;
+
+    CFixedDataStream(int nTypeIn, int nVersionIn) : nSize(0), nType(nTypeIn), nVersion(nVersionIn) { }
+
+    const_iterator begin() const { return vch; }
+    const_iterator end() const   { return vch + nSize; }
+    unsigned int size() const    { return nSize; }
+    bool empty() const           { return nSize == 0; }
+    void clear()                 { nSize = 0; }
+
+    int GetType()                { return nType; }
+    int GetVersion()             { return nVersion; }
+
+    CFixedDataStream& write(const char* pch, int nWrite)
+    {
+        assert(nWrite >= 0);
+        if ((unsigned int)nWrite > N - nSize)
+            throw std::ios_base::failure("CFixedDataStream::write() : capacity exceeded");
+        memcpy(vch + nSize, pch, nWrite);
+        nSize += nWrite;
+        return (*this);
+    }
+
+    template<typename T>
+    unsigned int GetSerializeSize(const T& obj)
+    {
+        return ::GetSerializeSize(obj, nType, nVersion);
+    }
+
+    template<typename T>
+    CFixedDataStream& operator<<(const T& obj)
+    {
+        ::Serialize(*this, obj, nType, nVersion);
+        return (*this);
     }
 };
 
@@ -0,0 +1,690 @@
+// Copyright (c) 2014 The NovaCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "snapshot.h"
+#include "checkpoints.h"
+#include "kernel.h"
+#include "txdb.h"
+#include "net.h"
+
+#include <boost/filesystem.hpp>
+#include <openssl/sha.h>
+
+using namespace std;
+
+static const char pchSnapshotMagic[8] = "NVCSNAP";
+static const int SNAPSHOT_FLUSH_BLOCKS = 2000;      // block index records per db transaction
+static const unsigned int SNAPSHOT_FLUSH_TXINDEX = 200000;
+static const int SNAPSHOT_DUMP_CHUNK = 1000;        // blocks read per cs_main lock
+static const int SNAPSHOT_VERIFY_SAVE = 1000;       // verified blocks between progress writes
+
+static CCriticalSection cs_snapshot;
+static CSnapshotStatus snapshotStatus = { 0, -1, -1, false, false };
+
+//
+// File layout: length prefixed records, the header first and then one
+// CSnapshotBlock per height, an empty record and the SHA256 of everything
+// before it.
+//
+
+static bool WriteRecord(FILE* file, SHA256_CTX& ctx, const CDataStream& ss)
+{
+    unsigned int nSize = ss.size();
+    SHA256_Update(&ctx, &nSize, sizeof(nSize));
+    if (fwrite(&nSize, sizeof(nSize), 1, file) != 1)
+        return false;
+    if (nSize == 0)
+        return true;
+    SHA256_Update(&ctx, &ss[0], nSize);
+    return fwrite(&ss[0], nSize, 1, file) == 1;
+}
+
+static bool ReadRecord(FILE* file, CDataStream& ss, string& strError)
+{
+    unsigned int nSize;
+    if (fread(&nSize, sizeof(nSize), 1, file) != 1)
+    {
+        strError = "unexpected end of snapshot file";
+        return false;
+    }
+    if (nSize > MAX_BLOCK_SIZE + 1024)
+    {
+        strError = "corrupt snapshot record";
+        return false;
+    }
+    vector<char> vch(nSize);
+    if (nSize > 0 && fread(&vch[0], nSize, 1, file) != 1)
+    {
+        strError = "unexpected end of snapshot file";
+        return false;
+    }
+    ss.clear();
+    ss.write(vch.empty() ? NULL : &vch[0], nSize);
+    return true;
+}
+
+static bool HashSnapshotFile(FILE* file, uint256& hashContentRet, string& strError)
+{
+    if (fseek(file, 0, SEEK_END) != 0 || ftell(file) < (long)sizeof(uint256))
+    {
+        strError = "snapshot file is too small";
+        return false;
+    }
+    long nContentSize = ftell(file) - sizeof(uint256);
+    fseek(file, 0, SEEK_SET);
+
+    SHA256_CTX ctx;
+    SHA256_Init(&ctx);
+    vector<char> vch(1 << 20);
+    for (long nPos = 0; nPos < nContentSize; )
+    {
+        size_t nRead = min((long)vch.size(), nContentSize - nPos);
+        if (fread(&vch[0], nRead, 1, file) != 1)
+        {
+            strError = "error reading snapshot file";
+            return false;
+        }
+        SHA256_Update(&ctx, &vch[0], nRead);
+        nPos += nRead;
+    }
+    SHA256_Final((unsigned char*)&hashContentRet, &ctx);
+
+    uint256 hashTrailer;
+    if (fread((char*)&hashTrailer, sizeof(hashTrailer), 1, file) != 1 || hashTrailer != hashContentRet)
+    {
+        strError = "snapshot file is truncated or corrupt";
+        return false;
+    }
+    return true;
+}
+
+bool DumpSnapshot(const string& strFile, int nHeight, uint256& hashContentRet, string& strError)
+{
+    int64_t nStart = GetTimeMillis();
+    CBlockIndex* pindex;
+    uint256 hashBlock;
+    uint256 hashSyncCheckpoint = (!fTestNet ? hashGenesisBlock : hashGenesisBlockTestNet);
+    {
+        LOCK(cs_main);
+        if (nHeight < 0 || nHeight > nBestHeight)
+        {
+            strError = "Block height out of range";
+            return false;
+        }
+        pindex = pindexGenesisBlock;
+        hashBlock = FindBlockByHeight(nHeight)->GetBlockHash();
+
+        // The sync checkpoint is only kept if the snapshot contains it
+        map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(Checkpoints::hashSyncCheckpoint);
+        if (mi != mapBlockIndex.end() && mi->second->IsInMainChain() && mi->second->nHeight <= nHeight)
+            hashSyncCheckpoint = Checkpoints::hashSyncCheckpoint;
+    }
+
+    CAutoFile fileout(fopen(strFile.c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+    if (!fileout)
+    {
+        strError = "Unable to open " + strFile + " for writing";
+        return false;
+    }
+
+    SHA256_CTX ctx;
+    SHA256_Init(&ctx);
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << FLATDATA(pchSnapshotMagic) << SNAPSHOT_VERSION << FLATDATA(pchMessageStart) << nHeight << hashBlock << hashSyncCheckpoint;
+    if (!WriteRecord(fileout, ctx, ss))
+    {
+        strError = "Error writing snapshot";
+        return false;
+    }
+
+    uint256 hashPrev = 0;
+    vector<CSnapshotBlock> vChunk;
+    vector<pair<unsigned int, unsigned int> > vPos;
+    for (int nNext = 0; nNext <= nHeight; )
+    {
+        if (fShutdown)
+        {
+            strError = "Shutdown requested";
+            return false;
+        }
+
+        // Copy the index state of the next blocks, then read them unlocked.
+        // Blocks are never removed from the block files, and the chain is
+        // checked to be the ancestors of the snapshot block at the end.
+        vChunk.clear();
+        vPos.clear();
+        {
+            LOCK(cs_main);
+            for (; pindex && nNext <= nHeight && (int)vChunk.size() < SNAPSHOT_DUMP_CHUNK; pindex = pindex->pnext, nNext++)
+            {
+                CSnapshotBlock snap;
+                snap.hash = pindex->GetBlockHash();
+                snap.nFlags = pindex->nFlags;
+                snap.nStakeModifier = pindex->nStakeModifier;
+                snap.nMint = pindex->nMint;
+                snap.nMoneySupply = pindex->nMoneySupply;
+                snap.hashProofOfStake = pindex->hashProofOfStake;
+                vChunk.push_back(snap);
+                vPos.push_back(make_pair(pindex->nFile, pindex->nBlockPos));
+            }
+            if (vChunk.empty())
+            {
+                strError = "Main chain changed during the dump, try a lower height";
+                return false;
+            }
+        }
+
+        for (unsigned int i = 0; i < vChunk.size(); i++)
+        {
+            CSnapshotBlock& snap = vChunk[i];
+            CAutoFile blockin(OpenBlockFile(vPos[i].first, vPos[i].second, "rb"), SER_DISK, CLIENT_VERSION);
+            if (!blockin)
+            {
+                strError = "Unable to read block " + snap.hash.ToString();
+                return false;
+            }
+            try {
+                blockin >> snap.block;
+            }
+            catch (std::exception &e) {
+                (void)e;
+                strError = "Deserialize or I/O error reading block " + snap.hash.ToString();
+                return false;
+            }
+            if (snap.block.hashPrevBlock != hashPrev)
+            {
+                strError = "Main chain changed during the dump, try a lower height";
+                return false;
+            }
+            hashPrev = snap.hash;
+
+            ss.clear();
+            ss << snap;
+            if (!WriteRecord(fileout, ctx, ss))
+            {
+                strError = "Error writing snapshot";
+                return false;
+            }
+        }
+        LogPrint(LOG_BLOCK, "DumpSnapshot() : %d of %d blocks written\n", nNext, nHeight + 1);
+    }
+
+    {
+        LOCK(cs_main);
+        if (hashPrev != hashBlock || !mapBlockIndex[hashBlock]->IsInMainChain())
+        {
+            strError = "Main chain changed during the dump, try a lower height";
+            return false;
+        }
+    }
+
+    ss.clear();
+    if (!WriteRecord(fileout, ctx, ss))
+    {
+        strError = "Error writing snapshot";
+        return false;
+    }
+    SHA256_Final((unsigned char*)&hashContentRet, &ctx);
+    if (fwrite((char*)&hashContentRet, sizeof(hashContentRet), 1, fileout) != 1 || fflush(fileout) != 0)
+    {
+        strError = "Error writing snapshot";
+        return false;
+    }
+    FileCommit(fileout);
+
+    printf("DumpSnapshot() : wrote %d blocks to %s in %" PRId64 "ms, hash %s\n", nHeight + 1, strFile.c_str(), GetTimeMillis() - nStart, hashContentRet.ToString().c_str());
+    return true;
+}
+
+// Write the changed transaction index entries and all block index records
+// except the last one, which is still waiting for its hashNext
+static bool FlushSnapshotImport(CTxDB& txdb, map<uint256, CTxIndex>& mapTxIndex, vector<CDiskBlockIndex>& vBlockIndex, bool fFinal)
+{
+    unsigned int nBlockIndex = fFinal ? vBlockIndex.size() : vBlockIndex.size() - 1;
+
+    txdb.TxnBegin();
+    for (map<uint256, CTxIndex>::iterator mi = mapTxIndex.begin(); mi != mapTxIndex.end(); ++mi)
+        if (!txdb.UpdateTxIndex(mi->first, mi->second))
+            return error("FlushSnapshotImport() : UpdateTxIndex failed");
+    for (unsigned int i = 0; i < nBlockIndex; i++)
+        if (!txdb.WriteBlockIndex(vBlockIndex[i]))
+            return error("FlushSnapshotImport() : WriteBlockIndex failed");
+    if (!txdb.TxnCommit())
+        return error("FlushSnapshotImport() : TxnCommit failed");
+
+    mapTxIndex.clear();
+    vBlockIndex.erase(vBlockIndex.begin(), vBlockIndex.begin() + nBlockIndex);
+    return true;
+}
+
+bool LoadSnapshot(const string& strFile, const uint256& hashContentExpected, string& strError)
+{
+    int64_t nStart = GetTimeMillis();
+    if (boost::filesystem::exists(GetDataDir() / "blk0001.dat"))
+    {
+        strError = "a snapshot can only be loaded into an empty data directory";
+        return false;
+    }
+
+    CAutoFile filein(fopen(strFile.c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+    if (!filein)
+    {
+        strError = "unable to open " + strFile;
+        return false;
+    }
+
+    // The whole file is checked before anything is written
+    printf("LoadSnapshot() : checking %s\n", strFile.c_str());
+    uint256 hashContent;
+    if (!HashSnapshotFile(filein, hashContent, strError))
+        return false;
+    if (hashContent != hashContentExpected)
+    {
+        strError = "snapshot hash " + hashContent.ToString() + " doesn't match -snapshothash";
+        return false;
+    }
+    fseek(filein, 0, SEEK_SET);
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    char pchMagic[sizeof(pchSnapshotMagic)];
+    unsigned char pchNetwork[sizeof(pchMessageStart)];
+    unsigned int nVersion;
+    int nHeight;
+    uint256 hashBlock, hashSyncCheckpoint;
+    try {
+        if (!ReadRecord(filein, ss, strError))
+            return false;
+        ss >> FLATDATA(pchMagic) >> nVersion >> FLATDATA(pchNetwork) >> nHeight >> hashBlock >> hashSyncCheckpoint;
+    }
+    catch (std::exception &e) {
+        (void)e;
+        strError = "corrupt snapshot header";
+        return false;
+    }
+    if (memcmp(pchMagic, pchSnapshotMagic, sizeof(pchMagic)) != 0 || nVersion > SNAPSHOT_VERSION)
+    {
+        strError = "unknown snapshot format";
+        return false;
+    }
+    if (memcmp(pchNetwork, pchMessageStart, sizeof(pchNetwork)) != 0)
+    {
+        strError = "snapshot is for a different network";
+        return false;
+    }
+
+    CTxDB txdb("cr+");
+    uint256 hashBestChainOld;
+    if (txdb.ReadHashBestChain(hashBestChainOld))
+    {
+        strError = "a snapshot can only be loaded into an empty data directory";
+        return false;
+    }
+
+    printf("LoadSnapshot() : importing %d blocks up to %s\n", nHeight + 1, hashBlock.ToString().c_str());
+    map<uint256, CTxIndex> mapTxIndex;
+    vector<CDiskBlockIndex> vBlockIndex;
+    uint256 hashPrev = 0;
+    int nBlocks = 0;
+    while (true)
+    {
+        if (fRequestShutdown)
+        {
+            strError = "shutdown requested";
+            return false;
+        }
+
+        CSnapshotBlock snap;
+        try {
+            if (!ReadRecord(filein, ss, strError))
+                return false;
+            if (ss.empty())
+                break;
+            ss >> snap;
+        }
+        catch (std::exception &e) {
+            (void)e;
+            strError = "corrupt snapshot record";
+            return false;
+        }
+        const CBlock& block = snap.block;
+        if (nBlocks > nHeight || block.hashPrevBlock != hashPrev || block.vtx.empty())
+        {
+            strError = "snapshot blocks are not a chain";
+            return false;
+        }
+
+        unsigned int nFile, nBlockPos;
+        if (!snap.block.WriteToDisk(nFile, nBlockPos))
+        {
+            strError = "error writing block file";
+            return false;
+        }
+
+        // Block index, hashNext is filled in by the next block
+        CBlockIndex indexNew(nFile, nBlockPos, snap.block);
+        indexNew.phashBlock = &snap.hash;
+        indexNew.nHeight = nBlocks;
+        indexNew.nFlags = snap.nFlags;
+        indexNew.nStakeModifier = snap.nStakeModifier;
+        indexNew.nMint = snap.nMint;
+        indexNew.nMoneySupply = snap.nMoneySupply;
+        indexNew.hashProofOfStake = snap.hashProofOfStake;
+        CDiskBlockIndex diskindex(&indexNew);
+        diskindex.hashPrev = hashPrev;
+        if (!vBlockIndex.empty())
+            vBlockIndex.back().hashNext = snap.hash;
+        vBlockIndex.push_back(diskindex);
+
+        // Transaction index, spending the inputs as ConnectBlock would
+        unsigned int nTxPos = block.GetTxPos(nBlockPos);
+        BOOST_FOREACH(const CTransaction& tx, block.vtx)
+        {
+            CDiskTxPos posThisTx(nFile, nBlockPos, nTxPos);
+            nTxPos += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
+
+            if (!tx.IsCoinBase())
+            {
+                BOOST_FOREACH(const CTxIn& txin, tx.vin)
+                {
+                    map<uint256, CTxIndex>::iterator mi = mapTxIndex.find(txin.prevout.hash);
+                    if (mi == mapTxIndex.end())
+                    {
+                        CTxIndex txindex;
+                        if (!txdb.ReadTxIndex(txin.prevout.hash, txindex))
+                        {
+                            strError = "missing input " + txin.prevout.hash.ToString() + " in snapshot";
+                            return false;
+                        }
+                        mi = mapTxIndex.insert(make_pair(txin.prevout.hash, txindex)).first;
+                    }
+                    if (txin.prevout.n >= mi->second.vSpent.size())
+                    {
+                        strError = "invalid input " + txin.prevout.ToString() + " in snapshot";
+                        return false;
+                    }
+                    mi->second.vSpent[txin.prevout.n] = posThisTx;
+                }
+            }
+            mapTxIndex[tx.GetHash()] = CTxIndex(posThisTx, tx.vout.size());
+        }
+
+        hashPrev = snap.hash;
+        nBlocks++;
+        if (nBlocks % SNAPSHOT_FLUSH_BLOCKS == 0 || mapTxIndex.size() > SNAPSHOT_FLUSH_TXINDEX)
+        {
+            if (!FlushSnapshotImport(txdb, mapTxIndex, vBlockIndex, false))
+            {
+                strError = "error writing block database";
+                return false;
+            }
+            if (nBlocks % (SNAPSHOT_FLUSH_BLOCKS * 50) == 0)
+                printf("LoadSnapshot() : %d of %d blocks imported\n", nBlocks, nHeight + 1);
+        }
+    }
+
+    if (nBlocks != nHeight + 1 || hashPrev != hashBlock)
+    {
+        strError = "snapshot doesn't end at its header block";
+        return false;
+    }
+    if (!FlushSnapshotImport(txdb, mapTxIndex, vBlockIndex, true))
+    {
+        strError = "error writing block database";
+        return false;
+    }
+
+    // LoadBlockIndex continues from here as with a synced database
+    txdb.TxnBegin();
+    if (!txdb.WriteHashBestChain(hashBlock) || !txdb.WriteSyncCheckpoint(hashSyncCheckpoint) ||
+        !txdb.WriteModifierUpgradeTime(0) || !txdb.WriteSnapshotHash(hashBlock) || !txdb.TxnCommit())
+    {
+        strError = "error writing block database";
+        return false;
+    }
+
+    printf("LoadSnapshot() : imported %d blocks in %" PRId64 "ms\n", nBlocks, GetTimeMillis() - nStart);
+    return true;
+}
+
+// The checks of AcceptBlock and ConnectBlock, against the imported indexes.
+// The spends of the block are taken back in a database transaction first,
+// ConnectBlock then checks and redoes them. -assumevalid doesn't apply, the
+// blocks of a snapshot were never checked.
+static bool VerifySnapshotBlock(CTxDB& txdb, CBlockIndex* pindex, string& strError)
+{
+    LOCK(cs_main);
+
+    CBlock block;
+    if (!block.ReadFromDisk(pindex))
+    {
+        strError = "unable to read block";
+        return false;
+    }
+    if (block.GetHash() != pindex->GetBlockHash())
+    {
+        strError = "block hash mismatch";
+        return false;
+    }
+    if (!block.CheckBlock(true, true, true))
+    {
+        strError = "CheckBlock failed";
+        return false;
+    }
+
+    // The genesis block isn't connected
+    if (!pindex->pprev)
+    {
+        if (block.GetHash() != (!fTestNet ? hashGenesisBlock : hashGenesisBlockTestNet))
+        {
+            strError = "wrong genesis block";
+            return false;
+        }
+        return true;
+    }
+    if (!block.CheckContext(pindex->pprev))
+    {
+        strError = "AcceptBlock checks failed";
+        return false;
+    }
+
+    // Stake modifier and proof-of-stake
+    uint64_t nStakeModifier = 0;
+    bool fGeneratedStakeModifier = false;
+    if (!ComputeNextStakeModifier(pindex->pprev, nStakeModifier, fGeneratedStakeModifier))
+    {
+        strError = "ComputeNextStakeModifier failed";
+        return false;
+    }
+    if (nStakeModifier != pindex->nStakeModifier || fGeneratedStakeModifier != pindex->GeneratedStakeModifier() ||
+        block.GetStakeEntropyBit(pindex->nHeight) != pindex->GetStakeEntropyBit())
+    {
+        strError = "stake modifier mismatch";
+        return false;
+    }
+    if (block.IsProofOfStake() != pindex->IsProofOfStake())
+    {
+        strError = "proof type mismatch";
+        return false;
+    }
+    if (block.IsProofOfStake())
+    {
+        uint256 hashProofOfStake = 0, targetProofOfStake = 0;
+        if (!CheckProofOfStake(block.vtx[1], block.nBits, hashProofOfStake, targetProofOfStake))
+        {
+            strError = "CheckProofOfStake failed";
+            return false;
+        }
+        if (hashProofOfStake != pindex->hashProofOfStake)
+        {
+            strError = "proof-of-stake hash mismatch";
+            return false;
+        }
+    }
+
+    // Transaction index entries of the block, they also hold the spends of
+    // later blocks and are put back after ConnectBlock
+    vector<CDiskTxPos> vPos;
+    vector<CTxIndex> vTxIndex;
+    unsigned int nTxPos = block.GetTxPos(pindex->nBlockPos);
+    BOOST_FOREACH(const CTransaction& tx, block.vtx)
+    {
+        CDiskTxPos posThisTx(pindex->nFile, pindex->nBlockPos, nTxPos);
+        nTxPos += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
+
+        CTxIndex txindex;
+        if (!txdb.ReadTxIndex(tx.GetHash(), txindex) || txindex.pos != posThisTx || txindex.vSpent.size() != tx.vout.size())
+        {
+            strError = "transaction index mismatch for " + tx.GetHash().ToString();
+            return false;
+        }
+        vPos.push_back(posThisTx);
+        vTxIndex.push_back(txindex);
+    }
+
+    txdb.TxnBegin();
+    for (unsigned int i = 0; i < block.vtx.size(); i++)
+    {
+        const CTransaction& tx = block.vtx[i];
+        if (tx.IsCoinBase())
+            continue;
+        BOOST_FOREACH(const CTxIn& txin, tx.vin)
+        {
+            CTxIndex txindexPrev;
+            if (!txdb.ReadTxIndex(txin.prevout.hash, txindexPrev) || txin.prevout.n >= txindexPrev.vSpent.size())
+            {
+                txdb.TxnAbort();
+                strError = "missing input " + txin.prevout.ToString();
+                return false;
+            }
+            if (txindexPrev.vSpent[txin.prevout.n] != vPos[i])
+            {
+                txdb.TxnAbort();
+                strError = "spent index mismatch for " + txin.prevout.ToString();
+                return false;
+            }
+            txindexPrev.vSpent[txin.prevout.n].SetNull();
+            txdb.UpdateTxIndex(txin.prevout.hash, txindexPrev);
+        }
+    }
+    BOOST_FOREACH(const CTransaction& tx, block.vtx)
+        txdb.EraseTxIndex(tx);
+
+    int64_t nMint = pindex->nMint;
+    int64_t nMoneySupply = pindex->nMoneySupply;
+    bool fConnected = block.ConnectBlock(txdb, pindex, false, true);
+    if (!fConnected || pindex->nMint != nMint || pindex->nMoneySupply != nMoneySupply)
+    {
+        txdb.TxnAbort();
+        pindex->nMint = nMint;
+        pindex->nMoneySupply = nMoneySupply;
+        strError = fConnected ? "money supply mismatch" : "ConnectBlock failed";
+        return false;
+    }
+
+    for (unsigned int i = 0; i < block.vtx.size(); i++)
+        txdb.UpdateTxIndex(block.vtx[i].GetHash(), vTxIndex[i]);
+    if (!txdb.TxnCommit())
+    {
+        strError = "error writing block database";
+        return false;
+    }
+    return true;
+}
+
+static void VerifySnapshot()
+{
+    uint256 hashSnapshot;
+    int nVerified;
+    {
+        CTxDB txdb("r");
+        if (!txdb.ReadSnapshotHash(hashSnapshot))
+            return;
+        if (!txdb.ReadSnapshotVerified(nVerified))
+            nVerified = -1;
+    }
+
+    // Ancestors of the snapshot block don't change, unlike pnext
+    vector<CBlockIndex*> vChain;
+    {
+        LOCK(cs_main);
+        map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashSnapshot);
+        if (mi == mapBlockIndex.end())
+        {
+            printf("VerifySnapshot() : snapshot block %s not found\n", hashSnapshot.ToString().c_str());
+            return;
+        }
+        for (CBlockIndex* pindex = mi->second; pindex && pindex->nHeight > nVerified; pindex = pindex->pprev)
+            vChain.push_back(pindex);
+        reverse(vChain.begin(), vChain.end());
+
+        {
+            LOCK(cs_snapshot);
+            snapshotStatus.hashBlock = hashSnapshot;
+            snapshotStatus.nHeight = mi->second->nHeight;
+            snapshotStatus.nVerifiedHeight = nVerified;
+            snapshotStatus.fVerifying = !vChain.empty();
+        }
+    }
+    if (vChain.empty())
+        return;
+
+    printf("VerifySnapshot() : verifying blocks %d to %d in the background\n", vChain.front()->nHeight, vChain.back()->nHeight);
+    int64_t nStart = GetTimeMillis();
+    for (unsigned int i = 0; i < vChain.size() && !fShutdown; )
+    {
+        // A short lived handle, so the database can be flushed and closed
+        CTxDB txdb("r+");
+        unsigned int nEnd = min((unsigned int)vChain.size(), i + SNAPSHOT_VERIFY_SAVE);
+        for (; i < nEnd && !fShutdown; i++)
+        {
+            string strError;
+            if (!VerifySnapshotBlock(txdb, vChain[i], strError))
+            {
+                error("VerifySnapshot() : block %d %s: %s", vChain[i]->nHeight, vChain[i]->GetBlockHash().ToString().c_str(), strError.c_str());
+                strMiscWarning = strprintf(_("Warning: imported snapshot failed verification at block %d, remove the data directory and resync."), vChain[i]->nHeight);
+                LOCK(cs_snapshot);
+                snapshotStatus.fVerifying = false;
+                snapshotStatus.fFailed = true;
+                return;
+            }
+        }
+        nVerified = vChain[i - 1]->nHeight;
+        txdb.WriteSnapshotVerified(nVerified);
+
+        LOCK(cs_snapshot);
+        snapshotStatus.nVerifiedHeight = nVerified;
+    }
+
+    LOCK(cs_snapshot);
+    snapshotStatus.fVerifying = false;
+    if (snapshotStatus.nVerifiedHeight == snapshotStatus.nHeight)
+        printf("VerifySnapshot() : all %d snapshot blocks verified in %" PRId64 "ms\n", snapshotStatus.nHeight + 1, GetTimeMillis() - nStart);
+}
+
+void ThreadSnapshotVerify(void* parg)
+{
+    // Make this thread recognisable as the snapshot verification thread
+    RenameThread("novacoin-snapshot");
+    SetThreadPriority(THREAD_PRIORITY_LOWEST);
+
+    try
+    {
+        vnThreadsRunning[THREAD_SNAPSHOT]++;
+        VerifySnapshot();
+        vnThreadsRunning[THREAD_SNAPSHOT]--;
+    }
+    catch (std::exception& e) {
+        vnThreadsRunning[THREAD_SNAPSHOT]--;
+        PrintException(&e, "ThreadSnapshotVerify()");
+    } catch (...) {
+        vnThreadsRunning[THREAD_SNAPSHOT]--;
+        PrintException(NULL, "ThreadSnapshotVerify()");
+    }
+}
+
+void GetSnapshotStatus(CSnapshotStatus& status)
+{
+    LOCK(cs_snapshot);
+    status = snapshotStatus;
+}
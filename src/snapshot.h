@@ -0,0 +1,82 @@
+// Copyright (c) 2014 The NovaCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef NOVACOIN_SNAPSHOT_H
+#define NOVACOIN_SNAPSHOT_H
+
+#include "main.h"
+
+#include <string>
+
+//
+// Chain snapshots for bootstrapping new nodes (dumpsnapshot, -loadsnapshot).
+//
+// A snapshot holds the main chain up to a height together with the block
+// index fields that can't be derived from the blocks without their inputs:
+// the stake modifier and flags, the proof-of-stake hash, mint and money
+// supply. Importing it writes the block files, block index and transaction
+// index directly, without connecting the blocks. The file ends with a
+// SHA256 of its content, which has to match the -snapshothash given by the
+// operator before anything is imported. The blocks are then validated by a
+// low priority thread while the node runs.
+//
+
+static const unsigned int SNAPSHOT_VERSION = 1;
+
+/** Block index state stored with each block of a snapshot */
+class CSnapshotBlock
+{
+public:
+    uint256 hash;
+    unsigned int nFlags;
+    uint64_t nStakeModifier;
+    int64_t nMint;
+    int64_t nMoneySupply;
+    uint256 hashProofOfStake;
+    CBlock block;
+
+    CSnapshotBlock()
+    {
+        hash = 0;
+        nFlags = 0;
+        nStakeModifier = 0;
+        nMint = 0;
+        nMoneySupply = 0;
+        hashProofOfStake = 0;
+    }
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(hash);
+        READWRITE(nFlags);
+        READWRITE(nStakeModifier);
+        READWRITE(nMint);
+        READWRITE(nMoneySupply);
+        if (nFlags & CBlockIndex::BLOCK_PROOF_OF_STAKE)
+            READWRITE(hashProofOfStake);
+        READWRITE(block);
+    )
+};
+
+/** Background verification state for getsnapshotinfo */
+struct CSnapshotStatus
+{
+    uint256 hashBlock;   // 0 if no snapshot was imported
+    int nHeight;
+    int nVerifiedHeight;
+    bool fVerifying;
+    bool fFailed;
+};
+
+// Write the main chain up to nHeight to strFile, doesn't hold cs_main while
+// reading blocks
+bool DumpSnapshot(const std::string& strFile, int nHeight, uint256& hashContentRet, std::string& strError);
+
+// Import a snapshot into an empty data directory, before the block index
+// is loaded
+bool LoadSnapshot(const std::string& strFile, const uint256& hashContentExpected, std::string& strError);
+
+void ThreadSnapshotVerify(void* parg);
+void GetSnapshotStatus(CSnapshotStatus& status);
+
+#endif
@@ -0,0 +1,287 @@
+// Copyright (c) 2014 The NovaCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "stakeforecast.h"
+#include "kernel.h"
+#include "txdb.h"
+
+#include <math.h>
+
+using namespace std;
+
+extern uint256 nPoWBase;
+
+static const uint32_t FORECAST_SLICE = 60 * 60; // seconds hashed per work item
+
+bool GetStakeForecastInput(const COutPoint& prevout, CStakeForecastInput& input, string& strError)
+{
+    LOCK(cs_main);
+
+    CTransaction tx;
+    uint256 hashBlock = 0;
+    if (!GetTransaction(prevout.hash, tx, hashBlock))
+    {
+        strError = "No information available about transaction";
+        return false;
+    }
+    if (prevout.n >= tx.vout.size())
+    {
+        strError = "Incorrect output number";
+        return false;
+    }
+    if (hashBlock == 0)
+    {
+        strError = "Unable to find transaction in the blockchain";
+        return false;
+    }
+
+    CTxDB txdb("r");
+    CTxIndex txindex;
+    if (!txdb.ReadTxIndex(prevout.hash, txindex))
+    {
+        strError = "Unable to read block index item";
+        return false;
+    }
+
+    CBlock block;
+    if (!block.ReadFromDisk(txindex.pos.nFile, txindex.pos.nBlockPos, false))
+    {
+        strError = "CBlock::ReadFromDisk() failed";
+        return false;
+    }
+
+    if (!GetKernelStakeModifier(block.GetHash(), input.nStakeModifier))
+    {
+        strError = "No kernel stake modifier generated yet";
+        return false;
+    }
+
+    input.prevout = prevout;
+    input.nValue = tx.vout[prevout.n].nValue;
+    input.nTxTime = tx.nTime;
+    input.nBlockTime = block.nTime;
+    input.nTxOffset = txindex.pos.nTxPos - txindex.pos.nBlockPos;
+    return true;
+}
+
+unsigned int GetStakeForecastBits(double dDifficulty)
+{
+    CBigNum bnTarget(nPoWBase);
+    bnTarget *= 1000;
+    bnTarget /= (int) (dDifficulty * 1000);
+    return bnTarget.GetCompact();
+}
+
+static bool CompareBitsDifficulty(unsigned int nBitsA, unsigned int nBitsB)
+{
+    CBigNum bnA, bnB;
+    bnA.SetCompact(nBitsA);
+    bnB.SetCompact(nBitsB);
+    return bnA > bnB;
+}
+
+CStakeForecast::CStakeForecast(const vector<CStakeForecastInput>& vInputsIn, const vector<unsigned int>& vBitsIn, uint32_t nTimeBeginIn, uint32_t nTimeEndIn) :
+    vInputs(vInputsIn), vBits(vBitsIn), nTimeBegin(nTimeBeginIn), nTimeEnd(nTimeEndIn),
+    nNextSlice(0), nSlicesDone(0), nThreadsRunning(0), fCancel(false)
+{
+    sort(vBits.begin(), vBits.end(), CompareBitsDifficulty);
+
+    CStakeForecastSolution none;
+    none.nTime = 0;
+    none.hashProofOfStake = 0;
+    vSolutions.assign(vInputs.size(), vector<CStakeForecastSolution>(vBits.size(), none));
+    vSolvedAll.assign(vInputs.size(), nTimeEnd);
+
+    // Earliest times of all inputs first
+    for (uint32_t nOffset = 0; nTimeBegin + nOffset < nTimeEnd; nOffset += FORECAST_SLICE)
+    {
+        for (unsigned int i = 0; i < vInputs.size(); i++)
+        {
+            CSlice slice;
+            slice.nInput = i;
+            slice.nBegin = max(nTimeBegin + nOffset, GetInputBegin(i));
+            slice.nEnd = min(nTimeBegin + nOffset + FORECAST_SLICE, nTimeEnd);
+            if (slice.nBegin < slice.nEnd)
+                vSlices.push_back(slice);
+        }
+    }
+}
+
+CStakeForecast::~CStakeForecast()
+{
+    Cancel();
+    Wait();
+}
+
+uint32_t CStakeForecast::GetInputBegin(unsigned int nInput) const
+{
+    // Only count coins meeting min age requirement
+    return max(nTimeBegin, vInputs[nInput].nBlockTime + nStakeMinAge);
+}
+
+void CStakeForecast::Start(int nThreads)
+{
+    nThreads = max(1, min(nThreads, (int)vSlices.size()));
+    for (int i = 0; i < nThreads; i++)
+    {
+        __sync_fetch_and_add(&nThreadsRunning, 1);
+        if (!NewThread(ThreadWorker, this))
+        {
+            printf("Error: NewThread(ThreadWorker) failed\n");
+            __sync_fetch_and_sub(&nThreadsRunning, 1);
+        }
+    }
+}
+
+void CStakeForecast::Cancel()
+{
+    fCancel = true;
+}
+
+void CStakeForecast::Wait()
+{
+    while (nThreadsRunning > 0)
+        Sleep(10);
+}
+
+double CStakeForecast::GetProgress() const
+{
+    if (vSlices.empty())
+        return 1.0;
+    return (double)nSlicesDone / vSlices.size();
+}
+
+void CStakeForecast::GetSolutions(vector<vector<CStakeForecastSolution> >& vSolutionsRet) const
+{
+    LOCK(cs);
+    vSolutionsRet = vSolutions;
+}
+
+void CStakeForecast::ThreadWorker(void* parg)
+{
+    RenameThread("novacoin-forecast");
+    CStakeForecast* pforecast = (CStakeForecast*)parg;
+    pforecast->Worker();
+    __sync_fetch_and_sub(&pforecast->nThreadsRunning, 1);
+}
+
+void CStakeForecast::Worker()
+{
+    while (!fCancel && !fShutdown)
+    {
+        unsigned int nSlice = __sync_fetch_and_add(&nNextSlice, 1);
+        if (nSlice >= vSlices.size())
+            break;
+        ScanSlice(vSlices[nSlice]);
+        __sync_fetch_and_add(&nSlicesDone, 1);
+    }
+}
+
+void CStakeForecast::ScanSlice(const CSlice& slice)
+{
+    const CStakeForecastInput& input = vInputs[slice.nInput];
+    uint32_t nEnd;
+    {
+        LOCK(cs);
+        nEnd = min(slice.nEnd, vSolvedAll[slice.nInput]);
+    }
+    if (slice.nBegin >= nEnd || vBits.empty())
+        return;
+
+    vector<CBigNum> vTargetPerCoinDay(vBits.size());
+    for (unsigned int i = 0; i < vBits.size(); i++)
+        vTargetPerCoinDay[i].SetCompact(vBits[i]);
+
+    // Hashes above the easiest target at the maximum weight can be skipped
+    // without big number arithmetic
+    uint256 maxTarget = (vTargetPerCoinDay[0] * CBigNum(input.nValue) * nStakeMaxAge / COIN / (24 * 60 * 60)).getuint256();
+
+    SHA256_CTX ctx;
+    GetKernelMidstate(input.nStakeModifier, input.nBlockTime, input.nTxOffset, input.nTxTime, input.prevout.n, ctx);
+
+    // First solution at each difficulty within this slice
+    vector<CStakeForecastSolution> vFound(vBits.size());
+    unsigned int nFound = 0;
+    for (unsigned int i = 0; i < vFound.size(); i++)
+        vFound[i].nTime = 0;
+
+    for (uint32_t nTimeTx = slice.nBegin; nTimeTx < nEnd && nFound < vBits.size(); nTimeTx++)
+    {
+        if ((nTimeTx & 0xfff) == 0 && (fCancel || fShutdown))
+            break;
+
+        SHA256_CTX ctxCopy = ctx;
+        uint256 hash1;
+        SHA256_Update(&ctxCopy, (unsigned char*)&nTimeTx, 4);
+        SHA256_Final((unsigned char*)&hash1, &ctxCopy);
+        uint256 hashProofOfStake;
+        SHA256((unsigned char*)&hash1, sizeof(hashProofOfStake), (unsigned char*)&hashProofOfStake);
+
+        if (hashProofOfStake > maxTarget)
+            continue;
+
+        CBigNum bnCoinDayWeight = CBigNum(input.nValue) * GetWeight((int64_t)input.nTxTime, (int64_t)nTimeTx) / COIN / (24 * 60 * 60);
+        CBigNum bnHash(hashProofOfStake);
+        for (unsigned int i = 0; i < vBits.size(); i++)
+        {
+            if (vFound[i].nTime)
+                continue;
+            // Targets are in descending order
+            if (bnCoinDayWeight * vTargetPerCoinDay[i] < bnHash)
+                break;
+            vFound[i].nTime = nTimeTx;
+            vFound[i].hashProofOfStake = hashProofOfStake;
+            nFound++;
+        }
+    }
+
+    if (nFound == 0)
+        return;
+
+    LOCK(cs);
+    vector<CStakeForecastSolution>& vInputSolutions = vSolutions[slice.nInput];
+    uint32_t nSolvedAll = 0;
+    for (unsigned int i = 0; i < vBits.size(); i++)
+    {
+        if (vFound[i].nTime && (vInputSolutions[i].nTime == 0 || vFound[i].nTime < vInputSolutions[i].nTime))
+            vInputSolutions[i] = vFound[i];
+        if (vInputSolutions[i].nTime == 0)
+            nSolvedAll = nTimeEnd;
+        else
+            nSolvedAll = max(nSolvedAll, vInputSolutions[i].nTime);
+    }
+    vSolvedAll[slice.nInput] = min(vSolvedAll[slice.nInput], nSolvedAll);
+}
+
+void CStakeForecast::GetProbabilities(unsigned int nInput, unsigned int nBits, vector<double>& vProbability) const
+{
+    const CStakeForecastInput& input = vInputs[nInput];
+    CBigNum bnTargetPerCoinDay;
+    bnTargetPerCoinDay.SetCompact(nBits);
+
+    // Chance of a single hash meeting the target per coin day
+    double dTargetPerCoinDay = bnTargetPerCoinDay.getuint256().getdouble() / pow(2.0, 256);
+
+    vProbability.clear();
+    double dLogMiss = 0; // log of the probability of no solution so far
+    uint32_t nInputBegin = GetInputBegin(nInput);
+    for (uint32_t nDayBegin = nTimeBegin; nDayBegin < nTimeEnd; nDayBegin += 24 * 60 * 60)
+    {
+        uint32_t nDayEnd = min(nDayBegin + 24 * 60 * 60, nTimeEnd);
+        for (uint32_t nHour = nDayBegin; nHour < nDayEnd; nHour += 60 * 60)
+        {
+            uint32_t nHourBegin = max(nHour, nInputBegin);
+            uint32_t nHourEnd = min(nHour + 60 * 60, nDayEnd);
+            if (nHourBegin >= nHourEnd)
+                continue;
+            int64_t nWeight = GetWeight((int64_t)input.nTxTime, (int64_t)(nHourBegin + nHourEnd) / 2);
+            if (nWeight <= 0)
+                continue;
+            double dCoinDays = (double)input.nValue * nWeight / COIN / (24 * 60 * 60);
+            double p = min(dCoinDays * dTargetPerCoinDay, 1.0);
+            dLogMiss += (nHourEnd - nHourBegin) * (p < 1.0 ? log1p(-p) : -INFINITY);
+        }
+        vProbability.push_back(1.0 - exp(dLogMiss));
+    }
+}
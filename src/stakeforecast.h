@@ -0,0 +1,101 @@
+// Copyright (c) 2014 The NovaCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef NOVACOIN_STAKEFORECAST_H
+#define NOVACOIN_STAKEFORECAST_H
+
+#include "main.h"
+#include "sync.h"
+
+#include <string>
+#include <vector>
+
+/** Everything the kernel hash of an output depends on */
+struct CStakeForecastInput
+{
+    COutPoint prevout;
+    int64_t nValue;
+    uint32_t nTxTime;
+    uint32_t nBlockTime;
+    uint32_t nTxOffset;
+    uint64_t nStakeModifier;
+};
+
+/** First kernel solution of an input at one difficulty, nTime is 0 if none was found */
+struct CStakeForecastSolution
+{
+    uint32_t nTime;
+    uint256 hashProofOfStake;
+};
+
+// Read the staked transaction and its block and get the kernel stake
+// modifier, takes cs_main
+bool GetStakeForecastInput(const COutPoint& prevout, CStakeForecastInput& input, std::string& strError);
+
+// Same conversion as scaninput uses
+unsigned int GetStakeForecastBits(double dDifficulty);
+
+/**
+ * Kernel solution search for many inputs over a time window at several
+ * difficulties.
+ *
+ * Every second of every input is hashed once and compared against all the
+ * targets. The window of each input is cut into slices that worker threads
+ * take in time order, an input is dropped once it has a solution at every
+ * difficulty. The search runs without cs_main and cs_wallet and can be
+ * cancelled at any time.
+ */
+class CStakeForecast
+{
+private:
+    struct CSlice
+    {
+        unsigned int nInput;
+        uint32_t nBegin;
+        uint32_t nEnd;
+    };
+
+    std::vector<CStakeForecastInput> vInputs;
+    std::vector<unsigned int> vBits;      // ascending difficulty
+    uint32_t nTimeBegin;
+    uint32_t nTimeEnd;
+    std::vector<CSlice> vSlices;
+
+    mutable CCriticalSection cs;
+    std::vector<std::vector<CStakeForecastSolution> > vSolutions; // [input][difficulty]
+    std::vector<uint32_t> vSolvedAll; // time by which an input is solved at every difficulty
+
+    volatile unsigned int nNextSlice;
+    volatile unsigned int nSlicesDone;
+    volatile int nThreadsRunning;
+    volatile bool fCancel;
+
+    static void ThreadWorker(void* parg);
+    void Worker();
+    void ScanSlice(const CSlice& slice);
+
+public:
+    CStakeForecast(const std::vector<CStakeForecastInput>& vInputsIn, const std::vector<unsigned int>& vBitsIn, uint32_t nTimeBeginIn, uint32_t nTimeEndIn);
+    ~CStakeForecast();
+
+    // First second an input can stake in the window
+    uint32_t GetInputBegin(unsigned int nInput) const;
+
+    void Start(int nThreads);
+    void Cancel();
+    // Blocks until all workers are finished
+    void Wait();
+
+    bool IsDone() const { return nThreadsRunning == 0; }
+    double GetProgress() const;
+
+    const std::vector<CStakeForecastInput>& GetInputs() const { return vInputs; }
+    const std::vector<unsigned int>& GetBits() const { return vBits; }
+    void GetSolutions(std::vector<std::vector<CStakeForecastSolution> >& vSolutionsRet) const;
+
+    // Probability that an input has staked by the end of each day of the
+    // window, from the expected number of solutions
+    void GetProbabilities(unsigned int nInput, unsigned int nBits, std::vector<double>& vProbability) const;
+};
+
+#endif
@@ -0,0 +1,779 @@
+// Copyright (c) 2014 The NovaCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "stratum.h"
+#include "main.h"
+#include "miner.h"
+#include "init.h"
+#include "net.h"
+#include "scrypt.h"
+#include "ui_interface.h"
+
+#include "json/json_spirit_reader_template.h"
+#include "json/json_spirit_writer_template.h"
+#include "json/json_spirit_utils.h"
+
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include <deque>
+
+using namespace std;
+using namespace json_spirit;
+using boost::asio::ip::tcp;
+
+extern uint256 nPoWBase;
+
+static const unsigned int STRATUM_EXTRANONCE1_SIZE = 4;
+static const unsigned int STRATUM_EXTRANONCE2_SIZE = 4;
+static const int64_t STRATUM_JOB_INTERVAL = 60;      // seconds before new transactions make a new job
+static const unsigned int STRATUM_MAX_JOBS = 8;       // older jobs of the same tip still accept shares
+static const unsigned int STRATUM_MAX_LINE = 16 * 1024;
+static const int64_t STRATUM_VARDIFF_WINDOW = 120;   // seconds between difficulty adjustments
+static const unsigned int STRATUM_MAX_QUEUED_SHARES = 1024; // shares waiting for a worker, from all connections
+static const unsigned int STRATUM_MAX_PENDING_SHARES = 64;  // shares of one connection being checked
+static const unsigned int STRATUM_MAX_SUBMITTED = 16384;    // shares of one connection remembered per clean job
+
+enum StratumError
+{
+    STRATUM_OTHER = 20,
+    STRATUM_JOB_NOT_FOUND = 21,
+    STRATUM_DUPLICATE_SHARE = 22,
+    STRATUM_LOW_DIFFICULTY = 23,
+    STRATUM_UNAUTHORIZED = 24,
+    STRATUM_NOT_SUBSCRIBED = 25,
+};
+
+static CCriticalSection cs_stratumStats;
+static CStratumStats stratumStats = { 0, 0, 0, 0, 0 };
+
+void GetStratumStats(CStratumStats& stats)
+{
+    LOCK(cs_stratumStats);
+    stats = stratumStats;
+}
+
+// Stratum difficulty 1 is 2^16 times the proof-of-work base target, as
+// scrypt miners expect
+static uint256 GetShareTarget(double dDifficulty)
+{
+    CBigNum bnTarget = CBigNum(nPoWBase) * 65536;
+    bnTarget *= 1000000;
+    bnTarget /= CBigNum((int64_t)(dDifficulty * 1000000) + 1);
+    if (bnTarget > CBigNum(~uint256(0)))
+        return ~uint256(0);
+    return bnTarget.getuint256();
+}
+
+static string HexUInt32(uint32_t n)
+{
+    return strprintf("%08x", n);
+}
+
+static bool ParseHexUInt32(const Value& value, uint32_t& n)
+{
+    if (value.type() != str_type || value.get_str().size() != 8 || !IsHex(value.get_str()))
+        return false;
+    n = strtoul(value.get_str().c_str(), NULL, 16);
+    return true;
+}
+
+/** Block template shared by all connections, the coinbase is split around the extranonces */
+struct CStratumJob
+{
+    string strId;
+    CBlock block; // coinbase without extranonces
+    vector<unsigned char> vchCoinbase1;
+    vector<unsigned char> vchCoinbase2;
+    vector<uint256> vMerkleBranch;
+    uint256 hashTarget;
+};
+
+class CStratumConnection;
+
+/** A share waiting for its scrypt hash */
+struct CStratumShare
+{
+    boost::shared_ptr<CStratumConnection> conn;
+    Value id;
+    boost::shared_ptr<const CStratumJob> job;
+    vector<unsigned char> vchCoinbase;
+    uint32_t nTime;
+    uint32_t nNonce;
+    uint256 hashShareTarget;
+};
+
+//
+// Server state below is only touched by the stratum thread, except for the
+// share queue.
+//
+static boost::asio::io_service* pStratumService = NULL;
+static set<boost::shared_ptr<CStratumConnection> > setStratumConnections;
+static map<string, boost::shared_ptr<const CStratumJob> > mapStratumJobs;
+static deque<string> vStratumJobIds;
+static boost::shared_ptr<const CStratumJob> pStratumJob;
+static CBlockIndex* pindexStratumPrev = NULL;
+static unsigned int nStratumTransactionsUpdated = 0;
+static int64_t nStratumJobTime = 0;
+static unsigned int nStratumJobCounter = 0;
+static uint32_t nStratumExtraNonce1 = 0;
+static double dStratumMinDifficulty = 0.001;
+static double dStratumShareTime = 15;
+
+static boost::mutex csStratumShares;
+static boost::condition_variable condStratumShares;
+static deque<CStratumShare> vStratumShares;
+static volatile int nStratumWorkersRunning = 0;
+
+class CStratumConnection : public boost::enable_shared_from_this<CStratumConnection>
+{
+public:
+    tcp::socket socket;
+
+private:
+    boost::asio::streambuf bufRecv;
+    deque<string> vSend;
+    bool fClosed;
+    bool fSubscribed;
+    bool fAuthorized;
+    uint32_t nExtraNonce1;
+    double dDifficulty;
+    uint256 hashShareTarget;
+    uint256 hashPrevShareTarget; // accepted until the next job is sent
+    int64_t nVardiffStart;
+    unsigned int nVardiffShares;
+    set<string> setShares; // submitted since the last clean job
+    unsigned int nSharesPending; // queued or being hashed
+
+    void Send(const Object& obj)
+    {
+        if (fClosed)
+            return;
+        bool fIdle = vSend.empty();
+        vSend.push_back(write_string(Value(obj), false) + "\n");
+        if (fIdle)
+            StartWrite();
+    }
+
+    void StartWrite()
+    {
+        boost::asio::async_write(socket, boost::asio::buffer(vSend.front()),
+            boost::bind(&CStratumConnection::HandleWrite, shared_from_this(), boost::asio::placeholders::error));
+    }
+
+    void HandleWrite(const boost::system::error_code& error)
+    {
+        if (error)
+        {
+            Close();
+            return;
+        }
+        vSend.pop_front();
+        if (!vSend.empty() && !fClosed)
+            StartWrite();
+    }
+
+    void StartRead()
+    {
+        boost::asio::async_read_until(socket, bufRecv, '\n',
+            boost::bind(&CStratumConnection::HandleRead, shared_from_this(), boost::asio::placeholders::error));
+    }
+
+    void HandleRead(const boost::system::error_code& error)
+    {
+        if (error || fClosed)
+        {
+            Close();
+            return;
+        }
+        istream is(&bufRecv);
+        string strLine;
+        getline(is, strLine);
+        if (!strLine.empty())
+            HandleLine(strLine);
+        if (!fClosed)
+            StartRead();
+    }
+
+    void Reply(const Value& id, const Value& result)
+    {
+        Object reply;
+        reply.push_back(Pair("id", id));
+        reply.push_back(Pair("result", result));
+        reply.push_back(Pair("error", Value::null));
+        Send(reply);
+    }
+
+    void ReplyError(const Value& id, int nCode, const string& strMessage)
+    {
+        Array error;
+        error.push_back(nCode);
+        error.push_back(strMessage);
+        error.push_back(Value::null);
+        Object reply;
+        reply.push_back(Pair("id", id));
+        reply.push_back(Pair("result", Value::null));
+        reply.push_back(Pair("error", error));
+        Send(reply);
+    }
+
+    void Notify(const string& strMethod, const Array& params)
+    {
+        Object notification;
+        notification.push_back(Pair("id", Value::null));
+        notification.push_back(Pair("method", strMethod));
+        notification.push_back(Pair("params", params));
+        Send(notification);
+    }
+
+    void SetDifficulty(double dNewDifficulty)
+    {
+        dDifficulty = max(dNewDifficulty, dStratumMinDifficulty);
+        hashShareTarget = GetShareTarget(dDifficulty);
+        Array params;
+        params.push_back(dDifficulty);
+        Notify("mining.set_difficulty", params);
+    }
+
+    void HandleLine(const string& strLine)
+    {
+        Value valRequest;
+        if (!read_string(strLine, valRequest) || valRequest.type() != obj_type)
+        {
+            LogPrint(LOG_MINER, "stratum: malformed request from %s\n", GetPeer().c_str());
+            Close();
+            return;
+        }
+        const Object& request = valRequest.get_obj();
+        Value id = find_value(request, "id");
+        Value method = find_value(request, "method");
+        Value params = find_value(request, "params");
+        if (method.type() != str_type)
+        {
+            ReplyError(id, STRATUM_OTHER, "Method not found");
+            return;
+        }
+        Array vParams;
+        if (params.type() == array_type)
+            vParams = params.get_array();
+
+        const string& strMethod = method.get_str();
+        if (strMethod == "mining.subscribe")
+        {
+            fSubscribed = true;
+            string strSubscription = HexUInt32(nExtraNonce1);
+            Array notify, difficulty, subscriptions, result;
+            difficulty.push_back("mining.set_difficulty");
+            difficulty.push_back(strSubscription);
+            notify.push_back("mining.notify");
+            notify.push_back(strSubscription);
+            subscriptions.push_back(difficulty);
+            subscriptions.push_back(notify);
+            result.push_back(subscriptions);
+            result.push_back(HexUInt32(nExtraNonce1));
+            result.push_back((int)STRATUM_EXTRANONCE2_SIZE);
+            Reply(id, result);
+
+            SetDifficulty(dDifficulty);
+            if (pStratumJob)
+                SendJob(pStratumJob, true);
+        }
+        else if (strMethod == "mining.authorize")
+        {
+            fAuthorized = true;
+            Reply(id, true);
+        }
+        else if (strMethod == "mining.extranonce.subscribe")
+            Reply(id, true);
+        else if (strMethod == "mining.suggest_difficulty")
+        {
+            if (vParams.size() > 0 && (vParams[0].type() == real_type || vParams[0].type() == int_type))
+                SetDifficulty(vParams[0].get_real());
+            Reply(id, true);
+        }
+        else if (strMethod == "mining.submit")
+            Submit(id, vParams);
+        else
+            ReplyError(id, STRATUM_OTHER, "Method not found");
+    }
+
+    void Submit(const Value& id, const Array& params)
+    {
+        if (!fSubscribed)
+            return ReplyError(id, STRATUM_NOT_SUBSCRIBED, "Not subscribed");
+        if (!fAuthorized)
+            return ReplyError(id, STRATUM_UNAUTHORIZED, "Unauthorized worker");
+        if (params.size() < 5 || params[1].type() != str_type || params[2].type() != str_type)
+            return ReplyError(id, STRATUM_OTHER, "Invalid parameters");
+
+        map<string, boost::shared_ptr<const CStratumJob> >::iterator mi = mapStratumJobs.find(params[1].get_str());
+        if (mi == mapStratumJobs.end())
+            return RejectShare(id, STRATUM_JOB_NOT_FOUND, "Job not found");
+        boost::shared_ptr<const CStratumJob> job = mi->second;
+
+        vector<unsigned char> vchExtraNonce2 = ParseHex(params[2].get_str());
+        if (vchExtraNonce2.size() != STRATUM_EXTRANONCE2_SIZE || !IsHex(params[2].get_str()))
+            return RejectShare(id, STRATUM_OTHER, "Invalid extranonce2 size");
+
+        uint32_t nTime, nNonce;
+        if (!ParseHexUInt32(params[3], nTime) || !ParseHexUInt32(params[4], nNonce))
+            return RejectShare(id, STRATUM_OTHER, "Invalid ntime or nonce");
+        if (nTime < job->block.nTime || nTime > FutureDrift(GetAdjustedTime()))
+            return RejectShare(id, STRATUM_OTHER, "ntime out of range");
+
+        CStratumShare share;
+        share.vchCoinbase = job->vchCoinbase1;
+        for (unsigned int i = 0; i < STRATUM_EXTRANONCE1_SIZE; i++)
+            share.vchCoinbase.push_back((nExtraNonce1 >> (8 * (STRATUM_EXTRANONCE1_SIZE - 1 - i))) & 0xff);
+        share.vchCoinbase.insert(share.vchCoinbase.end(), vchExtraNonce2.begin(), vchExtraNonce2.end());
+        share.vchCoinbase.insert(share.vchCoinbase.end(), job->vchCoinbase2.begin(), job->vchCoinbase2.end());
+
+        if (nSharesPending >= STRATUM_MAX_PENDING_SHARES)
+            return RejectShare(id, STRATUM_OTHER, "Too many shares pending");
+        if (setShares.size() >= STRATUM_MAX_SUBMITTED)
+            return RejectShare(id, STRATUM_OTHER, "Too many shares for this job");
+
+        // From the parsed values, so the case of the hex doesn't matter
+        string strShare = job->strId + ":" + HexStr(vchExtraNonce2.begin(), vchExtraNonce2.end()) + ":" + HexUInt32(nTime) + ":" + HexUInt32(nNonce);
+        if (!setShares.insert(strShare).second)
+            return RejectShare(id, STRATUM_DUPLICATE_SHARE, "Duplicate share");
+
+        share.conn = shared_from_this();
+        share.id = id;
+        share.job = job;
+        share.nTime = nTime;
+        share.nNonce = nNonce;
+        share.hashShareTarget = max(hashShareTarget, hashPrevShareTarget);
+        bool fQueued = false;
+        {
+            boost::mutex::scoped_lock lock(csStratumShares);
+            if (vStratumShares.size() < STRATUM_MAX_QUEUED_SHARES)
+            {
+                vStratumShares.push_back(share);
+                fQueued = true;
+            }
+        }
+        if (!fQueued)
+        {
+            // Not checked, so it may be sent again
+            setShares.erase(strShare);
+            return RejectShare(id, STRATUM_OTHER, "Server busy");
+        }
+        nSharesPending++;
+        condStratumShares.notify_one();
+    }
+
+    void RejectShare(const Value& id, int nCode, const string& strMessage)
+    {
+        {
+            LOCK(cs_stratumStats);
+            stratumStats.nSharesRejected++;
+        }
+        ReplyError(id, nCode, strMessage);
+    }
+
+public:
+    CStratumConnection(boost::asio::io_service& io_service) :
+        socket(io_service), bufRecv(STRATUM_MAX_LINE), fClosed(false), fSubscribed(false), fAuthorized(false),
+        nExtraNonce1(++nStratumExtraNonce1), nVardiffStart(GetTime()), nVardiffShares(0), nSharesPending(0)
+    {
+        dDifficulty = max(GetArg("-stratumdifficulty", 1), (int64_t)1) * 1.0;
+        hashShareTarget = hashPrevShareTarget = GetShareTarget(dDifficulty);
+    }
+
+    string GetPeer() const
+    {
+        boost::system::error_code ec;
+        tcp::endpoint endpoint = socket.remote_endpoint(ec);
+        return ec ? string("unknown") : endpoint.address().to_string();
+    }
+
+    void Start()
+    {
+        {
+            LOCK(cs_stratumStats);
+            stratumStats.nConnections++;
+        }
+        StartRead();
+    }
+
+    void Close()
+    {
+        if (fClosed)
+            return;
+        fClosed = true;
+        boost::system::error_code ec;
+        socket.close(ec);
+        {
+            LOCK(cs_stratumStats);
+            stratumStats.nConnections--;
+        }
+        setStratumConnections.erase(shared_from_this());
+    }
+
+    void SendJob(boost::shared_ptr<const CStratumJob> job, bool fClean)
+    {
+        if (!fSubscribed)
+            return;
+        if (fClean)
+            setShares.clear();
+        hashPrevShareTarget = hashShareTarget;
+
+        const CBlock& block = job->block;
+        // Previous block hash as eight byte swapped words, like the other hex fields
+        uint256 hashPrev = block.hashPrevBlock;
+        unsigned char* pch = (unsigned char*)&hashPrev;
+        for (int i = 0; i < 32; i += 4)
+        {
+            swap(pch[i], pch[i + 3]);
+            swap(pch[i + 1], pch[i + 2]);
+        }
+        Array branch;
+        BOOST_FOREACH(const uint256& hash, job->vMerkleBranch)
+            branch.push_back(HexStr(BEGIN(hash), END(hash)));
+
+        Array params;
+        params.push_back(job->strId);
+        params.push_back(HexStr(BEGIN(hashPrev), END(hashPrev)));
+        params.push_back(HexStr(job->vchCoinbase1.begin(), job->vchCoinbase1.end()));
+        params.push_back(HexStr(job->vchCoinbase2.begin(), job->vchCoinbase2.end()));
+        params.push_back(branch);
+        params.push_back(HexUInt32(block.nVersion));
+        params.push_back(HexUInt32(block.nBits));
+        params.push_back(HexUInt32(block.nTime));
+        params.push_back(fClean);
+        Notify("mining.notify", params);
+    }
+
+    // Called on the stratum thread with the result of a share check
+    void ShareChecked(Value id, bool fAccepted, int nCode, string strMessage)
+    {
+        nSharesPending--;
+        {
+            LOCK(cs_stratumStats);
+            if (fAccepted)
+                stratumStats.nSharesAccepted++;
+            else
+                stratumStats.nSharesRejected++;
+        }
+        if (!fAccepted)
+        {
+            ReplyError(id, nCode, strMessage);
+            return;
+        }
+        Reply(id, true);
+        nVardiffShares++;
+        UpdateDifficulty();
+    }
+
+    // Aim at one share every dStratumShareTime seconds
+    void UpdateDifficulty()
+    {
+        int64_t nElapsed = GetTime() - nVardiffStart;
+        if (nElapsed < STRATUM_VARDIFF_WINDOW && nVardiffShares < STRATUM_VARDIFF_WINDOW / dStratumShareTime * 4)
+            return;
+        if (nVardiffShares == 0 && nElapsed < 3 * STRATUM_VARDIFF_WINDOW)
+            return;
+
+        double dTarget = dDifficulty;
+        if (nVardiffShares == 0)
+            dTarget /= 4;
+        else
+            dTarget *= dStratumShareTime * nVardiffShares / max(nElapsed, (int64_t)1);
+        dTarget = max(dDifficulty / 4, min(dDifficulty * 4, dTarget));
+
+        nVardiffStart = GetTime();
+        nVardiffShares = 0;
+        if (fSubscribed && fabs(dTarget - dDifficulty) > dDifficulty * 0.2)
+            SetDifficulty(dTarget);
+    }
+};
+
+static void ThreadStratumWorker(void* parg)
+{
+    RenameThread("novacoin-stratumw");
+    __sync_fetch_and_add(&nStratumWorkersRunning, 1);
+
+    CReserveKey reservekey(pwalletMain);
+    while (true)
+    {
+        CStratumShare share;
+        {
+            boost::mutex::scoped_lock lock(csStratumShares);
+            while (vStratumShares.empty() && !fShutdown)
+                condStratumShares.timed_wait(lock, boost::posix_time::milliseconds(200));
+            if (fShutdown)
+                break;
+            share = vStratumShares.front();
+            vStratumShares.pop_front();
+        }
+
+        const CStratumJob& job = *share.job;
+        uint256 hashMerkleRoot = Hash(share.vchCoinbase.begin(), share.vchCoinbase.end());
+        BOOST_FOREACH(const uint256& hash, job.vMerkleBranch)
+            hashMerkleRoot = Hash(BEGIN(hashMerkleRoot), END(hashMerkleRoot), BEGIN(hash), END(hash));
+
+        // Block header, as laid out for GetHash()
+        unsigned char header[80];
+        memcpy(&header[0], &job.block.nVersion, 4);
+        memcpy(&header[4], &job.block.hashPrevBlock, 32);
+        memcpy(&header[36], &hashMerkleRoot, 32);
+        memcpy(&header[68], &share.nTime, 4);
+        memcpy(&header[72], &job.block.nBits, 4);
+        memcpy(&header[76], &share.nNonce, 4);
+        uint256 hash = scrypt_blockhash(header);
+
+        bool fAccepted = hash <= share.hashShareTarget;
+        if (hash <= job.hashTarget)
+        {
+            CBlock block(job.block);
+            try {
+                CDataStream(share.vchCoinbase, SER_NETWORK, PROTOCOL_VERSION) >> block.vtx[0];
+            }
+            catch (std::exception &e) {
+                printf("ThreadStratumWorker() : coinbase deserialize error\n");
+                pStratumService->post(boost::bind(&CStratumConnection::ShareChecked, share.conn, share.id, false,
+                                                  (int)STRATUM_OTHER, string("Invalid coinbase")));
+                continue;
+            }
+            block.nTime = share.nTime;
+            block.nNonce = share.nNonce;
+            block.hashMerkleRoot = block.BuildMerkleTree();
+            if (CheckWork(&block, *pwalletMain, reservekey))
+            {
+                LOCK(cs_stratumStats);
+                stratumStats.nBlocksFound++;
+            }
+            fAccepted = true;
+        }
+
+        pStratumService->post(boost::bind(&CStratumConnection::ShareChecked, share.conn, share.id, fAccepted,
+                                          (int)STRATUM_LOW_DIFFICULTY, string("Low difficulty share")));
+    }
+
+    __sync_fetch_and_sub(&nStratumWorkersRunning, 1);
+}
+
+static bool StratumClientAllowed(const boost::asio::ip::address& address)
+{
+    if (address.is_v6() && (address.to_v6().is_v4_compatible() || address.to_v6().is_v4_mapped()))
+        return StratumClientAllowed(address.to_v6().to_v4());
+
+    if (address.is_loopback() || (address.is_v4() && (address.to_v4().to_ulong() & 0xff000000) == 0x7f000000))
+        return true;
+
+    const string strAddress = address.to_string();
+    BOOST_FOREACH(const string& strAllow, mapMultiArgs["-stratumallowip"])
+        if (WildcardMatch(strAddress, strAllow))
+            return true;
+    return false;
+}
+
+static void StratumAccept(tcp::acceptor& acceptor);
+
+static void StratumHandleAccept(tcp::acceptor& acceptor, boost::shared_ptr<CStratumConnection> conn, const boost::system::error_code& error)
+{
+    if (error == boost::asio::error::operation_aborted || !acceptor.is_open())
+        return;
+    if (!error)
+    {
+        boost::system::error_code ec;
+        tcp::endpoint endpoint = conn->socket.remote_endpoint(ec);
+        if (ec || !StratumClientAllowed(endpoint.address()))
+        {
+            printf("stratum: refused connection from %s\n", conn->GetPeer().c_str());
+            conn->socket.close(ec);
+        }
+        else
+        {
+            LogPrint(LOG_MINER, "stratum: connection from %s\n", conn->GetPeer().c_str());
+            setStratumConnections.insert(conn);
+            conn->Start();
+        }
+    }
+    StratumAccept(acceptor);
+}
+
+static void StratumAccept(tcp::acceptor& acceptor)
+{
+    boost::shared_ptr<CStratumConnection> conn(new CStratumConnection(*pStratumService));
+    acceptor.async_accept(conn->socket, boost::bind(StratumHandleAccept, boost::ref(acceptor), conn, boost::asio::placeholders::error));
+}
+
+// Build a new job when the tip changes, or when transactions were added and
+// the current job is older than STRATUM_JOB_INTERVAL
+static void StratumUpdateJob()
+{
+    if (vNodes.empty() || IsInitialBlockDownload())
+        return;
+
+    bool fNewTip = pindexStratumPrev != pindexBest;
+    if (!fNewTip && (nTransactionsUpdated == nStratumTransactionsUpdated || GetTime() - nStratumJobTime < STRATUM_JOB_INTERVAL))
+        return;
+
+    unsigned int nTransactionsUpdatedNew = nTransactionsUpdated;
+    CBlockIndex* pindexPrevNew = pindexBest;
+    auto_ptr<CBlock> pblock(CreateNewBlock(pwalletMain));
+    if (!pblock.get() || pblock->hashPrevBlock != pindexPrevNew->GetBlockHash())
+        return;
+    pblock->UpdateTime(pindexPrevNew);
+
+    boost::shared_ptr<CStratumJob> job(new CStratumJob());
+    job->strId = strprintf("%x", ++nStratumJobCounter);
+    job->block = *pblock;
+    job->hashTarget = CBigNum().SetCompact(pblock->nBits).getuint256();
+
+    // Coinbase with room for both extranonces
+    CTransaction& txCoinBase = job->block.vtx[0];
+    const unsigned int nExtraNonceSize = STRATUM_EXTRANONCE1_SIZE + STRATUM_EXTRANONCE2_SIZE;
+    CScript scriptHeight = CScript() << (pindexPrevNew->nHeight + 1);
+    txCoinBase.vin[0].scriptSig = (CScript(scriptHeight) << vector<unsigned char>(nExtraNonceSize, 0)) + COINBASE_FLAGS;
+    if (txCoinBase.vin[0].scriptSig.size() > 100)
+        return;
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << txCoinBase;
+    // nVersion, nTime, vin count, prevout, script size, height push and the extranonce push opcode
+    unsigned int nOffset = 4 + 4 + 1 + 36 + GetSizeOfCompactSize(txCoinBase.vin[0].scriptSig.size()) + scriptHeight.size() + 1;
+    if (nOffset + nExtraNonceSize > ss.size())
+        return;
+    job->vchCoinbase1.assign(ss.begin(), ss.begin() + nOffset);
+    job->vchCoinbase2.assign(ss.begin() + nOffset + nExtraNonceSize, ss.end());
+
+    job->block.hashMerkleRoot = job->block.BuildMerkleTree();
+    job->vMerkleBranch = job->block.GetMerkleBranch(0);
+
+    // Shares for jobs of an older tip are stale
+    if (fNewTip)
+    {
+        mapStratumJobs.clear();
+        vStratumJobIds.clear();
+    }
+    mapStratumJobs[job->strId] = job;
+    vStratumJobIds.push_back(job->strId);
+    while (vStratumJobIds.size() > STRATUM_MAX_JOBS)
+    {
+        mapStratumJobs.erase(vStratumJobIds.front());
+        vStratumJobIds.pop_front();
+    }
+
+    pStratumJob = job;
+    pindexStratumPrev = pindexPrevNew;
+    nStratumTransactionsUpdated = nTransactionsUpdatedNew;
+    nStratumJobTime = GetTime();
+    {
+        LOCK(cs_stratumStats);
+        stratumStats.nJobs++;
+    }
+
+    // Connections may close while being notified
+    set<boost::shared_ptr<CStratumConnection> > setConnections = setStratumConnections;
+    BOOST_FOREACH(boost::shared_ptr<CStratumConnection> conn, setConnections)
+        conn->SendJob(pStratumJob, fNewTip);
+}
+
+static void StratumTimer(boost::asio::deadline_timer& timer, const boost::system::error_code& error)
+{
+    if (error == boost::asio::error::operation_aborted || fShutdown)
+        return;
+
+    StratumUpdateJob();
+
+    // Lower the difficulty of connections that stopped sending shares
+    set<boost::shared_ptr<CStratumConnection> > setConnections = setStratumConnections;
+    BOOST_FOREACH(boost::shared_ptr<CStratumConnection> conn, setConnections)
+        conn->UpdateDifficulty();
+
+    timer.expires_from_now(boost::posix_time::milliseconds(500));
+    timer.async_wait(boost::bind(StratumTimer, boost::ref(timer), boost::asio::placeholders::error));
+}
+
+static void ThreadStratumServer2(void* parg)
+{
+    boost::asio::io_service io_service;
+    pStratumService = &io_service;
+
+    if (mapArgs.count("-stratummindifficulty"))
+        dStratumMinDifficulty = atof(mapArgs["-stratummindifficulty"].c_str());
+    dStratumShareTime = max(GetArg("-stratumsharetime", 15), (int64_t)1);
+
+    const bool fLoopback = !mapArgs.count("-stratumallowip");
+    boost::asio::ip::address bindAddress = fLoopback ? boost::asio::ip::address(boost::asio::ip::address_v4::loopback()) : boost::asio::ip::address(boost::asio::ip::address_v4::any());
+    tcp::endpoint endpoint(bindAddress, GetArg("-stratumport", fTestNet ? STRATUM_DEFAULT_PORT_TESTNET : STRATUM_DEFAULT_PORT));
+    tcp::acceptor acceptor(io_service);
+    try
+    {
+        acceptor.open(endpoint.protocol());
+        acceptor.set_option(tcp::acceptor::reuse_address(true));
+        acceptor.bind(endpoint);
+        acceptor.listen(boost::asio::socket_base::max_connections);
+    }
+    catch (boost::system::system_error &e)
+    {
+        string strError = strprintf(_("An error occurred while setting up the stratum port %u for listening: %s"), endpoint.port(), e.what());
+        uiInterface.ThreadSafeMessageBox(strError, _("Error"), CClientUIInterface::OK | CClientUIInterface::MODAL);
+        return;
+    }
+    printf("Stratum server listening on %s:%u\n", endpoint.address().to_string().c_str(), endpoint.port());
+
+    int nWorkers = GetArg("-stratumthreads", 0);
+    if (nWorkers <= 0)
+        nWorkers = max((int)boost::thread::hardware_concurrency() / 2, 1);
+    for (int i = 0; i < nWorkers; i++)
+        if (!NewThread(ThreadStratumWorker, NULL))
+            printf("Error: NewThread(ThreadStratumWorker) failed\n");
+
+    StratumAccept(acceptor);
+    boost::asio::deadline_timer timer(io_service);
+    timer.expires_from_now(boost::posix_time::milliseconds(500));
+    timer.async_wait(boost::bind(StratumTimer, boost::ref(timer), boost::asio::placeholders::error));
+
+    vnThreadsRunning[THREAD_STRATUM]--;
+    while (!fShutdown)
+        io_service.run_one();
+    vnThreadsRunning[THREAD_STRATUM]++;
+
+    // Workers post their results to io_service, wait for them first
+    condStratumShares.notify_all();
+    while (nStratumWorkersRunning > 0)
+        Sleep(10);
+
+    boost::system::error_code ec;
+    acceptor.close(ec);
+    timer.cancel(ec);
+    set<boost::shared_ptr<CStratumConnection> > setConnections = setStratumConnections;
+    BOOST_FOREACH(boost::shared_ptr<CStratumConnection> conn, setConnections)
+        conn->Close();
+    mapStratumJobs.clear();
+    pStratumJob.reset();
+    {
+        boost::mutex::scoped_lock lock(csStratumShares);
+        vStratumShares.clear();
+    }
+    pStratumService = NULL;
+}
+
+void ThreadStratumServer(void* parg)
+{
+    // Make this thread recognisable as the stratum server
+    RenameThread("novacoin-stratum");
+
+    try
+    {
+        vnThreadsRunning[THREAD_STRATUM]++;
+        ThreadStratumServer2(parg);
+        vnThreadsRunning[THREAD_STRATUM]--;
+    }
+    catch (std::exception& e) {
+        vnThreadsRunning[THREAD_STRATUM]--;
+        PrintException(&e, "ThreadStratumServer()");
+    } catch (...) {
+        vnThreadsRunning[THREAD_STRATUM]--;
+        PrintException(NULL, "ThreadStratumServer()");
+    }
+    printf("ThreadStratumServer exited\n");
+}
@@ -0,0 +1,35 @@
+// Copyright (c) 2014 The NovaCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef NOVACOIN_STRATUM_H
+#define NOVACOIN_STRATUM_H
+
+#include <stdint.h>
+
+//
+// Stratum mining protocol server (-stratum).
+//
+// Miners keep a TCP connection open and are sent a new job whenever the
+// best chain or the memory pool changes, instead of polling getwork. Each
+// connection gets its own extranonce1 so miners roll extranonce2, ntime and
+// nonce without talking to the node. Share difficulty is adjusted per
+// connection, and shares are checked by a pool of scrypt worker threads.
+//
+
+static const int STRATUM_DEFAULT_PORT = 8345;
+static const int STRATUM_DEFAULT_PORT_TESTNET = 18345;
+
+/** Counters for getstratuminfo */
+struct CStratumStats
+{
+    int nConnections;
+    uint64_t nSharesAccepted;
+    uint64_t nSharesRejected;
+    uint64_t nBlocksFound;
+    uint64_t nJobs;
+};
+
+void ThreadStratumServer(void* parg);
+void GetStratumStats(CStratumStats& stats);
+
+#endif
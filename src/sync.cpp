@@ -7,6 +7,8 @@
 
 #include <boost/foreach.hpp>
 
+#include <algorithm>
+
 #ifdef DEBUG_LOCKCONTENTION
 void PrintLockContention(const char* pszName, const char* pszFile, int nLine)
 {
@@ -126,3 +128,187 @@ void LeaveCritical()
 }
 
 #endif /* DEBUG_LOCKORDER */
+
+//
+// Lock profiling.
+// Call sites are found by the addresses of the lock name and __FILE__
+// strings and the line number in an open addressing table, LOCK2 has two
+// sites on one line. Lookups don't lock, new sites are
+// added under a mutex and published by storing pszFile last. Counters are
+// updated with atomic adds, so profiling doesn't add contention of its own.
+//
+
+volatile bool fLockProfile = false;
+
+struct CLockSite
+{
+    const char* volatile pszFile;
+    int nLine;
+    const char* pszName;
+    uint64_t nAcquired;
+    uint64_t nContended;
+    uint64_t nTryAttempts;
+    uint64_t nTryFailed;
+    uint64_t nWaitMicros;
+    uint64_t nHoldMicros;
+    uint64_t vWaitHist[LOCKPROFILE_BUCKETS];
+    uint64_t vHoldHist[LOCKPROFILE_BUCKETS];
+};
+
+static const unsigned int LOCKPROFILE_SITES = 4096; // power of two
+static CLockSite vLockSites[LOCKPROFILE_SITES];
+
+static boost::mutex& LockSitesMutex()
+{
+    static boost::mutex* pmutex = new boost::mutex();
+    return *pmutex;
+}
+
+static inline unsigned int LockHistBucket(uint64_t nMicros)
+{
+    unsigned int nBucket = 0;
+    while (nMicros > 1 && nBucket < LOCKPROFILE_BUCKETS - 1)
+    {
+        nMicros >>= 1;
+        nBucket++;
+    }
+    return nBucket;
+}
+
+int64_t LockProfileTime()
+{
+    return GetTimeMicros();
+}
+
+CLockSite* LockProfileSite(const char* pszName, const char* pszFile, int nLine)
+{
+    unsigned int nHash = ((unsigned int)(size_t)pszFile >> 3) * 2654435761U + ((unsigned int)(size_t)pszName >> 3) * 2246822519U + (unsigned int)nLine * 40503U;
+    for (unsigned int i = 0; i < LOCKPROFILE_SITES; i++)
+    {
+        CLockSite* pSite = &vLockSites[(nHash + i) & (LOCKPROFILE_SITES - 1)];
+        const char* pszSiteFile = pSite->pszFile;
+        if (pszSiteFile == NULL)
+        {
+            boost::mutex::scoped_lock lock(LockSitesMutex());
+            if (pSite->pszFile == NULL)
+            {
+                pSite->nLine = nLine;
+                pSite->pszName = pszName;
+                __sync_synchronize();
+                pSite->pszFile = pszFile;
+                return pSite;
+            }
+            pszSiteFile = pSite->pszFile;
+        }
+        if (pszSiteFile == pszFile && pSite->nLine == nLine && pSite->pszName == pszName)
+            return pSite;
+    }
+    return NULL; // full, not counted
+}
+
+int64_t LockProfileAcquired(CLockSite* pSite, int64_t nWaitStart)
+{
+    int64_t nNow = LockProfileTime();
+    if (pSite)
+    {
+        __sync_fetch_and_add(&pSite->nAcquired, 1);
+        if (nWaitStart)
+        {
+            uint64_t nWait = std::max(nNow - nWaitStart, (int64_t)0);
+            __sync_fetch_and_add(&pSite->nContended, 1);
+            __sync_fetch_and_add(&pSite->nWaitMicros, nWait);
+            __sync_fetch_and_add(&pSite->vWaitHist[LockHistBucket(nWait)], 1);
+        }
+    }
+    return nNow;
+}
+
+int64_t LockProfileTryAcquired(CLockSite* pSite)
+{
+    if (pSite)
+        __sync_fetch_and_add(&pSite->nTryAttempts, 1);
+    return LockProfileAcquired(pSite, 0);
+}
+
+void LockProfileTryFailed(CLockSite* pSite)
+{
+    if (pSite)
+    {
+        __sync_fetch_and_add(&pSite->nTryAttempts, 1);
+        __sync_fetch_and_add(&pSite->nTryFailed, 1);
+    }
+}
+
+void LockProfileReleased(CLockSite* pSite, int64_t nLockedTime)
+{
+    if (!pSite)
+        return;
+    uint64_t nHold = std::max(LockProfileTime() - nLockedTime, (int64_t)0);
+    __sync_fetch_and_add(&pSite->nHoldMicros, nHold);
+    __sync_fetch_and_add(&pSite->vHoldHist[LockHistBucket(nHold)], 1);
+}
+
+static bool CompareLockWait(const CLockProfileEntry& a, const CLockProfileEntry& b)
+{
+    if (a.nWaitMicros != b.nWaitMicros)
+        return a.nWaitMicros > b.nWaitMicros;
+    return a.nHoldMicros > b.nHoldMicros;
+}
+
+void GetLockProfile(std::vector<CLockProfileEntry>& vEntries)
+{
+    vEntries.clear();
+    for (unsigned int i = 0; i < LOCKPROFILE_SITES; i++)
+    {
+        const CLockSite& site = vLockSites[i];
+        const char* pszFile = site.pszFile;
+        if (pszFile == NULL || site.nAcquired + site.nTryAttempts == 0)
+            continue;
+        __sync_synchronize();
+
+        CLockProfileEntry entry;
+        entry.strName = site.pszName;
+        entry.strLocation = strprintf("%s:%d", pszFile, site.nLine);
+        entry.nAcquired = site.nAcquired;
+        entry.nContended = site.nContended;
+        entry.nTryAttempts = site.nTryAttempts;
+        entry.nTryFailed = site.nTryFailed;
+        entry.nWaitMicros = site.nWaitMicros;
+        entry.nHoldMicros = site.nHoldMicros;
+        for (int j = 0; j < LOCKPROFILE_BUCKETS; j++)
+        {
+            entry.vWaitHist[j] = site.vWaitHist[j];
+            entry.vHoldHist[j] = site.vHoldHist[j];
+        }
+        vEntries.push_back(entry);
+    }
+    std::sort(vEntries.begin(), vEntries.end(), CompareLockWait);
+}
+
+void ResetLockProfile()
+{
+    // Sites stay registered, only the counters are cleared
+    for (unsigned int i = 0; i < LOCKPROFILE_SITES; i++)
+    {
+        CLockSite& site = vLockSites[i];
+        site.nAcquired = site.nContended = 0;
+        site.nTryAttempts = site.nTryFailed = 0;
+        site.nWaitMicros = site.nHoldMicros = 0;
+        for (int j = 0; j < LOCKPROFILE_BUCKETS; j++)
+            site.vWaitHist[j] = site.vHoldHist[j] = 0;
+    }
+}
+
+void PrintLockProfile(unsigned int nMaxSites)
+{
+    std::vector<CLockProfileEntry> vEntries;
+    GetLockProfile(vEntries);
+    printf("Lock profile, %" PRIszu " sites, by total wait:\n", vEntries.size());
+    for (unsigned int i = 0; i < vEntries.size() && i < nMaxSites; i++)
+    {
+        const CLockProfileEntry& entry = vEntries[i];
+        printf("  %s %s acquired=%" PRIu64 " contended=%" PRIu64 " wait=%" PRIu64 "us hold=%" PRIu64 "us try=%" PRIu64 " tryfailed=%" PRIu64 "\n",
+               entry.strName.c_str(), entry.strLocation.c_str(), entry.nAcquired, entry.nContended,
+               entry.nWaitMicros, entry.nHoldMicros, entry.nTryAttempts, entry.nTryFailed);
+    }
+}
@@ -10,6 +10,10 @@
 #include <boost/thread/locks.hpp>
 #include <boost/thread/condition_variable.hpp>
 
+#include <stdint.h>
+#include <string>
+#include <vector>
+
 
 
 
@@ -31,12 +35,71 @@ void static inline LeaveCritical() {}
 void PrintLockContention(const char* pszName, const char* pszFile, int nLine);
 #endif
 
+//
+// Lock profiling (-lockprofile): per LOCK/TRY_LOCK call site counts, wait and
+// hold time histograms. When it is off the only cost is testing the flag.
+//
+static const int LOCKPROFILE_BUCKETS = 20; // powers of two microseconds
+
+struct CLockSite;
+
+/** Statistics of one call site */
+struct CLockProfileEntry
+{
+    std::string strName;
+    std::string strLocation;
+    uint64_t nAcquired;
+    uint64_t nContended;
+    uint64_t nTryAttempts;
+    uint64_t nTryFailed;
+    uint64_t nWaitMicros;
+    uint64_t nHoldMicros;
+    uint64_t vWaitHist[LOCKPROFILE_BUCKETS];
+    uint64_t vHoldHist[LOCKPROFILE_BUCKETS];
+};
+
+extern volatile bool fLockProfile;
+
+int64_t LockProfileTime();
+CLockSite* LockProfileSite(const char* pszName, const char* pszFile, int nLine);
+// Return the time the lock was taken, nWaitStart is 0 if it was not contended
+int64_t LockProfileAcquired(CLockSite* pSite, int64_t nWaitStart);
+int64_t LockProfileTryAcquired(CLockSite* pSite);
+void LockProfileTryFailed(CLockSite* pSite);
+void LockProfileReleased(CLockSite* pSite, int64_t nLockedTime);
+
+// Sites sorted by total wait time
+void GetLockProfile(std::vector<CLockProfileEntry>& vEntries);
+void ResetLockProfile();
+void PrintLockProfile(unsigned int nMaxSites);
+
 /** Wrapper around boost::unique_lock<Mutex> */
 template<typename Mutex>
 class CMutexLock
 {
 private:
     boost::unique_lock<Mutex> lock;
+    CLockSite* pSite;
+    int64_t nLockedTime; // 0 when not profiled
+
+    void EnterProfiled(const char* pszName, const char* pszFile, int nLine)
+    {
+        pSite = LockProfileSite(pszName, pszFile, nLine);
+        int64_t nWaitStart = 0;
+        if (!lock.try_lock())
+        {
+            nWaitStart = LockProfileTime();
+            lock.lock();
+        }
+        nLockedTime = LockProfileAcquired(pSite, nWaitStart);
+    }
+
+    void LeaveProfiled()
+    {
+        LockProfileReleased(pSite, nLockedTime);
+        nLockedTime = 0;
+    }
+
 public:
 
     void Enter(const char* pszName, const char* pszFile, int nLine)
@@ -44,6 +107,11 @@ public:
         if (!lock.owns_lock())
         {
             EnterCritical(pszName, pszFile, nLine, (void*)(lock.mutex()));
+            if (fLockProfile)
+            {
+                EnterProfiled(pszName, pszFile, nLine);
+                return;
+            }
 #ifdef DEBUG_LOCKCONTENTION
             if (!lock.try_lock())
             {
@@ -60,6 +128,8 @@ public:
     {
         if (lock.owns_lock())
         {
+            if (nLockedTime)
+                LeaveProfiled();
             lock.unlock();
             LeaveCritical();
         }
@@ -71,13 +141,21 @@ public:
         {
             EnterCritical(pszName, pszFile, nLine, (void*)(lock.mutex()), true);
             lock.try_lock();
+            if (fLockProfile)
+            {
+                pSite = LockProfileSite(pszName, pszFile, nLine);
+                if (lock.owns_lock())
+                    nLockedTime = LockProfileTryAcquired(pSite);
+                else
+                    LockProfileTryFailed(pSite);
+            }
             if (!lock.owns_lock())
                 LeaveCritical();
         }
         return lock.owns_lock();
     }
 
-    CMutexLock(Mutex& mutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false) : lock(mutexIn, boost::defer_lock)
+    CMutexLock(Mutex& mutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false) : lock(mutexIn, boost::defer_lock), pSite(NULL), nLockedTime(0)
     {
         if (fTry)
             TryEnter(pszName, pszFile, nLine);
@@ -88,7 +166,11 @@ public:
     ~CMutexLock()
     {
         if (lock.owns_lock())
+        {
+            if (nLockedTime)
+                LeaveProfiled();
             LeaveCritical();
+        }
     }
 
     operator bool()
@@ -314,6 +314,26 @@ bool CTxDB::WriteModifierUpgradeTime(const unsigned int& nUpgradeTime)
     return Write(string("nUpgradeTime"), nUpgradeTime);
 }
 
+bool CTxDB::ReadSnapshotHash(uint256& hashSnapshot)
+{
+    return Read(string("hashSnapshot"), hashSnapshot);
+}
+
+bool CTxDB::WriteSnapshotHash(uint256 hashSnapshot)
+{
+    return Write(string("hashSnapshot"), hashSnapshot);
+}
+
+bool CTxDB::ReadSnapshotVerified(int& nHeight)
+{
+    return Read(string("nSnapshotVerified"), nHeight);
+}
+
+bool CTxDB::WriteSnapshotVerified(int nHeight)
+{
+    return Write(string("nSnapshotVerified"), nHeight);
+}
+
 static CBlockIndex *InsertBlockIndex(uint256 hash)
 {
     if (hash == 0)
@@ -204,6 +204,10 @@ public:
     bool WriteCheckpointPubKey(const std::string& strPubKey);
     bool ReadModifierUpgradeTime(unsigned int& nUpgradeTime);
     bool WriteModifierUpgradeTime(const unsigned int& nUpgradeTime);
+    bool ReadSnapshotHash(uint256& hashSnapshot);
+    bool WriteSnapshotHash(uint256 hashSnapshot);
+    bool ReadSnapshotVerified(int& nHeight);
+    bool WriteSnapshotVerified(int nHeight);
     bool LoadBlockIndex();
 };
 
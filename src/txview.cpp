@@ -0,0 +1,262 @@
+// Copyright (c) 2014 The NovaCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "txview.h"
+#include "main.h"
+#include "scrypt.h"
+
+using namespace std;
+
+namespace
+{
+    // Fixed size little-endian fields
+    template<typename T>
+    bool ReadField(const unsigned char*& pch, const unsigned char* pchEnd, T& obj)
+    {
+        if ((size_t)(pchEnd - pch) < sizeof(obj))
+            return false;
+        memcpy(&obj, pch, sizeof(obj));
+        pch += sizeof(obj);
+        return true;
+    }
+
+    // Same limits as ReadCompactSize(); fCanonical is cleared for longer
+    // encodings than WriteCompactSize() would produce
+    bool ReadSize(const unsigned char*& pch, const unsigned char* pchEnd, uint64_t& nSizeRet, bool& fCanonical)
+    {
+        unsigned char chSize;
+        if (!ReadField(pch, pchEnd, chSize))
+            return false;
+        if (chSize < 253)
+            nSizeRet = chSize;
+        else if (chSize == 253)
+        {
+            unsigned short xSize;
+            if (!ReadField(pch, pchEnd, xSize))
+                return false;
+            nSizeRet = xSize;
+            if (nSizeRet < 253)
+                fCanonical = false;
+        }
+        else if (chSize == 254)
+        {
+            unsigned int xSize;
+            if (!ReadField(pch, pchEnd, xSize))
+                return false;
+            nSizeRet = xSize;
+            if (nSizeRet <= USHRT_MAX)
+                fCanonical = false;
+        }
+        else
+        {
+            uint64_t xSize;
+            if (!ReadField(pch, pchEnd, xSize))
+                return false;
+            nSizeRet = xSize;
+            if (nSizeRet <= UINT_MAX)
+                fCanonical = false;
+        }
+        return nSizeRet <= (uint64_t)MAX_SIZE;
+    }
+
+    bool ReadScript(const unsigned char*& pch, const unsigned char* pchEnd, CScriptView& script, bool& fCanonical)
+    {
+        uint64_t nSize;
+        if (!ReadSize(pch, pchEnd, nSize, fCanonical) || (uint64_t)(pchEnd - pch) < nSize)
+            return false;
+        script.pbegin = pch;
+        script.pend = pch + nSize;
+        pch += nSize;
+        return true;
+    }
+}
+
+void CScriptView::GetScript(CScript& script) const
+{
+    script.assign(pbegin, pend);
+}
+
+uint256 CTxInView::GetPrevoutHash() const
+{
+    uint256 hash;
+    memcpy(&hash, pchPrevout, sizeof(hash));
+    return hash;
+}
+
+unsigned int CTxInView::GetPrevoutN() const
+{
+    unsigned int n;
+    memcpy(&n, pchPrevout + sizeof(uint256), sizeof(n));
+    return n;
+}
+
+bool CTransactionView::Parse(const unsigned char*& pch, const unsigned char* pchEnd)
+{
+    const unsigned char* pchBegin = pch;
+    fCanonical = true;
+    uint64_t nSize;
+
+    if (!ReadField(pch, pchEnd, nVersion) || !ReadField(pch, pchEnd, nTime))
+        return false;
+
+    if (!ReadSize(pch, pchEnd, nSize, fCanonical) || nSize > (uint64_t)(pchEnd - pch) / 41)
+        return false;
+    vin.resize(nSize);
+    for (unsigned int i = 0; i < vin.size(); i++)
+    {
+        CTxInView& txin = vin[i];
+        if ((size_t)(pchEnd - pch) < sizeof(uint256) + sizeof(unsigned int))
+            return false;
+        txin.pchPrevout = pch;
+        pch += sizeof(uint256) + sizeof(unsigned int);
+        if (!ReadScript(pch, pchEnd, txin.scriptSig, fCanonical) || !ReadField(pch, pchEnd, txin.nSequence))
+            return false;
+    }
+
+    if (!ReadSize(pch, pchEnd, nSize, fCanonical) || nSize > (uint64_t)(pchEnd - pch) / 9)
+        return false;
+    vout.resize(nSize);
+    for (unsigned int i = 0; i < vout.size(); i++)
+    {
+        CTxOutView& txout = vout[i];
+        if (!ReadField(pch, pchEnd, txout.nValue) || !ReadScript(pch, pchEnd, txout.scriptPubKey, fCanonical))
+            return false;
+    }
+
+    if (!ReadField(pch, pchEnd, nLockTime))
+        return false;
+
+    pbegin = pchBegin;
+    pend = pch;
+    return true;
+}
+
+uint256 CTransactionView::GetHash() const
+{
+    if (fCanonical)
+        return Hash(pbegin, pend);
+
+    // Hash what CTransaction would serialize to
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << nVersion << nTime;
+    WriteCompactSize(ss, vin.size());
+    for (unsigned int i = 0; i < vin.size(); i++)
+    {
+        const CTxInView& txin = vin[i];
+        ss.write((const char*)txin.pchPrevout, sizeof(uint256) + sizeof(unsigned int));
+        WriteCompactSize(ss, txin.scriptSig.size());
+        ss.write((const char*)txin.scriptSig.begin(), txin.scriptSig.size());
+        ss << txin.nSequence;
+    }
+    WriteCompactSize(ss, vout.size());
+    for (unsigned int i = 0; i < vout.size(); i++)
+    {
+        const CTxOutView& txout = vout[i];
+        ss << txout.nValue;
+        WriteCompactSize(ss, txout.scriptPubKey.size());
+        ss.write((const char*)txout.scriptPubKey.begin(), txout.scriptPubKey.size());
+    }
+    ss << nLockTime;
+    return ss.GetHash();
+}
+
+bool CTransactionView::GetTransaction(CTransaction& tx) const
+{
+    try {
+        CDataStream ss((const char*)pbegin, (const char*)pend, SER_NETWORK, PROTOCOL_VERSION);
+        ss >> tx;
+    }
+    catch (std::exception &e) {
+        return error("CTransactionView::GetTransaction() : deserialize error");
+    }
+    return true;
+}
+
+bool CBlockView::Parse(const unsigned char* pch, const unsigned char* pchEnd)
+{
+    const unsigned char* pchBegin = pch;
+    if (!ReadField(pch, pchEnd, nVersion) ||
+        !ReadField(pch, pchEnd, hashPrevBlock) ||
+        !ReadField(pch, pchEnd, hashMerkleRoot) ||
+        !ReadField(pch, pchEnd, nTime) ||
+        !ReadField(pch, pchEnd, nBits) ||
+        !ReadField(pch, pchEnd, nNonce))
+        return false;
+
+    bool fCanonical = true;
+    uint64_t nSize;
+    if (!ReadSize(pch, pchEnd, nSize, fCanonical) || nSize > (uint64_t)(pchEnd - pch) / 10)
+        return false;
+    vtx.resize(nSize);
+    for (unsigned int i = 0; i < vtx.size(); i++)
+        if (!vtx[i].Parse(pch, pchEnd))
+            return false;
+
+    if (!ReadScript(pch, pchEnd, vchBlockSig, fCanonical))
+        return false;
+
+    pbegin = pchBegin;
+    pend = pch;
+    return true;
+}
+
+uint256 CBlockView::GetHash() const
+{
+    return scrypt_blockhash(pbegin);
+}
+
+uint256 CBlockView::BuildMerkleRoot() const
+{
+    // Same tree as CBlock::BuildMerkleTree(), computed in place
+    vector<uint256> vMerkleTree;
+    vMerkleTree.reserve(vtx.size());
+    for (unsigned int i = 0; i < vtx.size(); i++)
+        vMerkleTree.push_back(vtx[i].GetHash());
+    for (unsigned int nSize = vMerkleTree.size(); nSize > 1; nSize = (nSize + 1) / 2)
+    {
+        for (unsigned int i = 0; i < nSize; i += 2)
+        {
+            unsigned int i2 = std::min(i+1, nSize-1);
+            vMerkleTree[i/2] = Hash(BEGIN(vMerkleTree[i]),  END(vMerkleTree[i]),
+                                    BEGIN(vMerkleTree[i2]), END(vMerkleTree[i2]));
+        }
+    }
+    return (vMerkleTree.empty() ? 0 : vMerkleTree[0]);
+}
+
+bool CBlockView::GetBlock(CBlock& block) const
+{
+    try {
+        CDataStream ss((const char*)pbegin, (const char*)pend, SER_NETWORK, PROTOCOL_VERSION);
+        ss >> block;
+    }
+    catch (std::exception &e) {
+        return error("CBlockView::GetBlock() : deserialize error");
+    }
+    return true;
+}
+
+bool CBlockView::ReadFromDisk(unsigned int nFile, unsigned int nBlockPos, std::vector<unsigned char>& vchBlock)
+{
+    // The block is preceded by the message start and its size
+    if (nBlockPos < sizeof(unsigned int))
+        return false;
+    CAutoFile filein = CAutoFile(OpenBlockFile(nFile, nBlockPos - sizeof(unsigned int), "rb"), SER_DISK, CLIENT_VERSION);
+    if (!filein)
+        return error("CBlockView::ReadFromDisk() : OpenBlockFile failed");
+
+    unsigned int nSize;
+    try {
+        filein >> nSize;
+        if (nSize > MAX_SIZE)
+            return error("CBlockView::ReadFromDisk() : block size %u too large", nSize);
+        vchBlock.resize(nSize);
+        if (nSize)
+            filein.read((char*)&vchBlock[0], nSize);
+    }
+    catch (std::exception &e) {
+        return error("CBlockView::ReadFromDisk() : I/O error");
+    }
+    return true;
+}
@@ -0,0 +1,128 @@
+// Copyright (c) 2014 The NovaCoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef NOVACOIN_TXVIEW_H
+#define NOVACOIN_TXVIEW_H
+
+#include <vector>
+
+#include "uint256.h"
+
+class CScript;
+class CTransaction;
+class CBlock;
+
+//
+// Read-only views of serialized transactions and blocks.
+//
+// Parsing a view records where every field is instead of copying it, so
+// inputs, outputs and scripts point into the original buffer, which has to
+// outlive the view. Reusing a view object for the next transaction or block
+// recycles its storage.
+//
+
+/** Script bytes inside a serialized transaction */
+class CScriptView
+{
+public:
+    const unsigned char* pbegin;
+    const unsigned char* pend;
+
+    CScriptView() : pbegin(NULL), pend(NULL) { }
+
+    const unsigned char* begin() const { return pbegin; }
+    const unsigned char* end() const { return pend; }
+    unsigned int size() const { return pend - pbegin; }
+    bool empty() const { return pbegin == pend; }
+
+    // Copy into script, reusing its capacity
+    void GetScript(CScript& script) const;
+};
+
+class CTxInView
+{
+public:
+    const unsigned char* pchPrevout; // 32 byte hash followed by the index
+    CScriptView scriptSig;
+    unsigned int nSequence;
+
+    uint256 GetPrevoutHash() const;
+    unsigned int GetPrevoutN() const;
+};
+
+class CTxOutView
+{
+public:
+    int64_t nValue;
+    CScriptView scriptPubKey;
+};
+
+/** View of a serialized CTransaction */
+class CTransactionView
+{
+private:
+    const unsigned char* pbegin;
+    const unsigned char* pend;
+    bool fCanonical; // all sizes use their shortest encoding
+
+public:
+    int nVersion;
+    unsigned int nTime;
+    std::vector<CTxInView> vin;
+    std::vector<CTxOutView> vout;
+    unsigned int nLockTime;
+
+    CTransactionView() : pbegin(NULL), pend(NULL), fCanonical(true) { }
+
+    // Parse the transaction starting at pch, leaving pch right after it
+    bool Parse(const unsigned char*& pch, const unsigned char* pchEnd);
+
+    const unsigned char* begin() const { return pbegin; }
+    const unsigned char* end() const { return pend; }
+    unsigned int size() const { return pend - pbegin; }
+    bool IsCanonical() const { return fCanonical; }
+
+    // Same as CTransaction::GetHash(), hashing the raw bytes when they are
+    // what CTransaction would serialize to
+    uint256 GetHash() const;
+
+    // Deserialize the full transaction
+    bool GetTransaction(CTransaction& tx) const;
+};
+
+/** View of a serialized CBlock */
+class CBlockView
+{
+private:
+    const unsigned char* pbegin;
+    const unsigned char* pend;
+
+public:
+    int nVersion;
+    uint256 hashPrevBlock;
+    uint256 hashMerkleRoot;
+    unsigned int nTime;
+    unsigned int nBits;
+    unsigned int nNonce;
+    std::vector<CTransactionView> vtx;
+    CScriptView vchBlockSig;
+
+    CBlockView() : pbegin(NULL), pend(NULL) { }
+
+    bool Parse(const unsigned char* pch, const unsigned char* pchEnd);
+
+    const unsigned char* begin() const { return pbegin; }
+    const unsigned char* end() const { return pend; }
+    unsigned int size() const { return pend - pbegin; }
+
+    uint256 GetHash() const;
+    uint256 BuildMerkleRoot() const;
+
+    // Deserialize the full block
+    bool GetBlock(CBlock& block) const;
+
+    // Read the serialized block at a position of the block files
+    static bool ReadFromDisk(unsigned int nFile, unsigned int nBlockPos, std::vector<unsigned char>& vchBlock);
+};
+
+#endif
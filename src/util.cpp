@@ -220,8 +220,6 @@ uint256 GetRandHash()
 
 
 
-static FILE* fileout = NULL;
-
 inline int OutputDebugStringF(const char* pszFormat, ...)
 {
     int ret = 0;
@@ -235,46 +233,22 @@ inline int OutputDebugStringF(const char* pszFormat, ...)
     }
     else if (!fPrintToDebugger)
     {
-        // print to debug.log
+        // print to debug.log, through the log writer
+        char pszBuffer[1024];
+        va_list arg_ptr;
+        va_start(arg_ptr, pszFormat);
+        ret = vsnprintf(pszBuffer, sizeof(pszBuffer), pszFormat, arg_ptr);
+        va_end(arg_ptr);
 
-        if (!fileout)
-        {
-            boost::filesystem::path pathDebug = GetDataDir() / "debug.log";
-            fileout = fopen(pathDebug.string().c_str(), "a");
-            if (fileout) setbuf(fileout, NULL); // unbuffered
-        }
-        if (fileout)
+        if (ret >= 0 && ret < (int)sizeof(pszBuffer))
+            LogWrite(pszBuffer, ret);
+        else
         {
-            static bool fStartedNewLine = true;
-
-            // This routine may be called by global destructors during shutdown.
-            // Since the order of destruction of static/global objects is undefined,
-            // allocate mutexDebugLog on the heap the first time this routine
-            // is called to avoid crashes during shutdown.
-            static boost::mutex* mutexDebugLog = NULL;
-            if (mutexDebugLog == NULL) mutexDebugLog = new boost::mutex();
-            boost::mutex::scoped_lock scoped_lock(*mutexDebugLog);
-
-            // reopen the log file, if requested
-            if (fReopenDebugLog) {
-                fReopenDebugLog = false;
-                boost::filesystem::path pathDebug = GetDataDir() / "debug.log";
-                if (freopen(pathDebug.string().c_str(),"a",fileout) != NULL)
-                    setbuf(fileout, NULL); // unbuffered
-            }
-
-            // Debug print useful for profiling
-            if (fLogTimestamps && fStartedNewLine)
-                fprintf(fileout, "%s ", DateTimeStrFormat("%x %H:%M:%S", GetTime()).c_str());
-            if (pszFormat[strlen(pszFormat) - 1] == '\n')
-                fStartedNewLine = true;
-            else
-                fStartedNewLine = false;
-
-            va_list arg_ptr;
             va_start(arg_ptr, pszFormat);
-            ret = vfprintf(fileout, pszFormat, arg_ptr);
+            string str = vstrprintf(pszFormat, arg_ptr);
             va_end(arg_ptr);
+            LogWrite(str.data(), str.size());
+            ret = str.size();
         }
     }
 
@@ -1060,15 +1034,19 @@ void PrintException(std::exception* pex, const char* pszThread)
 
 void LogStackTrace() {
     printf("\n\n******* exception encountered *******\n");
-    if (fileout)
-    {
 #if !defined(WIN32) && !defined(ANDROID)
-        void* pszBuffer[32];
-        size_t size;
-        size = backtrace(pszBuffer, 32);
-        backtrace_symbols_fd(pszBuffer, size, fileno(fileout));
-#endif
+    void* pszBuffer[32];
+    size_t size;
+    size = backtrace(pszBuffer, 32);
+    char** ppszSymbols = backtrace_symbols(pszBuffer, size);
+    if (ppszSymbols)
+    {
+        for (size_t i = 0; i < size; i++)
+            printf("%s\n", ppszSymbols[i]);
+        free(ppszSymbols);
     }
+#endif
+    LogFlush();
 }
 
 void PrintExceptionContinue(std::exception* pex, const char* pszThread)
@@ -1262,27 +1240,6 @@ int GetFilesize(FILE* file)
     return nFilesize;
 }
 
-void ShrinkDebugFile()
-{
-    // Scroll debug.log if it's getting too big
-    boost::filesystem::path pathLog = GetDataDir() / "debug.log";
-    FILE* file = fopen(pathLog.string().c_str(), "r");
-    if (file && GetFilesize(file) > 10 * 1000000)
-    {
-        // Restart the file with some of the end
-        char pch[200000];
-        fseek(file, -((long long)sizeof(pch)), SEEK_END);
-        int nBytes = fread(pch, 1, sizeof(pch), file);
-        fclose(file);
-
-        file = fopen(pathLog.string().c_str(), "w");
-        if (file)
-        {
-            fwrite(pch, 1, nBytes, file);
-            fclose(file);
-        }
-    }
-}
 
 
 
@@ -11,6 +11,7 @@
 #include "base58.h"
 #include "kernel.h"
 #include "coincontrol.h"
+#include "txview.h"
 #include <boost/algorithm/string/replace.hpp>
 
 #include "main.h"
@@ -961,11 +962,25 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
 {
     int ret = 0;
 
+    // Blocks are first looked at through a view of their raw bytes, only
+    // the ones with a transaction that may involve us are deserialized
+    vector<unsigned char> vchBlock;
+    CBlockView blockView;
+    CScript scriptPubKey;
+
     CBlockIndex* pindex = pindexStart;
     {
         LOCK(cs_wallet);
-        while (pindex)
+        while (pindex && !fRequestShutdown)
         {
+            if (CBlockView::ReadFromDisk(pindex->nFile, pindex->nBlockPos, vchBlock) &&
+                !vchBlock.empty() && blockView.Parse(&vchBlock[0], &vchBlock[0] + vchBlock.size()) &&
+                !IsBlockViewInvolvingMe(blockView, scriptPubKey))
+            {
+                pindex = pindex->pnext;
+                continue;
+            }
+
             CBlock block;
             block.ReadFromDisk(pindex, true);
             BOOST_FOREACH(CTransaction& tx, block.vtx)
@@ -979,6 +994,27 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
     return ret;
 }
 
+// True unless no transaction of the block can be added to the wallet or
+// spend one of its outputs
+bool CWallet::IsBlockViewInvolvingMe(const CBlockView& block, CScript& scriptPubKey) const
+{
+    BOOST_FOREACH(const CTransactionView& tx, block.vtx)
+    {
+        BOOST_FOREACH(const CTxInView& txin, tx.vin)
+            if (mapWallet.count(txin.GetPrevoutHash()))
+                return true;
+        BOOST_FOREACH(const CTxOutView& txout, tx.vout)
+        {
+            txout.scriptPubKey.GetScript(scriptPubKey);
+            if (::IsMine(*this, scriptPubKey) != MINE_NO)
+                return true;
+        }
+        if (mapWallet.count(tx.GetHash()))
+            return true;
+    }
+    return false;
+}
+
 int CWallet::ScanForWalletTransaction(const uint256& hashTx)
 {
     CTransaction tx;
@@ -988,18 +1024,36 @@ int CWallet::ScanForWalletTransaction(const uint256& hashTx)
     return 0;
 }
 
+// Transaction index keys in database order, the hash is stored little endian
+static bool CompareTxIndexKey(const uint256& a, const uint256& b)
+{
+    return memcmp(&a, &b, sizeof(uint256)) < 0;
+}
+
 void CWallet::ReacceptWalletTransactions()
 {
     CTxDB txdb("r");
-    bool fRepeat = true;
-    while (fRepeat)
+    LOCK(cs_wallet);
+
+    // All transactions first, then only the ones found spending our coins
+    vector<uint256> vCheck;
+    vCheck.reserve(mapWallet.size());
+    BOOST_FOREACH(PAIRTYPE(const uint256, CWalletTx)& item, mapWallet)
+        vCheck.push_back(item.first);
+
+    while (!vCheck.empty())
     {
-        LOCK(cs_wallet);
-        fRepeat = false;
-        vector<CDiskTxPos> vMissingTx;
-        BOOST_FOREACH(PAIRTYPE(const uint256, CWalletTx)& item, mapWallet)
+        // Read the index entries in key order
+        sort(vCheck.begin(), vCheck.end(), CompareTxIndexKey);
+
+        // Spending transactions not in the wallet, by block
+        map<pair<unsigned int, unsigned int>, set<unsigned int> > mapMissingTx;
+        BOOST_FOREACH(const uint256& hash, vCheck)
         {
-            CWalletTx& wtx = item.second;
+            map<uint256, CWalletTx>::iterator mi = mapWallet.find(hash);
+            if (mi == mapWallet.end())
+                continue;
+            CWalletTx& wtx = mi->second;
             if ((wtx.IsCoinBase() && wtx.IsSpent(0)) || (wtx.IsCoinStake() && wtx.IsSpent(1)))
                 continue;
 
@@ -1021,7 +1075,8 @@ void CWallet::ReacceptWalletTransactions()
                     {
                         wtx.MarkSpent(i);
                         fUpdated = true;
-                        vMissingTx.push_back(txindex.vSpent[i]);
+                        const CDiskTxPos& pos = txindex.vSpent[i];
+                        mapMissingTx[make_pair(pos.nFile, pos.nBlockPos)].insert(pos.nTxPos);
                     }
                 }
                 if (fUpdated)
@@ -1038,11 +1093,25 @@ void CWallet::ReacceptWalletTransactions()
                     wtx.AcceptWalletTransaction(txdb, false);
             }
         }
-        if (!vMissingTx.empty())
+        vCheck.clear();
+
+        // Load the blocks of the spending transactions instead of rescanning
+        // the chain, the ones added are checked in turn
+        for (map<pair<unsigned int, unsigned int>, set<unsigned int> >::iterator mi = mapMissingTx.begin(); mi != mapMissingTx.end(); ++mi)
         {
-            // TODO: optimize this to scan just part of the block chain?
-            if (ScanForWalletTransactions(pindexGenesisBlock))
-                fRepeat = true;  // Found missing transactions: re-do re-accept.
+            CBlock block;
+            if (!block.ReadFromDisk(mi->first.first, mi->first.second))
+            {
+                printf("ERROR: ReacceptWalletTransactions() : unable to read block at %u:%u\n", mi->first.first, mi->first.second);
+                continue;
+            }
+            unsigned int nTxPos = block.GetTxPos(mi->first.second);
+            BOOST_FOREACH(const CTransaction& tx, block.vtx)
+            {
+                if (mi->second.count(nTxPos) && AddToWalletIfInvolvingMe(tx, &block, false))
+                    vCheck.push_back(tx.GetHash());
+                nTxPos += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
+            }
         }
     }
 }
@@ -1220,6 +1289,30 @@ int64_t CWallet::GetImmatureWatchOnlyBalance() const
     return nTotal;
 }
 
+// Same as GetBalance, GetWatchOnlyBalance, GetStake, GetUnconfirmedBalance and
+// GetImmatureBalance, in a single pass over the wallet
+void CWallet::GetBalances(CWalletBalances& balances) const
+{
+    balances.nBalance = balances.nWatchOnlyBalance = balances.nStake = balances.nUnconfirmed = balances.nImmature = 0;
+
+    LOCK(cs_wallet);
+    for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+    {
+        const CWalletTx* pcoin = &(*it).second;
+        bool fTrusted = pcoin->IsTrusted();
+        if (fTrusted)
+        {
+            balances.nBalance += pcoin->GetAvailableCredit();
+            balances.nWatchOnlyBalance += pcoin->GetAvailableWatchCredit();
+        }
+        if (!pcoin->IsFinal() || !fTrusted)
+            balances.nUnconfirmed += pcoin->GetAvailableCredit();
+        balances.nImmature += pcoin->GetImmatureCredit();
+        if (pcoin->IsCoinStake() && pcoin->GetBlocksToMaturity() > 0 && pcoin->GetDepthInMainChain() > 0)
+            balances.nStake += CWallet::GetCredit(*pcoin, MINE_ALL);
+    }
+}
+
 // populate vCoins with vector of spendable COutputs
 void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const CCoinControl *coinControl) const
 {
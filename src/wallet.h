@@ -26,6 +26,7 @@ class CWalletTx;
 class CReserveKey;
 class COutput;
 class CCoinControl;
+class CBlockView;
 
 // Set of selected transactions
 typedef std::set<std::pair<const CWalletTx*,unsigned int> > CoinsSet;
@@ -67,6 +68,16 @@ public:
     )
 };
 
+/** Balances shown by the GUI, see CWallet::GetBalances */
+struct CWalletBalances
+{
+    int64_t nBalance;
+    int64_t nWatchOnlyBalance;
+    int64_t nStake;
+    int64_t nUnconfirmed;
+    int64_t nImmature;
+};
+
 /** A CWallet is an extension of a keystore, which also maintains a set of transactions and balances,
  * and provides the ability to create new transactions.
  */
@@ -200,6 +211,7 @@ public:
     void ClearOrphans();
     void WalletUpdateSpent(const CTransaction& prevout, bool fBlock = false);
     int ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate = false);
+    bool IsBlockViewInvolvingMe(const CBlockView& block, CScript& scriptPubKey) const;
     int ScanForWalletTransaction(const uint256& hashTx);
     void ReacceptWalletTransactions();
     void ResendWalletTransactions();
@@ -213,6 +225,7 @@ public:
     int64_t GetNewMint() const;
     int64_t GetWatchOnlyStake() const;
     int64_t GetWatchOnlyNewMint() const;
+    void GetBalances(CWalletBalances& balances) const;
     bool CreateTransaction(const std::vector<std::pair<CScript, int64_t> >& vecSend, CWalletTx& wtxNew, CReserveKey& reservekey, int64_t& nFeeRet, const CCoinControl *coinControl=NULL);
     bool CreateTransaction(CScript scriptPubKey, int64_t nValue, CWalletTx& wtxNew, CReserveKey& reservekey, int64_t& nFeeRet, const CCoinControl *coinControl=NULL);
     bool CommitTransaction(CWalletTx& wtxNew, CReserveKey& reservekey);